@@ -0,0 +1,262 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Admission Control
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * A source sending bad tokens costs a full validation per attempt. Each
+ * source address prefix (/32 and /64 by default) gets a token bucket of
+ * failed logins:
+ *
+ *   oauth2_admission_burst: 30      failures allowed in a row
+ *   oauth2_admission_rate: 10       failures regained per minute
+ *
+ * A source with an empty bucket is refused before its input is parsed.
+ * Successful logins cost nothing.
+ *
+ * The table has a fixed size, set by the first configuration loaded in
+ * the process: 4-way sets of 64-bit words packing a tag of the prefix,
+ * the tokens left (1/64 units) and the time of the last failure. Words
+ * are updated with compare-and-swap, without locks, so the table can sit
+ * in shared memory: an anonymous shared mapping is inherited by processes
+ * forked afterwards, and oauth2_admission_file maps a file for servers
+ * whose processes start on their own. A check is one hash of the address
+ * and four loads; a full set evicts the source closest to a full bucket.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OAUTH2_ADMISSION_MAGIC 0x4f324143u  /* "O2AC" */
+#define OAUTH2_ADMISSION_WAYS 4
+#define OAUTH2_ADMISSION_UNIT 64           /* Bucket units per failure */
+
+/* Entry layout: tag (24 bits), tokens in units (16 bits), seconds of the last failure (24 bits) */
+#define OAUTH2_ADMISSION_TAG(w) ((uint32_t)((w) >> 40))
+#define OAUTH2_ADMISSION_TOKENS(w) ((uint32_t)((w) >> 24) & 0xffffu)
+#define OAUTH2_ADMISSION_TIME(w) ((uint32_t)(w) & 0xffffffu)
+#define OAUTH2_ADMISSION_PACK(tag, tokens, now) \
+    (((uint64_t)(tag) << 40) | ((uint64_t)(tokens) << 24) | ((uint64_t)(now) & 0xffffffu))
+
+/* Mapped as is: the layout is shared by every process using the table */
+typedef struct oauth2_admission_table {
+    uint32_t magic;
+    uint32_t entries;
+    uint64_t failures;
+    uint64_t rejected;
+    uint64_t slots[];
+} oauth2_admission_table_t;
+
+static pthread_mutex_t oauth2_admission_lock = PTHREAD_MUTEX_INITIALIZER;
+static oauth2_admission_table_t *oauth2_admission_table;
+
+static size_t oauth2_admission_size(uint32_t entries) {
+    return sizeof(oauth2_admission_table_t) + (size_t)entries * sizeof(uint64_t);
+}
+
+/* Shared file mapping, sized for entries; a file of another size is reset */
+static oauth2_admission_table_t *oauth2_admission_map_file(const char *file, uint32_t entries) {
+    int fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    size_t size = oauth2_admission_size(entries);
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size != size && (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0))) {
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return addr == MAP_FAILED ? NULL : (oauth2_admission_table_t*)addr;
+}
+
+int oauth2_admission_setup(const sasl_utils_t *utils, int entries, const char *file) {
+    pthread_mutex_lock(&oauth2_admission_lock);
+    if (oauth2_admission_table) {
+        pthread_mutex_unlock(&oauth2_admission_lock);
+        return SASL_OK;
+    }
+
+    /* A power of two, whole sets */
+    uint32_t count = 64;
+    while (count < (uint32_t)entries && count < (1u << 24)) {
+        count *= 2;
+    }
+
+    oauth2_admission_table_t *table = NULL;
+    if (file) {
+        table = oauth2_admission_map_file(file, count);
+        if (!table) {
+            OAUTH2_LOG_WARN(utils, "Cannot map %s %s, admission control is per process", OAUTH2_CONF_ADMISSION_FILE,
+                            file);
+        }
+    }
+    if (!table) {
+        void *addr = mmap(NULL, oauth2_admission_size(count), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        table = addr == MAP_FAILED ? NULL : (oauth2_admission_table_t*)addr;
+    }
+    if (!table) {
+        pthread_mutex_unlock(&oauth2_admission_lock);
+        OAUTH2_LOG_ERR(utils, "Failed to allocate the admission table");
+        return SASL_NOMEM;
+    }
+    if (table->magic != OAUTH2_ADMISSION_MAGIC || table->entries != count) {
+        memset(table->slots, 0, (size_t)count * sizeof(uint64_t));
+        table->entries = count;
+        table->magic = OAUTH2_ADMISSION_MAGIC;
+    }
+    __atomic_store_n(&oauth2_admission_table, table, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&oauth2_admission_lock);
+    return SASL_OK;
+}
+
+uint64_t oauth2_admission_key(const oauth2_config_t *config, const char *ipremoteport) {
+    if (!ipremoteport || config->admission_burst <= 0) {
+        return 0;
+    }
+
+    /* "a.b.c.d;port" or "v6addr;port" as libsasl formats them, brackets tolerated */
+    char host[INET6_ADDRSTRLEN + 2];
+    const char *p = ipremoteport + (*ipremoteport == '[');
+    size_t len = strcspn(p, ";]%");
+    if (len == 0 || len >= sizeof(host)) {
+        return 0;
+    }
+    memcpy(host, p, len);
+    host[len] = '\0';
+
+    unsigned char addr[16];
+    int bits;
+    size_t bytes;
+    if (inet_pton(AF_INET, host, addr) == 1) {
+        bits = config->admission_ipv4_prefix;
+        bytes = 4;
+    } else if (inet_pton(AF_INET6, host, addr) == 1) {
+        /* IPv4-mapped addresses are the IPv4 source */
+        static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        int v4 = memcmp(addr, mapped, sizeof(mapped)) == 0;
+        if (v4) {
+            memmove(addr, addr + 12, 4);
+        }
+        bits = v4 ? config->admission_ipv4_prefix : config->admission_ipv6_prefix;
+        bytes = v4 ? 4 : 16;
+    } else {
+        return 0;
+    }
+
+    /* FNV-1a of the family and the prefix */
+    uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ bytes) * 1099511628211ULL;
+    hash = (hash ^ (uint64_t)bits) * 1099511628211ULL;
+    for (size_t i = 0; i < bytes; i++) {
+        int keep = bits - (int)i * 8;
+        unsigned char mask = keep >= 8 ? 0xff : keep <= 0 ? 0 : (unsigned char)(0xff << (8 - keep));
+        hash = (hash ^ (addr[i] & mask)) * 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/* Bucket of an entry now, refilled since its last failure */
+static uint32_t oauth2_admission_tokens(const oauth2_config_t *config, uint64_t word, uint32_t now) {
+    uint64_t elapsed = (now - OAUTH2_ADMISSION_TIME(word)) & 0xffffffu;
+    uint64_t tokens = OAUTH2_ADMISSION_TOKENS(word) +
+                      elapsed * (uint64_t)config->admission_rate * OAUTH2_ADMISSION_UNIT / 60;
+    uint64_t full = (uint64_t)config->admission_burst * OAUTH2_ADMISSION_UNIT;
+    return (uint32_t)(tokens < full ? tokens : full);
+}
+
+static uint32_t oauth2_admission_tag(uint64_t key) {
+    uint32_t tag = (uint32_t)(key >> 40);
+    return tag ? tag : 1;
+}
+
+int oauth2_admission_allow(const oauth2_config_t *config, uint64_t key) {
+    oauth2_admission_table_t *table = __atomic_load_n(&oauth2_admission_table, __ATOMIC_ACQUIRE);
+    if (!table || key == 0) {
+        return 1;
+    }
+
+    uint64_t *set = table->slots + (key & (table->entries / OAUTH2_ADMISSION_WAYS - 1)) * OAUTH2_ADMISSION_WAYS;
+    uint32_t tag = oauth2_admission_tag(key);
+    for (int i = 0; i < OAUTH2_ADMISSION_WAYS; i++) {
+        uint64_t word = __atomic_load_n(&set[i], __ATOMIC_RELAXED);
+        if (OAUTH2_ADMISSION_TAG(word) == tag) {
+            if (oauth2_admission_tokens(config, word, (uint32_t)time(NULL)) >= OAUTH2_ADMISSION_UNIT) {
+                return 1;
+            }
+            __atomic_fetch_add(&table->rejected, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void oauth2_admission_fail(const oauth2_config_t *config, uint64_t key) {
+    oauth2_admission_table_t *table = __atomic_load_n(&oauth2_admission_table, __ATOMIC_ACQUIRE);
+    if (!table || key == 0) {
+        return;
+    }
+    __atomic_fetch_add(&table->failures, 1, __ATOMIC_RELAXED);
+
+    uint64_t *set = table->slots + (key & (table->entries / OAUTH2_ADMISSION_WAYS - 1)) * OAUTH2_ADMISSION_WAYS;
+    uint32_t tag = oauth2_admission_tag(key);
+    uint32_t now = (uint32_t)time(NULL);
+
+    /* Another process may update the set in between: retry a few times, then let the failure go */
+    for (int attempt = 0; attempt < 8; attempt++) {
+        int slot = -1;
+        uint32_t tokens = 0, most = 0;
+        uint64_t word = 0;
+        for (int i = 0; i < OAUTH2_ADMISSION_WAYS; i++) {
+            uint64_t current = __atomic_load_n(&set[i], __ATOMIC_RELAXED);
+            uint32_t left = current ? oauth2_admission_tokens(config, current, now) : UINT32_MAX;
+            if (current && OAUTH2_ADMISSION_TAG(current) == tag) {
+                slot = i;
+                word = current;
+                tokens = left;
+                break;
+            }
+            if (slot < 0 || left > most) {
+                slot = i;
+                word = current;
+                most = left;
+                tokens = (uint32_t)config->admission_burst * OAUTH2_ADMISSION_UNIT;
+            }
+        }
+
+        tokens = tokens > OAUTH2_ADMISSION_UNIT ? tokens - OAUTH2_ADMISSION_UNIT : 0;
+        if (__atomic_compare_exchange_n(&set[slot], &word, OAUTH2_ADMISSION_PACK(tag, tokens, now), 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+void oauth2_admission_stats(const oauth2_config_t *config, oauth2_admission_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    oauth2_admission_table_t *table = __atomic_load_n(&oauth2_admission_table, __ATOMIC_ACQUIRE);
+    if (!table) {
+        return;
+    }
+
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t full = (uint32_t)config->admission_burst * OAUTH2_ADMISSION_UNIT;
+    stats->entries = table->entries;
+    for (uint32_t i = 0; i < table->entries; i++) {
+        uint64_t word = __atomic_load_n(&table->slots[i], __ATOMIC_RELAXED);
+        if (word) {
+            uint32_t tokens = oauth2_admission_tokens(config, word, now);
+            stats->sources += tokens < full;
+            stats->throttled += tokens < OAUTH2_ADMISSION_UNIT;
+        }
+    }
+    stats->failures = __atomic_load_n(&table->failures, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&table->rejected, __ATOMIC_RELAXED);
+}
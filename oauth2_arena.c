@@ -0,0 +1,129 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Authentication Arena
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Bump allocator attached to a server context. Parser output, decoded
+ * token segments and claim strings of one authentication are carved out
+ * of the context's inline buffer; only tokens too large for it cost an
+ * extra block. Objects with their own allocator (JSON claims) can be
+ * handed to the arena as deferred releases. Everything is wiped and
+ * released in one step when the context is disposed.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+
+#define OAUTH2_ARENA_ALIGN 16
+
+typedef struct oauth2_arena_block {
+    struct oauth2_arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char data[] __attribute__((aligned(OAUTH2_ARENA_ALIGN)));
+} oauth2_arena_block_t;
+
+typedef struct oauth2_arena_cleanup {
+    struct oauth2_arena_cleanup *next;
+    void (*release)(void *);
+    void *object;
+} oauth2_arena_cleanup_t;
+
+void oauth2_arena_init(oauth2_arena_t *arena) {
+    arena->used = 0;
+    arena->blocks = NULL;
+    arena->cleanups = NULL;
+}
+
+static size_t oauth2_arena_round(size_t size) {
+    return (size + OAUTH2_ARENA_ALIGN - 1) & ~(size_t)(OAUTH2_ARENA_ALIGN - 1);
+}
+
+void *oauth2_arena_alloc(oauth2_arena_t *arena, size_t size) {
+    if (!arena) return NULL;
+
+    size_t rounded = oauth2_arena_round(size ? size : 1);
+    if (rounded < size) return NULL;
+
+    if (rounded <= sizeof(arena->buffer) - arena->used) {
+        void *p = arena->buffer + arena->used;
+        arena->used += rounded;
+        return p;
+    }
+
+    oauth2_arena_block_t *block = arena->blocks;
+    if (block && rounded <= block->size - block->used) {
+        void *p = block->data + block->used;
+        block->used += rounded;
+        return p;
+    }
+
+    /* Large tokens: a block at least as large as the inline buffer, so the next strings fit too */
+    size_t block_size = rounded > sizeof(arena->buffer) ? rounded : sizeof(arena->buffer);
+    if (block_size > (size_t)-1 - sizeof(oauth2_arena_block_t)) return NULL;
+    block = malloc(sizeof(oauth2_arena_block_t) + block_size);
+    if (!block) return NULL;
+
+    block->size = block_size;
+    block->used = rounded;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block->data;
+}
+
+char *oauth2_arena_strndup(oauth2_arena_t *arena, const char *s, size_t len) {
+    if (!s || len == (size_t)-1) return NULL;
+
+    char *copy = oauth2_arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+int oauth2_arena_defer(oauth2_arena_t *arena, void (*release)(void *), void *object) {
+    if (!arena || !release || !object) {
+        return SASL_BADPARAM;
+    }
+
+    oauth2_arena_cleanup_t *cleanup = oauth2_arena_alloc(arena, sizeof(oauth2_arena_cleanup_t));
+    if (!cleanup) {
+        release(object);
+        return SASL_NOMEM;
+    }
+
+    cleanup->release = release;
+    cleanup->object = object;
+    cleanup->next = arena->cleanups;
+    arena->cleanups = cleanup;
+    return SASL_OK;
+}
+
+void oauth2_arena_run_deferred(oauth2_arena_t *arena) {
+    if (!arena) return;
+
+    /* Newest first: later objects may refer to earlier ones */
+    while (arena->cleanups) {
+        oauth2_arena_cleanup_t *cleanup = arena->cleanups;
+        arena->cleanups = cleanup->next;
+        cleanup->release(cleanup->object);
+    }
+}
+
+void oauth2_arena_release(oauth2_arena_t *arena) {
+    if (!arena) return;
+
+    oauth2_arena_run_deferred(arena);
+
+    /* The arena holds tokens: wipe what was handed out before the memory is reused */
+    while (arena->blocks) {
+        oauth2_arena_block_t *block = arena->blocks;
+        arena->blocks = block->next;
+        OPENSSL_cleanse(block->data, block->used);
+        free(block);
+    }
+    OPENSSL_cleanse(arena->buffer, arena->used);
+    arena->used = 0;
+}
@@ -0,0 +1,562 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Asynchronous Validation
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * For embedders running an event loop, e.g. a proxy in front of Cyrus,
+ * that must never block on the IdP. Tokens are submitted to a validator
+ * and checked by the engine of oauth2_validate.c on a small pool of
+ * worker threads, which only do the parsing and signature verification.
+ * A run that needs the network (a key refetch, introspection, userinfo)
+ * hands that step to a single network thread driving every transfer on a
+ * curl multi handle, and the worker moves on to the next token; once the
+ * step is done the validation runs again, replaying what was fetched.
+ * Completions are queued and signalled on a file descriptor (an eventfd
+ * on Linux); the embedder polls it and calls oauth2_validator_dispatch(),
+ * which runs the callbacks in its own thread.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/* Network steps one validation can go through; further steps run on the worker */
+#define OAUTH2_VALIDATION_STEPS 8
+
+typedef struct oauth2_validation {
+    struct oauth2_validation *next;
+    struct oauth2_validation *net_next; /* Steps in progress on the network thread */
+    oauth2_config_t *config;        /* Snapshot pinned at submit time */
+    char *token;                    /* Secure slab */
+    oauth2_validate_cb_t done;
+    void *arg;
+    int result;
+    char *username;                 /* Arena */
+    oauth2_deadline_t deadline;     /* Shared by every run */
+    oauth2_net_request_t *pending;  /* Step handed over by the last run */
+    int pending_started;            /* Network thread: the step is under way */
+    oauth2_net_request_t steps[OAUTH2_VALIDATION_STEPS]; /* Steps done or pending, replayed to later runs */
+    int steps_count;
+    oauth2_arena_t arena;           /* Kept across runs: later runs refer to claims of earlier ones */
+} oauth2_validation_t;
+
+struct oauth2_validator {
+    const sasl_utils_t *utils;
+    oauth2_config_holder_t *holder;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    oauth2_validation_t *queue;     /* FIFO of submitted validations */
+    oauth2_validation_t **queue_tail;
+    oauth2_validation_t *completed; /* FIFO of validations waiting for dispatch */
+    oauth2_validation_t **completed_tail;
+    oauth2_validation_t *network;   /* FIFO of validations with a step for the network thread */
+    oauth2_validation_t **network_tail;
+    int stopping;
+    int fd;                         /* Readable while completions are pending */
+    int fd_write;                   /* Same as fd for an eventfd, the write end of a pipe otherwise */
+    int workers_count;
+    pthread_t *workers;
+    oauth2_http_multi_t *multi;     /* Owned by the network thread */
+    pthread_t network_thread;
+    int network_started;
+};
+
+/* Validation being run by this worker thread, NULL on any other thread */
+static __thread oauth2_validation_t *oauth2_async_current;
+
+static int oauth2_validator_open_fd(oauth2_validator_t *validator) {
+#ifdef __linux__
+    validator->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    validator->fd_write = validator->fd;
+    return validator->fd >= 0 ? SASL_OK : SASL_FAIL;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return SASL_FAIL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    validator->fd = fds[0];
+    validator->fd_write = fds[1];
+    return SASL_OK;
+#endif
+}
+
+static void oauth2_validator_signal(oauth2_validator_t *validator) {
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t n = write(validator->fd_write, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t n = write(validator->fd_write, &one, 1); /* A full pipe is signalled already */
+#endif
+    (void)n;
+}
+
+static void oauth2_validator_drain_fd(oauth2_validator_t *validator) {
+#ifdef __linux__
+    uint64_t count;
+    ssize_t n = read(validator->fd, &count, sizeof(count));
+    (void)n;
+#else
+    char buf[64];
+    while (read(validator->fd, buf, sizeof(buf)) > 0) {
+    }
+#endif
+}
+
+static void oauth2_validation_free(oauth2_validation_t *job) {
+    for (int i = 0; i < job->steps_count; i++) {
+        free(job->steps[i].endpoint);
+        oauth2_secure_free(job->steps[i].fields);
+        if (job->steps[i].claims) json_decref(job->steps[i].claims);
+    }
+    oauth2_secure_free(job->token);
+    oauth2_arena_release(&job->arena);
+    oauth2_config_release(job->config);
+    free(job);
+}
+
+/* Caller holds the lock */
+static void oauth2_validator_complete(oauth2_validator_t *validator, oauth2_validation_t *job) {
+    job->next = NULL;
+    *validator->completed_tail = job;
+    validator->completed_tail = &job->next;
+}
+
+oauth2_net_request_t *oauth2_async_request(oauth2_net_kind_t kind, oauth2_provider_t *provider) {
+    oauth2_validation_t *job = oauth2_async_current;
+    if (!job || job->pending || job->steps_count == OAUTH2_VALIDATION_STEPS) {
+        return NULL;
+    }
+
+    oauth2_net_request_t *request = &job->steps[job->steps_count++];
+    memset(request, 0, sizeof(*request));
+    request->kind = kind;
+    request->provider = provider;
+    request->result = SASL_UNAVAIL;
+    job->pending = request;
+    return request;
+}
+
+int oauth2_async_result(oauth2_net_kind_t kind, oauth2_provider_t *provider, json_t **claims) {
+    oauth2_validation_t *job = oauth2_async_current;
+    for (int i = 0; job && i < job->steps_count; i++) {
+        oauth2_net_request_t *request = &job->steps[i];
+        if (request != job->pending && request->kind == kind && request->provider == provider) {
+            if (claims) {
+                *claims = request->claims ? json_incref(request->claims) : NULL;
+            }
+            return request->result;
+        }
+    }
+    return SASL_NOTDONE;
+}
+
+int oauth2_async_pending(void) {
+    return oauth2_async_current && oauth2_async_current->pending;
+}
+
+oauth2_deadline_t oauth2_async_deadline(void) {
+    return oauth2_async_current ? oauth2_async_current->deadline : 0;
+}
+
+static void *oauth2_validator_worker(void *arg) {
+    oauth2_validator_t *validator = (oauth2_validator_t*)arg;
+
+    pthread_mutex_lock(&validator->lock);
+    for (;;) {
+        while (!validator->queue && !validator->stopping) {
+            pthread_cond_wait(&validator->work, &validator->lock);
+        }
+        if (validator->stopping) {
+            break;
+        }
+
+        oauth2_validation_t *job = validator->queue;
+        validator->queue = job->next;
+        if (!validator->queue) {
+            validator->queue_tail = &validator->queue;
+        }
+        pthread_mutex_unlock(&validator->lock);
+
+        /* The same engine as the SASL server step, only off the embedder's thread */
+        oauth2_async_current = job;
+        job->result = oauth2_validate_token(validator->utils, job->config, &job->arena,
+                                            job->token, &job->username);
+        oauth2_async_current = NULL;
+
+        pthread_mutex_lock(&validator->lock);
+        if (job->result == SASL_CONTINUE && job->pending) {
+            /* This run waits for the network: the worker takes the next token meanwhile */
+            job->next = NULL;
+            *validator->network_tail = job;
+            validator->network_tail = &job->next;
+            oauth2_http_multi_wakeup(validator->multi);
+            continue;
+        }
+        pthread_mutex_unlock(&validator->lock);
+
+        if (job->result == SASL_CONTINUE) {
+            job->result = SASL_FAIL;
+        }
+        oauth2_arena_run_deferred(&job->arena);
+
+        pthread_mutex_lock(&validator->lock);
+        oauth2_validator_complete(validator, job);
+        oauth2_validator_signal(validator);
+    }
+    pthread_mutex_unlock(&validator->lock);
+
+    return NULL;
+}
+
+/* Give up a step that never reached the network: its cache slot must not stay pending */
+static void oauth2_validator_abandon(oauth2_validation_t *job) {
+    oauth2_net_request_t *request = job->pending;
+    if (request && request->slot) {
+        oauth2_claims_cache_complete(request->kind == OAUTH2_NET_INTROSPECT ? &job->config->introspection_cache :
+                                                                               &job->config->userinfo_cache,
+                                     request->slot, 0, NULL, 0);
+    }
+    job->pending = NULL;
+    job->result = SASL_FAIL;
+    oauth2_arena_run_deferred(&job->arena);
+}
+
+/* A step is done: run the validation again, or complete it when the validator is stopping */
+static void oauth2_validator_resume(oauth2_validator_t *validator, oauth2_validation_t *job) {
+    job->pending = NULL;
+
+    pthread_mutex_lock(&validator->lock);
+    if (validator->stopping) {
+        job->result = SASL_FAIL;
+        oauth2_arena_run_deferred(&job->arena);
+        oauth2_validator_complete(validator, job);
+        oauth2_validator_signal(validator);
+    } else {
+        job->next = NULL;
+        *validator->queue_tail = job;
+        validator->queue_tail = &job->next;
+        pthread_cond_signal(&validator->work);
+    }
+    pthread_mutex_unlock(&validator->lock);
+}
+
+/* Drive a refresh on the multi handle; 1 once it is over, with the refresh lock released */
+static int oauth2_validator_refresh(oauth2_validator_t *validator, oauth2_validation_t *job, int result) {
+    oauth2_net_request_t *request = job->pending;
+    while (result == SASL_CONTINUE) {
+        if (oauth2_http_multi_add(job->config, validator->multi, &request->refresh.transfer,
+                                  job->deadline) == SASL_OK) {
+            return 0;
+        }
+        /* Not started (deadline spent, out of memory): that fetch failed */
+        result = oauth2_provider_refresh_step(validator->utils, job->config, &request->refresh, job->deadline);
+    }
+
+    pthread_mutex_unlock(&request->provider->refresh_lock);
+    request->result = result;
+    return 1;
+}
+
+/* Start the step of a validation; 1 when it is already over, 0 while it is in progress */
+static int oauth2_validator_start(oauth2_validator_t *validator, oauth2_validation_t *job) {
+    oauth2_net_request_t *request = job->pending;
+
+    if (request->kind == OAUTH2_NET_REFRESH) {
+        /* Another thread is refreshing this provider: try again on the next turn of the loop */
+        if (pthread_mutex_trylock(&request->provider->refresh_lock) != 0) {
+            if (oauth2_deadline_remaining(job->deadline) > 0) {
+                return 0;
+            }
+            OAUTH2_METRIC_INC(job->config, deadline_exceeded);
+            request->result = SASL_UNAVAIL;
+            return 1;
+        }
+        job->pending_started = 1;
+        int result = oauth2_provider_refresh_begin(validator->utils, job->config, request->provider,
+                                                   request->generation, request->min_interval, &request->refresh);
+        return oauth2_validator_refresh(validator, job, result);
+    }
+
+    job->pending_started = 1;
+    if (oauth2_http_multi_add(job->config, validator->multi, &request->transfer, job->deadline) == SASL_OK) {
+        return 0;
+    }
+    if (request->kind == OAUTH2_NET_INTROSPECT) {
+        oauth2_introspect_complete(validator->utils, job->config, request);
+    } else {
+        oauth2_userinfo_complete(validator->utils, job->config, request);
+    }
+    return 1;
+}
+
+/* A transfer of the step of a validation finished; 1 when the step is over */
+static int oauth2_validator_transferred(oauth2_validator_t *validator, oauth2_validation_t *job,
+                                        oauth2_http_transfer_t *transfer) {
+    oauth2_net_request_t *request = job->pending;
+    oauth2_http_transfer_finish(job->config, transfer);
+
+    if (request->kind == OAUTH2_NET_REFRESH) {
+        int result = oauth2_provider_refresh_step(validator->utils, job->config, &request->refresh, job->deadline);
+        return oauth2_validator_refresh(validator, job, result);
+    }
+    if (request->kind == OAUTH2_NET_INTROSPECT) {
+        oauth2_introspect_complete(validator->utils, job->config, request);
+    } else {
+        oauth2_userinfo_complete(validator->utils, job->config, request);
+    }
+    return 1;
+}
+
+/* Unlink a validation from the list of steps in progress */
+static void oauth2_validator_unlink(oauth2_validation_t **active, oauth2_validation_t *job) {
+    for (oauth2_validation_t **p = active; *p; p = &(*p)->net_next) {
+        if (*p == job) {
+            *p = job->net_next;
+            break;
+        }
+    }
+}
+
+/*
+ * The network thread: every transfer of every validation on one multi handle.
+ * Refreshes of a provider another thread is refreshing wait their turn here,
+ * not on a worker. On stop, the steps in progress run to completion (each
+ * is bounded by its validation's deadline) and new ones are refused.
+ */
+static void *oauth2_validator_network(void *arg) {
+    oauth2_validator_t *validator = (oauth2_validator_t*)arg;
+    oauth2_validation_t *active = NULL;
+    int waiting = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&validator->lock);
+        oauth2_validation_t *incoming = validator->network;
+        validator->network = NULL;
+        validator->network_tail = &validator->network;
+        int stopping = validator->stopping;
+        pthread_mutex_unlock(&validator->lock);
+
+        while (incoming) {
+            oauth2_validation_t *job = incoming;
+            incoming = job->next;
+            if (stopping) {
+                oauth2_validator_abandon(job);
+                pthread_mutex_lock(&validator->lock);
+                oauth2_validator_complete(validator, job);
+                oauth2_validator_signal(validator);
+                pthread_mutex_unlock(&validator->lock);
+                continue;
+            }
+            job->pending_started = 0;
+            job->net_next = active;
+            active = job;
+        }
+
+        /* Steps not started yet: new ones, and refreshes waiting for their provider */
+        waiting = 0;
+        for (oauth2_validation_t *job = active, *next; job; job = next) {
+            next = job->net_next;
+            if (job->pending_started) continue;
+            if (oauth2_validator_start(validator, job)) {
+                oauth2_validator_unlink(&active, job);
+                oauth2_validator_resume(validator, job);
+            } else {
+                waiting += !job->pending_started;
+            }
+        }
+
+        if (stopping && !active) {
+            break;
+        }
+
+        /* A short turn while refreshes wait for a lock, else until a transfer or a worker needs us */
+        oauth2_http_multi_wait(validator->multi, waiting ? 10 : 1000);
+
+        oauth2_http_transfer_t *transfer;
+        while ((transfer = oauth2_http_multi_done(validator->multi)) != NULL) {
+            oauth2_validation_t *job = active;
+            while (job && transfer != &job->pending->transfer && transfer != &job->pending->refresh.transfer) {
+                job = job->net_next;
+            }
+            if (job && oauth2_validator_transferred(validator, job, transfer)) {
+                oauth2_validator_unlink(&active, job);
+                oauth2_validator_resume(validator, job);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+oauth2_validator_t *oauth2_validator_create(const sasl_utils_t *utils, oauth2_config_holder_t *holder,
+                                            int workers) {
+    if (!utils || !holder || workers <= 0) {
+        return NULL;
+    }
+
+    oauth2_validator_t *validator = calloc(1, sizeof(oauth2_validator_t));
+    if (!validator) {
+        return NULL;
+    }
+    validator->utils = utils;
+    validator->holder = holder;
+    validator->queue_tail = &validator->queue;
+    validator->completed_tail = &validator->completed;
+    validator->network_tail = &validator->network;
+    pthread_mutex_init(&validator->lock, NULL);
+    pthread_cond_init(&validator->work, NULL);
+
+    validator->workers = calloc((size_t)workers, sizeof(pthread_t));
+    validator->multi = oauth2_http_multi_create();
+    if (!validator->workers || !validator->multi || oauth2_validator_open_fd(validator) != SASL_OK) {
+        OAUTH2_LOG_ERR(utils, "Cannot set up the asynchronous validator");
+        free(validator->workers);
+        oauth2_http_multi_free(validator->multi);
+        pthread_cond_destroy(&validator->work);
+        pthread_mutex_destroy(&validator->lock);
+        free(validator);
+        return NULL;
+    }
+
+    if (pthread_create(&validator->network_thread, NULL, oauth2_validator_network, validator) != 0) {
+        OAUTH2_LOG_ERR(utils, "Cannot start the network thread of the asynchronous validator");
+        oauth2_validator_free(validator);
+        return NULL;
+    }
+    validator->network_started = 1;
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&validator->workers[i], NULL, oauth2_validator_worker, validator) != 0) {
+            OAUTH2_LOG_WARN(utils, "Asynchronous validator started with %d of %d workers", i, workers);
+            break;
+        }
+        validator->workers_count++;
+    }
+    if (validator->workers_count == 0) {
+        oauth2_validator_free(validator);
+        return NULL;
+    }
+
+    return validator;
+}
+
+int oauth2_validator_submit(oauth2_validator_t *validator, const char *token, size_t len,
+                            oauth2_validate_cb_t done, void *arg) {
+    if (!validator || !token || !done) {
+        return SASL_BADPARAM;
+    }
+
+    oauth2_validation_t *job = NULL;
+    if (posix_memalign((void**)&job, 16, sizeof(oauth2_validation_t)) != 0) {
+        return SASL_NOMEM;
+    }
+    memset(job, 0, offsetof(oauth2_validation_t, arena));
+    oauth2_arena_init(&job->arena);
+    job->done = done;
+    job->arg = arg;
+
+    /* Pinned until dispatch, as for a SASL connection */
+    oauth2_config_reload_check(validator->holder);
+    job->config = oauth2_config_acquire(validator->holder);
+    job->token = oauth2_secure_strndup(token, len);
+    job->deadline = job->config ? oauth2_deadline_after(job->config->timeout) : 0;
+    if (!job->config || !job->token) {
+        int result = job->config ? SASL_NOMEM : SASL_FAIL;
+        oauth2_validation_free(job);
+        return result;
+    }
+    if (oauth2_provider_start_refresher(job->config) != SASL_OK) {
+        OAUTH2_LOG_WARN(validator->utils, "Cannot start background key refresher, keys are fetched on demand");
+    }
+
+    pthread_mutex_lock(&validator->lock);
+    *validator->queue_tail = job;
+    validator->queue_tail = &job->next;
+    pthread_cond_signal(&validator->work);
+    pthread_mutex_unlock(&validator->lock);
+
+    return SASL_OK;
+}
+
+int oauth2_validator_fd(const oauth2_validator_t *validator) {
+    return validator ? validator->fd : -1;
+}
+
+int oauth2_validator_dispatch(oauth2_validator_t *validator) {
+    if (!validator) {
+        return 0;
+    }
+
+    /* Drain first: a completion queued after this point signals again */
+    oauth2_validator_drain_fd(validator);
+
+    pthread_mutex_lock(&validator->lock);
+    oauth2_validation_t *job = validator->completed;
+    validator->completed = NULL;
+    validator->completed_tail = &validator->completed;
+    pthread_mutex_unlock(&validator->lock);
+
+    int count = 0;
+    while (job) {
+        oauth2_validation_t *next = job->next;
+        job->done(job->arg, job->result, job->result == SASL_OK ? job->username : NULL);
+        oauth2_validation_free(job);
+        job = next;
+        count++;
+    }
+    return count;
+}
+
+void oauth2_validator_free(oauth2_validator_t *validator) {
+    if (!validator) return;
+
+    pthread_mutex_lock(&validator->lock);
+    validator->stopping = 1;
+    pthread_cond_broadcast(&validator->work);
+    oauth2_http_multi_wakeup(validator->multi);
+    pthread_mutex_unlock(&validator->lock);
+    for (int i = 0; i < validator->workers_count; i++) {
+        pthread_join(validator->workers[i], NULL);
+    }
+    if (validator->network_started) {
+        pthread_join(validator->network_thread, NULL);
+    }
+
+    /* Every submission gets its callback: validations never started or resumed complete as failed */
+    while (validator->queue) {
+        oauth2_validation_t *job = validator->queue;
+        validator->queue = job->next;
+        job->result = SASL_FAIL;
+        oauth2_validator_complete(validator, job);
+    }
+    while (validator->network) {
+        oauth2_validation_t *job = validator->network;
+        validator->network = job->next;
+        oauth2_validator_abandon(job);
+        oauth2_validator_complete(validator, job);
+    }
+    oauth2_validator_dispatch(validator);
+    oauth2_http_multi_free(validator->multi);
+
+    if (validator->fd >= 0) {
+        close(validator->fd);
+    }
+    if (validator->fd_write >= 0 && validator->fd_write != validator->fd) {
+        close(validator->fd_write);
+    }
+    free(validator->workers);
+    pthread_cond_destroy(&validator->work);
+    pthread_mutex_destroy(&validator->lock);
+    free(validator);
+}
@@ -0,0 +1,245 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Claims Cache
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Bounded cache for JSON answers of IdP endpoints called on the login
+ * path (token introspection, userinfo). Entries are keyed by a SHA-256
+ * and hold an immutable, reference counted JSON object. A miss claims a
+ * pending slot: concurrent lookups of the same key wait for its result
+ * instead of calling the IdP themselves.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <jansson.h>
+#include <openssl/evp.h>
+
+void oauth2_claims_cache_init(oauth2_claims_cache_t *cache) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->done, NULL);
+}
+
+static void oauth2_claims_entry_clear(oauth2_claims_entry_t *entry) {
+    if (entry->claims) {
+        json_decref(entry->claims);
+    }
+    memset(entry, 0, sizeof(*entry));
+}
+
+static void oauth2_claims_cache_clear(oauth2_claims_cache_t *cache) {
+    for (int i = 0; i < cache->sets * OAUTH2_CLAIMS_WAYS; i++) {
+        oauth2_claims_entry_clear(&cache->entries[i]);
+    }
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->sets = 0;
+}
+
+int oauth2_claims_cache_resize(oauth2_claims_cache_t *cache, int size) {
+    if (!cache) {
+        return SASL_BADPARAM;
+    }
+
+    /* Whole sets only; a size of 0 disables both caching and coalescing */
+    int sets = size > 0 ? (size + OAUTH2_CLAIMS_WAYS - 1) / OAUTH2_CLAIMS_WAYS : 0;
+    oauth2_claims_entry_t *entries = NULL;
+    if (sets > 0) {
+        entries = calloc((size_t)sets * OAUTH2_CLAIMS_WAYS, sizeof(oauth2_claims_entry_t));
+        if (!entries) {
+            return SASL_NOMEM;
+        }
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    oauth2_claims_cache_clear(cache);
+    cache->entries = entries;
+    cache->sets = sets;
+    pthread_mutex_unlock(&cache->lock);
+
+    return SASL_OK;
+}
+
+void oauth2_claims_cache_free(oauth2_claims_cache_t *cache) {
+    if (!cache) return;
+
+    oauth2_claims_cache_clear(cache);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->done);
+}
+
+int oauth2_claims_cache_key(const char *scope, const char *id, unsigned char key[32]) {
+    if (!scope || !id || !key) {
+        return SASL_BADPARAM;
+    }
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        return SASL_NOMEM;
+    }
+
+    /* The NUL after scope keeps ("ab", "c") and ("a", "bc") apart */
+    unsigned int len = 0;
+    int ok = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) &&
+             EVP_DigestUpdate(ctx, scope, strlen(scope) + 1) &&
+             EVP_DigestUpdate(ctx, id, strlen(id)) &&
+             EVP_DigestFinal_ex(ctx, key, &len);
+    EVP_MD_CTX_free(ctx);
+
+    return ok && len == 32 ? SASL_OK : SASL_FAIL;
+}
+
+static oauth2_claims_entry_t *oauth2_claims_cache_set(oauth2_claims_cache_t *cache,
+                                                      const unsigned char key[32]) {
+    unsigned int h = ((unsigned int)key[0] << 24) | ((unsigned int)key[1] << 16) |
+                     ((unsigned int)key[2] << 8) | key[3];
+    return &cache->entries[(h % (unsigned int)cache->sets) * OAUTH2_CLAIMS_WAYS];
+}
+
+/* Entry holding key, or NULL; the caller holds the cache lock */
+static oauth2_claims_entry_t *oauth2_claims_cache_find(oauth2_claims_cache_t *cache,
+                                                       const unsigned char key[32]) {
+    if (cache->sets == 0) {
+        return NULL;
+    }
+
+    oauth2_claims_entry_t *set = oauth2_claims_cache_set(cache, key);
+    for (int w = 0; w < OAUTH2_CLAIMS_WAYS; w++) {
+        if (set[w].state != OAUTH2_CLAIMS_EMPTY && memcmp(set[w].key, key, 32) == 0) {
+            return &set[w];
+        }
+    }
+    return NULL;
+}
+
+/* Slot for a new key: empty, then expired, then least recently used; pending slots are never taken */
+static oauth2_claims_entry_t *oauth2_claims_cache_victim(oauth2_claims_cache_t *cache,
+                                                         const unsigned char key[32], time_t now) {
+    if (cache->sets == 0) {
+        return NULL;
+    }
+
+    oauth2_claims_entry_t *set = oauth2_claims_cache_set(cache, key);
+    oauth2_claims_entry_t *victim = NULL;
+    for (int w = 0; w < OAUTH2_CLAIMS_WAYS; w++) {
+        oauth2_claims_entry_t *entry = &set[w];
+        if (entry->state == OAUTH2_CLAIMS_PENDING) continue;
+        if (entry->state == OAUTH2_CLAIMS_EMPTY || entry->expires_at <= now) {
+            return entry;
+        }
+        if (!victim || entry->used_at < victim->used_at) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+/* Wait for a pending lookup to complete, no longer than the deadline allows */
+static int oauth2_claims_cache_wait(oauth2_claims_cache_t *cache, oauth2_deadline_t deadline) {
+    if (deadline == 0) {
+        return pthread_cond_wait(&cache->done, &cache->lock) == 0 ? SASL_OK : SASL_FAIL;
+    }
+
+    long remaining_ms = oauth2_deadline_remaining(deadline);
+    if (remaining_ms == 0) {
+        return SASL_UNAVAIL;
+    }
+
+    struct timespec abs;
+    clock_gettime(CLOCK_REALTIME, &abs);
+    abs.tv_sec += remaining_ms / 1000;
+    abs.tv_nsec += (remaining_ms % 1000) * 1000000L;
+    if (abs.tv_nsec >= 1000000000L) {
+        abs.tv_sec++;
+        abs.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_cond_timedwait(&cache->done, &cache->lock, &abs) == ETIMEDOUT ? SASL_UNAVAIL : SASL_OK;
+}
+
+int oauth2_claims_cache_lookup(oauth2_claims_cache_t *cache, const unsigned char key[32],
+                               oauth2_deadline_t deadline, json_t **claims, oauth2_claims_entry_t **slot) {
+    *claims = NULL;
+    *slot = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    oauth2_claims_entry_t *entry;
+    for (;;) {
+        time_t now = time(NULL);
+        entry = oauth2_claims_cache_find(cache, key);
+        if (entry && entry->state == OAUTH2_CLAIMS_READY && entry->expires_at > now) {
+            entry->used_at = now;
+            *claims = entry->claims ? json_incref(entry->claims) : NULL;
+            pthread_mutex_unlock(&cache->lock);
+            return SASL_OK;
+        }
+        if (!entry || entry->state != OAUTH2_CLAIMS_PENDING) {
+            break;
+        }
+
+        /* The same key is being fetched right now: share that result */
+        if (oauth2_claims_cache_wait(cache, deadline) == SASL_UNAVAIL) {
+            pthread_mutex_unlock(&cache->lock);
+            return SASL_UNAVAIL;
+        }
+    }
+
+    /* Miss: claim a slot (an expired entry for this key, or a victim) and mark it pending */
+    if (!entry) {
+        entry = oauth2_claims_cache_victim(cache, key, time(NULL));
+    }
+    if (entry) {
+        oauth2_claims_entry_clear(entry);
+        memcpy(entry->key, key, 32);
+        entry->state = OAUTH2_CLAIMS_PENDING;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    *slot = entry;
+    return SASL_CONTINUE;
+}
+
+void oauth2_claims_cache_complete(oauth2_claims_cache_t *cache, oauth2_claims_entry_t *slot,
+                                  int cacheable, json_t *claims, time_t expires_at) {
+    if (!slot) return;
+
+    pthread_mutex_lock(&cache->lock);
+    if (cacheable) {
+        slot->state = OAUTH2_CLAIMS_READY;
+        slot->claims = claims ? json_incref(claims) : NULL;
+        slot->expires_at = expires_at;
+        slot->used_at = time(NULL);
+    } else {
+        oauth2_claims_entry_clear(slot); /* Waiters retry on their own */
+    }
+    pthread_cond_broadcast(&cache->done);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int oauth2_claims_cache_inherit(oauth2_claims_cache_t *cache, oauth2_claims_cache_t *previous) {
+    if (!cache || !previous) {
+        return SASL_BADPARAM;
+    }
+
+    /* Keys map to the same sets only when both caches have the same geometry */
+    if (cache->sets == 0 || cache->sets != previous->sets) {
+        return SASL_NOTDONE;
+    }
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&previous->lock);
+    for (int i = 0; i < cache->sets * OAUTH2_CLAIMS_WAYS; i++) {
+        const oauth2_claims_entry_t *entry = &previous->entries[i];
+        if (entry->state == OAUTH2_CLAIMS_READY && entry->expires_at > now) {
+            cache->entries[i] = *entry;
+            if (entry->claims) {
+                json_incref(entry->claims);
+            }
+        }
+    }
+    pthread_mutex_unlock(&previous->lock);
+
+    return SASL_OK;
+}
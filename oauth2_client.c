@@ -6,75 +6,83 @@
 #include "oauth2_plugin.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
 
 /* Client context structure - defined in oauth2_types.h */
 
-/* Generate XOAUTH2 authentication string */
-static int oauth2_generate_xoauth2(const char *username, const char *token,
-                                  char **output, unsigned *outputlen) {
-    if (!username || !token || !output || !outputlen) {
-        return SASL_BADPARAM;
-    }
-    
-    /* Format: user=username^Aauth=Bearer token^A^A */
-    size_t auth_len = strlen("user=") + strlen(username) + 1 + /* ^A */
-                      strlen("auth=Bearer ") + strlen(token) + 2; /* ^A^A */
-    
-    char *auth_string = malloc(auth_len);
-    if (!auth_string) {
-        return SASL_NOMEM;
-    }
-    
-    int snprintf_result = snprintf(auth_string, auth_len, "user=%s\x01auth=Bearer %s\x01\x01", username, token);
-    if (snprintf_result < 0 || (size_t)snprintf_result >= auth_len) {
-        free(auth_string);
-        return SASL_FAIL;
+/* Bytes of a GS2 authzid once ',' and '=' are escaped as =2C and =3D (RFC 5801) */
+static size_t oauth2_gs2_escaped_len(const char *name) {
+    size_t len = 0;
+    for (const char *p = name; *p; p++) {
+        len += (*p == ',' || *p == '=') ? 3 : 1;
     }
-    
-    /* Base64 encode the authentication string */
-    char *encoded = NULL;
-    size_t encoded_len = 0;
-    
-    /* Use liboauth2 v2.10+ API - returns size_t, not bool */
-    encoded_len = oauth2_base64_encode(NULL, (const uint8_t*)auth_string, auth_len - 1, &encoded);
-    if (encoded_len == 0 || !encoded) {
-        free(auth_string);
-        return SASL_FAIL;
-    }
-    
-    free(auth_string);
-    
-    *output = encoded;
-    *outputlen = encoded_len;
-    
-    return SASL_OK;
+    return len;
 }
 
-/* Generate OAUTHBEARER authentication string */
-/*@unused@*/ static int oauth2_generate_oauthbearer(const char *username, const char *token,
-                                      char **output, unsigned *outputlen) {
-    if (!username || !token || !output || !outputlen) {
+static char *oauth2_put(char *out, const char *s, size_t len) {
+    memcpy(out, s, len);
+    return out + len;
+}
+
+/*
+ * Initial response of the connection's mechanism, sized up front and
+ * written in one pass into the context's response buffer:
+ *   XOAUTH2:     user=username^Aauth=Bearer token^A^A
+ *   OAUTHBEARER: n,a=username,^Aauth=Bearer token^A^A
+ * The buffer is secure memory kept across reuse, so it is only grown for
+ * unusually large tokens. The application protocol does the base64.
+ */
+static int oauth2_client_encode(oauth2_client_context_t *context) {
+    static const char bearer[] = "auth=Bearer ";
+    size_t user_len = strlen(context->username);
+    size_t token_len = strlen(context->access_token);
+    size_t len;
+
+    if (context->mech == OAUTH2_CLIENT_OAUTHBEARER) {
+        len = 4 + oauth2_gs2_escaped_len(context->username) + 2;
+    } else {
+        len = 5 + user_len + 1;
+    }
+    len += sizeof(bearer) - 1 + token_len + 2;
+    if (len < token_len || len > UINT_MAX) {
         return SASL_BADPARAM;
     }
-    
-    /* Format: n,a=username,^Aauth=Bearer token^A^A */
-    size_t auth_len = strlen("n,a=") + strlen(username) + strlen(",\x01auth=Bearer ") + 
-                      strlen(token) + strlen("\x01\x01") + 1;
-    
-    char *auth_string = malloc(auth_len);
-    if (!auth_string) {
-        return SASL_NOMEM;
+
+    if (len > context->response_size) {
+        size_t size = len > OAUTH2_TOKEN_BUFFER_SIZE ? len : OAUTH2_TOKEN_BUFFER_SIZE;
+        char *response = oauth2_secure_alloc(size);
+        if (!response) {
+            return SASL_NOMEM;
+        }
+        oauth2_secure_free(context->response);
+        context->response = response;
+        context->response_size = size;
     }
-    
-    int snprintf_result = snprintf(auth_string, auth_len, "n,a=%s,\x01auth=Bearer %s\x01\x01", username, token);
-    if (snprintf_result < 0 || (size_t)snprintf_result >= auth_len) {
-        free(auth_string);
-        return SASL_FAIL;
+
+    char *out = context->response;
+    if (context->mech == OAUTH2_CLIENT_OAUTHBEARER) {
+        out = oauth2_put(out, "n,a=", 4);
+        for (const char *p = context->username; *p; p++) {
+            if (*p == ',') {
+                out = oauth2_put(out, "=2C", 3);
+            } else if (*p == '=') {
+                out = oauth2_put(out, "=3D", 3);
+            } else {
+                *out++ = *p;
+            }
+        }
+        out = oauth2_put(out, ",\x01", 2);
+    } else {
+        out = oauth2_put(out, "user=", 5);
+        out = oauth2_put(out, context->username, user_len);
+        *out++ = '\x01';
     }
-    
-    *output = auth_string;
-    *outputlen = strlen(auth_string);
-    
+    out = oauth2_put(out, bearer, sizeof(bearer) - 1);
+    out = oauth2_put(out, context->access_token, token_len);
+    out = oauth2_put(out, "\x01\x01", 2);
+
+    context->response_len = (size_t)(out - context->response);
     return SASL_OK;
 }
 
@@ -83,16 +91,6 @@ int oauth2_client_init(const sasl_utils_t *utils, oauth2_config_t *config) {
         return SASL_BADPARAM;
     }
     
-    /* Initialize liboauth2 log context if not already done */
-    if (!config->oauth2_log) {
-        oauth2_log_level_t log_level = config->debug ? OAUTH2_LOG_TRACE1 : OAUTH2_LOG_WARN;
-        config->oauth2_log = oauth2_log_init(log_level, NULL);
-        if (!config->oauth2_log) {
-            OAUTH2_LOG_ERR(utils, "Failed to initialize OAuth2 log context for client");
-            return SASL_FAIL;
-        }
-    }
-    
     OAUTH2_LOG_INFO(utils, "OAuth2/OIDC client plugin initialized");
     return SASL_OK;
 }
@@ -120,6 +118,24 @@ int oauth2_client_step(void *conn_context, sasl_client_params_t *params,
         return SASL_BADPROT;
     }
     
+    /* With a configured grant, the token comes from the process-wide cache instead of the application */
+    const char *user = context->username ? context->username : context->config->client_user;
+    if (!context->access_token && user && context->config->client_grant) {
+        int token_result = oauth2_client_token_get(utils, context->config, user, &context->access_token);
+        if (token_result != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "Failed to obtain an access token for %s", user);
+            return token_result;
+        }
+        if (!context->username) {
+            size_t user_len = strlen(user);
+            context->username = utils->malloc(user_len + 1);
+            if (!context->username) {
+                return SASL_NOMEM;
+            }
+            memcpy(context->username, user, user_len + 1);
+        }
+    }
+    
     /* We expect to have username and access token from previous interactions */
     if (!context->username || !context->access_token) {
         /* Request username and access token via prompts */
@@ -149,57 +165,32 @@ int oauth2_client_step(void *conn_context, sasl_client_params_t *params,
         return SASL_INTERACT;
     }
     
-    /* Generate authentication string based on mechanism */
-    char *auth_output = NULL;
-    unsigned auth_len = 0;
-    int result;
-    
-    /* Use XOAUTH2 mechanism (simplified approach) */
-    result = oauth2_generate_xoauth2(context->username, context->access_token,
-                                    &auth_output, &auth_len);
-    
+    int result = oauth2_client_encode(context);
     if (result != SASL_OK) {
         OAUTH2_LOG_ERR(utils, "Failed to generate authentication string");
         return result;
     }
     
-    *clientout = auth_output;
-    *clientoutlen = auth_len;
+    /* The SASL library owns the identities: canon_user sets user and authid in oparams */
+    result = params->canon_user(utils->conn, context->username, 0,
+                                SASL_CU_AUTHID | SASL_CU_AUTHZID, oparams);
+    if (result != SASL_OK) {
+        OAUTH2_LOG_ERR(utils, "Failed to canonicalize user: %s", context->username);
+        return result;
+    }
+    
+    /* Valid until dispose */
+    *clientout = context->response;
+    *clientoutlen = (unsigned)context->response_len;
     
     context->state = 1;
     
-    /* Set output parameters */
+    /* Set output parameters - user/authid already set by canon_user */
     oparams->doneflag = 1;
     oparams->mech_ssf = 0; /* No security layer */
     oparams->maxoutbuf = 0;
     oparams->encode = NULL;
     oparams->decode = NULL;
-    /* realm member doesn't exist in modern SASL */
-    /* Free any existing user/authid before setting new ones */
-    if (oparams->user) {
-        utils->free((void*)oparams->user);
-        oparams->user = NULL;
-    }
-    if (oparams->authid) {
-        utils->free((void*)oparams->authid);
-        oparams->authid = NULL;
-    }
-    
-    /* Allocate and set user and authid */
-    size_t username_len = strlen(context->username);
-    char *user_copy = utils->malloc(username_len + 1);
-    char *authid_copy = utils->malloc(username_len + 1);
-    
-    if (user_copy) {
-        strncpy(user_copy, context->username, username_len);
-        user_copy[username_len] = '\0';
-        oparams->user = user_copy;
-    }
-    if (authid_copy) {
-        strncpy(authid_copy, context->username, username_len);
-        authid_copy[username_len] = '\0';
-        oparams->authid = authid_copy;
-    }
     
     OAUTH2_LOG_INFO(utils, "OAuth2 client authentication data generated for user: %s", 
                    context->username);
@@ -213,11 +204,8 @@ static void oauth2_cleanup_context_fields(char *username, char *access_token, co
         utils->free(username);
     }
     
-    if (access_token) {
-        /* Clear token from memory for security */
-        memset(access_token, 0, strlen(access_token));
-        utils->free(access_token);
-    }
+    /* Wiped with its known length when it goes back to the slab */
+    oauth2_secure_free(access_token);
 }
 
 void oauth2_client_dispose(void *conn_context, const sasl_utils_t *utils) {
@@ -226,13 +214,19 @@ void oauth2_client_dispose(void *conn_context, const sasl_utils_t *utils) {
     if (!context) return;
     
     oauth2_cleanup_context_fields(context->username, context->access_token, utils);
-    utils->free(context);
+    
+    int pool_size = context->config ? context->config->context_pool_size : 0;
+    oauth2_config_release(context->config);
+    
+    /* The response buffer stays with the context for its next connection */
+    oauth2_secure_wipe(context->response, context->response_len);
+    memset(context, 0, offsetof(oauth2_client_context_t, response));
+    oauth2_context_pool_put(OAUTH2_POOL_CLIENT, context, pool_size);
 }
 
 /* Client mechanism functions for SASL plugin interface */
-int oauth2_client_mech_new(void *glob_context,
-                           sasl_client_params_t *params,
-                           void **conn_context) {
+static int oauth2_client_new(void *glob_context, sasl_client_params_t *params,
+                             int mech, void **conn_context) {
     
     oauth2_client_context_t *context;
     const sasl_utils_t *utils = params->utils;
@@ -242,21 +236,40 @@ int oauth2_client_mech_new(void *glob_context,
         return SASL_FAIL;
     }
     
-    context = utils->malloc(sizeof(oauth2_client_context_t));
+    /* Zeroed, whether fresh or reused */
+    context = oauth2_context_pool_get(OAUTH2_POOL_CLIENT);
     if (!context) {
         utils->seterror(params->utils->conn, 0, "Failed to allocate client context");
         return SASL_NOMEM;
     }
     
-    memset(context, 0, sizeof(oauth2_client_context_t));
-    context->config = (oauth2_config_t*)glob_context;
+    /* Pinned until dispose, a newly published configuration only applies to new connections */
+    oauth2_config_reload_check((oauth2_config_holder_t*)glob_context);
+    context->config = oauth2_config_acquire((oauth2_config_holder_t*)glob_context);
+    if (!context->config) {
+        oauth2_context_pool_put(OAUTH2_POOL_CLIENT, context, OAUTH2_DEFAULT_CONTEXT_POOL_SIZE);
+        utils->seterror(params->utils->conn, 0, "No configuration available");
+        return SASL_FAIL;
+    }
     context->state = 0;
+    context->mech = mech;
     
     *conn_context = context;
     
     return SASL_OK;
 }
 
+/* One constructor per plugin entry: the client params do not name the negotiated mechanism */
+int oauth2_client_mech_new_xoauth2(void *glob_context, sasl_client_params_t *params,
+                                   void **conn_context) {
+    return oauth2_client_new(glob_context, params, OAUTH2_CLIENT_XOAUTH2, conn_context);
+}
+
+int oauth2_client_mech_new_oauthbearer(void *glob_context, sasl_client_params_t *params,
+                                       void **conn_context) {
+    return oauth2_client_new(glob_context, params, OAUTH2_CLIENT_OAUTHBEARER, conn_context);
+}
+
 int oauth2_client_mech_step(void *conn_context,
                             sasl_client_params_t *params,
                             const char *serverin,
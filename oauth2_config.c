@@ -8,90 +8,242 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
 
 /* For strdup function */
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 
-/* Utility function to parse space-separated string lists */
-/*@null@*/ char **oauth2_parse_string_list(const char *input, int *count) {
-    *count = 0;
-    if (!input || strlen(input) == 0) {
-        return NULL;
+#define OAUTH2_STRING_POOL_MIN_SLOTS 64
+
+uint32_t oauth2_string_hash(const char *s, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
     }
-    
-    /* Count items first */
-    char *temp = strdup(input);
-    char *token = strtok(temp, " \t\n");
-    int item_count = 0;
-    while (token) {
-        item_count++;
-        token = strtok(NULL, " \t\n");
+    return hash;
+}
+
+static int oauth2_string_pool_reserve(oauth2_string_pool_t *pool, size_t len) {
+    /* Offsets are 32 bits */
+    if (len >= UINT32_MAX - pool->len) {
+        return SASL_NOMEM;
     }
-    free(temp);
-    
-    if (item_count == 0) {
-        return NULL;
+    if (pool->len + len + 1 <= pool->size) {
+        return SASL_OK;
     }
-    
-    /* Allocate array */
-    char **list = malloc((item_count + 1) * sizeof(char*));
-    if (!list) {
-        return NULL;
+    size_t size = pool->size ? pool->size : 256;
+    while (size < pool->len + len + 1) {
+        size *= 2;
     }
-    
-    /* Parse items */
-    temp = strdup(input);
-    token = strtok(temp, " \t\n");
-    int i = 0;
-    while ((token != NULL) && (i < item_count)) {
-        list[i] = strdup(token);
-        if (!list[i]) {
-            /* Cleanup on error */
-            for (int j = 0; j < i; j++) {
-                free(list[j]);
-            }
-            free(list);
-            free(temp);
-            return NULL;
+    char *data = realloc(pool->data, size);
+    if (!data) {
+        return SASL_NOMEM;
+    }
+    pool->data = data;
+    pool->size = size;
+    return SASL_OK;
+}
+
+static int oauth2_string_pool_grow_slots(oauth2_string_pool_t *pool) {
+    size_t count = pool->slots_count ? pool->slots_count * 2 : OAUTH2_STRING_POOL_MIN_SLOTS;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots) {
+        return SASL_NOMEM;
+    }
+    for (size_t i = 0; i < pool->slots_count; i++) {
+        if (!pool->slots[i]) continue;
+        const char *s = pool->data + pool->slots[i] - 1;
+        size_t j = oauth2_string_hash(s, strlen(s)) & (count - 1);
+        while (slots[j]) {
+            j = (j + 1) & (count - 1);
         }
-        i++;
-        token = strtok(NULL, " \t\n");
+        slots[j] = pool->slots[i];
     }
-    list[i] = NULL;
-    free(temp);
-    
-    *count = item_count;
-    return list;
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slots_count = count;
+    return SASL_OK;
 }
 
-void oauth2_free_string_list(char **list, int count) {
-    if (!list) return;
-    
-    for (int i = 0; i < count; i++) {
-        if (list[i]) {
-            free(list[i]);
+/*
+ * Intern the len bytes just written after the pool's end: the offset of an
+ * equal string already in the pool, else of the new one.
+ */
+static uint32_t oauth2_string_pool_commit(oauth2_string_pool_t *pool, size_t len) {
+    if ((pool->interned + 1) * 2 > pool->slots_count && oauth2_string_pool_grow_slots(pool) != SASL_OK) {
+        return OAUTH2_STRING_NONE;
+    }
+
+    const char *candidate = pool->data + pool->len;
+    size_t i = oauth2_string_hash(candidate, len) & (pool->slots_count - 1);
+    while (pool->slots[i]) {
+        const char *s = pool->data + pool->slots[i] - 1;
+        if (strncmp(s, candidate, len) == 0 && s[len] == '\0') {
+            return pool->slots[i] - 1;
+        }
+        i = (i + 1) & (pool->slots_count - 1);
+    }
+
+    uint32_t offset = (uint32_t)pool->len;
+    pool->data[pool->len + len] = '\0';
+    pool->len += len + 1;
+    pool->slots[i] = offset + 1;
+    pool->interned++;
+    return offset;
+}
+
+uint32_t oauth2_string_pool_intern(oauth2_string_pool_t *pool, const char *s, size_t len) {
+    if (oauth2_string_pool_reserve(pool, len) != SASL_OK) {
+        return OAUTH2_STRING_NONE;
+    }
+    memcpy(pool->data + pool->len, s, len);
+    return oauth2_string_pool_commit(pool, len);
+}
+
+/* Loading is over: drop the index and the unused room, pointers into the data stay valid from here on */
+void oauth2_string_pool_seal(oauth2_string_pool_t *pool) {
+    free(pool->slots);
+    pool->slots = NULL;
+    pool->slots_count = 0;
+    pool->interned = 0;
+    if (pool->data && pool->len > 0 && pool->len < pool->size) {
+        char *data = realloc(pool->data, pool->len);
+        if (data) {
+            pool->data = data;
+            pool->size = pool->len;
         }
     }
-    free(list);
 }
 
-static const char *oauth2_config_get_string(const sasl_utils_t *utils, 
-                                           const char *key, 
-                                           const char *default_value) {
+void oauth2_string_pool_free(oauth2_string_pool_t *pool) {
+    free(pool->data);
+    free(pool->slots);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static int oauth2_string_list_alloc(oauth2_string_list_t *list, int count) {
+    list->count = 0;
+    list->offsets = count > 0 ? malloc((size_t)count * 2 * sizeof(uint32_t)) : NULL;
+    list->lengths = list->offsets ? list->offsets + count : NULL;
+    return count == 0 || list->offsets ? SASL_OK : SASL_NOMEM;
+}
+
+static int oauth2_string_list_add(oauth2_string_pool_t *pool, oauth2_string_list_t *list, uint32_t offset) {
+    if (offset == OAUTH2_STRING_NONE) {
+        return SASL_NOMEM;
+    }
+    list->offsets[list->count] = offset;
+    list->lengths[list->count] = (uint32_t)strlen(pool->data + offset);
+    list->count++;
+    return SASL_OK;
+}
+
+static int oauth2_string_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Space-separated setting into list, its items interned in pool */
+int oauth2_string_list_parse(oauth2_string_pool_t *pool, const char *input, oauth2_string_list_t *list) {
+    memset(list, 0, sizeof(*list));
+    if (!input) {
+        return SASL_OK;
+    }
+
+    /* Count first, so the list takes a single allocation */
+    int count = 0;
+    for (const char *p = input; *p; ) {
+        while (oauth2_string_is_space(*p)) p++;
+        if (!*p) break;
+        count++;
+        while (*p && !oauth2_string_is_space(*p)) p++;
+    }
+    if (oauth2_string_list_alloc(list, count) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+
+    for (const char *p = input; *p; ) {
+        while (oauth2_string_is_space(*p)) p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && !oauth2_string_is_space(*p)) p++;
+        if (oauth2_string_list_add(pool, list, oauth2_string_pool_intern(pool, start, (size_t)(p - start))) != SASL_OK) {
+            oauth2_string_list_free(list);
+            return SASL_NOMEM;
+        }
+    }
+    return SASL_OK;
+}
+
+void oauth2_string_list_free(oauth2_string_list_t *list) {
+    free(list->offsets);
+    memset(list, 0, sizeof(*list));
+}
+
+const char *oauth2_config_list_item(const oauth2_config_t *config, const oauth2_string_list_t *list, int i) {
+    return config->strings.data + list->offsets[i];
+}
+
+/* Index of s in list, or -1; lengths are compared first, they sit together in memory */
+int oauth2_config_list_find(const oauth2_config_t *config, const oauth2_string_list_t *list,
+                            const char *s, size_t len) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->lengths[i] == len && memcmp(config->strings.data + list->offsets[i], s, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int oauth2_config_parse_list(oauth2_config_t *config, const sasl_utils_t *utils, const char *input,
+                                    oauth2_string_list_t *list) {
+    if (oauth2_string_list_parse(&config->strings, input, list) != SASL_OK) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for configuration lists");
+        return SASL_NOMEM;
+    }
+    return SASL_OK;
+}
+
+/* Raw setting: the configuration file first, then SASL options; the empty key is never set */
+static const char *oauth2_config_get_value(const oauth2_config_t *config,
+                                           const sasl_utils_t *utils,
+                                           const char *key) {
+    if (!key[0]) {
+        return NULL;
+    }
+    for (int i = 0; i < config->file.count; i++) {
+        if (strcmp(config->file.keys[i], key) == 0) {
+            return config->file.values[i];
+        }
+    }
+    
     const char *value;
     if (utils->getopt(utils->getopt_context, "oauth2", key, &value, NULL) == SASL_OK && value) {
+        return value;
+    }
+    return NULL;
+}
+
+static const char *oauth2_config_get_string(const oauth2_config_t *config,
+                                           const sasl_utils_t *utils, 
+                                           const char *key, 
+                                           const char *default_value) {
+    const char *value = oauth2_config_get_value(config, utils, key);
+    if (value) {
         return value;  /* Return direct pointer - no strdup needed */
     }
     return default_value;
 }
 
-static int oauth2_config_get_int(const sasl_utils_t *utils, 
+static int oauth2_config_get_int(const oauth2_config_t *config,
+                                const sasl_utils_t *utils, 
                                 const char *key, 
                                 int default_value) {
-    const char *value;
-    if (utils->getopt(utils->getopt_context, "oauth2", key, &value, NULL) == SASL_OK && value) {
+    const char *value = oauth2_config_get_value(config, utils, key);
+    if (value) {
         /* Secure integer parsing with validation */
         char *endptr;
         long parsed_value = strtol(value, &endptr, 10);
@@ -116,11 +268,12 @@ static int oauth2_config_get_int(const sasl_utils_t *utils,
     return default_value;
 }
 
-static int oauth2_config_get_bool(const sasl_utils_t *utils, 
+static int oauth2_config_get_bool(const oauth2_config_t *config,
+                                 const sasl_utils_t *utils, 
                                  const char *key, 
                                  int default_value) {
-    const char *value;
-    if (utils->getopt(utils->getopt_context, "oauth2", key, &value, NULL) == SASL_OK && value) {
+    const char *value = oauth2_config_get_value(config, utils, key);
+    if (value) {
         return (strcasecmp(value, "yes") == 0 || 
                 strcasecmp(value, "true") == 0 || 
                 strcasecmp(value, "1") == 0) ? 1 : 0;
@@ -128,6 +281,93 @@ static int oauth2_config_get_bool(const sasl_utils_t *utils,
     return default_value;
 }
 
+/* Key of block N's setting: oauth2_provider<N>_ and the global key without "oauth2_" */
+static void oauth2_config_block_key(char *scoped, size_t size, int block, const char *key) {
+    snprintf(scoped, size, OAUTH2_CONF_PROVIDER_PREFIX "%d_%s", block, key + strlen("oauth2_"));
+}
+
+/* Key of a provider's own setting, in the block bound to it; empty when it has none */
+static void oauth2_config_provider_key(const oauth2_config_t *config, char *scoped, size_t size,
+                                       int provider, const char *key) {
+    int block = config->provider_blocks ? config->provider_blocks[provider] : provider + 1;
+    if (block == 0) {
+        scoped[0] = '\0';
+        return;
+    }
+    oauth2_config_block_key(scoped, size, block, key);
+}
+
+static char *oauth2_config_trim(char *start, char *end) {
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return start;
+}
+
+/* Read the configuration file: "key: value" lines and '#' comments, as in SASL configuration files */
+static int oauth2_config_read_file(oauth2_config_t *config, const sasl_utils_t *utils, const char *path) {
+    oauth2_file_map_t map;
+    if (oauth2_file_map(path, &map) != SASL_OK) {
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 0) {
+            return SASL_OK;
+        }
+        OAUTH2_LOG_ERR(utils, "Cannot read %s %s", OAUTH2_CONF_CONFIG_FILE, path);
+        return SASL_FAIL;
+    }
+    
+    oauth2_config_file_t *file = &config->file;
+    file->data = malloc(map.len + 1);
+    int lines = 1;
+    if (file->data) {
+        memcpy(file->data, map.data, map.len);
+        file->data[map.len] = '\0';
+        for (size_t i = 0; i < map.len; i++) {
+            lines += map.data[i] == '\n';
+        }
+    }
+    oauth2_file_unmap(&map);
+    
+    file->keys = file->data ? calloc((size_t)lines, sizeof(char*)) : NULL;
+    file->values = file->data ? calloc((size_t)lines, sizeof(char*)) : NULL;
+    if (!file->keys || !file->values) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", path);
+        return SASL_NOMEM;
+    }
+    
+    char *line = file->data;
+    for (int number = 1; line; number++) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0' || *start == '#') {
+            line = next;
+            continue;
+        }
+        
+        char *end = start + strlen(start);
+        char *colon = strchr(start, ':');
+        if (!colon) {
+            OAUTH2_LOG_ERR(utils, "%s:%d: expected \"key: value\"", path, number);
+            return SASL_FAIL;
+        }
+        
+        const char *key = oauth2_config_trim(start, colon);
+        if (!*key) {
+            OAUTH2_LOG_ERR(utils, "%s:%d: missing key", path, number);
+            return SASL_FAIL;
+        }
+        file->keys[file->count] = key;
+        file->values[file->count] = oauth2_config_trim(colon + 1, end);
+        file->count++;
+        line = next;
+    }
+    
+    return SASL_OK;
+}
+
 oauth2_config_t *oauth2_config_init(const sasl_utils_t *utils) {
     oauth2_config_t *config;
     
@@ -147,18 +387,61 @@ oauth2_config_t *oauth2_config_init(const sasl_utils_t *utils) {
         return NULL;
     }
     
+    pthread_mutex_init(&config->refresher_lock, NULL);
+    pthread_cond_init(&config->refresher_cond, NULL);
+    config->refcount = 1;
+    oauth2_claims_cache_init(&config->introspection_cache);
+    oauth2_claims_cache_init(&config->userinfo_cache);
+    oauth2_tenant_table_init(&config->tenants);
+    
     return config;
 }
 
 void oauth2_config_free(oauth2_config_t *config) {
     if (!config) return;
     
-    /* Free string list configurations */
-    oauth2_free_string_list(config->discovery_urls, config->discovery_urls_count);
-    oauth2_free_string_list(config->issuers, config->issuers_count);
-    oauth2_free_string_list(config->audiences, config->audiences_count);
+    /* The background refresher uses the providers: stop it first */
+    oauth2_provider_stop_refresher(config);
     
-    /* NOTE: Simple string configurations are pointers to SASL internal data - do NOT free them */
+    /* Free string list configurations and the pool behind them */
+    for (int i = 0; config->policies && i < config->discovery_urls.count; i++) {
+        oauth2_string_list_free(&config->policies[i].audiences);
+        oauth2_string_list_free(&config->policies[i].allowed_algs);
+        oauth2_claim_policy_free(&config->policies[i].claims);
+        oauth2_user_map_free(&config->policies[i].user_map);
+    }
+    free(config->policies);
+    free(config->provider_blocks);
+    oauth2_string_list_free(&config->discovery_urls);
+    oauth2_string_list_free(&config->issuers);
+    oauth2_string_list_free(&config->audiences);
+    oauth2_string_list_free(&config->jwks_files);
+    oauth2_string_list_free(&config->public_key_files);
+    oauth2_string_list_free(&config->token_validation);
+    oauth2_string_list_free(&config->allowed_algs);
+    oauth2_claim_policy_free(&config->claim_policy);
+    oauth2_user_map_free(&config->user_map);
+    oauth2_string_pool_free(&config->strings);
+    
+    /* Free provider registry and its key stores */
+    for (int i = 0; i < config->providers_count; i++) {
+        oauth2_provider_free(&config->providers[i]);
+    }
+    free(config->providers);
+    free(config->issuer_slots);
+    oauth2_tenant_table_free(&config->tenants);
+    oauth2_claims_cache_free(&config->introspection_cache);
+    oauth2_claims_cache_free(&config->userinfo_cache);
+    oauth2_revocation_list_free(config->revocation);
+    oauth2_latency_free(config->latency);
+    free(config->file.keys);
+    free(config->file.values);
+    free(config->file.data);
+    
+    pthread_mutex_destroy(&config->refresher_lock);
+    pthread_cond_destroy(&config->refresher_cond);
+    
+    /* NOTE: Simple string configurations point to SASL internal data or config->file - do NOT free them */
     /* config->client_id, client_secret, scope, user_claim point to getopt() results */
     
     /* Cleanup liboauth2 logging context */
@@ -170,18 +453,484 @@ void oauth2_config_free(oauth2_config_t *config) {
     free(config);
 }
 
-int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
+oauth2_config_t *oauth2_config_acquire(oauth2_config_holder_t *holder) {
+    if (!holder) return NULL;
+
+    /* Announce the read first: a publisher waits for the readers of its generation
+     * before dropping the old snapshot */
+    unsigned long *readers = &holder->readers[__atomic_load_n(&holder->generation, __ATOMIC_SEQ_CST) & 1];
+    __atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+    oauth2_config_t *config = __atomic_load_n(&holder->current, __ATOMIC_SEQ_CST);
+    if (config) {
+        __atomic_fetch_add(&config->refcount, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(readers, 1, __ATOMIC_RELEASE);
+
+    return config;
+}
+
+void oauth2_config_release(oauth2_config_t *config) {
+    if (config && __atomic_sub_fetch(&config->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        oauth2_config_free(config);
+    }
+}
+
+void oauth2_config_publish(oauth2_config_holder_t *holder, oauth2_config_t *config) {
+    if (!holder) return;
+
+    pthread_mutex_lock(&holder->publish_lock);
+    oauth2_config_t *old = __atomic_exchange_n(&holder->current, config, __ATOMIC_SEQ_CST);
+
+    /* Grace period: a reader that may have loaded the old pointer announced itself
+     * in the generation closed here and has pinned it once that count drains.
+     * Later readers count in the next generation and see the new pointer. */
+    unsigned long closed = __atomic_fetch_add(&holder->generation, 1, __ATOMIC_SEQ_CST) & 1;
+    while (__atomic_load_n(&holder->readers[closed], __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&holder->publish_lock);
+    oauth2_config_release(old);
+}
+
+/* Split a per-provider key file entry ("a.json,b.pem" or "-") and append the paths */
+static int oauth2_config_collect_key_files(const char *entry, char **files, int *files_count, int max_files) {
+    if (!entry || strcmp(entry, OAUTH2_KEY_FILE_NONE) == 0) {
+        return SASL_OK;
+    }
+    
+    char *copy = strdup(entry);
+    if (!copy) return SASL_NOMEM;
+    
+    char *saveptr = NULL;
+    for (char *path = strtok_r(copy, ",", &saveptr); path; path = strtok_r(NULL, ",", &saveptr)) {
+        if (*files_count >= max_files) break;
+        files[*files_count] = strdup(path);
+        if (!files[*files_count]) {
+            free(copy);
+            return SASL_NOMEM;
+        }
+        (*files_count)++;
+    }
+    
+    free(copy);
+    return SASL_OK;
+}
+
+static int oauth2_config_same_string(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+/* Network provider of the previous configuration with the same identity and settings, or NULL */
+static oauth2_provider_t *oauth2_config_same_provider(oauth2_config_t *previous, const oauth2_provider_t *provider) {
+    if (!previous || provider->local_keys || !provider->keys) {
+        return NULL;
+    }
+    
+    for (int i = 0; i < previous->providers_count; i++) {
+        oauth2_provider_t *candidate = &previous->providers[i];
+        if (!candidate->local_keys && candidate->keys &&
+            candidate->introspection == provider->introspection &&
+            strcmp(candidate->discovery_url, provider->discovery_url) == 0 &&
+            oauth2_config_same_string(candidate->issuer, provider->issuer) &&
+            oauth2_config_same_string(candidate->keys->options, provider->keys->options)) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Bind the oauth2_provider<N>_ blocks to providers. A block naming an issuer
+ * (or discovery URL) with oauth2_provider<N>_issuer follows that provider
+ * when the lists are reordered; a block that names none stays with the
+ * provider at position N. A name matching no provider, or a provider named
+ * twice, fails the load rather than apply settings to the wrong provider.
+ */
+static int oauth2_config_bind_blocks(oauth2_config_t *config, const sasl_utils_t *utils) {
+    int count = config->discovery_urls.count;
+    config->provider_blocks = calloc((size_t)count, sizeof(int));
+    if (!config->provider_blocks) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for provider settings");
+        return SASL_NOMEM;
+    }
+
+    int issuers_positional = (config->issuers.count == count);
+    char key[128];
+    for (int block = 1; block <= count; block++) {
+        oauth2_config_block_key(key, sizeof(key), block, OAUTH2_CONF_PROVIDER_ISSUER);
+        const char *name = oauth2_config_get_value(config, utils, key);
+        if (!name) continue;
+
+        int provider = -1;
+        for (int i = 0; i < count && provider < 0; i++) {
+            if (strcmp(name, oauth2_config_list_item(config, &config->discovery_urls, i)) == 0 ||
+                (issuers_positional && strcmp(name, oauth2_config_list_item(config, &config->issuers, i)) == 0)) {
+                provider = i;
+            }
+        }
+        if (provider < 0) {
+            OAUTH2_LOG_ERR(utils, "%s names no configured provider: %s", key, name);
+            return SASL_FAIL;
+        }
+        if (config->provider_blocks[provider]) {
+            OAUTH2_LOG_ERR(utils, "%s and " OAUTH2_CONF_PROVIDER_PREFIX "%d_issuer both name %s",
+                           key, config->provider_blocks[provider], name);
+            return SASL_FAIL;
+        }
+        config->provider_blocks[provider] = block;
+    }
+
+    for (int i = 0; i < count; i++) {
+        oauth2_config_block_key(key, sizeof(key), i + 1, OAUTH2_CONF_PROVIDER_ISSUER);
+        if (!config->provider_blocks[i] && !oauth2_config_get_value(config, utils, key)) {
+            config->provider_blocks[i] = i + 1;
+        }
+    }
+    return SASL_OK;
+}
+
+/*
+ * Compile each provider's settings: its own oauth2_provider<N>_* keys, the
+ * global ones otherwise. Runs before the pool is sealed, the lists intern
+ * their strings like the global ones. Unrouted tokens use default_policy,
+ * a view of the global settings.
+ */
+static int oauth2_config_compile_policies(oauth2_config_t *config, const sasl_utils_t *utils) {
+    const char *claims_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_CLAIM_POLICY, NULL);
+    int result = oauth2_claim_policy_compile(utils, &config->strings, claims_str, &config->claim_policy);
+    if (result != SASL_OK) {
+        return result;
+    }
+    const char *transform_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_USER_TRANSFORM, NULL);
+    result = oauth2_user_map_compile(utils, &config->strings, config->user_claim, transform_str, &config->user_map);
+    if (result != SASL_OK) {
+        return result;
+    }
+    
+    config->default_policy.audiences = config->audiences;
+    config->default_policy.user_claim = config->user_claim;
+    config->default_policy.user_map = config->user_map;
+    config->default_policy.allowed_algs = config->allowed_algs;
+    config->default_policy.claims = config->claim_policy;
+    config->default_policy.introspection_cache_ttl = config->introspection_cache_ttl;
+    config->default_policy.userinfo_cache_ttl = config->userinfo_cache_ttl;
+    
+    if (config->discovery_urls.count == 0) {
+        return SASL_OK;
+    }
+    config->policies = calloc((size_t)config->discovery_urls.count, sizeof(oauth2_issuer_policy_t));
+    if (!config->policies) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for provider settings");
+        return SASL_NOMEM;
+    }
+    result = oauth2_config_bind_blocks(config, utils);
+    if (result != SASL_OK) {
+        return result;
+    }
+    
+    const char *audiences_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_AUDIENCES,
+                                    oauth2_config_get_string(config, utils, OAUTH2_CONF_AUDIENCE, NULL));
+    const char *algs_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_ALLOWED_ALGS, NULL);
+    char key[128], singular[128];
+    
+    for (int i = 0; i < config->discovery_urls.count; i++) {
+        oauth2_issuer_policy_t *policy = &config->policies[i];
+        
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_AUDIENCES);
+        oauth2_config_provider_key(config, singular, sizeof(singular), i, OAUTH2_CONF_AUDIENCE);
+        const char *own = oauth2_config_get_string(config, utils, key,
+                              oauth2_config_get_string(config, utils, singular, audiences_str));
+        if (oauth2_config_parse_list(config, utils, own, &policy->audiences) != SASL_OK) {
+            return SASL_NOMEM;
+        }
+        
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_ALLOWED_ALGS);
+        own = oauth2_config_get_string(config, utils, key, algs_str);
+        if (oauth2_config_parse_list(config, utils, own, &policy->allowed_algs) != SASL_OK) {
+            return SASL_NOMEM;
+        }
+        
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_CLAIM_POLICY);
+        own = oauth2_config_get_string(config, utils, key, claims_str);
+        result = oauth2_claim_policy_compile(utils, &config->strings, own, &policy->claims);
+        if (result != SASL_OK) {
+            return result;
+        }
+        
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_USER_CLAIM);
+        policy->user_claim = oauth2_config_get_string(config, utils, key, config->user_claim);
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_USER_TRANSFORM);
+        own = oauth2_config_get_string(config, utils, key, transform_str);
+        result = oauth2_user_map_compile(utils, &config->strings, policy->user_claim, own, &policy->user_map);
+        if (result != SASL_OK) {
+            return result;
+        }
+        
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_INTROSPECTION_CACHE_TTL);
+        policy->introspection_cache_ttl = oauth2_config_get_int(config, utils, key,
+                                                                config->introspection_cache_ttl);
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_USERINFO_CACHE_TTL);
+        policy->userinfo_cache_ttl = oauth2_config_get_int(config, utils, key, config->userinfo_cache_ttl);
+        if (policy->introspection_cache_ttl < 0) {
+            policy->introspection_cache_ttl = 0;
+        }
+        if (policy->userinfo_cache_ttl < 0) {
+            policy->userinfo_cache_ttl = 0;
+        }
+    }
+    return SASL_OK;
+}
+
+/* Index the configured issuers: open addressing, at least twice as many slots as providers */
+static int oauth2_config_index_issuers(oauth2_config_t *config, const sasl_utils_t *utils) {
+    size_t slots_count = 4;
+    while (slots_count < (size_t)config->providers_count * 2) {
+        slots_count *= 2;
+    }
+    config->issuer_slots = calloc(slots_count, sizeof(uint32_t));
+    if (!config->issuer_slots) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for the issuer index");
+        return SASL_NOMEM;
+    }
+    config->issuer_slots_count = slots_count;
+    
+    for (int i = 0; i < config->providers_count; i++) {
+        const char *issuer = config->providers[i].issuer;
+        if (!issuer) {
+            continue;
+        }
+        size_t slot = oauth2_string_hash(issuer, strlen(issuer)) & (slots_count - 1);
+        while (config->issuer_slots[slot] != 0 &&
+               strcmp(config->providers[config->issuer_slots[slot] - 1].issuer, issuer) != 0) {
+            slot = (slot + 1) & (slots_count - 1);
+        }
+        /* The first provider of a repeated issuer keeps it, as with a linear scan */
+        if (config->issuer_slots[slot] == 0) {
+            config->issuer_slots[slot] = (uint32_t)i + 1;
+        }
+    }
+    return SASL_OK;
+}
+
+/* Build the provider registry: one provider per discovery URL, with local or fetched keys */
+static int oauth2_config_build_providers(oauth2_config_t *config, const sasl_utils_t *utils,
+                                         oauth2_config_t *previous) {
+    config->providers = calloc((size_t)config->discovery_urls.count, sizeof(oauth2_provider_t));
+    if (!config->providers && config->discovery_urls.count > 0) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for provider registry");
+        return SASL_NOMEM;
+    }
+    config->providers_count = config->discovery_urls.count;
+    
+    /* Issuers are positional only when they line up with the discovery URLs */
+    int issuers_positional = (config->issuers.count == config->discovery_urls.count);
+    int local_providers = 0, introspection_providers = 0;
+    
+    for (int i = 0; i < config->providers_count; i++) {
+        oauth2_provider_t *provider = &config->providers[i];
+        provider->discovery_url = oauth2_config_list_item(config, &config->discovery_urls, i);
+        provider->issuer = issuers_positional ? oauth2_config_list_item(config, &config->issuers, i) : NULL;
+        provider->policy = &config->policies[i];
+        oauth2_provider_init(provider);
+        const char *options = provider->policy->audiences.count > 0 ? "verify.aud=required" : NULL;
+        
+        /* The provider's own mode, else a single mode for every provider, else one per provider */
+        char key[128];
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_TOKEN_VALIDATION);
+        const char *mode = oauth2_config_get_value(config, utils, key);
+        mode = mode ? mode : config->token_validation.count == 1 ?
+                           oauth2_config_list_item(config, &config->token_validation, 0) :
+                           i < config->token_validation.count ?
+                           oauth2_config_list_item(config, &config->token_validation, i) :
+                           OAUTH2_VALIDATION_JWT;
+        if (strcmp(mode, OAUTH2_VALIDATION_INTROSPECTION) == 0) {
+            provider->introspection = 1;
+            introspection_providers++;
+        } else if (strcmp(mode, OAUTH2_VALIDATION_JWT) != 0) {
+            OAUTH2_LOG_ERR(utils, "Invalid %s value '%s' (use %s or %s)",
+                           key[0] ? key : OAUTH2_CONF_TOKEN_VALIDATION, mode, OAUTH2_VALIDATION_JWT, OAUTH2_VALIDATION_INTROSPECTION);
+            return SASL_FAIL;
+        }
+        
+        /* Collect this provider's JWKS and PEM files (comma-separated within an entry) */
+        char *files[16];
+        int files_count = 0;
+        int result = SASL_OK;
+        if (i < config->jwks_files.count) {
+            result = oauth2_config_collect_key_files(oauth2_config_list_item(config, &config->jwks_files, i),
+                                                     files, &files_count, 16);
+        }
+        if (result == SASL_OK && i < config->public_key_files.count) {
+            result = oauth2_config_collect_key_files(oauth2_config_list_item(config, &config->public_key_files, i),
+                                                     files, &files_count, 16);
+        }
+        
+        /* Without files the store starts empty and is filled from the provider's JWKS */
+        if (result == SASL_OK) {
+            provider->keys = oauth2_key_store_create(utils, config->oauth2_log, files, files_count,
+                                                     options, config->key_reload_interval);
+            if (!provider->keys) {
+                result = SASL_NOMEM;
+            }
+            provider->local_keys = files_count > 0;
+            local_providers += provider->local_keys;
+        }
+        
+        for (int j = 0; j < files_count; j++) {
+            free(files[j]);
+        }
+        if (result != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "Failed to set up keys for provider %d", i);
+            return result;
+        }
+        if (provider->local_keys && provider->introspection) {
+            OAUTH2_LOG_ERR(utils, "Provider %d cannot use both local key files and introspection", i);
+            return SASL_FAIL;
+        }
+
+        /* The global list only describes a lone provider: origins differ from one IdP to the next */
+        oauth2_config_provider_key(config, key, sizeof(key), i, OAUTH2_CONF_MIRRORS);
+        const char *mirrors = oauth2_config_get_value(config, utils, key);
+        if (!mirrors && config->providers_count == 1) {
+            mirrors = oauth2_config_get_value(config, utils, OAUTH2_CONF_MIRRORS);
+        }
+        if (mirrors && provider->local_keys) {
+            OAUTH2_LOG_ERR(utils, "Provider %d has local key files, %s does not apply", i,
+                           key[0] ? key : OAUTH2_CONF_MIRRORS);
+            return SASL_FAIL;
+        }
+        result = oauth2_mirror_setup(utils, provider, mirrors);
+        if (result != SASL_OK) {
+            return result == SASL_NOMEM ? SASL_NOMEM : SASL_FAIL;
+        }
+    }
+
+    if (config->providers_count > 1 && oauth2_config_get_value(config, utils, OAUTH2_CONF_MIRRORS)) {
+        OAUTH2_LOG_ERR(utils, "%s needs a single provider, use %s<N>_mirrors", OAUTH2_CONF_MIRRORS,
+                       OAUTH2_CONF_PROVIDER_PREFIX);
+        return SASL_FAIL;
+    }
+    
+    if (oauth2_config_index_issuers(config, utils) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+    
+    /* Tokens are routed to local keys by their issuer */
+    if (local_providers > 0 && config->providers_count > 1 && !issuers_positional) {
+        OAUTH2_LOG_ERR(utils, "Local key files with several providers require %s in the same order as %s",
+                       OAUTH2_CONF_ISSUERS, OAUTH2_CONF_DISCOVERY_URLS);
+        return SASL_FAIL;
+    }
+    
+    if (local_providers > 0) {
+        OAUTH2_LOG_INFO(utils, "%d of %d providers use local key files", 
+                        local_providers, config->providers_count);
+    }
+    
+    /* On reload, unchanged providers keep their documents, keys and breaker state */
+    for (int i = 0; previous && i < config->providers_count; i++) {
+        oauth2_provider_t *same = oauth2_config_same_provider(previous, &config->providers[i]);
+        if (same && oauth2_provider_inherit(utils, &config->providers[i], same) != SASL_OK) {
+            OAUTH2_LOG_WARN(utils, "Cannot keep cached state of %s, it will be fetched again",
+                            config->providers[i].discovery_url);
+        }
+    }
+    
+    /* Introspection authenticates the plugin as a confidential client */
+    if (introspection_providers > 0) {
+        if (!config->client_secret) {
+            OAUTH2_LOG_ERR(utils, "%s is required for token introspection", OAUTH2_CONF_CLIENT_SECRET);
+            return SASL_FAIL;
+        }
+        if (oauth2_claims_cache_resize(&config->introspection_cache,
+                                       config->introspection_cache_size) != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "Failed to allocate the introspection cache");
+            return SASL_NOMEM;
+        }
+        if (previous) {
+            oauth2_claims_cache_inherit(&config->introspection_cache, &previous->introspection_cache);
+        }
+        OAUTH2_LOG_INFO(utils, "%d of %d providers use token introspection (cache %d entries, ttl %ds)",
+                        introspection_providers, config->providers_count,
+                        config->introspection_cache.sets * OAUTH2_CLAIMS_WAYS, config->introspection_cache_ttl);
+    }
+    
+    /* Userinfo needs a network provider; local key files carry no endpoints */
+    if (config->userinfo_fallback &&
+        (local_providers < config->providers_count || config->tenants.templates_count > 0)) {
+        if (oauth2_claims_cache_resize(&config->userinfo_cache, config->userinfo_cache_size) != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "Failed to allocate the userinfo cache");
+            return SASL_NOMEM;
+        }
+        if (previous) {
+            oauth2_claims_cache_inherit(&config->userinfo_cache, &previous->userinfo_cache);
+        }
+        OAUTH2_LOG_INFO(utils, "Userinfo fallback enabled (cache %d entries, ttl %ds)",
+                        config->userinfo_cache.sets * OAUTH2_CLAIMS_WAYS, config->userinfo_cache_ttl);
+    }
+    
+    return SASL_OK;
+}
+
+oauth2_provider_t *oauth2_config_find_provider(oauth2_config_t *config, const char *issuer) {
+    if (!config || config->providers_count == 0) {
+        return NULL;
+    }
+    
+    /* A single provider needs no routing, unless tokens of other issuers may belong to tenants */
+    if (config->providers_count == 1 && config->tenants.templates_count == 0) {
+        return &config->providers[0];
+    }
+    
+    if (!issuer) {
+        return NULL;
+    }
+    
+    /* One hash, and a string comparison per colliding slot only */
+    if (config->issuer_slots) {
+        size_t mask = config->issuer_slots_count - 1;
+        size_t slot = oauth2_string_hash(issuer, strlen(issuer)) & mask;
+        for (uint32_t index; (index = config->issuer_slots[slot]) != 0; slot = (slot + 1) & mask) {
+            if (strcmp(config->providers[index - 1].issuer, issuer) == 0) {
+                return &config->providers[index - 1];
+            }
+        }
+    }
+    
+    /* Fall back to the issuer announced by discovery (warm start or refresh) */
+    for (int i = 0; i < config->providers_count; i++) {
+        const char *discovered = __atomic_load_n(&config->providers[i].discovered_issuer, __ATOMIC_ACQUIRE);
+        if (discovered && strcmp(discovered, issuer) == 0) {
+            return &config->providers[i];
+        }
+    }
+    return NULL;
+}
+
+static int oauth2_config_load_from(oauth2_config_t *config, const sasl_utils_t *utils,
+                                   oauth2_config_t *previous) {
     if (!config || !utils) {
         return SASL_BADPARAM;
     }
     
+    /* Settings of the dedicated configuration file take precedence and are reloaded on change */
+    config->config_file = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CONFIG_FILE, NULL);
+    if (config->config_file) {
+        int file_result = oauth2_config_read_file(config, utils, config->config_file);
+        if (file_result != SASL_OK) {
+            return file_result;
+        }
+    }
+    config->config_reload_interval = oauth2_config_get_int(config, utils, OAUTH2_CONF_CONFIG_RELOAD_INTERVAL,
+                                                           OAUTH2_DEFAULT_CONFIG_RELOAD_INTERVAL);
+    
     /* Loading OAuth2 configuration */
     
     /* Load OIDC Discovery settings - support multiple URLs/issuers */
-    const char *discovery_urls_str = oauth2_config_get_string(utils, OAUTH2_CONF_DISCOVERY_URLS, NULL);
-    const char *discovery_url_str = oauth2_config_get_string(utils, OAUTH2_CONF_DISCOVERY_URL, NULL);
-    const char *issuers_str = oauth2_config_get_string(utils, OAUTH2_CONF_ISSUERS, NULL);
-    const char *issuer_str = oauth2_config_get_string(utils, OAUTH2_CONF_ISSUER, NULL);
+    const char *discovery_urls_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_DISCOVERY_URLS, NULL);
+    const char *discovery_url_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_DISCOVERY_URL, NULL);
+    const char *issuers_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_ISSUERS, NULL);
+    const char *issuer_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_ISSUER, NULL);
     
     /* Log configuration input summary */
     OAUTH2_LOG_DEBUG(utils, "Reading OAuth2 configuration from SASL");
@@ -194,10 +943,9 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
     }
     
     /* Parse discovery URLs (priority: plural form, then singular) */
-    if (discovery_urls_str) {
-        config->discovery_urls = oauth2_parse_string_list(discovery_urls_str, &config->discovery_urls_count);
-    } else if (discovery_url_str) {
-        config->discovery_urls = oauth2_parse_string_list(discovery_url_str, &config->discovery_urls_count);
+    if (oauth2_config_parse_list(config, utils, discovery_urls_str ? discovery_urls_str : discovery_url_str,
+                                 &config->discovery_urls) != SASL_OK) {
+        return SASL_NOMEM;
     }
     
     /* Validate exclusive configuration for issuers */
@@ -208,58 +956,70 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
     }
     
     /* Parse issuers (priority: plural form, then singular) */
-    if (issuers_str) {
-        config->issuers = oauth2_parse_string_list(issuers_str, &config->issuers_count);
-    } else if (issuer_str) {
-        config->issuers = oauth2_parse_string_list(issuer_str, &config->issuers_count);
+    if (oauth2_config_parse_list(config, utils, issuers_str ? issuers_str : issuer_str,
+                                 &config->issuers) != SASL_OK) {
+        return SASL_NOMEM;
     }
     
-    /* Ensure we have at least one discovery URL or issuer */
-    if (!config->discovery_urls && !config->issuers) {
-        OAUTH2_LOG_ERR(utils, "Either %s/%s or %s/%s must be configured", 
+    /* Issuer patterns of multi-tenant IdPs, tenants loaded on first use */
+    const char *tenant_issuers_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_TENANT_ISSUERS, NULL);
+    int tenants_result = oauth2_tenant_table_compile(utils, &config->strings, tenant_issuers_str, &config->tenants);
+    if (tenants_result != SASL_OK) {
+        return tenants_result == SASL_NOMEM ? SASL_NOMEM : SASL_FAIL;
+    }
+    if (config->tenants.templates_count > 0) {
+        int memory = oauth2_config_get_int(config, utils, OAUTH2_CONF_TENANT_CACHE_MEMORY,
+                                           OAUTH2_DEFAULT_TENANT_CACHE_MEMORY);
+        config->tenants.max_bytes = (size_t)(memory > 0 ? memory : 1) * 1024 * 1024;
+        config->tenants.idle_timeout = oauth2_config_get_int(config, utils, OAUTH2_CONF_TENANT_IDLE_TIMEOUT,
+                                                             OAUTH2_DEFAULT_TENANT_IDLE_TIMEOUT);
+        if (config->tenants.idle_timeout < 0) {
+            config->tenants.idle_timeout = 0;
+        }
+        OAUTH2_LOG_INFO(utils, "%d tenant issuer patterns (cache %d MiB, idle timeout %ds)",
+                        config->tenants.templates_count, memory > 0 ? memory : 1, config->tenants.idle_timeout);
+    }
+    
+    /* Ensure we have at least one discovery URL, issuer or issuer pattern */
+    if (config->discovery_urls.count == 0 && config->issuers.count == 0 && config->tenants.templates_count == 0) {
+        OAUTH2_LOG_ERR(utils, "Either %s/%s, %s/%s or %s must be configured", 
                       OAUTH2_CONF_DISCOVERY_URLS, OAUTH2_CONF_DISCOVERY_URL,
-                      OAUTH2_CONF_ISSUERS, OAUTH2_CONF_ISSUER);
+                      OAUTH2_CONF_ISSUERS, OAUTH2_CONF_ISSUER, OAUTH2_CONF_TENANT_ISSUERS);
         return SASL_FAIL;
     }
     
-    /* If only issuers provided, construct discovery URLs */
-    if (!config->discovery_urls && config->issuers) {
-        config->discovery_urls = malloc(config->issuers_count * sizeof(char*));
-        if (!config->discovery_urls) {
+    /* If only issuers provided, construct discovery URLs, interned next to the issuers */
+    if (config->discovery_urls.count == 0) {
+        static const char suffix[] = "/.well-known/openid-configuration";
+        if (oauth2_string_list_alloc(&config->discovery_urls, config->issuers.count) != SASL_OK) {
             OAUTH2_LOG_ERR(utils, "Failed to allocate memory for discovery URLs");
             return SASL_NOMEM;
         }
         
-        config->discovery_urls_count = config->issuers_count;
-        for (int i = 0; i < config->issuers_count; i++) {
+        for (int i = 0; i < config->issuers.count; i++) {
             /* Ensure issuer doesn't end with slash */
-            char *clean_issuer = strdup(config->issuers[i]);
-            size_t issuer_len = strlen(clean_issuer);
-            if (issuer_len > 0 && clean_issuer[issuer_len - 1] == '/') {
-                clean_issuer[issuer_len - 1] = '\0';
+            size_t issuer_len = config->issuers.lengths[i];
+            if (issuer_len > 0 && oauth2_config_list_item(config, &config->issuers, i)[issuer_len - 1] == '/') {
+                issuer_len--;
             }
             
-            size_t len = strlen(clean_issuer) + strlen("/.well-known/openid-configuration") + 1;
-            config->discovery_urls[i] = malloc(len);
-            if (!config->discovery_urls[i]) {
+            oauth2_string_pool_t *pool = &config->strings;
+            uint32_t offset = OAUTH2_STRING_NONE;
+            if (oauth2_string_pool_reserve(pool, issuer_len + sizeof(suffix) - 1) == SASL_OK) {
+                memcpy(pool->data + pool->len, oauth2_config_list_item(config, &config->issuers, i), issuer_len);
+                memcpy(pool->data + pool->len + issuer_len, suffix, sizeof(suffix) - 1);
+                offset = oauth2_string_pool_commit(pool, issuer_len + sizeof(suffix) - 1);
+            }
+            if (oauth2_string_list_add(pool, &config->discovery_urls, offset) != SASL_OK) {
                 OAUTH2_LOG_ERR(utils, "Failed to allocate memory for discovery URL %d", i);
-                /* Cleanup partial allocation */
-                for (int j = 0; j < i; j++) {
-                    free(config->discovery_urls[j]);
-                }
-                free(config->discovery_urls);
-                free(clean_issuer);
                 return SASL_NOMEM;
             }
-            
-            snprintf(config->discovery_urls[i], len, "%s/.well-known/openid-configuration", clean_issuer);
-            free(clean_issuer);
         }
     }
     
     /* Load client credentials */
-    config->client_id = (char*)oauth2_config_get_string(utils, OAUTH2_CONF_CLIENT_ID, NULL);
-    config->client_secret = (char*)oauth2_config_get_string(utils, OAUTH2_CONF_CLIENT_SECRET, NULL);
+    config->client_id = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_ID, NULL);
+    config->client_secret = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_SECRET, NULL);
     
     if (!config->client_id) {
         OAUTH2_LOG_ERR(utils, "%s must be configured", OAUTH2_CONF_CLIENT_ID);
@@ -267,8 +1027,8 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
     }
     
     /* Load token validation settings - support multiple audiences */
-    const char *audiences_str = oauth2_config_get_string(utils, OAUTH2_CONF_AUDIENCES, NULL);
-    const char *audience_str = oauth2_config_get_string(utils, OAUTH2_CONF_AUDIENCE, NULL);
+    const char *audiences_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_AUDIENCES, NULL);
+    const char *audience_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_AUDIENCE, NULL);
     
     /* Log key configuration loaded */
     OAUTH2_LOG_DEBUG(utils, "Client ID configured: %s", config->client_id ? config->client_id : "N/A");
@@ -281,20 +1041,46 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
     }
     
     /* Parse audiences (priority: plural form, then singular) */
-    if (audiences_str) {
-        config->audiences = oauth2_parse_string_list(audiences_str, &config->audiences_count);
-    } else if (audience_str) {
-        config->audiences = oauth2_parse_string_list(audience_str, &config->audiences_count);
+    if (oauth2_config_parse_list(config, utils, audiences_str ? audiences_str : audience_str,
+                                 &config->audiences) != SASL_OK) {
+        return SASL_NOMEM;
     }
     
-    config->scope = (char*)oauth2_config_get_string(utils, OAUTH2_CONF_SCOPE, OAUTH2_DEFAULT_SCOPE);
-    config->user_claim = (char*)oauth2_config_get_string(utils, OAUTH2_CONF_USER_CLAIM, OAUTH2_DEFAULT_USER_CLAIM);
-    config->verify_signature = oauth2_config_get_bool(utils, OAUTH2_CONF_VERIFY_SIGNATURE, OAUTH2_DEFAULT_VERIFY_SIGNATURE);
+    config->scope = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_SCOPE, OAUTH2_DEFAULT_SCOPE);
+    config->user_claim = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_USER_CLAIM, OAUTH2_DEFAULT_USER_CLAIM);
+    if (oauth2_config_parse_list(config, utils, oauth2_config_get_string(config, utils, OAUTH2_CONF_ALLOWED_ALGS, NULL),
+                                 &config->allowed_algs) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+    config->verify_signature = oauth2_config_get_bool(config, utils, OAUTH2_CONF_VERIFY_SIGNATURE, OAUTH2_DEFAULT_VERIFY_SIGNATURE);
     
     /* Load network settings */
-    config->ssl_verify = oauth2_config_get_bool(utils, OAUTH2_CONF_SSL_VERIFY, OAUTH2_DEFAULT_SSL_VERIFY);
-    config->timeout = oauth2_config_get_int(utils, OAUTH2_CONF_TIMEOUT, OAUTH2_DEFAULT_TIMEOUT);
-    config->debug = oauth2_config_get_bool(utils, OAUTH2_CONF_DEBUG, OAUTH2_DEFAULT_DEBUG);
+    config->ssl_verify = oauth2_config_get_bool(config, utils, OAUTH2_CONF_SSL_VERIFY, OAUTH2_DEFAULT_SSL_VERIFY);
+    config->timeout = oauth2_config_get_int(config, utils, OAUTH2_CONF_TIMEOUT, OAUTH2_DEFAULT_TIMEOUT);
+    if (config->timeout <= 0) {
+        config->timeout = OAUTH2_DEFAULT_TIMEOUT;
+    }
+    
+    /* Adaptive timeouts: a percentile of each endpoint's latency, between the floor and oauth2_timeout */
+    int percentile = oauth2_config_get_int(config, utils, OAUTH2_CONF_TIMEOUT_PERCENTILE,
+                                           OAUTH2_DEFAULT_TIMEOUT_PERCENTILE);
+    if (percentile > 0) {
+        int multiplier = oauth2_config_get_int(config, utils, OAUTH2_CONF_TIMEOUT_MULTIPLIER,
+                                               OAUTH2_DEFAULT_TIMEOUT_MULTIPLIER);
+        long floor_ms = oauth2_config_get_int(config, utils, OAUTH2_CONF_TIMEOUT_FLOOR_MS,
+                                              OAUTH2_DEFAULT_TIMEOUT_FLOOR_MS);
+        long max_ms = config->timeout * 1000L;
+        config->latency = oauth2_latency_create(percentile < 100 ? percentile : 100, multiplier > 1 ? multiplier : 1,
+                                                floor_ms < 1 ? 1 : floor_ms > max_ms ? max_ms : floor_ms, max_ms);
+        if (!config->latency) {
+            OAUTH2_LOG_ERR(utils, "Failed to allocate the latency digests");
+            return SASL_NOMEM;
+        }
+        if (previous) {
+            oauth2_latency_inherit(config->latency, previous->latency);
+        }
+    }
+    config->debug = oauth2_config_get_bool(config, utils, OAUTH2_CONF_DEBUG, OAUTH2_DEFAULT_DEBUG);
     
     /* Adjust liboauth2 log level based on debug setting */
     if (config->oauth2_log) {
@@ -303,15 +1089,203 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
         oauth2_log_sink_level_set(&oauth2_log_sink_stderr, log_level);
     }
     
+    /* Load local key sources - one entry per provider, "-" keeps network fetching */
+    const char *jwks_files_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_JWKS_FILES, NULL);
+    const char *jwks_file_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_JWKS_FILE, NULL);
+    const char *public_key_files_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_PUBLIC_KEY_FILES, NULL);
+    
+    if (jwks_files_str && jwks_file_str) {
+        OAUTH2_LOG_ERR(utils, "Cannot configure both %s and %s - use only one form", 
+                      OAUTH2_CONF_JWKS_FILES, OAUTH2_CONF_JWKS_FILE);
+        return SASL_FAIL;
+    }
+    
+    if (oauth2_config_parse_list(config, utils, jwks_files_str ? jwks_files_str : jwks_file_str,
+                                 &config->jwks_files) != SASL_OK ||
+        oauth2_config_parse_list(config, utils, public_key_files_str, &config->public_key_files) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+    
+    if ((config->jwks_files.count > 0 && config->jwks_files.count != config->discovery_urls.count) ||
+        (config->public_key_files.count > 0 && config->public_key_files.count != config->discovery_urls.count)) {
+        OAUTH2_LOG_ERR(utils, "%s and %s need one entry per provider (use %s for network keys)",
+                      OAUTH2_CONF_JWKS_FILES, OAUTH2_CONF_PUBLIC_KEY_FILES, OAUTH2_KEY_FILE_NONE);
+        return SASL_FAIL;
+    }
+    
+    config->key_reload_interval = oauth2_config_get_int(config, utils, OAUTH2_CONF_KEY_RELOAD_INTERVAL, 
+                                                        OAUTH2_DEFAULT_KEY_RELOAD_INTERVAL);
+    
+    /* Load local revocation list, reloaded like key files */
+    const char *revocation_file = oauth2_config_get_string(config, utils, OAUTH2_CONF_REVOCATION_FILE, NULL);
+    if (revocation_file) {
+        config->revocation = oauth2_revocation_list_create(utils, revocation_file, config->key_reload_interval,
+                                                           previous ? previous->revocation : NULL);
+        if (!config->revocation) {
+            /* Accepting every token while a configured list is unusable would undo the revocations */
+            OAUTH2_LOG_ERR(utils, "Failed to set up %s %s", OAUTH2_CONF_REVOCATION_FILE, revocation_file);
+            return SASL_FAIL;
+        }
+    }
+    
+    /* Load warm start state directory (disabled unless configured) */
+    config->state_dir = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_STATE_DIR, NULL);
+    if (config->state_dir && access(config->state_dir, W_OK) != 0) {
+        OAUTH2_LOG_WARN(utils, "%s %s is not writable, provider state will not be persisted",
+                        OAUTH2_CONF_STATE_DIR, config->state_dir);
+    }
+    config->utils = utils;
+    
+    /* Load bounds for IdP cache lifetimes (Cache-Control/Expires) */
+    config->refresh_min_interval = oauth2_config_get_int(config, utils, OAUTH2_CONF_REFRESH_MIN_INTERVAL,
+                                                         OAUTH2_DEFAULT_REFRESH_MIN_INTERVAL);
+    config->refresh_max_interval = oauth2_config_get_int(config, utils, OAUTH2_CONF_REFRESH_MAX_INTERVAL,
+                                                         OAUTH2_DEFAULT_REFRESH_MAX_INTERVAL);
+    if (config->refresh_min_interval < 0) {
+        config->refresh_min_interval = 0;
+    }
+    if (config->refresh_max_interval < config->refresh_min_interval) {
+        OAUTH2_LOG_WARN(utils, "%s is below %s, using %d", OAUTH2_CONF_REFRESH_MAX_INTERVAL,
+                        OAUTH2_CONF_REFRESH_MIN_INTERVAL, config->refresh_min_interval);
+        config->refresh_max_interval = config->refresh_min_interval;
+    }
+    
+    /* Load circuit breaker settings */
+    config->breaker_threshold = oauth2_config_get_int(config, utils, OAUTH2_CONF_BREAKER_THRESHOLD,
+                                                      OAUTH2_DEFAULT_BREAKER_THRESHOLD);
+    config->breaker_cooldown = oauth2_config_get_int(config, utils, OAUTH2_CONF_BREAKER_COOLDOWN,
+                                                     OAUTH2_DEFAULT_BREAKER_COOLDOWN);
+    if (config->breaker_cooldown < 1) {
+        config->breaker_cooldown = 1;
+    }
+    
+    config->warmup_timeout = oauth2_config_get_int(config, utils, OAUTH2_CONF_WARMUP_TIMEOUT,
+                                                   OAUTH2_DEFAULT_WARMUP_TIMEOUT);
+    
+    /* Load token validation modes - one per provider, or one for all */
+    const char *token_validation_str = oauth2_config_get_string(config, utils, OAUTH2_CONF_TOKEN_VALIDATION, NULL);
+    if (oauth2_config_parse_list(config, utils, token_validation_str, &config->token_validation) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+    if (config->token_validation.count > 1 && config->token_validation.count != config->discovery_urls.count) {
+        OAUTH2_LOG_ERR(utils, "%s needs one entry, or one entry per provider", OAUTH2_CONF_TOKEN_VALIDATION);
+        return SASL_FAIL;
+    }
+    config->introspection_cache_ttl = oauth2_config_get_int(config, utils, OAUTH2_CONF_INTROSPECTION_CACHE_TTL,
+                                                            OAUTH2_DEFAULT_INTROSPECTION_CACHE_TTL);
+    config->introspection_cache_size = oauth2_config_get_int(config, utils, OAUTH2_CONF_INTROSPECTION_CACHE_SIZE,
+                                                             OAUTH2_DEFAULT_INTROSPECTION_CACHE_SIZE);
+    if (config->introspection_cache_ttl < 0) {
+        config->introspection_cache_ttl = 0;
+    }
+    
+    /* Load userinfo fallback for user claims missing from tokens */
+    config->userinfo_fallback = oauth2_config_get_bool(config, utils, OAUTH2_CONF_USERINFO_FALLBACK,
+                                                       OAUTH2_DEFAULT_USERINFO_FALLBACK);
+    config->userinfo_cache_ttl = oauth2_config_get_int(config, utils, OAUTH2_CONF_USERINFO_CACHE_TTL,
+                                                       OAUTH2_DEFAULT_USERINFO_CACHE_TTL);
+    config->userinfo_cache_size = oauth2_config_get_int(config, utils, OAUTH2_CONF_USERINFO_CACHE_SIZE,
+                                                        OAUTH2_DEFAULT_USERINFO_CACHE_SIZE);
+    if (config->userinfo_cache_ttl < 0) {
+        config->userinfo_cache_ttl = 0;
+    }
+    
+    config->context_pool_size = oauth2_config_get_int(config, utils, OAUTH2_CONF_CONTEXT_POOL_SIZE,
+                                                      OAUTH2_DEFAULT_CONTEXT_POOL_SIZE);
+    if (config->context_pool_size < 0) {
+        config->context_pool_size = 0;
+    }
+    
+    /* Admission control of failed logins per source prefix; the table is process-wide, sized once */
+    config->admission_burst = oauth2_config_get_int(config, utils, OAUTH2_CONF_ADMISSION_BURST,
+                                                    OAUTH2_DEFAULT_ADMISSION_BURST);
+    if (config->admission_burst < 0 || config->admission_burst > OAUTH2_ADMISSION_MAX_BURST) {
+        config->admission_burst = config->admission_burst < 0 ? 0 : OAUTH2_ADMISSION_MAX_BURST;
+    }
+    config->admission_rate = oauth2_config_get_int(config, utils, OAUTH2_CONF_ADMISSION_RATE,
+                                                   OAUTH2_DEFAULT_ADMISSION_RATE);
+    if (config->admission_rate < 1) {
+        config->admission_rate = 1;
+    }
+    config->admission_ipv4_prefix = oauth2_config_get_int(config, utils, OAUTH2_CONF_ADMISSION_IPV4_PREFIX,
+                                                          OAUTH2_DEFAULT_ADMISSION_IPV4_PREFIX);
+    config->admission_ipv6_prefix = oauth2_config_get_int(config, utils, OAUTH2_CONF_ADMISSION_IPV6_PREFIX,
+                                                          OAUTH2_DEFAULT_ADMISSION_IPV6_PREFIX);
+    if (config->admission_ipv4_prefix < 0 || config->admission_ipv4_prefix > 32 ||
+        config->admission_ipv6_prefix < 0 || config->admission_ipv6_prefix > 128) {
+        OAUTH2_LOG_ERR(utils, "%s must be 0 to 32 and %s 0 to 128", OAUTH2_CONF_ADMISSION_IPV4_PREFIX,
+                       OAUTH2_CONF_ADMISSION_IPV6_PREFIX);
+        return SASL_FAIL;
+    }
+    if (config->admission_burst > 0 &&
+        oauth2_admission_setup(utils, oauth2_config_get_int(config, utils, OAUTH2_CONF_ADMISSION_ENTRIES,
+                                                            OAUTH2_DEFAULT_ADMISSION_ENTRIES),
+                               oauth2_config_get_string(config, utils, OAUTH2_CONF_ADMISSION_FILE, NULL)) != SASL_OK) {
+        return SASL_NOMEM;
+    }
+    
+    /* Client token acquisition, used by the client mechanisms only */
+    config->client_user = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_USER, NULL);
+    config->client_grant = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_GRANT, NULL);
+    config->client_refresh_token = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_REFRESH_TOKEN, NULL);
+    config->client_refresh_margin = oauth2_config_get_int(config, utils, OAUTH2_CONF_CLIENT_REFRESH_MARGIN,
+                                                          OAUTH2_DEFAULT_CLIENT_REFRESH_MARGIN);
+    if (config->client_refresh_margin < 0) {
+        config->client_refresh_margin = 0;
+    }
+    config->client_token_helper = (char*)oauth2_config_get_string(config, utils, OAUTH2_CONF_CLIENT_TOKEN_HELPER, NULL);
+    if (config->client_token_helper && !config->client_grant) {
+        config->client_grant = OAUTH2_GRANT_HELPER;
+    }
+    if (config->client_grant) {
+        if (strcmp(config->client_grant, OAUTH2_GRANT_REFRESH_TOKEN) == 0) {
+            if (!config->client_refresh_token) {
+                OAUTH2_LOG_ERR(utils, "%s is required for %s %s", OAUTH2_CONF_CLIENT_REFRESH_TOKEN,
+                               OAUTH2_CONF_CLIENT_GRANT, OAUTH2_GRANT_REFRESH_TOKEN);
+                return SASL_FAIL;
+            }
+        } else if (strcmp(config->client_grant, OAUTH2_GRANT_CLIENT_CREDENTIALS) == 0) {
+            if (!config->client_secret) {
+                OAUTH2_LOG_ERR(utils, "%s is required for %s %s", OAUTH2_CONF_CLIENT_SECRET,
+                               OAUTH2_CONF_CLIENT_GRANT, OAUTH2_GRANT_CLIENT_CREDENTIALS);
+                return SASL_FAIL;
+            }
+        } else if (strcmp(config->client_grant, OAUTH2_GRANT_HELPER) == 0) {
+            if (!config->client_token_helper) {
+                OAUTH2_LOG_ERR(utils, "%s is required for %s %s", OAUTH2_CONF_CLIENT_TOKEN_HELPER,
+                               OAUTH2_CONF_CLIENT_GRANT, OAUTH2_GRANT_HELPER);
+                return SASL_FAIL;
+            }
+        } else {
+            OAUTH2_LOG_ERR(utils, "Invalid %s: %s (expected %s, %s or %s)", OAUTH2_CONF_CLIENT_GRANT,
+                           config->client_grant, OAUTH2_GRANT_REFRESH_TOKEN, OAUTH2_GRANT_CLIENT_CREDENTIALS,
+                           OAUTH2_GRANT_HELPER);
+            return SASL_FAIL;
+        }
+    }
+    
+    int policies_result = oauth2_config_compile_policies(config, utils);
+    if (policies_result != SASL_OK) {
+        return policies_result;
+    }
+    
+    /* Every list is parsed: providers point into the pool, which no longer moves */
+    oauth2_string_pool_seal(&config->strings);
+    
+    int providers_result = oauth2_config_build_providers(config, utils, previous);
+    if (providers_result != SASL_OK) {
+        return providers_result;
+    }
+    
     /* Network settings configured */
-    OAUTH2_LOG_DEBUG(utils, "Network: SSL verify=%s, timeout=%ds, debug=%s",
-                     config->ssl_verify ? "yes" : "no", config->timeout,
+    OAUTH2_LOG_DEBUG(utils, "Network: SSL verify=%s, timeout=%ds (adaptive: %s), debug=%s",
+                     config->ssl_verify ? "yes" : "no", config->timeout, config->latency ? "yes" : "no",
                      config->debug ? "yes" : "no");
     
     /* Log configuration summary */
     OAUTH2_LOG_INFO(utils, "OAuth2 configuration loaded: %d providers, %d audiences", 
-                   config->discovery_urls_count, 
-                   config->audiences_count);
+                   config->discovery_urls.count, 
+                   config->audiences.count);
     
     /* Log essential configuration at DEBUG level */
     OAUTH2_LOG_DEBUG(utils, "User claim: %s, signature verification: %s", 
@@ -319,4 +1293,153 @@ int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
                      config->verify_signature ? "enabled" : "disabled");
     
     return SASL_OK;
-}
\ No newline at end of file
+}
+
+int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils) {
+    return oauth2_config_load_from(config, utils, NULL);
+}
+
+oauth2_config_t *oauth2_config_rebuild(const sasl_utils_t *utils, oauth2_config_t *previous) {
+    oauth2_config_t *config = oauth2_config_init(utils);
+    if (!config) {
+        return NULL;
+    }
+    
+    if (oauth2_config_load_from(config, utils, previous) != SASL_OK) {
+        oauth2_config_release(config);
+        return NULL;
+    }
+    
+    /* New providers start from persisted state, then whatever is missing is fetched before the swap */
+    for (int i = 0; i < config->providers_count; i++) {
+        if (!oauth2_config_same_provider(previous, &config->providers[i])) {
+            oauth2_provider_warm_start(utils, config, &config->providers[i]);
+        }
+    }
+    oauth2_provider_warmup(utils, config, config->warmup_timeout);
+    
+    return config;
+}
+
+int oauth2_config_watch(oauth2_config_holder_t *holder, const sasl_utils_t *utils) {
+    if (!holder || !utils) {
+        return SASL_BADPARAM;
+    }
+    
+    oauth2_config_t *config = oauth2_config_acquire(holder);
+    int result = SASL_OK;
+    
+    pthread_mutex_lock(&holder->watch_lock);
+    if (config && config->config_file && !holder->watch.path) {
+        holder->utils = utils;
+        holder->watch_pid = getpid();
+        result = oauth2_file_watch_init(&holder->watch, config->config_file, config->config_reload_interval);
+        if (result == SASL_OK) {
+            OAUTH2_LOG_INFO(utils, "Watching %s for configuration changes", config->config_file);
+        }
+    }
+    pthread_mutex_unlock(&holder->watch_lock);
+    
+    oauth2_config_release(config);
+    return result;
+}
+
+void oauth2_config_unwatch(oauth2_config_holder_t *holder) {
+    if (!holder) return;
+    
+    pthread_mutex_lock(&holder->watch_lock);
+    oauth2_file_watch_free(&holder->watch);
+    pthread_mutex_unlock(&holder->watch_lock);
+    
+    /* A running reload publishes into the holder: let it finish */
+    while (__atomic_load_n(&holder->reloading, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+int oauth2_config_reload(oauth2_config_holder_t *holder, const sasl_utils_t *utils) {
+    if (!holder || !utils) {
+        return SASL_BADPARAM;
+    }
+    
+    oauth2_config_t *previous = oauth2_config_acquire(holder);
+    if (!previous) {
+        return SASL_NOTDONE;
+    }
+    
+    long long started = oauth2_monotonic_ms();
+    oauth2_config_t *config = oauth2_config_rebuild(utils, previous);
+    if (!config) {
+        OAUTH2_LOG_WARN(utils, "Configuration reload failed, keeping the current configuration");
+        oauth2_config_release(previous);
+        return SASL_FAIL;
+    }
+    
+    int kept = 0;
+    for (int i = 0; i < config->providers_count; i++) {
+        kept += oauth2_config_same_provider(previous, &config->providers[i]) != NULL;
+    }
+    
+    /* Counters are process-wide: carry them over last, so that what the old
+     * snapshot counted during the rebuild and warmup is kept */
+    oauth2_metrics_carry(&config->metrics, &previous->metrics);
+    oauth2_config_publish(holder, config);
+    OAUTH2_LOG_INFO(utils, "Configuration reloaded in %lldms: %d providers, %d kept warm",
+                    oauth2_monotonic_ms() - started, config->providers_count, kept);
+    
+    oauth2_config_release(previous);
+    return SASL_OK;
+}
+
+/* Background reload; changes seen while it runs are picked up by another round */
+static void *oauth2_config_reloader(void *arg) {
+    oauth2_config_holder_t *holder = arg;
+    int idle;
+    
+    do {
+        __atomic_store_n(&holder->reload_pending, 0, __ATOMIC_RELEASE);
+        oauth2_config_reload(holder, holder->utils);
+        __atomic_store_n(&holder->reloading, 0, __ATOMIC_RELEASE);
+        idle = 0;
+    } while (__atomic_load_n(&holder->reload_pending, __ATOMIC_ACQUIRE) &&
+             __atomic_compare_exchange_n(&holder->reloading, &idle, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    
+    return NULL;
+}
+
+void oauth2_config_reload_check(oauth2_config_holder_t *holder) {
+    if (!holder || pthread_mutex_trylock(&holder->watch_lock) != 0) {
+        return;
+    }
+    
+    int changed = 0;
+    if (holder->watch.path) {
+        /* A watch inherited across fork shares its inotify queue with the parent and siblings */
+        pid_t pid = getpid();
+        if (holder->watch_pid != pid) {
+            holder->watch_pid = pid;
+            changed = oauth2_file_watch_rearm(&holder->watch);
+        }
+        changed |= oauth2_file_watch_changed(&holder->watch);
+    }
+    pthread_mutex_unlock(&holder->watch_lock);
+    if (!changed) {
+        return;
+    }
+    
+    /* Logins go on with the current snapshot while the new one is built */
+    __atomic_store_n(&holder->reload_pending, 1, __ATOMIC_RELEASE);
+    int idle = 0;
+    if (!__atomic_compare_exchange_n(&holder->reloading, &idle, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, oauth2_config_reloader, holder) != 0) {
+        oauth2_config_reloader(holder);
+    }
+    pthread_attr_destroy(&attr);
+}
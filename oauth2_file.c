@@ -0,0 +1,212 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Local File Sources
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Read-only memory mapping of local files and cheap change detection
+ * (inotify on Linux, mtime polling elsewhere) for key material and
+ * other file-backed plugin state.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+int oauth2_file_map(const char *path, oauth2_file_map_t *map) {
+    if (!path || !map) {
+        return SASL_BADPARAM;
+    }
+
+    memset(map, 0, sizeof(*map));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return SASL_FAIL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return SASL_FAIL;
+    }
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* The mapping keeps its own reference */
+    if (addr == MAP_FAILED) {
+        return SASL_FAIL;
+    }
+
+    map->data = addr;
+    map->len = (size_t)st.st_size;
+    return SASL_OK;
+}
+
+void oauth2_file_unmap(oauth2_file_map_t *map) {
+    if (!map || !map->data) return;
+
+    munmap((void*)map->data, map->len);
+    map->data = NULL;
+    map->len = 0;
+}
+
+#ifdef __APPLE__
+#define OAUTH2_ST_MTIM(st) ((st).st_mtimespec)
+#define OAUTH2_ST_CTIM(st) ((st).st_ctimespec)
+#else
+#define OAUTH2_ST_MTIM(st) ((st).st_mtim)
+#define OAUTH2_ST_CTIM(st) ((st).st_ctim)
+#endif
+
+static int oauth2_timespec_differs(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec != b->tv_sec || a->tv_nsec != b->tv_nsec;
+}
+
+/* Record the identity of the file currently at w->path. Timestamps are
+ * compared to the nanosecond and ctime is included, so an in-place rewrite
+ * of the same size within the same second is still seen as a change. */
+static int oauth2_file_watch_stat(oauth2_file_watch_t *w, int *changed) {
+    struct stat st;
+
+    *changed = 0;
+    if (stat(w->path, &st) != 0) {
+        /* A missing file is not a change: keep serving the last good copy */
+        return SASL_FAIL;
+    }
+
+    if (st.st_ino != w->ino || st.st_size != w->size ||
+        oauth2_timespec_differs(&OAUTH2_ST_MTIM(st), &w->mtime) ||
+        oauth2_timespec_differs(&OAUTH2_ST_CTIM(st), &w->ctime)) {
+        w->ino = st.st_ino;
+        w->mtime = OAUTH2_ST_MTIM(st);
+        w->ctime = OAUTH2_ST_CTIM(st);
+        w->size = st.st_size;
+        *changed = 1;
+    }
+    return SASL_OK;
+}
+
+/* Set up inotify for w->path, leaving polling in place when it is unavailable */
+static void oauth2_file_watch_arm(oauth2_file_watch_t *w) {
+    w->inotify_fd = -1;
+
+#ifdef __linux__
+    /* Watch the directory rather than the file so that atomic replacement
+     * (write to temp + rename) is seen as well as in-place rewrites */
+    const char *slash = strrchr(w->path, '/');
+    w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->inotify_fd >= 0) {
+        char *dir = slash ? strndup(w->path, (size_t)(slash - w->path)) : strdup(".");
+        int wd = -1;
+        if (dir) {
+            wd = inotify_add_watch(w->inotify_fd, dir[0] ? dir : "/",
+                                   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+            free(dir);
+        }
+        if (wd < 0) {
+            close(w->inotify_fd);
+            w->inotify_fd = -1;
+        }
+    }
+#endif
+}
+
+int oauth2_file_watch_init(oauth2_file_watch_t *w, const char *path, int interval) {
+    if (!w || !path) {
+        return SASL_BADPARAM;
+    }
+
+    memset(w, 0, sizeof(*w));
+    w->inotify_fd = -1;
+    w->interval = interval > 0 ? interval : 0;
+    w->path = strdup(path);
+    if (!w->path) {
+        return SASL_NOMEM;
+    }
+
+    const char *slash = strrchr(w->path, '/');
+    w->name = slash ? slash + 1 : w->path;
+
+    oauth2_file_watch_arm(w);
+
+    int changed;
+    (void)oauth2_file_watch_stat(w, &changed);
+    w->last_check = time(NULL);
+    return SASL_OK;
+}
+
+void oauth2_file_watch_free(oauth2_file_watch_t *w) {
+    if (!w) return;
+
+    if (w->inotify_fd >= 0) {
+        close(w->inotify_fd);
+    }
+    free(w->path);
+    memset(w, 0, sizeof(*w));
+    w->inotify_fd = -1;
+}
+
+int oauth2_file_watch_changed(oauth2_file_watch_t *w) {
+    if (!w || !w->path) return 0;
+
+#ifdef __linux__
+    if (w->inotify_fd >= 0) {
+        /* Drain pending events without blocking; only stat() when one names our file */
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        int relevant = 0;
+        ssize_t n;
+
+        while ((n = read(w->inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + n; ) {
+                struct inotify_event *ev = (struct inotify_event*)p;
+                if (ev->len > 0 && strcmp(ev->name, w->name) == 0) {
+                    relevant = 1;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+
+        if (!relevant) {
+            return 0;
+        }
+
+        int changed;
+        oauth2_file_watch_stat(w, &changed);
+        return changed;
+    }
+#endif
+
+    /* Polling fallback, rate limited to one stat() per interval */
+    time_t now = time(NULL);
+    if (w->interval > 0 && now - w->last_check < w->interval) {
+        return 0;
+    }
+    w->last_check = now;
+
+    int changed;
+    oauth2_file_watch_stat(w, &changed);
+    return changed;
+}
+
+int oauth2_file_watch_rearm(oauth2_file_watch_t *w) {
+    if (!w || !w->path) return 0;
+
+    if (w->inotify_fd >= 0) {
+        close(w->inotify_fd);
+    }
+    oauth2_file_watch_arm(w);
+
+    /* Events consumed elsewhere are lost: compare with the identity last seen instead */
+    int changed;
+    oauth2_file_watch_stat(w, &changed);
+    w->last_check = time(NULL);
+    return changed;
+}
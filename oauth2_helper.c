@@ -0,0 +1,283 @@
+/*
+ * OAuth2/OIDC SASL Plugin - External Token Helper
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Client tokens from a local agent instead of the token endpoint, for
+ * service accounts whose credentials the agent holds. A "unix:" helper is
+ * spoken to over one persistent connection: each request is a JSON line
+ * naming the user and issuer, each answer a single line. Any other helper
+ * is a command run through /bin/sh with OAUTH2_USER and OAUTH2_ISSUER in
+ * its environment, answering on its standard output. The answer is the
+ * token endpoint's JSON ("access_token", optionally "expires_in") or the
+ * bare token. The token cache of oauth2_tokens.c calls the helper once per
+ * token lifetime.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <jansson.h>
+
+extern char **environ;
+
+static struct {
+    pthread_mutex_t lock;           /* One request at a time on the connection */
+    int fd;                         /* Persistent connection, -1 when closed */
+    char *path;                     /* Socket it is connected to, a reload may name another one */
+    pid_t pid;                      /* A forked child opens its own connection */
+} oauth2_token_helper = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+/* Caller holds the lock */
+static void oauth2_token_helper_disconnect(void) {
+    if (oauth2_token_helper.fd >= 0) {
+        close(oauth2_token_helper.fd);
+    }
+    oauth2_token_helper.fd = -1;
+    free(oauth2_token_helper.path);
+    oauth2_token_helper.path = NULL;
+}
+
+/* Caller holds the lock */
+static int oauth2_token_helper_connect(const sasl_utils_t *utils, const char *path) {
+    if (oauth2_token_helper.pid != getpid()) {
+        /* Only this process's copy of the parent's descriptor is closed */
+        oauth2_token_helper_disconnect();
+        oauth2_token_helper.pid = getpid();
+    }
+    if (oauth2_token_helper.fd >= 0 && strcmp(oauth2_token_helper.path, path) == 0) {
+        return SASL_OK;
+    }
+    oauth2_token_helper_disconnect();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        OAUTH2_LOG_ERR(utils, "Token helper socket path too long: %s", path);
+        return SASL_BADPARAM;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        OAUTH2_LOG_WARN(utils, "Cannot connect to token helper %s: %s", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return SASL_UNAVAIL;
+    }
+    oauth2_token_helper.path = strdup(path);
+    if (!oauth2_token_helper.path) {
+        close(fd);
+        return SASL_NOMEM;
+    }
+    oauth2_token_helper.fd = fd;
+    return SASL_OK;
+}
+
+/*
+ * Read from fd into the secure buffer until EOF, or until a newline when
+ * line is set. Returns the number of bytes read, or -1 on error, overflow
+ * or when the deadline passes.
+ */
+static ssize_t oauth2_token_helper_read(int fd, char *buffer, size_t size, int line,
+                                        oauth2_deadline_t deadline) {
+    size_t len = 0;
+    for (;;) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        long remaining_ms = oauth2_deadline_remaining(deadline);
+        if (remaining_ms == 0) {
+            return -1;
+        }
+        int ready = poll(&pfd, 1, remaining_ms > 0 ? (int)remaining_ms : -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return -1;
+        }
+
+        ssize_t n = read(fd, buffer + len, size - 1 - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+        if (line && memchr(buffer + len - (size_t)n, '\n', (size_t)n)) {
+            break;
+        }
+        if (len == size - 1) {
+            return -1;
+        }
+    }
+    buffer[len] = '\0';
+    return (ssize_t)len;
+}
+
+static int oauth2_token_helper_socket(const sasl_utils_t *utils, const char *path, const char *issuer,
+                                      const char *user, oauth2_deadline_t deadline, char *buffer,
+                                      size_t size, size_t *len) {
+    json_t *request = json_pack("{s:s, s:s}", "user", user, "issuer", issuer);
+    char *line = request ? json_dumps(request, JSON_COMPACT) : NULL;
+    if (request) json_decref(request);
+    if (!line) {
+        return SASL_NOMEM;
+    }
+    size_t line_len = strlen(line);
+    line[line_len] = '\n';          /* Replaces the terminator, the length is known */
+
+    pthread_mutex_lock(&oauth2_token_helper.lock);
+    int result = SASL_UNAVAIL;
+    /* A helper restarted since the last request closed the connection: reconnect once */
+    for (int attempt = 0; attempt < 2 && result == SASL_UNAVAIL; attempt++) {
+        int reused = oauth2_token_helper.fd >= 0 && oauth2_token_helper.pid == getpid();
+        result = oauth2_token_helper_connect(utils, path);
+        if (result != SASL_OK) {
+            break;
+        }
+
+        ssize_t n = -1;
+        if (send(oauth2_token_helper.fd, line, line_len + 1, MSG_NOSIGNAL) == (ssize_t)(line_len + 1)) {
+            n = oauth2_token_helper_read(oauth2_token_helper.fd, buffer, size, 1, deadline);
+        }
+        if (n > 0 && buffer[n - 1] == '\n') {
+            *len = (size_t)n;
+            break;
+        }
+
+        /* A late answer would be taken for the next request's: never keep a connection out of step */
+        oauth2_token_helper_disconnect();
+        result = SASL_UNAVAIL;
+        if (!reused || oauth2_deadline_remaining(deadline) == 0) {
+            OAUTH2_LOG_WARN(utils, "Token helper %s did not answer", path);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&oauth2_token_helper.lock);
+
+    free(line);
+    return result;
+}
+
+static int oauth2_token_helper_command(const sasl_utils_t *utils, const char *command, const char *issuer,
+                                       const char *user, oauth2_deadline_t deadline, char *buffer,
+                                       size_t size, size_t *len) {
+    size_t environ_count = 0;
+    while (environ[environ_count]) environ_count++;
+
+    char **envp = calloc(environ_count + 3, sizeof(char*));
+    size_t user_len = strlen("OAUTH2_USER=") + strlen(user) + 1;
+    size_t issuer_len = strlen("OAUTH2_ISSUER=") + strlen(issuer) + 1;
+    char *user_env = malloc(user_len);
+    char *issuer_env = malloc(issuer_len);
+    int fds[2] = { -1, -1 };
+    int result = SASL_NOMEM;
+    if (!envp || !user_env || !issuer_env) {
+        goto done;
+    }
+    snprintf(user_env, user_len, "OAUTH2_USER=%s", user);
+    snprintf(issuer_env, issuer_len, "OAUTH2_ISSUER=%s", issuer);
+    size_t envc = 0;
+    for (size_t i = 0; i < environ_count; i++) {
+        if (strncmp(environ[i], "OAUTH2_USER=", 12) != 0 && strncmp(environ[i], "OAUTH2_ISSUER=", 14) != 0) {
+            envp[envc++] = environ[i];
+        }
+    }
+    envp[envc++] = user_env;
+    envp[envc++] = issuer_env;
+
+    result = SASL_UNAVAIL;
+    if (pipe(fds) != 0) {
+        goto done;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    char *argv[] = { "sh", "-c", (char*)command, NULL };
+    pid_t pid;
+    int rc = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (rc != 0) {
+        OAUTH2_LOG_WARN(utils, "Cannot run token helper: %s", strerror(rc));
+        goto done;
+    }
+
+    ssize_t n = oauth2_token_helper_read(fds[0], buffer, size, 0, deadline);
+    if (n < 0) {
+        kill(pid, SIGKILL);
+    }
+    int status = 0;
+    pid_t waited;
+    do {
+        waited = waitpid(pid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+
+    /* With SIGCHLD ignored the status is lost: the answer alone decides */
+    if (n <= 0 || (waited == pid && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))) {
+        OAUTH2_LOG_WARN(utils, "Token helper command failed for %s", user);
+        goto done;
+    }
+    *len = (size_t)n;
+    result = SASL_OK;
+
+done:
+    if (fds[0] >= 0) close(fds[0]);
+    free(user_env);
+    free(issuer_env);
+    free(envp);
+    return result;
+}
+
+int oauth2_token_helper_request(const sasl_utils_t *utils, oauth2_config_t *config, const char *issuer,
+                                const char *user, oauth2_deadline_t deadline, char **response) {
+    if (!config || !config->client_token_helper || !user || !response) {
+        return SASL_BADPARAM;
+    }
+    *response = NULL;
+
+    char *buffer = oauth2_secure_alloc(OAUTH2_TOKEN_HELPER_MAX_RESPONSE);
+    if (!buffer) {
+        return SASL_NOMEM;
+    }
+
+    const char *helper = config->client_token_helper;
+    size_t len = 0;
+    int result = strncmp(helper, "unix:", 5) == 0 ?
+        oauth2_token_helper_socket(utils, helper + 5, issuer ? issuer : "", user, deadline,
+                                   buffer, OAUTH2_TOKEN_HELPER_MAX_RESPONSE, &len) :
+        oauth2_token_helper_command(utils, helper, issuer ? issuer : "", user, deadline,
+                                    buffer, OAUTH2_TOKEN_HELPER_MAX_RESPONSE, &len);
+    if (result != SASL_OK) {
+        oauth2_secure_free(buffer);
+        return result;
+    }
+
+    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r' || buffer[len - 1] == ' ')) {
+        buffer[--len] = '\0';
+    }
+    *response = buffer;
+    return SASL_OK;
+}
+
+void oauth2_token_helper_close(void) {
+    pthread_mutex_lock(&oauth2_token_helper.lock);
+    oauth2_token_helper_disconnect();
+    pthread_mutex_unlock(&oauth2_token_helper.lock);
+}
@@ -0,0 +1,557 @@
+/*
+ * OAuth2/OIDC SASL Plugin - HTTP Fetch Layer
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Minimal libcurl based fetcher for discovery documents and JWKS, with
+ * HTTP caching semantics: Cache-Control/Expires freshness and ETag or
+ * Last-Modified revalidation (RFC 9111), plus authenticated form posts
+ * for token introspection.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <curl/curl.h>
+
+/* Upper bound for any document fetched from an IdP */
+#define OAUTH2_HTTP_MAX_BODY (1024 * 1024)
+
+/* Lifetime of documents served without freshness information */
+#define OAUTH2_HTTP_DEFAULT_LIFETIME 3600
+
+static pthread_once_t oauth2_http_once = PTHREAD_ONCE_INIT;
+
+static void oauth2_http_global_init(void) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+static size_t oauth2_http_write_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    oauth2_http_response_t *response = (oauth2_http_response_t*)userdata;
+    size_t chunk = size * nmemb;
+
+    if (response->len + chunk > OAUTH2_HTTP_MAX_BODY) {
+        return 0; /* Aborts the transfer */
+    }
+
+    char *body = realloc(response->body, response->len + chunk + 1);
+    if (!body) {
+        return 0;
+    }
+
+    memcpy(body + response->len, data, chunk);
+    response->body = body;
+    response->len += chunk;
+    response->body[response->len] = '\0';
+    return chunk;
+}
+
+long long oauth2_monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+oauth2_deadline_t oauth2_deadline_after(int seconds) {
+    return oauth2_monotonic_ms() + (long long)(seconds > 0 ? seconds : OAUTH2_DEFAULT_TIMEOUT) * 1000;
+}
+
+long oauth2_deadline_remaining(oauth2_deadline_t deadline) {
+    if (deadline == 0) {
+        return LONG_MAX;
+    }
+    long long remaining = deadline - oauth2_monotonic_ms();
+    return remaining > 0 ? (long)remaining : 0;
+}
+
+/* Copy a header value without surrounding whitespace */
+static char *oauth2_http_header_value(const char *value, size_t len) {
+    while (len > 0 && isspace((unsigned char)*value)) {
+        value++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    return strndup(value, len);
+}
+
+static void oauth2_http_parse_cache_control(oauth2_http_response_t *response, const char *value) {
+    char *copy = strdup(value);
+    if (!copy) return;
+
+    char *saveptr = NULL;
+    for (char *directive = strtok_r(copy, ",", &saveptr); directive;
+         directive = strtok_r(NULL, ",", &saveptr)) {
+        while (isspace((unsigned char)*directive)) directive++;
+
+        if (strncasecmp(directive, "max-age=", 8) == 0) {
+            response->max_age = strtol(directive + 8, NULL, 10);
+        } else if (strncasecmp(directive, "no-store", 8) == 0) {
+            response->no_store = 1;
+        } else if (strncasecmp(directive, "no-cache", 8) == 0) {
+            response->max_age = 0; /* Usable, but revalidate on every refresh */
+        }
+    }
+    free(copy);
+}
+
+static size_t oauth2_http_header_cb(char *data, size_t size, size_t nmemb, void *userdata) {
+    oauth2_http_response_t *response = (oauth2_http_response_t*)userdata;
+    size_t len = size * nmemb;
+
+    /* A new status line (e.g. after 100 Continue) starts a new header block */
+    if (len >= 5 && strncmp(data, "HTTP/", 5) == 0) {
+        free(response->etag);
+        free(response->last_modified);
+        response->etag = response->last_modified = NULL;
+        response->max_age = -1;
+        response->age = 0;
+        response->no_store = 0;
+        response->expires = 0;
+        return len;
+    }
+
+    const char *colon = memchr(data, ':', len);
+    if (!colon) {
+        return len;
+    }
+    size_t name_len = (size_t)(colon - data);
+    char *value = oauth2_http_header_value(colon + 1, len - name_len - 1);
+    if (!value) {
+        return len;
+    }
+
+    if (name_len == 13 && strncasecmp(data, "Cache-Control", 13) == 0) {
+        oauth2_http_parse_cache_control(response, value);
+    } else if (name_len == 7 && strncasecmp(data, "Expires", 7) == 0) {
+        long expires = curl_getdate(value, NULL);
+        response->expires = expires > 0 ? (time_t)expires : 1; /* Invalid dates mean already expired */
+    } else if (name_len == 3 && strncasecmp(data, "Age", 3) == 0) {
+        response->age = strtol(value, NULL, 10);
+    } else if (name_len == 4 && strncasecmp(data, "ETag", 4) == 0) {
+        free(response->etag);
+        response->etag = value;
+        value = NULL;
+    } else if (name_len == 13 && strncasecmp(data, "Last-Modified", 13) == 0) {
+        free(response->last_modified);
+        response->last_modified = value;
+        value = NULL;
+    }
+
+    free(value);
+    return len;
+}
+
+/* Time left for one request: the caller's deadline, at most the endpoint's timeout */
+static long oauth2_http_timeout_ms(const oauth2_config_t *config, const char *url, oauth2_deadline_t deadline) {
+    long timeout_ms = config->latency ? oauth2_latency_timeout_ms(config->latency, url) :
+                      (config->timeout > 0 ? config->timeout : OAUTH2_DEFAULT_TIMEOUT) * 1000L;
+    long remaining_ms = oauth2_deadline_remaining(deadline);
+    return remaining_ms < timeout_ms ? remaining_ms : timeout_ms;
+}
+
+/* Feed a finished transfer to its endpoint's digest; failures other than timeouts say nothing of latency */
+static void oauth2_http_observe(const oauth2_config_t *config, CURL *curl, const char *url, CURLcode rc) {
+    if (!config->latency || (rc != CURLE_OK && rc != CURLE_OPERATION_TIMEDOUT)) {
+        return;
+    }
+    double seconds = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &seconds);
+    oauth2_latency_record(config->latency, url, (long)(seconds * 1000.0), rc == CURLE_OPERATION_TIMEDOUT);
+}
+
+/* Prepare an easy handle writing into response; *headers must be freed after the transfer */
+static CURL *oauth2_http_easy(const oauth2_config_t *config, const char *url,
+                              const oauth2_http_doc_t *cached, long timeout_ms,
+                              oauth2_http_response_t *response, struct curl_slist **headers) {
+    memset(response, 0, sizeof(*response));
+    response->max_age = -1;
+    *headers = NULL;
+
+    pthread_once(&oauth2_http_once, oauth2_http_global_init);
+
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        return NULL;
+    }
+
+    /* Conditional request: a 304 lets us keep the cached body */
+    if (cached && cached->body) {
+        char header[1024];
+        if (cached->etag) {
+            snprintf(header, sizeof(header), "If-None-Match: %s", cached->etag);
+            *headers = curl_slist_append(*headers, header);
+        }
+        if (cached->last_modified) {
+            snprintf(header, sizeof(header), "If-Modified-Since: %s", cached->last_modified);
+            *headers = curl_slist_append(*headers, header);
+        }
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, oauth2_http_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, oauth2_http_header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
+    if (*headers) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+    }
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, OAUTH2_PLUGIN_NAME "/" OAUTH2_PLUGIN_VERSION);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, config->ssl_verify ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, config->ssl_verify ? 2L : 0L);
+
+    return curl;
+}
+
+/* Prepare the easy handle of a transfer: a GET, a form POST or a GET with a bearer token */
+static int oauth2_http_transfer_prepare(const oauth2_config_t *config, oauth2_http_transfer_t *transfer,
+                                        oauth2_deadline_t deadline) {
+    memset(&transfer->response, 0, sizeof(transfer->response));
+    transfer->result = SASL_UNAVAIL;
+    transfer->handle = NULL;
+    transfer->headers = NULL;
+
+    long timeout_ms = oauth2_http_timeout_ms(config, transfer->url, deadline);
+    if (timeout_ms <= 0) {
+        return SASL_UNAVAIL;
+    }
+
+    struct curl_slist *headers;
+    CURL *curl = oauth2_http_easy(config, transfer->url, transfer->cached, timeout_ms,
+                                  &transfer->response, &headers);
+    if (!curl) {
+        return SASL_NOMEM;
+    }
+
+    /* application/x-www-form-urlencoded body, client authentication with HTTP Basic */
+    if (transfer->fields) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, transfer->fields);
+        if (transfer->username) {
+            curl_easy_setopt(curl, CURLOPT_HTTPAUTH, (long)CURLAUTH_BASIC);
+            curl_easy_setopt(curl, CURLOPT_USERNAME, transfer->username);
+            curl_easy_setopt(curl, CURLOPT_PASSWORD, transfer->password ? transfer->password : "");
+        }
+    }
+
+    /* RFC 6750 section 2.1: the access token in the Authorization header */
+    if (transfer->bearer) {
+        size_t header_len = strlen(transfer->bearer) + 32;
+        char *header = oauth2_secure_alloc(header_len);
+        struct curl_slist *list = NULL;
+        if (header) {
+            snprintf(header, header_len, "Authorization: Bearer %s", transfer->bearer);
+            list = curl_slist_append(headers, header);
+            oauth2_secure_free(header);
+        }
+        if (!list) {
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(headers);
+            return SASL_NOMEM;
+        }
+        headers = list;
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+    transfer->handle = curl;
+    transfer->headers = headers;
+    return SASL_OK;
+}
+
+/* libcurl keeps its own copy of each header line; wipe those holding a token before freeing */
+static void oauth2_http_wipe_headers(struct curl_slist *headers) {
+    for (struct curl_slist *h = headers; h; h = h->next) {
+        if (h->data) {
+            oauth2_secure_wipe(h->data, strlen(h->data));
+        }
+    }
+}
+
+void oauth2_http_transfer_finish(const oauth2_config_t *config, oauth2_http_transfer_t *transfer) {
+    CURL *curl = (CURL*)transfer->handle;
+    if (!curl) {
+        return;
+    }
+
+    CURLcode rc = (CURLcode)transfer->code;
+    if (rc == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &transfer->response.status);
+        transfer->result = SASL_OK;
+    }
+    oauth2_http_observe(config, curl, transfer->url, rc);
+    curl_easy_cleanup(curl);
+
+    struct curl_slist *headers = (struct curl_slist*)transfer->headers;
+    if (transfer->bearer) {
+        oauth2_http_wipe_headers(headers);
+    }
+    curl_slist_free_all(headers);
+    transfer->handle = NULL;
+    transfer->headers = NULL;
+
+    if (transfer->result != SASL_OK) {
+        oauth2_http_response_free(&transfer->response);
+    }
+}
+
+/* Run one transfer in the calling thread */
+static int oauth2_http_run(const oauth2_config_t *config, oauth2_http_transfer_t *transfer,
+                           oauth2_deadline_t deadline, oauth2_http_response_t *response) {
+    int result = oauth2_http_transfer_prepare(config, transfer, deadline);
+    if (result == SASL_OK) {
+        transfer->code = curl_easy_perform((CURL*)transfer->handle);
+        oauth2_http_transfer_finish(config, transfer);
+        result = transfer->result;
+    }
+    *response = transfer->response;
+    return result;
+}
+
+int oauth2_http_get(const oauth2_config_t *config, const char *url, const oauth2_http_doc_t *cached,
+                    oauth2_deadline_t deadline, oauth2_http_response_t *response) {
+    if (!config || !url || !response) {
+        return SASL_BADPARAM;
+    }
+
+    oauth2_http_transfer_t transfer = { .url = url, .cached = cached };
+    return oauth2_http_run(config, &transfer, deadline, response);
+}
+
+/* application/x-www-form-urlencoded value, in secure memory since the value is usually a token */
+char *oauth2_http_form_escape(const char *value) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *escaped = oauth2_secure_alloc(strlen(value) * 3 + 1);
+    if (!escaped) return NULL;
+
+    char *out = escaped;
+    for (const unsigned char *p = (const unsigned char*)value; *p; p++) {
+        if ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') ||
+            *p == '-' || *p == '.' || *p == '_' || *p == '~') {
+            *out++ = (char)*p;
+        } else {
+            *out++ = '%';
+            *out++ = hex[*p >> 4];
+            *out++ = hex[*p & 0x0f];
+        }
+    }
+    *out = '\0';
+    return escaped;
+}
+
+int oauth2_http_post_form(const oauth2_config_t *config, const char *url, const char *fields,
+                          const char *username, const char *password,
+                          oauth2_deadline_t deadline, oauth2_http_response_t *response) {
+    if (!config || !url || !fields || !response) {
+        return SASL_BADPARAM;
+    }
+
+    oauth2_http_transfer_t transfer = { .url = url, .fields = fields, .username = username, .password = password };
+    return oauth2_http_run(config, &transfer, deadline, response);
+}
+
+int oauth2_http_get_bearer(const oauth2_config_t *config, const char *url, const char *token,
+                           oauth2_deadline_t deadline, oauth2_http_response_t *response) {
+    if (!config || !url || !token || !response) {
+        return SASL_BADPARAM;
+    }
+
+    oauth2_http_transfer_t transfer = { .url = url, .bearer = token };
+    return oauth2_http_run(config, &transfer, deadline, response);
+}
+
+struct oauth2_http_multi {
+    CURLM *multi;
+};
+
+oauth2_http_multi_t *oauth2_http_multi_create(void) {
+    pthread_once(&oauth2_http_once, oauth2_http_global_init);
+
+    oauth2_http_multi_t *multi = calloc(1, sizeof(oauth2_http_multi_t));
+    if (multi && !(multi->multi = curl_multi_init())) {
+        free(multi);
+        return NULL;
+    }
+    return multi;
+}
+
+int oauth2_http_multi_add(const oauth2_config_t *config, oauth2_http_multi_t *multi,
+                          oauth2_http_transfer_t *transfer, oauth2_deadline_t deadline) {
+    int result = oauth2_http_transfer_prepare(config, transfer, deadline);
+    if (result != SASL_OK) {
+        return result;
+    }
+    if (curl_multi_add_handle(multi->multi, (CURL*)transfer->handle) != CURLM_OK) {
+        transfer->code = CURLE_FAILED_INIT;
+        oauth2_http_transfer_finish(config, transfer);
+        return SASL_FAIL;
+    }
+    return SASL_OK;
+}
+
+void oauth2_http_multi_cancel(oauth2_http_multi_t *multi, oauth2_http_transfer_t *transfer) {
+    if (transfer->handle) {
+        curl_multi_remove_handle(multi->multi, (CURL*)transfer->handle);
+        transfer->code = CURLE_ABORTED_BY_CALLBACK;
+    }
+}
+
+/* Wait for activity, libcurl's own timers or a wakeup, no longer than timeout_ms, then progress every transfer */
+int oauth2_http_multi_wait(oauth2_http_multi_t *multi, long timeout_ms) {
+    if (timeout_ms > 0) {
+        curl_multi_poll(multi->multi, NULL, 0, (int)(timeout_ms < INT_MAX ? timeout_ms : INT_MAX), NULL);
+    }
+    int running = 0;
+    return curl_multi_perform(multi->multi, &running) == CURLM_OK ? running : -1;
+}
+
+oauth2_http_transfer_t *oauth2_http_multi_done(oauth2_http_multi_t *multi) {
+    CURLMsg *msg;
+    int queued;
+    while ((msg = curl_multi_info_read(multi->multi, &queued)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        oauth2_http_transfer_t *transfer = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+        transfer->code = msg->data.result;
+        curl_multi_remove_handle(multi->multi, msg->easy_handle);
+        return transfer;
+    }
+    return NULL;
+}
+
+void oauth2_http_multi_wakeup(oauth2_http_multi_t *multi) {
+    curl_multi_wakeup(multi->multi);
+}
+
+void oauth2_http_multi_free(oauth2_http_multi_t *multi) {
+    if (!multi) return;
+
+    curl_multi_cleanup(multi->multi);
+    free(multi);
+}
+
+int oauth2_http_get_many(const oauth2_config_t *config, oauth2_http_transfer_t *requests, int count,
+                         oauth2_deadline_t deadline) {
+    if (!config || (!requests && count > 0)) {
+        return SASL_BADPARAM;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memset(&requests[i].response, 0, sizeof(requests[i].response));
+        requests[i].result = SASL_UNAVAIL;
+        requests[i].handle = NULL;
+    }
+
+    if (count == 0 || oauth2_deadline_remaining(deadline) == 0) {
+        return count == 0 ? SASL_OK : SASL_UNAVAIL;
+    }
+
+    oauth2_http_multi_t *multi = oauth2_http_multi_create();
+    if (!multi) {
+        return SASL_NOMEM;
+    }
+
+    /* All transfers run concurrently; each is bounded by its endpoint's timeout and the shared deadline */
+    for (int i = 0; i < count; i++) {
+        oauth2_http_multi_add(config, multi, &requests[i], deadline);
+    }
+
+    int running;
+    do {
+        long wait_ms = oauth2_deadline_remaining(deadline);
+        running = oauth2_http_multi_wait(multi, wait_ms < 1000 ? wait_ms : 1000);
+
+        oauth2_http_transfer_t *transfer;
+        while ((transfer = oauth2_http_multi_done(multi)) != NULL) {
+            oauth2_http_transfer_finish(config, transfer);
+        }
+        if (running > 0 && wait_ms == 0) {
+            break; /* Budget spent: unfinished transfers are reported as unavailable */
+        }
+    } while (running > 0);
+
+    for (int i = 0; i < count; i++) {
+        oauth2_http_multi_cancel(multi, &requests[i]);
+        oauth2_http_transfer_finish(config, &requests[i]);
+    }
+    oauth2_http_multi_free(multi);
+
+    return SASL_OK;
+}
+
+void oauth2_http_response_free(oauth2_http_response_t *response) {
+    if (!response) return;
+
+    free(response->body);
+    free(response->etag);
+    free(response->last_modified);
+    response->body = response->etag = response->last_modified = NULL;
+    response->len = 0;
+}
+
+time_t oauth2_http_lifetime(const oauth2_config_t *config, const oauth2_http_response_t *response,
+                            time_t now) {
+    long lifetime = OAUTH2_HTTP_DEFAULT_LIFETIME;
+
+    /* max-age wins over Expires; no-store documents are used but refetched as soon as allowed */
+    if (response->no_store) {
+        lifetime = 0;
+    } else if (response->max_age >= 0) {
+        lifetime = response->max_age - response->age;
+    } else if (response->expires > 0) {
+        lifetime = (long)(response->expires - now);
+    }
+
+    /* Floors protect the IdP from aggressive headers, ceilings bound key staleness */
+    if (lifetime < config->refresh_min_interval) lifetime = config->refresh_min_interval;
+    if (config->refresh_max_interval > 0 && lifetime > config->refresh_max_interval) {
+        lifetime = config->refresh_max_interval;
+    }
+    return (time_t)lifetime;
+}
+
+void oauth2_http_doc_update(oauth2_http_doc_t *doc, oauth2_http_response_t *response,
+                            time_t now, time_t lifetime) {
+    /* A 304 keeps the cached body; validators are only replaced when sent again */
+    if (response->status != 304) {
+        free(doc->body);
+        doc->body = response->body;
+        doc->len = response->len;
+        response->body = NULL;
+        response->len = 0;
+
+        free(doc->etag);
+        free(doc->last_modified);
+        doc->etag = doc->last_modified = NULL;
+    }
+    if (response->etag) {
+        free(doc->etag);
+        doc->etag = response->etag;
+        response->etag = NULL;
+    }
+    if (response->last_modified) {
+        free(doc->last_modified);
+        doc->last_modified = response->last_modified;
+        response->last_modified = NULL;
+    }
+
+    doc->no_store = response->no_store;
+    doc->fetched_at = now;
+    doc->expires_at = now + lifetime;
+}
+
+void oauth2_http_doc_clear(oauth2_http_doc_t *doc) {
+    if (!doc) return;
+
+    free(doc->body);
+    free(doc->etag);
+    free(doc->last_modified);
+    memset(doc, 0, sizeof(*doc));
+}
@@ -12,15 +12,15 @@
 #include <sasl/saslutil.h>
 #endif
 
-/* Global configuration instance */
-static oauth2_config_t *global_config = NULL;
+/* Global configuration, shared by server and client mechanisms */
+static oauth2_config_holder_t global_config = OAUTH2_CONFIG_HOLDER_INIT;
 
 /* Test function to reset global state - FOR TESTING ONLY */
 void oauth2_reset_global_config(void) {
-    if (global_config) {
-        oauth2_config_free(global_config);
-        global_config = NULL;
-    }
+    oauth2_config_unwatch(&global_config);
+    oauth2_config_publish(&global_config, NULL);
+    oauth2_context_pool_drain();
+    oauth2_client_token_drain();
 }
 
 /* Global plugin lists */
@@ -73,7 +73,7 @@ static sasl_client_plug_t oauth2_client_plugins[] = {
         | SASL_FEAT_ALLOWS_PROXY,    /* features */
         NULL,                        /* required_prompts */
         NULL,                        /* glob_context */
-        &oauth2_client_mech_new,     /* mech_new */
+        &oauth2_client_mech_new_xoauth2, /* mech_new */
         &oauth2_client_mech_step,    /* mech_step */
         &oauth2_client_mech_dispose, /* mech_dispose */
         NULL,                        /* mech_free */
@@ -90,7 +90,7 @@ static sasl_client_plug_t oauth2_client_plugins[] = {
         | SASL_FEAT_ALLOWS_PROXY,    /* features */
         NULL,                        /* required_prompts */
         NULL,                        /* glob_context */
-        &oauth2_client_mech_new,     /* mech_new */
+        &oauth2_client_mech_new_oauthbearer, /* mech_new */
         &oauth2_client_mech_step,    /* mech_step */
         &oauth2_client_mech_dispose, /* mech_dispose */
         NULL,                        /* mech_free */
@@ -115,34 +115,41 @@ SASLPLUGINAPI int sasl_server_plug_init(const sasl_utils_t *utils,
     }
     
     /* Initialize global configuration if not already done */
-    if (!global_config) {
-        global_config = oauth2_config_init(utils);
-        if (!global_config) {
+    if (!global_config.current) {
+        oauth2_config_t *config = oauth2_config_init(utils);
+        if (!config) {
             utils->log(utils->conn, SASL_LOG_ERR, "oauth2_plugin: Failed to initialize configuration");
             utils->seterror(utils->conn, 0, "OAuth2: Failed to initialize configuration");
             return SASL_FAIL;
         }
         
         /* Load configuration - fail if essential config is missing */
-        int config_result = oauth2_config_load(global_config, utils);
+        int config_result = oauth2_config_load(config, utils);
         if (config_result != SASL_OK) {
             utils->log(utils->conn, SASL_LOG_ERR, "oauth2_plugin: Config load failed with %d - essential configuration missing", config_result);
             utils->seterror(utils->conn, 0, "OAuth2: Essential configuration missing");
-            oauth2_config_free(global_config);
-            global_config = NULL;
+            oauth2_config_release(config);
             return SASL_FAIL;
         }
         
         /* Initialize server mechanisms */
-        int server_init_result = oauth2_server_init(utils, global_config);
+        int server_init_result = oauth2_server_init(utils, config);
         if (server_init_result != SASL_OK) {
             utils->log(utils->conn, SASL_LOG_WARN, "oauth2_plugin: Server init failed with %d", server_init_result);
         }
+        
+        /* Read-only from here on */
+        oauth2_config_publish(&global_config, config);
+    }
+    
+    /* Later changes to the configuration file are picked up without a restart */
+    if (oauth2_config_watch(&global_config, utils) != SASL_OK) {
+        utils->log(utils->conn, SASL_LOG_WARN, "oauth2_plugin: Configuration file changes will not be picked up");
     }
     
-    /* Set global context in mechanism descriptors */
-    oauth2_server_plugins[0].glob_context = global_config;
-    oauth2_server_plugins[1].glob_context = global_config;
+    /* Mechanisms pin the published snapshot per connection */
+    oauth2_server_plugins[0].glob_context = &global_config;
+    oauth2_server_plugins[1].glob_context = &global_config;
     
     *out_version = SASL_SERVER_PLUG_VERSION;
     *pluglist = oauth2_server_plugins;
@@ -167,34 +174,39 @@ SASLPLUGINAPI int sasl_client_plug_init(const sasl_utils_t *utils,
     }
     
     /* Use global configuration if already initialized */
-    if (!global_config) {
-        global_config = oauth2_config_init(utils);
-        if (!global_config) {
+    oauth2_config_t *config = oauth2_config_acquire(&global_config);
+    int published = config != NULL;
+    if (!config) {
+        config = oauth2_config_init(utils);
+        if (!config) {
             utils->seterror(utils->conn, 0, "OAuth2: Failed to initialize configuration");
             return SASL_FAIL;
         }
         
-        if (oauth2_config_load(global_config, utils) != SASL_OK) {
+        if (oauth2_config_load(config, utils) != SASL_OK) {
             utils->seterror(utils->conn, 0, "OAuth2: Failed to load configuration");
-            oauth2_config_free(global_config);
-            global_config = NULL;
+            oauth2_config_release(config);
             return SASL_FAIL;
         }
     }
     
     /* Initialize client mechanisms */
-    if (oauth2_client_init(utils, global_config) != SASL_OK) {
+    if (oauth2_client_init(utils, config) != SASL_OK) {
         utils->seterror(utils->conn, 0, "OAuth2: Failed to initialize client");
-        if (!oauth2_server_plugins[0].glob_context) { /* Only free if server didn't set it */
-            oauth2_config_free(global_config);
-            global_config = NULL;
-        }
+        oauth2_config_release(config); /* Only frees it if the server did not publish it */
         return SASL_FAIL;
     }
     
-    /* Set global context in mechanism descriptors */
-    oauth2_client_plugins[0].glob_context = global_config;
-    oauth2_client_plugins[1].glob_context = global_config;
+    if (published) {
+        oauth2_config_release(config);
+    } else {
+        oauth2_config_publish(&global_config, config);
+    }
+    oauth2_config_watch(&global_config, utils);
+    
+    /* Mechanisms pin the published snapshot per connection */
+    oauth2_client_plugins[0].glob_context = &global_config;
+    oauth2_client_plugins[1].glob_context = &global_config;
     
     *out_version = SASL_CLIENT_PLUG_VERSION;
     *pluglist = oauth2_client_plugins;
@@ -0,0 +1,195 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Token Introspection
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * RFC 7662 introspection of opaque access tokens. Results are cached by
+ * provider and token (oauth2_cache.c) until the token expires or the
+ * cache TTL elapses, whichever comes first.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+
+/* Form body of an introspection request, in secure memory */
+static char *oauth2_introspection_fields(const char *token) {
+    char *escaped = oauth2_http_form_escape(token);
+    size_t fields_len = (escaped ? strlen(escaped) : 0) + 64;
+    char *fields = escaped ? oauth2_secure_alloc(fields_len) : NULL;
+    if (fields) {
+        snprintf(fields, fields_len, "token=%s&token_type_hint=access_token", escaped);
+    }
+    oauth2_secure_free(escaped);
+    return fields;
+}
+
+/*
+ * The answer to an introspection request. Returns SASL_OK with the response
+ * of an active token, SASL_BADAUTH for an inactive one (both cacheable until
+ * *expires_at), or an error that must not be cached.
+ */
+static int oauth2_introspection_answer(const sasl_utils_t *utils, oauth2_config_t *config,
+                                       oauth2_provider_t *provider, const char *endpoint, int result,
+                                       oauth2_http_response_t *response, json_t **claims, time_t *expires_at) {
+    /* Transport errors and server errors count against the provider's breaker */
+    if (result != SASL_OK || response->status >= 500) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        oauth2_provider_breaker_record(config, provider, 0);
+        if (result == SASL_OK) {
+            OAUTH2_LOG_WARN(utils, "Introspection at %s returned HTTP %ld", endpoint, response->status);
+            oauth2_http_response_free(response);
+        } else {
+            OAUTH2_LOG_WARN(utils, "Introspection at %s failed", endpoint);
+        }
+        return SASL_UNAVAIL;
+    }
+    oauth2_provider_breaker_record(config, provider, 1);
+
+    if (response->status != 200 || !response->body) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        OAUTH2_LOG_ERR(utils, "Introspection at %s returned HTTP %ld (check %s and %s)", endpoint,
+                       response->status, OAUTH2_CONF_CLIENT_ID, OAUTH2_CONF_CLIENT_SECRET);
+        oauth2_http_response_free(response);
+        return SASL_FAIL;
+    }
+    OAUTH2_METRIC_INC(config, http_ok);
+
+    json_error_t json_error;
+    json_t *json = json_loadb(response->body, response->len, 0, &json_error);
+    oauth2_http_response_free(response);
+    if (!json || !json_is_object(json)) {
+        OAUTH2_LOG_ERR(utils, "Invalid introspection response from %s", endpoint);
+        if (json) json_decref(json);
+        return SASL_FAIL;
+    }
+
+    time_t now = time(NULL);
+    *expires_at = now + (provider->policy ? provider->policy->introspection_cache_ttl :
+                                            config->introspection_cache_ttl);
+
+    json_t *exp = json_object_get(json, "exp");
+    time_t token_exp = json_is_integer(exp) ? (time_t)json_integer_value(exp) : 0;
+    if (!json_is_true(json_object_get(json, "active")) || (token_exp > 0 && token_exp <= now)) {
+        json_decref(json);
+        return SASL_BADAUTH;
+    }
+    if (token_exp > 0 && token_exp < *expires_at) {
+        *expires_at = token_exp;
+    }
+
+    /* "iss" is optional in RFC 7662; fill it in so issuer checks apply as for JWTs */
+    const char *issuer = provider->issuer ? provider->issuer :
+                         __atomic_load_n(&provider->discovered_issuer, __ATOMIC_ACQUIRE);
+    if (!json_object_get(json, "iss") && issuer) {
+        json_object_set_new(json, "iss", json_string(issuer));
+    }
+
+    *claims = json;
+    return SASL_OK;
+}
+
+/*
+ * One introspection round trip, answered as by oauth2_introspection_answer().
+ * On an asynchronous validator the network thread sends the request and
+ * completes the cache slot (SASL_CONTINUE); otherwise the caller completes it.
+ */
+static int oauth2_introspection_request(const sasl_utils_t *utils, oauth2_config_t *config,
+                                        oauth2_provider_t *provider, const char *token,
+                                        oauth2_deadline_t deadline, oauth2_claims_entry_t *slot,
+                                        json_t **claims, time_t *expires_at) {
+    char *endpoint = oauth2_provider_introspection_endpoint(utils, config, provider, deadline);
+    if (!endpoint && oauth2_async_pending()) {
+        oauth2_claims_cache_complete(&config->introspection_cache, slot, 0, NULL, 0);
+        return SASL_CONTINUE; /* Discovery first */
+    }
+    if (!endpoint) {
+        OAUTH2_LOG_WARN(utils, "No introspection endpoint known for %s", provider->discovery_url);
+        return SASL_UNAVAIL;
+    }
+
+    /* Fail fast while the IdP is known to be down */
+    if (!oauth2_provider_breaker_allow(config, provider)) {
+        free(endpoint);
+        return SASL_UNAVAIL;
+    }
+
+    char *fields = oauth2_introspection_fields(token);
+    if (!fields) {
+        free(endpoint);
+        return SASL_NOMEM;
+    }
+
+    OAUTH2_METRIC_INC(config, introspection_requests);
+    oauth2_net_request_t *request = oauth2_async_request(OAUTH2_NET_INTROSPECT, provider);
+    if (request) {
+        request->endpoint = endpoint;
+        request->fields = fields;
+        request->slot = slot;
+        request->transfer.url = endpoint;
+        request->transfer.fields = fields;
+        request->transfer.username = config->client_id;
+        request->transfer.password = config->client_secret;
+        return SASL_CONTINUE;
+    }
+
+    oauth2_http_response_t response;
+    int result = oauth2_http_post_form(config, endpoint, fields, config->client_id, config->client_secret,
+                                       deadline, &response);
+    oauth2_secure_free(fields);
+
+    result = oauth2_introspection_answer(utils, config, provider, endpoint, result, &response, claims, expires_at);
+    free(endpoint);
+    return result;
+}
+
+void oauth2_introspect_complete(const sasl_utils_t *utils, oauth2_config_t *config,
+                                oauth2_net_request_t *request) {
+    time_t expires_at = 0;
+    request->result = oauth2_introspection_answer(utils, config, request->provider, request->endpoint,
+                                                  request->transfer.result, &request->transfer.response,
+                                                  &request->claims, &expires_at);
+    oauth2_claims_cache_complete(&config->introspection_cache, request->slot,
+                                 request->result == SASL_OK || request->result == SASL_BADAUTH,
+                                 request->claims, expires_at);
+}
+
+int oauth2_introspect_token(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, const char *token,
+                            oauth2_deadline_t deadline, json_t **claims) {
+    if (!config || !provider || !token || !claims) {
+        return SASL_BADPARAM;
+    }
+    *claims = NULL;
+
+    /* A validation resumed by an asynchronous validator: the answer its network thread got */
+    int result = oauth2_async_result(OAUTH2_NET_INTROSPECT, provider, claims);
+    if (result != SASL_NOTDONE) {
+        return result;
+    }
+
+    unsigned char key[32];
+    result = oauth2_claims_cache_key(provider->discovery_url, token, key);
+    if (result != SASL_OK) {
+        return result;
+    }
+
+    oauth2_claims_entry_t *slot = NULL;
+    result = oauth2_claims_cache_lookup(&config->introspection_cache, key, deadline, claims, &slot);
+    if (result == SASL_OK) {
+        OAUTH2_METRIC_INC(config, introspection_cache_hits);
+        return *claims ? SASL_OK : SASL_BADAUTH;
+    }
+    if (result == SASL_UNAVAIL) {
+        OAUTH2_METRIC_INC(config, deadline_exceeded);
+        return SASL_UNAVAIL;
+    }
+
+    time_t expires_at = 0;
+    result = oauth2_introspection_request(utils, config, provider, token, deadline, slot, claims, &expires_at);
+    if (result != SASL_CONTINUE) {
+        oauth2_claims_cache_complete(&config->introspection_cache, slot,
+                                     result == SASL_OK || result == SASL_BADAUTH, *claims, expires_at);
+    }
+    return result;
+}
@@ -0,0 +1,312 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Key Store
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Keeps the verification keys of a provider as an immutable, reference
+ * counted key set built once from JWKS or PEM material. Key sets are
+ * swapped atomically when their source changes so that validations in
+ * progress keep using the keys they started with.
+ */
+
+/* For memmem function */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <jansson.h>
+
+#define OAUTH2_PEM_BEGIN "-----BEGIN "
+#define OAUTH2_PEM_END "-----END "
+
+/* Add a single JWK (JSON object) to the verifier chain */
+static int oauth2_keyset_add_jwk(oauth2_log_t *log, oauth2_keyset_t *keys,
+                                 json_t *jwk, const char *options) {
+    if (!json_is_object(jwk)) {
+        return SASL_BADPARAM;
+    }
+
+    /* Skip encryption keys, they are never used to sign tokens */
+    json_t *use = json_object_get(jwk, "use");
+    if (json_is_string(use) && strcmp(json_string_value(use), "sig") != 0) {
+        return SASL_OK;
+    }
+
+    char *jwk_str = json_dumps(jwk, JSON_COMPACT);
+    if (!jwk_str) {
+        return SASL_NOMEM;
+    }
+
+    const char *rv = oauth2_cfg_token_verify_add_options(log, &keys->verify, "jwk", jwk_str, options);
+    free(jwk_str);
+    if (rv != NULL) {
+        oauth2_mem_free((char*)rv);
+        return SASL_FAIL;
+    }
+
+    keys->key_count++;
+    return SASL_OK;
+}
+
+/* Add every PEM block of a buffer: public keys and certificates */
+static int oauth2_keyset_add_pem(oauth2_log_t *log, oauth2_keyset_t *keys,
+                                 const char *data, size_t len, const char *options) {
+    const char *ptr = data;
+    const char *end = data + len;
+    int added = 0;
+
+    while (ptr < end) {
+        const char *begin = memmem(ptr, (size_t)(end - ptr), OAUTH2_PEM_BEGIN, strlen(OAUTH2_PEM_BEGIN));
+        if (!begin) break;
+
+        const char *stop = memmem(begin, (size_t)(end - begin), OAUTH2_PEM_END, strlen(OAUTH2_PEM_END));
+        if (!stop) break;
+
+        /* Include the END line itself */
+        const char *eol = memchr(stop, '\n', (size_t)(end - stop));
+        const char *block_end = eol ? eol + 1 : end;
+
+        char *block = strndup(begin, (size_t)(block_end - begin));
+        if (!block) {
+            return SASL_NOMEM;
+        }
+
+        const char *type = strncmp(begin + strlen(OAUTH2_PEM_BEGIN), "CERTIFICATE", 11) == 0 ? "pem" : "pubkey";
+        const char *rv = oauth2_cfg_token_verify_add_options(log, &keys->verify, type, block, options);
+        free(block);
+        if (rv != NULL) {
+            oauth2_mem_free((char*)rv);
+            return SASL_FAIL;
+        }
+
+        keys->key_count++;
+        added++;
+        ptr = block_end;
+    }
+
+    return added > 0 ? SASL_OK : SASL_FAIL;
+}
+
+int oauth2_keyset_add_jwks(oauth2_log_t *log, oauth2_keyset_t *keys,
+                           json_t *jwks, const char *options) {
+    if (!keys || !json_is_object(jwks)) {
+        return SASL_BADPARAM;
+    }
+
+    json_t *list = json_object_get(jwks, "keys");
+    if (!list) {
+        /* A bare JWK rather than a JWK Set */
+        return oauth2_keyset_add_jwk(log, keys, jwks, options);
+    }
+
+    if (!json_is_array(list)) {
+        return SASL_FAIL;
+    }
+
+    /* Keys liboauth2 cannot load (other key types, curves) are skipped, the set needs one usable key */
+    size_t index;
+    json_t *jwk;
+    json_array_foreach(list, index, jwk) {
+        int result = oauth2_keyset_add_jwk(log, keys, jwk, options);
+        if (result == SASL_NOMEM) {
+            return result;
+        }
+        keys->skipped_count += result != SASL_OK;
+    }
+    return keys->key_count > 0 ? SASL_OK : SASL_FAIL;
+}
+
+/* Parse a JWKS/JWK document or a PEM bundle into the key set */
+int oauth2_keyset_add_buffer(oauth2_log_t *log, oauth2_keyset_t *keys,
+                             const char *data, size_t len, const char *options) {
+    if (!keys || !data || len == 0) {
+        return SASL_BADPARAM;
+    }
+
+    size_t skip = 0;
+    while (skip < len && isspace((unsigned char)data[skip])) skip++;
+
+    if (skip < len && data[skip] == '{') {
+        json_error_t json_error;
+        json_t *jwks = json_loadb(data + skip, len - skip, 0, &json_error);
+        if (!jwks) {
+            return SASL_FAIL;
+        }
+        int result = oauth2_keyset_add_jwks(log, keys, jwks, options);
+        json_decref(jwks);
+        return result;
+    }
+
+    return oauth2_keyset_add_pem(log, keys, data + skip, len - skip, options);
+}
+
+oauth2_keyset_t *oauth2_keyset_new(void) {
+    oauth2_keyset_t *keys = calloc(1, sizeof(oauth2_keyset_t));
+    if (keys) {
+        keys->refcount = 1;
+    }
+    return keys;
+}
+
+oauth2_keyset_t *oauth2_keyset_ref(oauth2_keyset_t *keys) {
+    if (keys) {
+        __atomic_add_fetch(&keys->refcount, 1, __ATOMIC_RELAXED);
+    }
+    return keys;
+}
+
+void oauth2_keyset_release(oauth2_keyset_t *keys, oauth2_log_t *log) {
+    if (!keys) return;
+
+    if (__atomic_sub_fetch(&keys->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (keys->verify) {
+            oauth2_cfg_token_verify_free(log, keys->verify);
+        }
+        free(keys);
+    }
+}
+
+/* Build a fresh key set from every file of the store; NULL if any file is unusable */
+static oauth2_keyset_t *oauth2_key_store_load(const sasl_utils_t *utils,
+                                              oauth2_key_store_t *store) {
+    oauth2_keyset_t *keys = oauth2_keyset_new();
+    if (!keys) {
+        return NULL;
+    }
+
+    for (int i = 0; i < store->files_count; i++) {
+        oauth2_file_map_t map;
+        const char *path = store->watches[i].path;
+
+        if (oauth2_file_map(path, &map) != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "Cannot map key file %s", path);
+            oauth2_keyset_release(keys, store->log);
+            return NULL;
+        }
+
+        int skipped_count = keys->skipped_count;
+        int result = oauth2_keyset_add_buffer(store->log, keys, map.data, map.len, store->options);
+        oauth2_file_unmap(&map);
+
+        if (result != SASL_OK) {
+            OAUTH2_LOG_ERR(utils, "No usable keys in key file %s", path);
+            oauth2_keyset_release(keys, store->log);
+            return NULL;
+        }
+        if (keys->skipped_count > skipped_count) {
+            OAUTH2_LOG_WARN(utils, "Skipped %d unusable key(s) of key file %s", keys->skipped_count - skipped_count,
+                            path);
+        }
+    }
+
+    if (keys->key_count == 0) {
+        oauth2_keyset_release(keys, store->log);
+        return NULL;
+    }
+
+    return keys;
+}
+
+/* Install a new key set; the previous one lives on until its last user releases it */
+void oauth2_key_store_swap(oauth2_key_store_t *store, oauth2_keyset_t *keys) {
+    pthread_mutex_lock(&store->lock);
+    oauth2_keyset_t *old = store->current;
+    store->current = keys;
+    pthread_mutex_unlock(&store->lock);
+
+    oauth2_keyset_release(old, store->log);
+}
+
+oauth2_key_store_t *oauth2_key_store_create(const sasl_utils_t *utils, oauth2_log_t *log,
+                                            char **files, int files_count,
+                                            const char *options, int reload_interval) {
+    oauth2_key_store_t *store = calloc(1, sizeof(oauth2_key_store_t));
+    if (!store) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_mutex_init(&store->reload_lock, NULL);
+    store->log = log;
+    store->options = options ? strdup(options) : NULL;
+
+    if (files_count > 0) {
+        store->watches = calloc((size_t)files_count, sizeof(oauth2_file_watch_t));
+        if (!store->watches) {
+            oauth2_key_store_free(store);
+            return NULL;
+        }
+        for (int i = 0; i < files_count; i++) {
+            if (oauth2_file_watch_init(&store->watches[i], files[i], reload_interval) != SASL_OK) {
+                oauth2_key_store_free(store);
+                return NULL;
+            }
+            store->files_count++;
+        }
+        store->watch_pid = getpid();
+
+        store->current = oauth2_key_store_load(utils, store);
+        if (store->current) {
+            OAUTH2_LOG_INFO(utils, "Loaded %d key(s) from %d local file(s)",
+                            store->current->key_count, store->files_count);
+        } else {
+            OAUTH2_LOG_ERR(utils, "Local key files unusable at startup, will retry when they change");
+        }
+    }
+
+    return store;
+}
+
+void oauth2_key_store_free(oauth2_key_store_t *store) {
+    if (!store) return;
+
+    oauth2_keyset_release(store->current, store->log);
+    for (int i = 0; i < store->files_count; i++) {
+        oauth2_file_watch_free(&store->watches[i]);
+    }
+    free(store->watches);
+    free(store->options);
+    pthread_mutex_destroy(&store->lock);
+    pthread_mutex_destroy(&store->reload_lock);
+    free(store);
+}
+
+oauth2_keyset_t *oauth2_key_store_acquire(oauth2_key_store_t *store, const sasl_utils_t *utils) {
+    if (!store) return NULL;
+
+    /* Pick up file changes; a single caller reloads while the others keep the current set */
+    if (store->files_count > 0 && pthread_mutex_trylock(&store->reload_lock) == 0) {
+        /* Watches inherited across fork share their inotify queues with the parent and siblings */
+        int changed = 0;
+        pid_t pid = getpid();
+        int rearm = store->watch_pid != pid;
+        store->watch_pid = pid;
+        for (int i = 0; i < store->files_count; i++) {
+            if (rearm) {
+                changed |= oauth2_file_watch_rearm(&store->watches[i]);
+            }
+            changed |= oauth2_file_watch_changed(&store->watches[i]);
+        }
+
+        if (changed) {
+            oauth2_keyset_t *keys = oauth2_key_store_load(utils, store);
+            if (keys) {
+                OAUTH2_LOG_INFO(utils, "Reloaded %d key(s) from local key files", keys->key_count);
+                oauth2_key_store_swap(store, keys);
+            } else {
+                OAUTH2_LOG_WARN(utils, "Key file reload failed, keeping previous keys");
+            }
+        }
+        pthread_mutex_unlock(&store->reload_lock);
+    }
+
+    pthread_mutex_lock(&store->lock);
+    oauth2_keyset_t *keys = oauth2_keyset_ref(store->current);
+    pthread_mutex_unlock(&store->lock);
+
+    return keys;
+}
@@ -0,0 +1,163 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Adaptive Timeouts
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * oauth2_timeout bounds every IdP request, but an IdP answering in 20 ms
+ * has stalled long before 10 s. Each endpoint (a URL without its query)
+ * keeps a digest of its response times: a histogram of 64 buckets four per
+ * doubling, halved every OAUTH2_LATENCY_WINDOW samples so that it follows
+ * the IdP through slow periods. Once an endpoint has enough samples its
+ * requests get
+ *
+ *   oauth2_timeout_percentile of the digest * oauth2_timeout_multiplier
+ *
+ * clamped between oauth2_timeout_floor_ms and oauth2_timeout. A request
+ * that times out is recorded at its timeout, so a slowing IdP raises its
+ * own timeouts within a few requests.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Samples needed before the digest replaces oauth2_timeout */
+#define OAUTH2_LATENCY_MIN_SAMPLES 20
+
+/* Samples after which the digest is halved */
+#define OAUTH2_LATENCY_WINDOW 512
+
+/* Growth between bucket bounds, 2^(1/4) */
+#define OAUTH2_LATENCY_STEP 1.189207115
+
+oauth2_latency_table_t *oauth2_latency_create(int percentile, int multiplier, long floor_ms, long max_ms) {
+    oauth2_latency_table_t *table = calloc(1, sizeof(oauth2_latency_table_t));
+    if (!table) {
+        return NULL;
+    }
+    pthread_mutex_init(&table->lock, NULL);
+    table->percentile = percentile;
+    table->multiplier = multiplier;
+    table->floor_ms = floor_ms;
+    table->max_ms = max_ms;
+    return table;
+}
+
+void oauth2_latency_free(oauth2_latency_table_t *table) {
+    if (!table) return;
+
+    pthread_mutex_destroy(&table->lock);
+    free(table);
+}
+
+/* The previous configuration may still be fetching: copy under its lock */
+void oauth2_latency_inherit(oauth2_latency_table_t *table, oauth2_latency_table_t *previous) {
+    if (!table || !previous) {
+        return;
+    }
+    pthread_mutex_lock(&previous->lock);
+    memcpy(table->endpoints, previous->endpoints, sizeof(table->endpoints));
+    table->count = previous->count;
+    table->timeouts = previous->timeouts;
+    pthread_mutex_unlock(&previous->lock);
+}
+
+/* Length of the endpoint part of url: everything before the query or fragment */
+static size_t oauth2_latency_key_len(const char *url) {
+    return strcspn(url, "?#");
+}
+
+/* Caller holds the lock; with create, a new endpoint takes a free entry if any */
+static oauth2_latency_endpoint_t *oauth2_latency_find(oauth2_latency_table_t *table, const char *url,
+                                                      int create) {
+    size_t len = oauth2_latency_key_len(url);
+    size_t name_len = len < OAUTH2_LATENCY_NAME_MAX - 1 ? len : OAUTH2_LATENCY_NAME_MAX - 1;
+    uint32_t hash = oauth2_string_hash(url, len);
+    for (int i = 0; i < table->count; i++) {
+        oauth2_latency_endpoint_t *endpoint = &table->endpoints[i];
+        if (endpoint->hash == hash && strncmp(endpoint->name, url, name_len) == 0 &&
+            endpoint->name[name_len] == '\0') {
+            return endpoint;
+        }
+    }
+    if (!create || table->count == OAUTH2_LATENCY_ENDPOINTS) {
+        return NULL;
+    }
+
+    oauth2_latency_endpoint_t *endpoint = &table->endpoints[table->count++];
+    memset(endpoint, 0, sizeof(*endpoint));
+    endpoint->hash = hash;
+    memcpy(endpoint->name, url, name_len);
+    endpoint->name[name_len] = '\0';
+    return endpoint;
+}
+
+/* Timeout of an endpoint; caller holds the lock */
+static long oauth2_latency_effective(const oauth2_latency_table_t *table,
+                                     const oauth2_latency_endpoint_t *endpoint) {
+    if (!endpoint || endpoint->samples < OAUTH2_LATENCY_MIN_SAMPLES) {
+        return table->max_ms;
+    }
+
+    /* Upper bound of the bucket holding the percentile */
+    uint32_t rank = (uint32_t)(((uint64_t)endpoint->samples * (uint64_t)table->percentile + 99) / 100);
+    uint32_t seen = 0;
+    double bound = OAUTH2_LATENCY_STEP;
+    for (int i = 0; i < OAUTH2_LATENCY_BUCKETS - 1; i++) {
+        seen += endpoint->buckets[i];
+        if (seen >= rank) break;
+        bound *= OAUTH2_LATENCY_STEP;
+    }
+
+    double timeout = (bound + 0.5) * table->multiplier;
+    if (timeout < (double)table->floor_ms) {
+        return table->floor_ms;
+    }
+    return timeout > (double)table->max_ms ? table->max_ms : (long)timeout;
+}
+
+long oauth2_latency_timeout_ms(oauth2_latency_table_t *table, const char *url) {
+    pthread_mutex_lock(&table->lock);
+    long timeout = oauth2_latency_effective(table, oauth2_latency_find(table, url, 0));
+    pthread_mutex_unlock(&table->lock);
+    return timeout;
+}
+
+void oauth2_latency_record(oauth2_latency_table_t *table, const char *url, long elapsed_ms, int timed_out) {
+    int bucket = 0;
+    for (double bound = OAUTH2_LATENCY_STEP; bucket < OAUTH2_LATENCY_BUCKETS - 1 && (double)elapsed_ms > bound;
+         bound *= OAUTH2_LATENCY_STEP) {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&table->lock);
+    oauth2_latency_endpoint_t *endpoint = oauth2_latency_find(table, url, 1);
+    table->timeouts += timed_out != 0;
+    if (endpoint) {
+        endpoint->requests++;
+        endpoint->timeouts += timed_out != 0;
+        endpoint->buckets[bucket]++;
+        if (++endpoint->samples >= OAUTH2_LATENCY_WINDOW) {
+            endpoint->samples = 0;
+            for (int i = 0; i < OAUTH2_LATENCY_BUCKETS; i++) {
+                endpoint->buckets[i] /= 2;
+                endpoint->samples += endpoint->buckets[i];
+            }
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+}
+
+int oauth2_latency_format(oauth2_latency_table_t *table, char *buf, size_t len) {
+    pthread_mutex_lock(&table->lock);
+    int n = snprintf(buf, len, " http_timeouts=%lu", table->timeouts);
+    size_t used = n > 0 ? (size_t)n : 0;
+    for (int i = 0; n >= 0 && used < len && i < table->count; i++) {
+        const oauth2_latency_endpoint_t *endpoint = &table->endpoints[i];
+        n = snprintf(buf + used, len - used, " timeout[%s]=%ldms:%lu/%lu", endpoint->name,
+                     oauth2_latency_effective(table, endpoint), endpoint->timeouts, endpoint->requests);
+        used += n > 0 ? (size_t)n : 0;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return n < 0 || used >= len ? SASL_BUFOVER : SASL_OK;
+}
@@ -0,0 +1,135 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Metrics
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Process-wide counters kept in the configuration and rendered as
+ * "name=value" pairs for logging.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdio.h>
+#include <string.h>
+
+int oauth2_metrics_format(oauth2_config_t *config, char *buf, size_t len) {
+    if (!config || !buf || len == 0) {
+        return SASL_BADPARAM;
+    }
+
+    static const char *breaker_names[] = { "closed", "open", "half-open" };
+    const oauth2_metrics_t *m = &config->metrics;
+    unsigned long userinfo_lookups = __atomic_load_n(&m->userinfo_lookups, __ATOMIC_RELAXED);
+    unsigned long userinfo_hits = __atomic_load_n(&m->userinfo_cache_hits, __ATOMIC_RELAXED);
+    unsigned long userinfo_requests = __atomic_load_n(&m->userinfo_requests, __ATOMIC_RELAXED);
+    unsigned long userinfo_latency = __atomic_load_n(&m->userinfo_latency_ms, __ATOMIC_RELAXED);
+    oauth2_secure_stats_t secure;
+    oauth2_secure_stats(&secure);
+    oauth2_pool_stats_t server_pool, client_pool;
+    oauth2_context_pool_stats(OAUTH2_POOL_SERVER, &server_pool);
+    oauth2_context_pool_stats(OAUTH2_POOL_CLIENT, &client_pool);
+    oauth2_client_token_stats_t client_tokens;
+    oauth2_client_token_stats(&client_tokens);
+    int n = snprintf(buf, len, "http_ok=%lu http_not_modified=%lu http_errors=%lu "
+                     "breaker_opened=%lu breaker_rejected=%lu deadline_exceeded=%lu "
+                     "introspection_requests=%lu introspection_cache_hits=%lu "
+                     "userinfo_lookups=%lu userinfo_cache_hits=%lu userinfo_hit_ratio=%.2f "
+                     "userinfo_requests=%lu userinfo_latency_avg_ms=%lu userinfo_latency_max_ms=%lu "
+                     "tokens_revoked=%lu mirror_failovers=%lu secure_in_use=%lu secure_dedicated=%lu "
+                     "secure_locked_bytes=%zu secure_lock_failures=%lu "
+                     "context_pool_allocated=%lu context_pool_reused=%lu context_pool_dropped=%lu "
+                     "context_pool_idle=%d context_pool_high_water=%d "
+                     "client_token_hits=%lu client_token_requests=%lu client_token_failures=%lu",
+                     __atomic_load_n(&m->http_ok, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->http_not_modified, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->http_errors, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->breaker_opened, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->breaker_rejected, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->deadline_exceeded, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->introspection_requests, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->introspection_cache_hits, __ATOMIC_RELAXED),
+                     userinfo_lookups, userinfo_hits,
+                     userinfo_lookups ? (double)userinfo_hits / (double)userinfo_lookups : 0.0,
+                     userinfo_requests, userinfo_requests ? userinfo_latency / userinfo_requests : 0,
+                     __atomic_load_n(&m->userinfo_latency_max_ms, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->tokens_revoked, __ATOMIC_RELAXED),
+                     __atomic_load_n(&m->mirror_failovers, __ATOMIC_RELAXED),
+                     secure.in_use, secure.dedicated, secure.bytes_locked, secure.lock_failures,
+                     server_pool.allocated + client_pool.allocated, server_pool.reused + client_pool.reused,
+                     server_pool.dropped + client_pool.dropped, server_pool.idle + client_pool.idle,
+                     server_pool.high_water + client_pool.high_water,
+                     client_tokens.hits, client_tokens.requests, client_tokens.failures);
+    if (n < 0 || (size_t)n >= len) {
+        return SASL_BUFOVER;
+    }
+
+    /* Breaker state and mirror health of each network provider, by position */
+    size_t used = (size_t)n;
+    for (int i = 0; i < config->providers_count; i++) {
+        oauth2_provider_t *provider = &config->providers[i];
+        if (provider->local_keys) continue;
+
+        n = snprintf(buf + used, len - used, " breaker[%d]=%s", i,
+                     breaker_names[oauth2_provider_breaker_state(provider)]);
+        if (n < 0 || (size_t)n >= len - used) {
+            return SASL_BUFOVER;
+        }
+        used += (size_t)n;
+
+        if (oauth2_mirror_format(provider, i, config->breaker_cooldown, buf + used, len - used) != SASL_OK) {
+            return SASL_BUFOVER;
+        }
+        used += strlen(buf + used);
+    }
+
+    /* Admission control, shared by every process using the table */
+    if (config->admission_burst > 0) {
+        oauth2_admission_stats_t admission;
+        oauth2_admission_stats(config, &admission);
+        n = snprintf(buf + used, len - used, " admission_failures=%lu admission_rejected=%lu "
+                     "admission_sources=%lu admission_throttled=%lu", admission.failures, admission.rejected,
+                     admission.sources, admission.throttled);
+        if (n < 0 || (size_t)n >= len - used) {
+            return SASL_BUFOVER;
+        }
+        used += (size_t)n;
+    }
+
+    /* Timeouts and effective timeout of each endpoint */
+    if (config->latency && oauth2_latency_format(config->latency, buf + used, len - used) != SASL_OK) {
+        return SASL_BUFOVER;
+    }
+
+    return SASL_OK;
+}
+
+/* Every counter is carried by oauth2_metrics_carry(): a new one must be listed there */
+_Static_assert(sizeof(oauth2_metrics_t) == 15 * sizeof(unsigned long),
+               "oauth2_metrics_carry() does not list every counter");
+
+/* Add the counters of a replaced configuration to its successor's, one field at a time */
+void oauth2_metrics_carry(oauth2_metrics_t *to, oauth2_metrics_t *from) {
+#define OAUTH2_METRIC_CARRY(counter) \
+    __atomic_fetch_add(&to->counter, __atomic_load_n(&from->counter, __ATOMIC_RELAXED), __ATOMIC_RELAXED)
+    OAUTH2_METRIC_CARRY(http_ok);
+    OAUTH2_METRIC_CARRY(http_not_modified);
+    OAUTH2_METRIC_CARRY(http_errors);
+    OAUTH2_METRIC_CARRY(breaker_opened);
+    OAUTH2_METRIC_CARRY(breaker_rejected);
+    OAUTH2_METRIC_CARRY(deadline_exceeded);
+    OAUTH2_METRIC_CARRY(introspection_requests);
+    OAUTH2_METRIC_CARRY(introspection_cache_hits);
+    OAUTH2_METRIC_CARRY(userinfo_lookups);
+    OAUTH2_METRIC_CARRY(userinfo_cache_hits);
+    OAUTH2_METRIC_CARRY(userinfo_requests);
+    OAUTH2_METRIC_CARRY(userinfo_latency_ms);
+    OAUTH2_METRIC_CARRY(tokens_revoked);
+    OAUTH2_METRIC_CARRY(mirror_failovers);
+#undef OAUTH2_METRIC_CARRY
+
+    /* A maximum, not a count */
+    unsigned long slowest = __atomic_load_n(&from->userinfo_latency_max_ms, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&to->userinfo_latency_max_ms, __ATOMIC_RELAXED);
+    while (slowest > max &&
+           !__atomic_compare_exchange_n(&to->userinfo_latency_max_ms, &max, slowest,
+                                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
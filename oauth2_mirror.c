@@ -0,0 +1,222 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Provider Mirrors
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * An IdP served from several sites declares the other origins of its
+ * discovery URL, one provider with several ways to reach it:
+ *
+ *   oauth2_provider1_mirrors: https://idp-dc2.example.com https://idp-dc3.example.com
+ *
+ * Documents whose URL is on the provider's own origin (discovery, and the
+ * JWKS when the IdP serves it there) can be fetched from any mirror. Each
+ * keeps moving averages of its fetch latency and error rate; refreshes go
+ * to the healthy mirror with the lowest latency once stretched by its
+ * error rate, one never answering first, and move on to the next at once
+ * when a fetch fails. A failed mirror is last in line for
+ * oauth2_breaker_cooldown seconds.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Weight of the newest sample in the moving averages */
+#define OAUTH2_MIRROR_ALPHA 0.2
+
+/* Error rate counted at most, so that a flaky mirror still gets tried again */
+#define OAUTH2_MIRROR_MAX_ERROR_RATE 0.9
+
+/* Length of the "scheme://host[:port]" part of url, 0 if it has none */
+static size_t oauth2_mirror_origin_len(const char *url, size_t len) {
+    const char *scheme = NULL;
+    for (size_t i = 0; i + 3 <= len && url[i] != '/'; i++) {
+        if (memcmp(url + i, "://", 3) == 0) {
+            scheme = url + i;
+            break;
+        }
+    }
+    if (!scheme || scheme == url || (size_t)(scheme + 3 - url) == len) {
+        return 0;
+    }
+    const char *path = memchr(scheme + 3, '/', len - (size_t)(scheme + 3 - url));
+    return path ? (size_t)(path - url) : len;
+}
+
+int oauth2_mirror_setup(const sasl_utils_t *utils, oauth2_provider_t *provider, const char *origins) {
+    provider->mirrors = NULL;
+    provider->mirrors_count = 0;
+    if (!origins) {
+        return SASL_OK;
+    }
+
+    size_t own_len = oauth2_mirror_origin_len(provider->discovery_url, strlen(provider->discovery_url));
+    if (own_len == 0) {
+        OAUTH2_LOG_ERR(utils, "%s needs an absolute discovery URL: %s", OAUTH2_CONF_MIRRORS,
+                       provider->discovery_url);
+        return SASL_BADPARAM;
+    }
+    oauth2_mirror_t mirrors[OAUTH2_MIRRORS_MAX];
+    memset(mirrors, 0, sizeof(mirrors));
+    mirrors[0].origin = provider->discovery_url;
+    mirrors[0].origin_len = own_len;
+    int count = 1;
+
+    for (const char *p = origins; *p; ) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && *p != ' ' && *p != '\t') p++;
+        size_t len = (size_t)(p - start);
+        if (len > 0 && start[len - 1] == '/') {
+            len--;
+        }
+
+        if (oauth2_mirror_origin_len(start, len) != len) {
+            OAUTH2_LOG_ERR(utils, "Invalid %s entry '%.*s': expected scheme://host[:port]", OAUTH2_CONF_MIRRORS,
+                           (int)(p - start), start);
+            return SASL_BADPARAM;
+        }
+        if (count == OAUTH2_MIRRORS_MAX) {
+            OAUTH2_LOG_ERR(utils, "Too many %s for %s (at most %d)", OAUTH2_CONF_MIRRORS,
+                           provider->discovery_url, OAUTH2_MIRRORS_MAX - 1);
+            return SASL_BADPARAM;
+        }
+        mirrors[count].origin = start;
+        mirrors[count].origin_len = len;
+        count++;
+    }
+    if (count == 1) {
+        return SASL_OK;
+    }
+
+    provider->mirrors = malloc((size_t)count * sizeof(oauth2_mirror_t));
+    if (!provider->mirrors) {
+        return SASL_NOMEM;
+    }
+    memcpy(provider->mirrors, mirrors, (size_t)count * sizeof(oauth2_mirror_t));
+    provider->mirrors_count = count;
+    return SASL_OK;
+}
+
+/* Caller holds previous->lock: the previous snapshot may still be fetching */
+void oauth2_mirror_inherit(oauth2_provider_t *provider, const oauth2_provider_t *previous) {
+    for (int i = 0; i < provider->mirrors_count; i++) {
+        oauth2_mirror_t *mirror = &provider->mirrors[i];
+        for (int j = 0; j < previous->mirrors_count; j++) {
+            const oauth2_mirror_t *same = &previous->mirrors[j];
+            if (same->origin_len == mirror->origin_len &&
+                memcmp(same->origin, mirror->origin, mirror->origin_len) == 0) {
+                mirror->latency_ms = same->latency_ms;
+                mirror->error_rate = same->error_rate;
+                mirror->requests = same->requests;
+                mirror->failures = same->failures;
+                mirror->failed_at = same->failed_at;
+                break;
+            }
+        }
+    }
+}
+
+/* Caller holds the lock */
+static int oauth2_mirror_failing(const oauth2_mirror_t *mirror, int cooldown, time_t now) {
+    return mirror->failed_at && now - mirror->failed_at < cooldown;
+}
+
+/* Expected time to a good answer: the latency stretched by the retries its error rate predicts */
+static double oauth2_mirror_cost(const oauth2_mirror_t *mirror) {
+    if (mirror->requests == mirror->failures) {
+        return 0;                   /* Never answered: tried first, so that every mirror gets measured */
+    }
+    double error_rate = mirror->error_rate < OAUTH2_MIRROR_MAX_ERROR_RATE ? mirror->error_rate
+                                                                         : OAUTH2_MIRROR_MAX_ERROR_RATE;
+    return mirror->latency_ms / (1.0 - error_rate);
+}
+
+/* Whether a mirror should be tried before another: healthy first, then cheapest or oldest failure */
+static int oauth2_mirror_before(const oauth2_mirror_t *a, const oauth2_mirror_t *b, int cooldown, time_t now) {
+    int a_failing = oauth2_mirror_failing(a, cooldown, now);
+    int b_failing = oauth2_mirror_failing(b, cooldown, now);
+    if (a_failing != b_failing) {
+        return !a_failing;
+    }
+    if (a_failing) {
+        return a->failed_at < b->failed_at;
+    }
+    return oauth2_mirror_cost(a) < oauth2_mirror_cost(b);
+}
+
+int oauth2_mirror_order(oauth2_provider_t *provider, const char *url, int cooldown, int *order) {
+    if (provider->mirrors_count == 0) {
+        return 0;
+    }
+    const oauth2_mirror_t *own = &provider->mirrors[0];
+    if (strncmp(url, own->origin, own->origin_len) != 0 ||
+        (url[own->origin_len] != '/' && url[own->origin_len] != '\0')) {
+        return 0;
+    }
+
+    /* A handful of entries: insertion sort, stable so that ties keep the configured order */
+    time_t now = time(NULL);
+    pthread_mutex_lock(&provider->lock);
+    int count = provider->mirrors_count;
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        while (j > 0 && oauth2_mirror_before(&provider->mirrors[i], &provider->mirrors[order[j - 1]],
+                                             cooldown, now)) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    pthread_mutex_unlock(&provider->lock);
+    return count;
+}
+
+char *oauth2_mirror_url(const oauth2_provider_t *provider, int mirror, const char *url) {
+    const oauth2_mirror_t *own = &provider->mirrors[0];
+    const oauth2_mirror_t *to = &provider->mirrors[mirror];
+    const char *path = url + own->origin_len;
+    size_t path_len = strlen(path);
+    char *mirrored = malloc(to->origin_len + path_len + 1);
+    if (mirrored) {
+        memcpy(mirrored, to->origin, to->origin_len);
+        memcpy(mirrored + to->origin_len, path, path_len + 1);
+    }
+    return mirrored;
+}
+
+void oauth2_mirror_record(oauth2_provider_t *provider, int mirror, int success, long latency_ms) {
+    pthread_mutex_lock(&provider->lock);
+    oauth2_mirror_t *m = &provider->mirrors[mirror];
+    int first = m->requests == m->failures;
+    m->requests++;
+    m->error_rate += OAUTH2_MIRROR_ALPHA * ((success ? 0.0 : 1.0) - m->error_rate);
+    if (success) {
+        m->latency_ms = first ? (double)latency_ms
+                              : m->latency_ms + OAUTH2_MIRROR_ALPHA * ((double)latency_ms - m->latency_ms);
+    } else {
+        m->failures++;
+        m->failed_at = time(NULL);
+    }
+    pthread_mutex_unlock(&provider->lock);
+}
+
+int oauth2_mirror_format(oauth2_provider_t *provider, int index, int cooldown, char *buf, size_t len) {
+    size_t used = 0;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&provider->lock);
+    for (int i = 0; i < provider->mirrors_count; i++) {
+        const oauth2_mirror_t *m = &provider->mirrors[i];
+        int n = snprintf(buf + used, len - used, " mirror[%d.%d]=%.*s:%s:%.0fms:%.2f:%lu/%lu", index, i,
+                         (int)m->origin_len, m->origin, oauth2_mirror_failing(m, cooldown, now) ? "failing" : "ok",
+                         m->latency_ms, m->error_rate, m->failures, m->requests);
+        if (n < 0 || (size_t)n >= len - used) {
+            pthread_mutex_unlock(&provider->lock);
+            return SASL_BUFOVER;
+        }
+        used += (size_t)n;
+    }
+    pthread_mutex_unlock(&provider->lock);
+    return SASL_OK;
+}
@@ -22,6 +22,12 @@
 #include <oauth2/oauth2.h>
 #include <oauth2/mem.h>
 #include <oauth2/openidc.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <jansson.h>
+#include <regex.h>
 #include "oauth2_types.h"
 
 /* Plugin version and identification */
@@ -37,16 +43,57 @@
 #define OAUTH2_CONF_DISCOVERY_URLS "oauth2_discovery_urls"  /* Space-separated list */
 #define OAUTH2_CONF_ISSUER "oauth2_issuer"
 #define OAUTH2_CONF_ISSUERS "oauth2_issuers"  /* Space-separated list */
+#define OAUTH2_CONF_TENANT_ISSUERS "oauth2_tenant_issuers"  /* Space-separated patterns (oauth2_tenants.c) */
+#define OAUTH2_CONF_TENANT_CACHE_MEMORY "oauth2_tenant_cache_memory"  /* MiB */
+#define OAUTH2_CONF_TENANT_IDLE_TIMEOUT "oauth2_tenant_idle_timeout"
 #define OAUTH2_CONF_CLIENT_ID "oauth2_client_id"
 #define OAUTH2_CONF_CLIENT_SECRET "oauth2_client_secret"
 #define OAUTH2_CONF_AUDIENCE "oauth2_audience"
 #define OAUTH2_CONF_AUDIENCES "oauth2_audiences"  /* Space-separated list */
 #define OAUTH2_CONF_SCOPE "oauth2_scope"
-#define OAUTH2_CONF_USER_CLAIM "oauth2_user_claim"
+#define OAUTH2_CONF_USER_CLAIM "oauth2_user_claim"  /* Claim names or JSON pointers, first present wins */
+#define OAUTH2_CONF_USER_TRANSFORM "oauth2_user_transform"  /* Space-separated steps (oauth2_usermap.c) */
+#define OAUTH2_CONF_ALLOWED_ALGS "oauth2_allowed_algs"  /* Space-separated list */
+#define OAUTH2_CONF_CLAIM_POLICY "oauth2_claim_policy"  /* Rules separated by ';' (oauth2_policy.c) */
 #define OAUTH2_CONF_VERIFY_SIGNATURE "oauth2_verify_signature"
 #define OAUTH2_CONF_SSL_VERIFY "oauth2_ssl_verify"
 #define OAUTH2_CONF_TIMEOUT "oauth2_timeout"
+#define OAUTH2_CONF_TIMEOUT_PERCENTILE "oauth2_timeout_percentile"
+#define OAUTH2_CONF_TIMEOUT_MULTIPLIER "oauth2_timeout_multiplier"
+#define OAUTH2_CONF_TIMEOUT_FLOOR_MS "oauth2_timeout_floor_ms"
 #define OAUTH2_CONF_DEBUG "oauth2_debug"
+#define OAUTH2_CONF_JWKS_FILE "oauth2_jwks_file"
+#define OAUTH2_CONF_JWKS_FILES "oauth2_jwks_files"  /* Space-separated list, one per provider */
+#define OAUTH2_CONF_PUBLIC_KEY_FILES "oauth2_public_key_files"  /* Space-separated list, one per provider */
+#define OAUTH2_CONF_KEY_RELOAD_INTERVAL "oauth2_key_reload_interval"
+#define OAUTH2_CONF_STATE_DIR "oauth2_state_dir"
+#define OAUTH2_CONF_REFRESH_MIN_INTERVAL "oauth2_refresh_min_interval"
+#define OAUTH2_CONF_REFRESH_MAX_INTERVAL "oauth2_refresh_max_interval"
+#define OAUTH2_CONF_BREAKER_THRESHOLD "oauth2_breaker_threshold"
+#define OAUTH2_CONF_BREAKER_COOLDOWN "oauth2_breaker_cooldown"
+#define OAUTH2_CONF_WARMUP_TIMEOUT "oauth2_warmup_timeout"
+#define OAUTH2_CONF_TOKEN_VALIDATION "oauth2_token_validation"  /* Space-separated list, one per provider */
+#define OAUTH2_CONF_MIRRORS "oauth2_mirrors"  /* Space-separated origins (oauth2_mirror.c) */
+#define OAUTH2_CONF_INTROSPECTION_CACHE_TTL "oauth2_introspection_cache_ttl"
+#define OAUTH2_CONF_INTROSPECTION_CACHE_SIZE "oauth2_introspection_cache_size"
+#define OAUTH2_CONF_USERINFO_FALLBACK "oauth2_userinfo_fallback"
+#define OAUTH2_CONF_USERINFO_CACHE_TTL "oauth2_userinfo_cache_ttl"
+#define OAUTH2_CONF_USERINFO_CACHE_SIZE "oauth2_userinfo_cache_size"
+#define OAUTH2_CONF_REVOCATION_FILE "oauth2_revocation_file"
+#define OAUTH2_CONF_CONFIG_FILE "oauth2_config_file"
+#define OAUTH2_CONF_CONFIG_RELOAD_INTERVAL "oauth2_config_reload_interval"
+#define OAUTH2_CONF_CONTEXT_POOL_SIZE "oauth2_context_pool_size"
+#define OAUTH2_CONF_CLIENT_USER "oauth2_client_user"
+#define OAUTH2_CONF_CLIENT_GRANT "oauth2_client_grant"
+#define OAUTH2_CONF_CLIENT_REFRESH_TOKEN "oauth2_client_refresh_token"
+#define OAUTH2_CONF_CLIENT_REFRESH_MARGIN "oauth2_client_refresh_margin"
+#define OAUTH2_CONF_CLIENT_TOKEN_HELPER "oauth2_client_token_helper"
+#define OAUTH2_CONF_ADMISSION_BURST "oauth2_admission_burst"
+#define OAUTH2_CONF_ADMISSION_RATE "oauth2_admission_rate"
+#define OAUTH2_CONF_ADMISSION_IPV4_PREFIX "oauth2_admission_ipv4_prefix"
+#define OAUTH2_CONF_ADMISSION_IPV6_PREFIX "oauth2_admission_ipv6_prefix"
+#define OAUTH2_CONF_ADMISSION_ENTRIES "oauth2_admission_entries"
+#define OAUTH2_CONF_ADMISSION_FILE "oauth2_admission_file"
 
 /* Plugin API definition */
 #ifdef WIN32
@@ -59,46 +106,937 @@
 #define OAUTH2_DEFAULT_USER_CLAIM "email"
 #define OAUTH2_DEFAULT_SCOPE "openid email profile"
 #define OAUTH2_DEFAULT_TIMEOUT 10
+#define OAUTH2_DEFAULT_TIMEOUT_PERCENTILE 99
+#define OAUTH2_DEFAULT_TIMEOUT_MULTIPLIER 3
+#define OAUTH2_DEFAULT_TIMEOUT_FLOOR_MS 1000
 #define OAUTH2_DEFAULT_VERIFY_SIGNATURE 1
 #define OAUTH2_DEFAULT_SSL_VERIFY 1
 #define OAUTH2_DEFAULT_DEBUG 0
+#define OAUTH2_DEFAULT_KEY_RELOAD_INTERVAL 5
+#define OAUTH2_DEFAULT_REFRESH_MIN_INTERVAL 60
+#define OAUTH2_DEFAULT_REFRESH_MAX_INTERVAL 86400
+#define OAUTH2_DEFAULT_BREAKER_THRESHOLD 5
+#define OAUTH2_DEFAULT_BREAKER_COOLDOWN 30
+#define OAUTH2_DEFAULT_WARMUP_TIMEOUT 10
+#define OAUTH2_DEFAULT_INTROSPECTION_CACHE_TTL 300
+#define OAUTH2_DEFAULT_INTROSPECTION_CACHE_SIZE 4096
+#define OAUTH2_DEFAULT_USERINFO_FALLBACK 0
+#define OAUTH2_DEFAULT_USERINFO_CACHE_TTL 300
+#define OAUTH2_DEFAULT_USERINFO_CACHE_SIZE 4096
+#define OAUTH2_DEFAULT_CONFIG_RELOAD_INTERVAL 5
+#define OAUTH2_DEFAULT_TENANT_CACHE_MEMORY 64
+#define OAUTH2_DEFAULT_TENANT_IDLE_TIMEOUT 3600
+#define OAUTH2_DEFAULT_CONTEXT_POOL_SIZE 64
+#define OAUTH2_DEFAULT_CLIENT_REFRESH_MARGIN 60
+#define OAUTH2_DEFAULT_ADMISSION_BURST 30
+#define OAUTH2_DEFAULT_ADMISSION_RATE 10
+#define OAUTH2_DEFAULT_ADMISSION_IPV4_PREFIX 32
+#define OAUTH2_DEFAULT_ADMISSION_IPV6_PREFIX 64
+#define OAUTH2_DEFAULT_ADMISSION_ENTRIES 16384
+
+/* Client mechanism of a connection (oauth2_client_context_t.mech) */
+#define OAUTH2_CLIENT_XOAUTH2 0
+#define OAUTH2_CLIENT_OAUTHBEARER 1
+
+/*
+ * Per-provider settings: "oauth2_provider<N>_" and the global key without
+ * "oauth2_", e.g. oauth2_provider2_user_claim. A block with
+ * oauth2_provider<N>_issuer belongs to the provider of that issuer (or
+ * discovery URL) wherever it is listed; otherwise N counts providers from 1.
+ * Applies to audiences, user_claim, user_transform, allowed_algs,
+ * claim_policy, token_validation, mirrors and the introspection and
+ * userinfo cache TTLs.
+ */
+#define OAUTH2_CONF_PROVIDER_PREFIX "oauth2_provider"
+#define OAUTH2_CONF_PROVIDER_ISSUER "oauth2_issuer"  /* Only as oauth2_provider<N>_issuer */
+
+/* Token validation modes (oauth2_token_validation) */
+#define OAUTH2_VALIDATION_JWT "jwt"
+#define OAUTH2_VALIDATION_INTROSPECTION "introspection"
+
+/* Client token grants (oauth2_client_grant) */
+#define OAUTH2_GRANT_REFRESH_TOKEN "refresh_token"
+#define OAUTH2_GRANT_CLIENT_CREDENTIALS "client_credentials"
+#define OAUTH2_GRANT_HELPER "helper"     /* oauth2_client_token_helper instead of the token endpoint */
+
+/* Key file list placeholder for providers that fetch their keys from the network */
+#define OAUTH2_KEY_FILE_NONE "-"
+
+/* Memory mapped read-only file (oauth2_file.c) */
+typedef struct oauth2_file_map {
+    const char *data;
+    size_t len;
+} oauth2_file_map_t;
+
+/* Change detection for a local file (oauth2_file.c) */
+typedef struct oauth2_file_watch {
+    char *path;
+    const char *name;               /* Basename within path */
+    int inotify_fd;                 /* -1 when polling */
+    int interval;                   /* Seconds between polls */
+    time_t last_check;
+    ino_t ino;
+    struct timespec mtime;          /* Full resolution, so same-second rewrites are seen */
+    struct timespec ctime;
+    off_t size;
+} oauth2_file_watch_t;
+
+/* Immutable, reference counted set of verification keys (oauth2_keys.c) */
+typedef struct oauth2_keyset {
+    int refcount;
+    int key_count;
+    int skipped_count;              /* JWKs of the set that could not be loaded */
+    oauth2_cfg_token_verify_t *verify;  /* liboauth2 verifier chain, one entry per key */
+} oauth2_keyset_t;
+
+/* Key source of one provider; the current key set is swapped atomically */
+typedef struct oauth2_key_store {
+    pthread_mutex_t lock;           /* Protects current */
+    pthread_mutex_t reload_lock;    /* Held by the single reloading caller */
+    oauth2_keyset_t *current;
+    oauth2_file_watch_t *watches;   /* Local key files, if any */
+    int files_count;
+    pid_t watch_pid;                /* Process the watches were armed in */
+    char *options;                  /* liboauth2 verify options */
+    oauth2_log_t *log;
+} oauth2_key_store_t;
+
+/* Immutable, reference counted revocation index built from one file (oauth2_revocation.c) */
+typedef struct oauth2_revocation_slot {
+    uint32_t tag;                   /* High hash bits, 0 for an empty slot */
+    uint32_t offset;                /* Key in pool: type byte ('j' or 's') then the NUL terminated id */
+    long long cutoff;               /* "sub" entries: tokens issued before this time are revoked */
+} oauth2_revocation_slot_t;
+
+typedef struct oauth2_revocation_set {
+    int refcount;
+    size_t count;                   /* Distinct entries */
+    uint64_t *bloom;                /* Blocked Bloom filter, 512-bit blocks */
+    size_t bloom_blocks;
+    oauth2_revocation_slot_t *slots;/* Exact set, linear probing */
+    size_t slots_count;
+    char *pool;
+    size_t pool_len;
+} oauth2_revocation_set_t;
+
+/* Revocation file; the current set is swapped atomically on change */
+typedef struct oauth2_revocation_list {
+    pthread_mutex_t lock;           /* Protects current */
+    pthread_mutex_t reload_lock;    /* Held by the single reloading caller */
+    oauth2_revocation_set_t *current;
+    oauth2_file_watch_t watch;
+    pid_t watch_pid;                /* Process the watch was armed in */
+} oauth2_revocation_list_t;
+
+/* HTTP response body (oauth2_http.c) */
+typedef struct oauth2_http_response {
+    long status;
+    char *body;                     /* NUL terminated */
+    size_t len;
+    
+    /* Caching headers */
+    char *etag;
+    char *last_modified;
+    long max_age;                   /* Cache-Control max-age, -1 when absent */
+    long age;                       /* Age header */
+    int no_store;
+    time_t expires;                 /* Expires header, 0 when absent */
+} oauth2_http_response_t;
+
+/* Cached IdP document with its freshness window and validators */
+typedef struct oauth2_http_doc {
+    char *body;                     /* NUL terminated, NULL when absent */
+    size_t len;
+    time_t fetched_at;              /* Last fetch or successful revalidation */
+    time_t expires_at;
+    char *etag;
+    char *last_modified;
+    int no_store;                   /* Never persisted to disk */
+} oauth2_http_doc_t;
+
+/* One transfer of a concurrent batch (oauth2_http_get_many) or of a caller's multi handle */
+typedef struct oauth2_http_transfer {
+    const char *url;
+    const oauth2_http_doc_t *cached; /* Validators for a conditional request, or NULL */
+    const char *fields;             /* Form body of a POST, NULL for a GET */
+    const char *username;           /* HTTP Basic client authentication of the POST, or NULL */
+    const char *password;
+    const char *bearer;             /* Access token of a GET to a protected resource, or NULL */
+    oauth2_http_response_t response;
+    int result;                     /* SASL_OK once a response was received */
+    void *handle;                   /* libcurl state while the transfer runs */
+    void *headers;
+    int code;                       /* libcurl result once finished */
+} oauth2_http_transfer_t;
+
+/* Transfers driven by the caller's own loop (oauth2_http.c) */
+typedef struct oauth2_http_multi oauth2_http_multi_t;
+
+/* Absolute CLOCK_MONOTONIC deadline in milliseconds, 0 for none (oauth2_http.c) */
+typedef long long oauth2_deadline_t;
+
+/* Per-provider circuit breaker state */
+typedef enum {
+    OAUTH2_BREAKER_CLOSED = 0,      /* Calls allowed */
+    OAUTH2_BREAKER_OPEN,            /* Calls refused until the cooldown elapses */
+    OAUTH2_BREAKER_HALF_OPEN        /* A single probe call in flight */
+} oauth2_breaker_state_t;
+
+/* Process-wide counters, updated with relaxed atomics */
+typedef struct oauth2_metrics {
+    unsigned long http_ok;          /* 200 responses */
+    unsigned long http_not_modified;/* 304 responses */
+    unsigned long http_errors;      /* Transport errors and unexpected statuses */
+    unsigned long breaker_opened;   /* Closed or half-open to open transitions */
+    unsigned long breaker_rejected; /* Calls refused by an open breaker */
+    unsigned long deadline_exceeded;/* Logins out of time for network work */
+    unsigned long introspection_requests;   /* Calls to introspection endpoints */
+    unsigned long introspection_cache_hits; /* Answered from the cache, including coalesced waiters */
+    unsigned long userinfo_lookups;         /* User claim fallbacks to the userinfo endpoint */
+    unsigned long userinfo_cache_hits;      /* Answered from the (iss, sub) cache */
+    unsigned long userinfo_requests;        /* Calls to userinfo endpoints */
+    unsigned long userinfo_latency_ms;      /* Total time spent in userinfo requests */
+    unsigned long userinfo_latency_max_ms;  /* Slowest userinfo request */
+    unsigned long tokens_revoked;           /* Valid tokens rejected by the revocation list */
+    unsigned long mirror_failovers;         /* Fetches retried on the next mirror */
+} oauth2_metrics_t;
+
+/* Latency digests of IdP endpoints for adaptive request timeouts (oauth2_latency.c) */
+#define OAUTH2_LATENCY_BUCKETS 64           /* Bucket i ends at 2^((i+1)/4) ms: 1 ms to 65 s */
+#define OAUTH2_LATENCY_ENDPOINTS 32
+#define OAUTH2_LATENCY_NAME_MAX 96
+
+typedef struct oauth2_latency_endpoint {
+    uint32_t hash;                  /* Of the URL without its query */
+    char name[OAUTH2_LATENCY_NAME_MAX];     /* The URL without its query, truncated */
+    uint32_t buckets[OAUTH2_LATENCY_BUCKETS];
+    uint32_t samples;               /* Sum of the buckets, halved with them to favour recent samples */
+    unsigned long requests;         /* Transfers measured */
+    unsigned long timeouts;         /* Transfers cut short by their timeout */
+} oauth2_latency_endpoint_t;
+
+typedef struct oauth2_latency_table {
+    pthread_mutex_t lock;
+    int percentile;                 /* 1 to 100 */
+    int multiplier;
+    long floor_ms;
+    long max_ms;                    /* oauth2_timeout, used until an endpoint has enough samples */
+    int count;                      /* Endpoints tracked; later ones keep max_ms */
+    unsigned long timeouts;
+    oauth2_latency_endpoint_t endpoints[OAUTH2_LATENCY_ENDPOINTS];
+} oauth2_latency_table_t;
+
+/* Failed logins per source address prefix, shared by the server processes (oauth2_admission.c) */
+#define OAUTH2_ADMISSION_MAX_BURST 1000
+
+typedef struct oauth2_admission_stats {
+    unsigned long entries;          /* Size of the table */
+    unsigned long sources;          /* Prefixes with a recent failure */
+    unsigned long throttled;        /* Prefixes currently refused */
+    unsigned long failures;         /* Failed logins recorded, all processes */
+    unsigned long rejected;         /* Logins refused before any token work, all processes */
+} oauth2_admission_stats_t;
+
+/* Secure slab for bearer tokens (oauth2_secure.c) */
+#define OAUTH2_SECURE_CLASSES 4
+
+typedef struct oauth2_secure_stats {
+    unsigned long in_use;           /* Slots handed out */
+    unsigned long dedicated;        /* Tokens too large for any class, given their own mapping */
+    size_t bytes_locked;            /* Slab memory locked with mlock() */
+    unsigned long lock_failures;    /* Mappings left unlocked (RLIMIT_MEMLOCK) */
+} oauth2_secure_stats_t;
+
+/* Secure buffer attached to each server context; larger tokens take a slab slot of their own */
+#define OAUTH2_TOKEN_BUFFER_SIZE 4096
+
+/* Largest token helper answer, the largest slab class */
+#define OAUTH2_TOKEN_HELPER_MAX_RESPONSE 16384
+
+/* Freelists of disposed connection contexts (oauth2_pool.c) */
+typedef enum {
+    OAUTH2_POOL_SERVER = 0,
+    OAUTH2_POOL_CLIENT,
+    OAUTH2_POOL_KINDS
+} oauth2_pool_kind_t;
+
+typedef struct oauth2_pool_stats {
+    unsigned long allocated;        /* Contexts created */
+    unsigned long reused;           /* Contexts handed out again from the freelist */
+    unsigned long dropped;          /* Disposed contexts freed because the freelist was full */
+    int idle;                       /* Contexts on the freelist */
+    int high_water;                 /* Most contexts ever idle at once */
+} oauth2_pool_stats_t;
+
+/* Client token cache counters (oauth2_tokens.c) */
+typedef struct oauth2_client_token_stats {
+    unsigned long hits;             /* Connections served a cached token */
+    unsigned long requests;         /* Token endpoint requests */
+    unsigned long background;       /* Refreshes started ahead of expiry, off the connection path */
+    unsigned long waits;            /* Connections that waited for another connection's request */
+    unsigned long failures;         /* Token endpoint requests that brought no token */
+} oauth2_client_token_stats_t;
+
+/* Asynchronous validation (oauth2_async.c); username is NULL unless result is SASL_OK */
+typedef void (*oauth2_validate_cb_t)(void *arg, int result, const char *username);
+typedef struct oauth2_validator oauth2_validator_t;
+
+#define OAUTH2_METRIC_INC(config, counter) \
+    __atomic_fetch_add(&(config)->metrics.counter, 1, __ATOMIC_RELAXED)
+
+/*
+ * Strings of the list settings of one configuration, back to back and
+ * interned: an issuer that is also an audience is stored once. The hash
+ * index only lives while the configuration loads; the data is stable from
+ * then on (oauth2_config.c).
+ */
+typedef struct oauth2_string_pool {
+    char *data;                     /* NUL-terminated strings */
+    size_t len;
+    size_t size;
+    uint32_t *slots;                /* Open addressing on offset + 1, 0 for a free slot */
+    size_t slots_count;
+    size_t interned;
+} oauth2_string_pool_t;
+
+/* oauth2_string_pool_intern() out of memory */
+#define OAUTH2_STRING_NONE UINT32_MAX
+
+/* A space-separated setting: offsets into the string pool and lengths, in one allocation */
+typedef struct oauth2_string_list {
+    uint32_t *offsets;
+    uint32_t *lengths;
+    int count;
+} oauth2_string_list_t;
+
+/* Claim policy operators */
+typedef enum {
+    OAUTH2_CLAIM_HAS = 0,           /* Every value present */
+    OAUTH2_CLAIM_ANY,               /* At least one value present */
+    OAUTH2_CLAIM_EQUALS,            /* The single value */
+    OAUTH2_CLAIM_IN,                /* One of the values */
+    OAUTH2_CLAIM_PREFIX             /* Starts with one of the values */
+} oauth2_claim_op_t;
+
+/* Values of a "has" rule, tracked in a 64-bit set */
+#define OAUTH2_CLAIM_MAX_VALUES 64
+
+/* One rule of a compiled claim policy, its values and hash slots are ranges of the policy's arrays */
+typedef struct oauth2_claim_rule {
+    uint32_t claim;                 /* Claim name, offset into the string pool */
+    oauth2_claim_op_t op;
+    uint32_t values;                /* First value */
+    uint32_t values_count;
+    uint32_t slots;                 /* First hash slot: value index + 1, 0 for a free slot */
+    uint32_t slots_mask;            /* Slots - 1, none for "prefix" */
+} oauth2_claim_rule_t;
+
+/* oauth2_claim_policy compiled at load, every rule must hold (oauth2_policy.c) */
+typedef struct oauth2_claim_policy {
+    oauth2_claim_rule_t *rules;
+    int count;
+    uint32_t *offsets;              /* Values into the string pool; one allocation with the arrays below */
+    uint32_t *lengths;
+    uint32_t *hashes;
+    uint32_t *slots;
+} oauth2_claim_policy_t;
+
+/* One reference token of a user claim path */
+typedef struct oauth2_user_segment {
+    uint32_t name;                  /* Member name, offset into the string pool */
+    uint32_t index;                 /* Array index, OAUTH2_STRING_NONE if the name is not one */
+} oauth2_user_segment_t;
+
+/* One entry of oauth2_user_claim: a range of the map's segments */
+typedef struct oauth2_user_path {
+    uint32_t segments;
+    uint32_t segments_count;
+} oauth2_user_path_t;
+
+/* Username transformation steps (oauth2_user_transform) */
+typedef enum {
+    OAUTH2_USER_LOWERCASE = 0,
+    OAUTH2_USER_STRIP_REALM,
+    OAUTH2_USER_APPEND_REALM,
+    OAUTH2_USER_REGEX
+} oauth2_user_op_t;
+
+typedef struct oauth2_user_step {
+    oauth2_user_op_t op;
+    uint32_t arg;                   /* Realm, offset into the string pool */
+    uint32_t arg_len;
+    regex_t *regex;                 /* Compiled at load */
+} oauth2_user_step_t;
+
+/* oauth2_user_claim and oauth2_user_transform compiled at load (oauth2_usermap.c) */
+typedef struct oauth2_user_map {
+    oauth2_user_path_t *paths;      /* Tried in order */
+    int paths_count;
+    oauth2_user_segment_t *segments;
+    int segments_count;
+    oauth2_user_step_t *steps;
+    int steps_count;
+    size_t growth;                  /* Bytes the steps may add to a username */
+} oauth2_user_map_t;
+
+/* Settings of one provider: its oauth2_provider<N>_* keys over the global ones (oauth2_config.c) */
+typedef struct oauth2_issuer_policy {
+    oauth2_string_list_t audiences;
+    const char *user_claim;
+    oauth2_user_map_t user_map;
+    oauth2_string_list_t allowed_algs;  /* JWS "alg" values accepted, empty for any */
+    oauth2_claim_policy_t claims;
+    int introspection_cache_ttl;
+    int userinfo_cache_ttl;
+} oauth2_issuer_policy_t;
+
+/* Origin serving the same documents as a provider's own, with its observed health (oauth2_mirror.c) */
+typedef struct oauth2_mirror {
+    const char *origin;             /* "scheme://host[:port]", not NUL terminated */
+    size_t origin_len;
+    double latency_ms;              /* Moving average of successful fetches */
+    double error_rate;              /* Moving average of failures, 0 to 1 */
+    unsigned long requests;
+    unsigned long failures;
+    time_t failed_at;               /* Last failure, 0 if none */
+} oauth2_mirror_t;
+
+/* Most mirrors a provider can declare, its own origin included */
+#define OAUTH2_MIRRORS_MAX 8
+
+/* One configured identity provider */
+typedef struct oauth2_provider {
+    const char *issuer;             /* Points into config->strings, NULL if unknown */
+    const char *discovery_url;      /* Points into config->strings */
+    oauth2_key_store_t *keys;       /* Verification keys, from files or fetched JWKS */
+    int local_keys;                 /* Keys come from local files only */
+    int introspection;              /* Tokens are validated by RFC 7662 introspection */
+    const oauth2_issuer_policy_t *policy; /* Entry of config->policies, NULL for the global settings */
+    
+    /* Network provider runtime (oauth2_provider.c) */
+    pthread_mutex_t lock;           /* Protects the fields below */
+    pthread_mutex_t refresh_lock;   /* Held by the single refreshing caller */
+    oauth2_http_doc_t discovery;
+    oauth2_http_doc_t jwks;
+    char *jwks_uri;
+    char *discovered_issuer;        /* Issuer announced by discovery, set once */
+    char *introspection_endpoint;
+    char *userinfo_endpoint;
+    char *token_endpoint;           /* Used by the client token cache */
+    time_t last_attempt;
+    unsigned long generation;       /* Bumped on every completed refresh */
+    
+    /* Circuit breaker, protected by lock */
+    oauth2_breaker_state_t breaker_state;
+    int breaker_failures;           /* Consecutive failed refreshes */
+    time_t breaker_opened_at;
+
+    /* Equivalent origins, mirrors[0] that of discovery_url; none without oauth2_mirrors. Protected by lock */
+    oauth2_mirror_t *mirrors;
+    int mirrors_count;
+} oauth2_provider_t;
+
+/* Issuer pattern with one placeholder for the tenant, e.g. https://login.example.com/{tenant}/v2.0 */
+typedef struct oauth2_tenant_template {
+    uint32_t pattern;               /* Offsets into config->strings */
+    uint32_t prefix_len;            /* Text before the placeholder */
+    uint32_t suffix;
+    uint32_t suffix_len;            /* Text after it */
+} oauth2_tenant_template_t;
+
+/* Provider of one tenant, loaded on first use and shared by the logins using it */
+typedef struct oauth2_tenant {
+    oauth2_provider_t provider;     /* First: logins hold the provider, the arena releases the tenant */
+    struct oauth2_tenant_table *table;
+    char *issuer;                   /* Backs provider.issuer and provider.discovery_url */
+    uint32_t hash;
+    int refcount;                   /* One for the table while linked, one per login using it */
+    int linked;
+    time_t used_at;
+    size_t bytes;                   /* Charged against the table's memory cap */
+    struct oauth2_tenant *next;     /* Hash chain */
+    struct oauth2_tenant *newer, *older;  /* LRU list */
+} oauth2_tenant_t;
+
+/* Tenants of the templated issuers by issuer, evicted least recently used first */
+typedef struct oauth2_tenant_table {
+    pthread_mutex_t lock;           /* Protects the fields below the templates */
+    oauth2_tenant_template_t *templates;
+    int templates_count;
+    size_t max_bytes;
+    int idle_timeout;               /* Seconds unused before eviction, 0 keeps idle tenants */
+    oauth2_tenant_t **buckets;
+    size_t buckets_count;           /* Power of two */
+    size_t count;
+    size_t bytes;
+    oauth2_tenant_t *newest, *oldest;
+} oauth2_tenant_table_t;
+
+/* Cached IdP answer (introspection or userinfo response), keyed by a SHA-256 (oauth2_cache.c) */
+typedef struct oauth2_claims_entry {
+    unsigned char key[32];
+    int state;                      /* OAUTH2_CLAIMS_* */
+    time_t expires_at;
+    time_t used_at;
+    json_t *claims;                 /* Immutable once cached, NULL for a negative answer */
+} oauth2_claims_entry_t;
+
+#define OAUTH2_CLAIMS_EMPTY 0
+#define OAUTH2_CLAIMS_PENDING 1         /* Lookup in flight; never evicted */
+#define OAUTH2_CLAIMS_READY 2
+
+/* Bounded set-associative cache; lookups of a pending key wait for its result */
+typedef struct oauth2_claims_cache {
+    pthread_mutex_t lock;
+    pthread_cond_t done;            /* Signalled when a pending lookup completes */
+    oauth2_claims_entry_t *entries;
+    int sets;                       /* entries holds sets * OAUTH2_CLAIMS_WAYS slots */
+} oauth2_claims_cache_t;
+
+#define OAUTH2_CLAIMS_WAYS 4
+
+/* A refresh in progress: oauth2_provider_refresh() runs its transfers in turn, an asynchronous validator on its multi handle */
+typedef struct oauth2_provider_refresh_op {
+    oauth2_provider_t *provider;
+    int phase;                      /* OAUTH2_REFRESH_* document being fetched */
+    int unavailable;                /* A fetch failed: counts against the breaker */
+    char *jwks_uri;
+    const oauth2_http_doc_t *cached; /* Copy revalidated by the fetch */
+    int order[OAUTH2_MIRRORS_MAX];  /* Mirrors of the fetch, best first */
+    int mirrors;
+    int mirror;                     /* Index into order of the transfer in flight */
+    char *mirrored;                 /* URL of that transfer when it goes to a mirror */
+    long long started;
+    const char *url;                /* Document URL, before mirroring */
+    oauth2_http_transfer_t transfer;
+} oauth2_provider_refresh_op_t;
+
+#define OAUTH2_REFRESH_DISCOVERY 0
+#define OAUTH2_REFRESH_JWKS 1
+
+/* Network step of a validation, handed by an asynchronous validator's worker to its network thread */
+typedef enum {
+    OAUTH2_NET_REFRESH,             /* Discovery and JWKS of a provider */
+    OAUTH2_NET_INTROSPECT,          /* RFC 7662 introspection of the token */
+    OAUTH2_NET_USERINFO             /* Userinfo request with the token */
+} oauth2_net_kind_t;
+
+typedef struct oauth2_net_request {
+    oauth2_net_kind_t kind;
+    oauth2_provider_t *provider;
+    unsigned long generation;       /* Refresh: provider generation when it was asked for */
+    int min_interval;               /* Refresh: throttle, as for oauth2_provider_refresh() */
+    char *endpoint;                 /* Introspection, userinfo: target of the transfer */
+    char *fields;                   /* Introspection: form body, in secure memory */
+    const char *sub;                /* Userinfo: subject the answer must be about, in the validation's claims */
+    oauth2_claims_entry_t *slot;    /* Cache slot the answer completes, or NULL */
+    long long started;
+    oauth2_http_transfer_t transfer;
+    oauth2_provider_refresh_op_t refresh;
+    int result;                     /* Outcome, replayed to the validation */
+    json_t *claims;                 /* Introspection or userinfo answer, NULL otherwise */
+} oauth2_net_request_t;
+
+/* Settings read from the dedicated configuration file, "key: value" per line */
+typedef struct oauth2_config_file {
+    char *data;                     /* File contents, split in place */
+    const char **keys;
+    const char **values;
+    int count;
+} oauth2_config_file_t;
 
 /* Plugin configuration structure */
 typedef struct oauth2_config {
+    /* Backs every list below */
+    oauth2_string_pool_t strings;
+    
     /* OIDC Discovery - support multiple URLs/issuers */
-    char **discovery_urls;
-    int discovery_urls_count;
-    char **issuers;
-    int issuers_count;
+    oauth2_string_list_t discovery_urls;
+    oauth2_string_list_t issuers;
     char *client_id;
     char *client_secret;
     
     /* Token validation - support multiple audiences */
-    char **audiences;
-    int audiences_count;
+    oauth2_string_list_t audiences;
     char *scope;
     char *user_claim;
+    oauth2_user_map_t user_map;
+    oauth2_string_list_t allowed_algs;
+    oauth2_claim_policy_t claim_policy;
     int verify_signature;
     
     /* Network settings */
     int ssl_verify;
     int timeout;
     int debug;
+    oauth2_latency_table_t *latency;        /* Adaptive timeouts, NULL for oauth2_timeout alone */
+    
+    /* Local key sources, one entry per provider ("-" for network) */
+    oauth2_string_list_t jwks_files;
+    oauth2_string_list_t public_key_files;
+    int key_reload_interval;
+    
+    /* Provider registry, one entry per discovery URL */
+    oauth2_provider_t *providers;
+    int providers_count;
+    uint32_t *issuer_slots;         /* Configured issuers by hash: provider index + 1, 0 for a free slot */
+    size_t issuer_slots_count;
+    
+    /* Templated issuers of multi-tenant IdPs, one provider per tenant seen */
+    oauth2_tenant_table_t tenants;
+    
+    /* Settings of each provider, indexed like providers, and the global ones for unrouted tokens */
+    oauth2_issuer_policy_t *policies;
+    oauth2_issuer_policy_t default_policy;
+    int *provider_blocks;           /* Per provider: N of its oauth2_provider<N>_ keys, 0 for none */
+    
+    /* Warm start state, NULL when disabled */
+    char *state_dir;
+    
+    /* Bounds applied to IdP cache lifetimes */
+    int refresh_min_interval;
+    int refresh_max_interval;
+    
+    /* Circuit breaker: failures before opening (0 disables) and seconds before a probe */
+    int breaker_threshold;
+    int breaker_cooldown;
+    
+    /* Total time budget for fetching all providers at startup, 0 disables */
+    int warmup_timeout;
+    
+    /* Validation mode per provider ("jwt" or "introspection") */
+    oauth2_string_list_t token_validation;
+    int introspection_cache_ttl;
+    int introspection_cache_size;
+    oauth2_claims_cache_t introspection_cache;
+    
+    /* Userinfo lookup of a user claim missing from the token, cached by (iss, sub) */
+    int userinfo_fallback;
+    int userinfo_cache_ttl;
+    int userinfo_cache_size;
+    oauth2_claims_cache_t userinfo_cache;
+    
+    /* Locally revoked tokens, NULL when no revocation file is configured */
+    oauth2_revocation_list_t *revocation;
+    
+    /* Dedicated configuration file, takes precedence over SASL options and is watched for changes */
+    char *config_file;
+    int config_reload_interval;
+    oauth2_config_file_t file;
+    
+    /* Idle connection contexts kept for reuse, per mechanism side (0 disables) */
+    int context_pool_size;
+    
+    /* Client side: tokens fetched from the token endpoint or a helper, cached per (issuer, user) */
+    char *client_user;              /* User to authenticate as when the application gives none */
+    char *client_grant;             /* OAUTH2_GRANT_*, NULL to prompt the application for a token */
+    char *client_refresh_token;
+    int client_refresh_margin;      /* Seconds before expiry at which tokens are renewed */
+    char *client_token_helper;      /* "unix:" socket path or shell command, for OAUTH2_GRANT_HELPER */
+    
+    /* Server side: failed logins a source prefix may make in a burst (0 disables) and regains per minute */
+    int admission_burst;
+    int admission_rate;
+    int admission_ipv4_prefix;
+    int admission_ipv6_prefix;
     
     /* Runtime state */
+    int refcount;                   /* Connections pinning this snapshot, plus one while published */
     oauth2_log_t *oauth2_log;
+    const sasl_utils_t *utils;      /* Utilities of the loading context, for background work */
+    oauth2_metrics_t metrics;
+    
+    /* Background key refresher (oauth2_provider.c) */
+    pthread_mutex_t refresher_lock;
+    pthread_cond_t refresher_cond;
+    pthread_t refresher;
+    pid_t refresher_pid;            /* Process owning the thread, 0 if none */
+    int refresher_running;
+    int refresher_stop;
 } oauth2_config_t;
 
-/* Function prototypes */
+/*
+ * Published configuration. A loaded config is immutable: connections pin
+ * the current snapshot without taking a lock and keep it until dispose,
+ * so publishing a new one never changes a login half way through.
+ */
+typedef struct oauth2_config_holder {
+    oauth2_config_t *current;
+    
+    /* Threads between loading current and pinning it, counted in the generation
+     * they started in: a publisher flips the generation and waits for the old
+     * one alone, so readers arriving meanwhile cannot hold it up */
+    unsigned long generation;
+    unsigned long readers[2];
+    pthread_mutex_t publish_lock;   /* One publisher at a time */
+    
+    /* Hot reload from the configuration file; watch.path is NULL when none is set */
+    pthread_mutex_t watch_lock;     /* Serializes change checks */
+    oauth2_file_watch_t watch;
+    pid_t watch_pid;                /* Process the watch was armed in */
+    const sasl_utils_t *utils;
+    int reloading;                  /* A background reload is running */
+    int reload_pending;             /* A change was seen since it started */
+} oauth2_config_holder_t;
 
-/* Utility functions */
-char **oauth2_parse_string_list(const char *input, int *count);
-void oauth2_free_string_list(char **list, int count);
+#define OAUTH2_CONFIG_HOLDER_INIT { NULL, 0, { 0, 0 }, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, \
+                                    { .inotify_fd = -1 }, 0, NULL, 0, 0 }
+
+/* Function prototypes */
 
 /* oauth2_config.c */
+uint32_t oauth2_string_hash(const char *s, size_t len);
+uint32_t oauth2_string_pool_intern(oauth2_string_pool_t *pool, const char *s, size_t len);
+void oauth2_string_pool_seal(oauth2_string_pool_t *pool);
+void oauth2_string_pool_free(oauth2_string_pool_t *pool);
+int oauth2_string_list_parse(oauth2_string_pool_t *pool, const char *input, oauth2_string_list_t *list);
+void oauth2_string_list_free(oauth2_string_list_t *list);
+const char *oauth2_config_list_item(const oauth2_config_t *config, const oauth2_string_list_t *list, int i);
+int oauth2_config_list_find(const oauth2_config_t *config, const oauth2_string_list_t *list,
+                            const char *s, size_t len);
 oauth2_config_t *oauth2_config_init(const sasl_utils_t *utils);
 void oauth2_config_free(oauth2_config_t *config);
 int oauth2_config_load(oauth2_config_t *config, const sasl_utils_t *utils);
+oauth2_provider_t *oauth2_config_find_provider(oauth2_config_t *config, const char *issuer);
+oauth2_config_t *oauth2_config_acquire(oauth2_config_holder_t *holder);
+void oauth2_config_release(oauth2_config_t *config);
+void oauth2_config_publish(oauth2_config_holder_t *holder, oauth2_config_t *config);
+oauth2_config_t *oauth2_config_rebuild(const sasl_utils_t *utils, oauth2_config_t *previous);
+int oauth2_config_watch(oauth2_config_holder_t *holder, const sasl_utils_t *utils);
+void oauth2_config_unwatch(oauth2_config_holder_t *holder);
+void oauth2_config_reload_check(oauth2_config_holder_t *holder);
+int oauth2_config_reload(oauth2_config_holder_t *holder, const sasl_utils_t *utils);
+
+/* oauth2_file.c */
+int oauth2_file_map(const char *path, oauth2_file_map_t *map);
+void oauth2_file_unmap(oauth2_file_map_t *map);
+int oauth2_file_watch_init(oauth2_file_watch_t *w, const char *path, int interval);
+void oauth2_file_watch_free(oauth2_file_watch_t *w);
+int oauth2_file_watch_changed(oauth2_file_watch_t *w);
+int oauth2_file_watch_rearm(oauth2_file_watch_t *w);
+
+/* oauth2_keys.c */
+oauth2_keyset_t *oauth2_keyset_new(void);
+oauth2_keyset_t *oauth2_keyset_ref(oauth2_keyset_t *keys);
+void oauth2_keyset_release(oauth2_keyset_t *keys, oauth2_log_t *log);
+int oauth2_keyset_add_jwks(oauth2_log_t *log, oauth2_keyset_t *keys,
+                           json_t *jwks, const char *options);
+int oauth2_keyset_add_buffer(oauth2_log_t *log, oauth2_keyset_t *keys,
+                             const char *data, size_t len, const char *options);
+oauth2_key_store_t *oauth2_key_store_create(const sasl_utils_t *utils, oauth2_log_t *log,
+                                            char **files, int files_count,
+                                            const char *options, int reload_interval);
+void oauth2_key_store_free(oauth2_key_store_t *store);
+void oauth2_key_store_swap(oauth2_key_store_t *store, oauth2_keyset_t *keys);
+oauth2_keyset_t *oauth2_key_store_acquire(oauth2_key_store_t *store, const sasl_utils_t *utils);
+
+/* oauth2_policy.c */
+int oauth2_claim_policy_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *source,
+                                oauth2_claim_policy_t *policy);
+void oauth2_claim_policy_free(oauth2_claim_policy_t *policy);
+int oauth2_claim_policy_check(const sasl_utils_t *utils, const oauth2_claim_policy_t *policy,
+                              const char *strings, json_t *claims);
+
+/* oauth2_usermap.c */
+int oauth2_user_map_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *claims,
+                            const char *transform, oauth2_user_map_t *map);
+void oauth2_user_map_free(oauth2_user_map_t *map);
+json_t *oauth2_user_map_find(const oauth2_user_map_t *map, const char *strings, json_t *claims);
+int oauth2_user_map_apply(const sasl_utils_t *utils, const oauth2_user_map_t *map, const char *strings,
+                          oauth2_arena_t *arena, const char *value, size_t len, char **username);
+
+/* oauth2_mirror.c */
+int oauth2_mirror_setup(const sasl_utils_t *utils, oauth2_provider_t *provider, const char *origins);
+void oauth2_mirror_inherit(oauth2_provider_t *provider, const oauth2_provider_t *previous);
+int oauth2_mirror_order(oauth2_provider_t *provider, const char *url, int cooldown, int *order);
+char *oauth2_mirror_url(const oauth2_provider_t *provider, int mirror, const char *url);
+void oauth2_mirror_record(oauth2_provider_t *provider, int mirror, int success, long latency_ms);
+int oauth2_mirror_format(oauth2_provider_t *provider, int index, int cooldown, char *buf, size_t len);
+
+/* oauth2_admission.c */
+int oauth2_admission_setup(const sasl_utils_t *utils, int entries, const char *file);
+uint64_t oauth2_admission_key(const oauth2_config_t *config, const char *ipremoteport);
+int oauth2_admission_allow(const oauth2_config_t *config, uint64_t key);
+void oauth2_admission_fail(const oauth2_config_t *config, uint64_t key);
+void oauth2_admission_stats(const oauth2_config_t *config, oauth2_admission_stats_t *stats);
+
+/* oauth2_latency.c */
+oauth2_latency_table_t *oauth2_latency_create(int percentile, int multiplier, long floor_ms, long max_ms);
+void oauth2_latency_free(oauth2_latency_table_t *table);
+void oauth2_latency_inherit(oauth2_latency_table_t *table, oauth2_latency_table_t *previous);
+long oauth2_latency_timeout_ms(oauth2_latency_table_t *table, const char *url);
+void oauth2_latency_record(oauth2_latency_table_t *table, const char *url, long elapsed_ms, int timed_out);
+int oauth2_latency_format(oauth2_latency_table_t *table, char *buf, size_t len);
+
+/* oauth2_tenants.c */
+void oauth2_tenant_table_init(oauth2_tenant_table_t *table);
+int oauth2_tenant_table_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *source,
+                                oauth2_tenant_table_t *table);
+void oauth2_tenant_table_free(oauth2_tenant_table_t *table);
+int oauth2_tenant_table_match(const oauth2_tenant_table_t *table, const char *strings,
+                              const char *issuer, size_t len);
+oauth2_provider_t *oauth2_tenant_acquire(const sasl_utils_t *utils, oauth2_config_t *config,
+                                         const char *issuer, oauth2_deadline_t deadline);
+void oauth2_tenant_release(void *provider);
+
+/* oauth2_revocation.c */
+oauth2_revocation_set_t *oauth2_revocation_set_build(const char *data, size_t len, int *bad_line);
+oauth2_revocation_set_t *oauth2_revocation_set_ref(oauth2_revocation_set_t *set);
+void oauth2_revocation_set_release(oauth2_revocation_set_t *set);
+size_t oauth2_revocation_set_bytes(const oauth2_revocation_set_t *set);
+int oauth2_revocation_set_check(const oauth2_revocation_set_t *set, const char *jti,
+                                const char *sub, long long iat);
+oauth2_revocation_list_t *oauth2_revocation_list_create(const sasl_utils_t *utils, const char *path,
+                                                        int reload_interval, oauth2_revocation_list_t *previous);
+void oauth2_revocation_list_free(oauth2_revocation_list_t *list);
+oauth2_revocation_set_t *oauth2_revocation_list_acquire(oauth2_revocation_list_t *list,
+                                                        const sasl_utils_t *utils);
+
+/* oauth2_http.c */
+long long oauth2_monotonic_ms(void);
+oauth2_deadline_t oauth2_deadline_after(int seconds);
+long oauth2_deadline_remaining(oauth2_deadline_t deadline);
+int oauth2_http_get(const oauth2_config_t *config, const char *url, const oauth2_http_doc_t *cached,
+                    oauth2_deadline_t deadline, oauth2_http_response_t *response);
+int oauth2_http_get_many(const oauth2_config_t *config, oauth2_http_transfer_t *requests, int count,
+                         oauth2_deadline_t deadline);
+char *oauth2_http_form_escape(const char *value);
+int oauth2_http_post_form(const oauth2_config_t *config, const char *url, const char *fields,
+                          const char *username, const char *password,
+                          oauth2_deadline_t deadline, oauth2_http_response_t *response);
+int oauth2_http_get_bearer(const oauth2_config_t *config, const char *url, const char *token,
+                           oauth2_deadline_t deadline, oauth2_http_response_t *response);
+void oauth2_http_response_free(oauth2_http_response_t *response);
+void oauth2_http_transfer_finish(const oauth2_config_t *config, oauth2_http_transfer_t *transfer);
+oauth2_http_multi_t *oauth2_http_multi_create(void);
+int oauth2_http_multi_add(const oauth2_config_t *config, oauth2_http_multi_t *multi,
+                          oauth2_http_transfer_t *transfer, oauth2_deadline_t deadline);
+void oauth2_http_multi_cancel(oauth2_http_multi_t *multi, oauth2_http_transfer_t *transfer);
+int oauth2_http_multi_wait(oauth2_http_multi_t *multi, long timeout_ms);
+oauth2_http_transfer_t *oauth2_http_multi_done(oauth2_http_multi_t *multi);
+void oauth2_http_multi_wakeup(oauth2_http_multi_t *multi);
+void oauth2_http_multi_free(oauth2_http_multi_t *multi);
+time_t oauth2_http_lifetime(const oauth2_config_t *config, const oauth2_http_response_t *response,
+                            time_t now);
+void oauth2_http_doc_update(oauth2_http_doc_t *doc, oauth2_http_response_t *response,
+                            time_t now, time_t lifetime);
+void oauth2_http_doc_clear(oauth2_http_doc_t *doc);
+
+/* oauth2_cache.c */
+void oauth2_claims_cache_init(oauth2_claims_cache_t *cache);
+int oauth2_claims_cache_resize(oauth2_claims_cache_t *cache, int size);
+void oauth2_claims_cache_free(oauth2_claims_cache_t *cache);
+int oauth2_claims_cache_key(const char *scope, const char *id, unsigned char key[32]);
+int oauth2_claims_cache_lookup(oauth2_claims_cache_t *cache, const unsigned char key[32],
+                               oauth2_deadline_t deadline, json_t **claims, oauth2_claims_entry_t **slot);
+void oauth2_claims_cache_complete(oauth2_claims_cache_t *cache, oauth2_claims_entry_t *slot,
+                                  int cacheable, json_t *claims, time_t expires_at);
+int oauth2_claims_cache_inherit(oauth2_claims_cache_t *cache, oauth2_claims_cache_t *previous);
+
+/* oauth2_introspect.c */
+int oauth2_introspect_token(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, const char *token,
+                            oauth2_deadline_t deadline, json_t **claims);
+void oauth2_introspect_complete(const sasl_utils_t *utils, oauth2_config_t *config,
+                                oauth2_net_request_t *request);
+
+/* oauth2_userinfo.c */
+int oauth2_userinfo_resolve(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, const char *token, json_t *claims,
+                            oauth2_deadline_t deadline, json_t **userinfo);
+void oauth2_userinfo_complete(const sasl_utils_t *utils, oauth2_config_t *config,
+                              oauth2_net_request_t *request);
+
+/* oauth2_metrics.c */
+int oauth2_metrics_format(oauth2_config_t *config, char *buf, size_t len);
+void oauth2_metrics_carry(oauth2_metrics_t *to, oauth2_metrics_t *from);
+
+/* oauth2_state.c */
+int oauth2_state_save(const oauth2_config_t *config, const char *url,
+                      const oauth2_http_doc_t *discovery, const oauth2_http_doc_t *jwks);
+int oauth2_state_load(const oauth2_config_t *config, const char *url,
+                      oauth2_http_doc_t *discovery, oauth2_http_doc_t *jwks);
+
+/* oauth2_provider.c */
+int oauth2_provider_init(oauth2_provider_t *provider);
+void oauth2_provider_free(oauth2_provider_t *provider);
+int oauth2_provider_warm_start(const sasl_utils_t *utils, oauth2_config_t *config,
+                               oauth2_provider_t *provider);
+int oauth2_provider_inherit(const sasl_utils_t *utils, oauth2_provider_t *provider,
+                            oauth2_provider_t *previous);
+int oauth2_provider_refresh(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, int min_interval, oauth2_deadline_t deadline);
+int oauth2_provider_refresh_begin(const sasl_utils_t *utils, oauth2_config_t *config,
+                                  oauth2_provider_t *provider, unsigned long generation, int min_interval,
+                                  oauth2_provider_refresh_op_t *op);
+int oauth2_provider_refresh_step(const sasl_utils_t *utils, oauth2_config_t *config,
+                                 oauth2_provider_refresh_op_t *op, oauth2_deadline_t deadline);
+char *oauth2_provider_introspection_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                             oauth2_provider_t *provider, oauth2_deadline_t deadline);
+char *oauth2_provider_userinfo_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                        oauth2_provider_t *provider, oauth2_deadline_t deadline);
+char *oauth2_provider_token_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                     oauth2_provider_t *provider, oauth2_deadline_t deadline);
+oauth2_keyset_t *oauth2_provider_acquire_keys(const sasl_utils_t *utils, oauth2_config_t *config,
+                                              oauth2_provider_t *provider, int force_refresh,
+                                              oauth2_deadline_t deadline);
+int oauth2_provider_breaker_allow(oauth2_config_t *config, oauth2_provider_t *provider);
+void oauth2_provider_breaker_record(oauth2_config_t *config, oauth2_provider_t *provider, int success);
+oauth2_breaker_state_t oauth2_provider_breaker_state(oauth2_provider_t *provider);
+int oauth2_provider_warmup(const sasl_utils_t *utils, oauth2_config_t *config, int budget);
+int oauth2_provider_start_refresher(oauth2_config_t *config);
+void oauth2_provider_stop_refresher(oauth2_config_t *config);
+
+/* oauth2_secure.c */
+void *oauth2_secure_alloc(size_t size);
+char *oauth2_secure_strndup(const char *s, size_t len);
+void oauth2_secure_free(void *p);
+void oauth2_secure_wipe(void *p, size_t len);
+void oauth2_secure_stats(oauth2_secure_stats_t *stats);
+
+/* oauth2_pool.c */
+void *oauth2_context_pool_get(oauth2_pool_kind_t kind);
+void oauth2_context_pool_put(oauth2_pool_kind_t kind, void *context, int cap);
+void oauth2_context_pool_drain(void);
+void oauth2_context_pool_stats(oauth2_pool_kind_t kind, oauth2_pool_stats_t *stats);
+
+/* oauth2_arena.c */
+void oauth2_arena_init(oauth2_arena_t *arena);
+void *oauth2_arena_alloc(oauth2_arena_t *arena, size_t size);
+char *oauth2_arena_strndup(oauth2_arena_t *arena, const char *s, size_t len);
+int oauth2_arena_defer(oauth2_arena_t *arena, void (*release)(void *), void *object);
+void oauth2_arena_run_deferred(oauth2_arena_t *arena);
+void oauth2_arena_release(oauth2_arena_t *arena);
+
+/* oauth2_tokens.c */
+int oauth2_client_token_get(const sasl_utils_t *utils, oauth2_config_t *config, const char *user,
+                            char **token);
+void oauth2_client_token_drain(void);
+void oauth2_client_token_stats(oauth2_client_token_stats_t *stats);
+
+/* oauth2_helper.c */
+int oauth2_token_helper_request(const sasl_utils_t *utils, oauth2_config_t *config, const char *issuer,
+                                const char *user, oauth2_deadline_t deadline, char **response);
+void oauth2_token_helper_close(void);
+
+/* oauth2_validate.c */
+int oauth2_jwt_decode_claims(const sasl_utils_t *utils, oauth2_arena_t *arena, const char *token,
+                             json_t **claims);
+int oauth2_validate_token(const sasl_utils_t *utils, oauth2_config_t *config, oauth2_arena_t *arena,
+                          const char *token, char **username);
+
+/* oauth2_async.c */
+oauth2_validator_t *oauth2_validator_create(const sasl_utils_t *utils, oauth2_config_holder_t *holder,
+                                            int workers);
+int oauth2_validator_submit(oauth2_validator_t *validator, const char *token, size_t len,
+                            oauth2_validate_cb_t done, void *arg);
+int oauth2_validator_fd(const oauth2_validator_t *validator);
+int oauth2_validator_dispatch(oauth2_validator_t *validator);
+void oauth2_validator_free(oauth2_validator_t *validator);
+oauth2_net_request_t *oauth2_async_request(oauth2_net_kind_t kind, oauth2_provider_t *provider);
+int oauth2_async_result(oauth2_net_kind_t kind, oauth2_provider_t *provider, json_t **claims);
+int oauth2_async_pending(void);
+oauth2_deadline_t oauth2_async_deadline(void);
 
 /* oauth2_server.c */
 int oauth2_server_init(const sasl_utils_t *utils, oauth2_config_t *config);
@@ -127,8 +1065,10 @@ int oauth2_server_mech_step(void *conn_context, sasl_server_params_t *params,
 void oauth2_server_mech_dispose(void *conn_context, const sasl_utils_t *utils);
 
 /* SASL mechanism functions - client */
-int oauth2_client_mech_new(void *glob_context, sasl_client_params_t *params,
-                           void **conn_context);
+int oauth2_client_mech_new_xoauth2(void *glob_context, sasl_client_params_t *params,
+                                   void **conn_context);
+int oauth2_client_mech_new_oauthbearer(void *glob_context, sasl_client_params_t *params,
+                                       void **conn_context);
 int oauth2_client_mech_step(void *conn_context, sasl_client_params_t *params,
                             const char *serverin, unsigned serverinlen,
                             sasl_interact_t **prompt_need,
@@ -0,0 +1,283 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Claim Policy
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Conditions on the claims of a validated token, e.g. to restrict IMAP to
+ * tokens with the "imap" scope held by members of one group:
+ *
+ *   oauth2_claim_policy: scope has imap; groups any mail-users staff
+ *
+ * Rules are separated by ';' and must all hold. Each names a claim, an
+ * operator and its values:
+ *   has     every value is present
+ *   any     at least one value is present
+ *   =       the claim is the single value
+ *   in      the claim is one of the values
+ *   prefix  the claim starts with one of the values
+ * A string claim is split on spaces for "has" and "any", as scope is; an
+ * array claim is a set of strings for every operator.
+ *
+ * The policy is compiled once per configuration load: claim names and
+ * values are interned in the configuration's string pool, and every rule
+ * gets a small hash table of its values, so a check costs one hash per
+ * claim item whatever the number of values. "has" tracks the values seen
+ * in a 64-bit set.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+
+static const struct {
+    const char *name;
+    oauth2_claim_op_t op;
+} oauth2_claim_ops[] = {
+    { "has", OAUTH2_CLAIM_HAS },
+    { "any", OAUTH2_CLAIM_ANY },
+    { "=", OAUTH2_CLAIM_EQUALS },
+    { "in", OAUTH2_CLAIM_IN },
+    { "prefix", OAUTH2_CLAIM_PREFIX }
+};
+
+static int oauth2_claim_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/* Next space-separated word of [*p, end), NULL at the end */
+static const char *oauth2_claim_policy_word(const char **p, const char *end, size_t *len) {
+    while (*p < end && oauth2_claim_is_space(**p)) (*p)++;
+    if (*p == end) {
+        return NULL;
+    }
+    const char *word = *p;
+    while (*p < end && !oauth2_claim_is_space(**p)) (*p)++;
+    *len = (size_t)(*p - word);
+    return word;
+}
+
+/* Hash table of a rule: a power of two, at least twice its values */
+static uint32_t oauth2_claim_rule_slots(uint32_t values) {
+    uint32_t slots = 2;
+    while (slots < values * 2) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+/* Index of s among the values of the rule, -1 when absent */
+static int oauth2_claim_rule_find(const oauth2_claim_policy_t *policy, const oauth2_claim_rule_t *rule,
+                                  const char *strings, const char *s, size_t len) {
+    uint32_t hash = oauth2_string_hash(s, len);
+    const uint32_t *slots = policy->slots + rule->slots;
+    for (uint32_t i = hash & rule->slots_mask, index; (index = slots[i]) != 0; i = (i + 1) & rule->slots_mask) {
+        uint32_t v = rule->values + index - 1;
+        if (policy->hashes[v] == hash && policy->lengths[v] == len &&
+            memcmp(strings + policy->offsets[v], s, len) == 0) {
+            return (int)index - 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Parse the policy; with policy->rules NULL only check and count it,
+ * otherwise fill the arrays sized by the counting pass.
+ */
+static int oauth2_claim_policy_scan(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *source,
+                                    oauth2_claim_policy_t *policy, uint32_t *values_count, uint32_t *slots_count) {
+    int fill = policy->rules != NULL;
+    *values_count = 0;
+    *slots_count = 0;
+    policy->count = 0;
+
+    for (const char *rule_start = source; *rule_start; ) {
+        const char *rule_end = strchr(rule_start, ';');
+        if (!rule_end) {
+            rule_end = rule_start + strlen(rule_start);
+        }
+        const char *p = rule_start;
+        rule_start = *rule_end ? rule_end + 1 : rule_end;
+
+        size_t claim_len = 0, op_len = 0;
+        const char *claim = oauth2_claim_policy_word(&p, rule_end, &claim_len);
+        if (!claim) {
+            continue;               /* Empty rule, e.g. after a trailing ';' */
+        }
+        const char *op_name = oauth2_claim_policy_word(&p, rule_end, &op_len);
+        int op = -1;
+        for (size_t i = 0; op_name && i < sizeof(oauth2_claim_ops) / sizeof(oauth2_claim_ops[0]); i++) {
+            if (strlen(oauth2_claim_ops[i].name) == op_len && memcmp(oauth2_claim_ops[i].name, op_name, op_len) == 0) {
+                op = (int)oauth2_claim_ops[i].op;
+            }
+        }
+        if (op < 0) {
+            OAUTH2_LOG_ERR(utils, "Invalid %s rule for claim '%.*s': expected has, any, =, in or prefix",
+                           OAUTH2_CONF_CLAIM_POLICY, (int)claim_len, claim);
+            return SASL_BADPARAM;
+        }
+
+        uint32_t count = 0;
+        const char *q = p;
+        size_t len;
+        while (oauth2_claim_policy_word(&q, rule_end, &len)) count++;
+        if (count == 0 || (op == OAUTH2_CLAIM_EQUALS && count != 1) ||
+            (op == OAUTH2_CLAIM_HAS && count > OAUTH2_CLAIM_MAX_VALUES)) {
+            OAUTH2_LOG_ERR(utils, "Invalid %s rule for claim '%.*s': %s", OAUTH2_CONF_CLAIM_POLICY,
+                           (int)claim_len, claim, count == 0 ? "no value" : op == OAUTH2_CLAIM_EQUALS ?
+                           "'=' takes a single value" : "too many values for 'has'");
+            return SASL_BADPARAM;
+        }
+
+        uint32_t slots = op == OAUTH2_CLAIM_PREFIX ? 0 : oauth2_claim_rule_slots(count);
+        if (fill) {
+            oauth2_claim_rule_t *rule = &policy->rules[policy->count];
+            rule->claim = oauth2_string_pool_intern(pool, claim, claim_len);
+            rule->op = (oauth2_claim_op_t)op;
+            rule->values = *values_count;
+            rule->values_count = 0;
+            rule->slots = *slots_count;
+            rule->slots_mask = slots ? slots - 1 : 0;
+            if (rule->claim == OAUTH2_STRING_NONE) {
+                return SASL_NOMEM;
+            }
+
+            const char *value;
+            while ((value = oauth2_claim_policy_word(&p, rule_end, &len)) != NULL) {
+                /* Repeated values are kept once: "has" counts each value it sees once */
+                if (slots && oauth2_claim_rule_find(policy, rule, pool->data, value, len) >= 0) {
+                    continue;
+                }
+                uint32_t v = rule->values + rule->values_count;
+                policy->offsets[v] = oauth2_string_pool_intern(pool, value, len);
+                if (policy->offsets[v] == OAUTH2_STRING_NONE) {
+                    return SASL_NOMEM;
+                }
+                policy->lengths[v] = (uint32_t)len;
+                policy->hashes[v] = oauth2_string_hash(value, len);
+                rule->values_count++;
+
+                if (slots) {
+                    uint32_t *table = policy->slots + rule->slots;
+                    uint32_t i = policy->hashes[v] & rule->slots_mask;
+                    while (table[i] != 0) i = (i + 1) & rule->slots_mask;
+                    table[i] = rule->values_count;
+                }
+            }
+            *values_count += rule->values_count;
+        } else {
+            *values_count += count;
+        }
+        *slots_count += slots;
+        policy->count++;
+    }
+    return SASL_OK;
+}
+
+int oauth2_claim_policy_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *source,
+                                oauth2_claim_policy_t *policy) {
+    memset(policy, 0, sizeof(*policy));
+    if (!source) {
+        return SASL_OK;
+    }
+
+    uint32_t values_count, slots_count;
+    int result = oauth2_claim_policy_scan(utils, pool, source, policy, &values_count, &slots_count);
+    if (result != SASL_OK || policy->count == 0) {
+        return result;
+    }
+
+    /* Values and every rule's hash table in one allocation */
+    policy->rules = calloc((size_t)policy->count, sizeof(oauth2_claim_rule_t));
+    policy->offsets = calloc((size_t)values_count * 3 + slots_count, sizeof(uint32_t));
+    if (!policy->rules || !policy->offsets) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", OAUTH2_CONF_CLAIM_POLICY);
+        oauth2_claim_policy_free(policy);
+        return SASL_NOMEM;
+    }
+    policy->lengths = policy->offsets + values_count;
+    policy->hashes = policy->lengths + values_count;
+    policy->slots = policy->hashes + values_count;
+
+    result = oauth2_claim_policy_scan(utils, pool, source, policy, &values_count, &slots_count);
+    if (result != SASL_OK) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", OAUTH2_CONF_CLAIM_POLICY);
+        oauth2_claim_policy_free(policy);
+    }
+    return result;
+}
+
+void oauth2_claim_policy_free(oauth2_claim_policy_t *policy) {
+    free(policy->rules);
+    free(policy->offsets);
+    memset(policy, 0, sizeof(*policy));
+}
+
+/* One item of the claim; returns whether the rule now holds */
+static int oauth2_claim_rule_item(const oauth2_claim_policy_t *policy, const oauth2_claim_rule_t *rule,
+                                  const char *strings, const char *s, size_t len, uint64_t *seen) {
+    if (rule->op == OAUTH2_CLAIM_PREFIX) {
+        for (uint32_t v = rule->values; v < rule->values + rule->values_count; v++) {
+            if (len >= policy->lengths[v] && memcmp(s, strings + policy->offsets[v], policy->lengths[v]) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    int index = oauth2_claim_rule_find(policy, rule, strings, s, len);
+    if (index < 0) {
+        return 0;
+    }
+    if (rule->op != OAUTH2_CLAIM_HAS) {
+        return 1;
+    }
+    *seen |= 1ULL << index;
+    return *seen == (rule->values_count == 64 ? ~0ULL : (1ULL << rule->values_count) - 1);
+}
+
+static int oauth2_claim_rule_check(const oauth2_claim_policy_t *policy, const oauth2_claim_rule_t *rule,
+                                   const char *strings, json_t *claim) {
+    uint64_t seen = 0;
+
+    if (json_is_string(claim)) {
+        const char *s = json_string_value(claim);
+        size_t len = json_string_length(claim);
+        if (rule->op != OAUTH2_CLAIM_HAS && rule->op != OAUTH2_CLAIM_ANY) {
+            return oauth2_claim_rule_item(policy, rule, strings, s, len, &seen);
+        }
+
+        const char *p = s;
+        const char *word;
+        size_t word_len;
+        while ((word = oauth2_claim_policy_word(&p, s + len, &word_len)) != NULL) {
+            if (oauth2_claim_rule_item(policy, rule, strings, word, word_len, &seen)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    size_t index;
+    json_t *item;
+    json_array_foreach(claim, index, item) {
+        if (json_is_string(item) &&
+            oauth2_claim_rule_item(policy, rule, strings, json_string_value(item), json_string_length(item), &seen)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int oauth2_claim_policy_check(const sasl_utils_t *utils, const oauth2_claim_policy_t *policy,
+                              const char *strings, json_t *claims) {
+    for (int i = 0; i < policy->count; i++) {
+        const oauth2_claim_rule_t *rule = &policy->rules[i];
+        const char *name = strings + rule->claim;
+        if (!oauth2_claim_rule_check(policy, rule, strings, json_object_get(claims, name))) {
+            OAUTH2_LOG_ERR(utils, "Token rejected: claim '%s' does not satisfy %s", name, OAUTH2_CONF_CLAIM_POLICY);
+            return SASL_BADAUTH;
+        }
+    }
+    return SASL_OK;
+}
@@ -0,0 +1,113 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Connection Context Pool
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Per-process freelists of server and client contexts. A disposed
+ * context is wiped by its mechanism and kept, with its arena and its
+ * secure token buffer, for the next connection; reconnect storms then
+ * cost no allocation at all. The number of idle contexts is capped by
+ * oauth2_context_pool_size, beyond which disposed contexts are freed.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct oauth2_context_pool {
+    pthread_mutex_t lock;
+    void *idle;                     /* LIFO, linked through the first word of each context */
+    size_t size;
+    oauth2_pool_stats_t stats;
+} oauth2_context_pool_t;
+
+static oauth2_context_pool_t oauth2_context_pools[OAUTH2_POOL_KINDS] = {
+    [OAUTH2_POOL_SERVER] = { PTHREAD_MUTEX_INITIALIZER, NULL, sizeof(oauth2_server_context_t), { 0 } },
+    [OAUTH2_POOL_CLIENT] = { PTHREAD_MUTEX_INITIALIZER, NULL, sizeof(oauth2_client_context_t), { 0 } }
+};
+
+/* Free a context with the buffers it carries across reuse */
+static void oauth2_context_destroy(oauth2_pool_kind_t kind, void *context) {
+    if (kind == OAUTH2_POOL_SERVER) {
+        oauth2_secure_free(((oauth2_server_context_t*)context)->token_buffer);
+    } else {
+        oauth2_secure_free(((oauth2_client_context_t*)context)->response);
+    }
+    free(context);
+}
+
+void *oauth2_context_pool_get(oauth2_pool_kind_t kind) {
+    oauth2_context_pool_t *pool = &oauth2_context_pools[kind];
+
+    /* Most recently disposed first, its memory is the most likely to be cached */
+    pthread_mutex_lock(&pool->lock);
+    void *context = pool->idle;
+    if (context) {
+        pool->idle = *(void**)context;
+        pool->stats.idle--;
+        pool->stats.reused++;
+    } else {
+        pool->stats.allocated++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (context) {
+        *(void**)context = NULL;
+        return context;
+    }
+
+    /* Arenas need 16-byte alignment */
+    if (posix_memalign(&context, 16, pool->size) != 0) {
+        return NULL;
+    }
+    memset(context, 0, pool->size);
+    return context;
+}
+
+void oauth2_context_pool_put(oauth2_pool_kind_t kind, void *context, int cap) {
+    if (!context) return;
+
+    oauth2_context_pool_t *pool = &oauth2_context_pools[kind];
+    pthread_mutex_lock(&pool->lock);
+    if (pool->stats.idle < cap) {
+        *(void**)context = pool->idle;
+        pool->idle = context;
+        if (++pool->stats.idle > pool->stats.high_water) {
+            pool->stats.high_water = pool->stats.idle;
+        }
+        context = NULL;
+    } else {
+        pool->stats.dropped++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (context) {
+        oauth2_context_destroy(kind, context);
+    }
+}
+
+void oauth2_context_pool_drain(void) {
+    for (int kind = 0; kind < OAUTH2_POOL_KINDS; kind++) {
+        oauth2_context_pool_t *pool = &oauth2_context_pools[kind];
+
+        pthread_mutex_lock(&pool->lock);
+        void *idle = pool->idle;
+        pool->idle = NULL;
+        pool->stats.idle = 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        while (idle) {
+            void *next = *(void**)idle;
+            oauth2_context_destroy((oauth2_pool_kind_t)kind, idle);
+            idle = next;
+        }
+    }
+}
+
+void oauth2_context_pool_stats(oauth2_pool_kind_t kind, oauth2_pool_stats_t *stats) {
+    oauth2_context_pool_t *pool = &oauth2_context_pools[kind];
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
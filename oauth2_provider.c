@@ -0,0 +1,966 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Provider Runtime
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Discovery and JWKS handling for network providers: warm start from
+ * persisted state, coalesced refreshes and a background refresher that
+ * keeps keys fresh off the authentication path. Introspection providers
+ * only need their discovery document, for the introspection endpoint.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <jansson.h>
+
+/* Minimum delay between two refresh attempts of the same provider */
+#define OAUTH2_PROVIDER_RETRY_INTERVAL 30
+
+/* Longest sleep of the background refresher */
+#define OAUTH2_PROVIDER_MAX_SLEEP 60
+
+int oauth2_provider_init(oauth2_provider_t *provider) {
+    if (!provider) {
+        return SASL_BADPARAM;
+    }
+
+    pthread_mutex_init(&provider->lock, NULL);
+    pthread_mutex_init(&provider->refresh_lock, NULL);
+    return SASL_OK;
+}
+
+void oauth2_provider_free(oauth2_provider_t *provider) {
+    if (!provider) return;
+
+    oauth2_key_store_free(provider->keys);
+    oauth2_http_doc_clear(&provider->discovery);
+    oauth2_http_doc_clear(&provider->jwks);
+    free(provider->jwks_uri);
+    free(provider->discovered_issuer);
+    free(provider->introspection_endpoint);
+    free(provider->userinfo_endpoint);
+    free(provider->token_endpoint);
+    free(provider->mirrors);
+    pthread_mutex_destroy(&provider->lock);
+    pthread_mutex_destroy(&provider->refresh_lock);
+}
+
+/* Endpoints announced by a discovery document */
+typedef struct oauth2_provider_endpoints {
+    char *jwks_uri;
+    char *issuer;
+    char *introspection_endpoint;
+    char *userinfo_endpoint;
+    char *token_endpoint;
+} oauth2_provider_endpoints_t;
+
+static void oauth2_provider_endpoints_free(oauth2_provider_endpoints_t *endpoints) {
+    free(endpoints->jwks_uri);
+    free(endpoints->issuer);
+    free(endpoints->introspection_endpoint);
+    free(endpoints->userinfo_endpoint);
+    free(endpoints->token_endpoint);
+    memset(endpoints, 0, sizeof(*endpoints));
+}
+
+static char *oauth2_provider_json_strdup(json_t *json, const char *key) {
+    json_t *value = json_object_get(json, key);
+    return json_is_string(value) ? strdup(json_string_value(value)) : NULL;
+}
+
+/* Extract the endpoints of a discovery document; the one the provider's mode needs is required */
+static int oauth2_provider_parse_discovery(const oauth2_provider_t *provider, const oauth2_http_doc_t *doc,
+                                           oauth2_provider_endpoints_t *endpoints) {
+    memset(endpoints, 0, sizeof(*endpoints));
+
+    json_error_t json_error;
+    json_t *json = json_loadb(doc->body, doc->len, 0, &json_error);
+    if (!json) {
+        return SASL_FAIL;
+    }
+
+    endpoints->jwks_uri = oauth2_provider_json_strdup(json, "jwks_uri");
+    endpoints->issuer = oauth2_provider_json_strdup(json, "issuer");
+    endpoints->introspection_endpoint = oauth2_provider_json_strdup(json, "introspection_endpoint");
+    endpoints->userinfo_endpoint = oauth2_provider_json_strdup(json, "userinfo_endpoint");
+    endpoints->token_endpoint = oauth2_provider_json_strdup(json, "token_endpoint");
+    json_decref(json);
+
+    if (!(provider->introspection ? endpoints->introspection_endpoint : endpoints->jwks_uri)) {
+        oauth2_provider_endpoints_free(endpoints);
+        return SASL_FAIL;
+    }
+    return SASL_OK;
+}
+
+/* Install discovery results; the first discovered issuer is kept for token routing */
+static void oauth2_provider_apply_discovery(oauth2_provider_t *provider, oauth2_http_doc_t *doc,
+                                            oauth2_provider_endpoints_t *endpoints) {
+    char *issuer = endpoints->issuer;
+
+    pthread_mutex_lock(&provider->lock);
+
+    oauth2_http_doc_clear(&provider->discovery);
+    provider->discovery = *doc;
+    memset(doc, 0, sizeof(*doc));
+
+    free(provider->jwks_uri);
+    provider->jwks_uri = endpoints->jwks_uri;
+    free(provider->introspection_endpoint);
+    provider->introspection_endpoint = endpoints->introspection_endpoint;
+    free(provider->userinfo_endpoint);
+    provider->userinfo_endpoint = endpoints->userinfo_endpoint;
+    free(provider->token_endpoint);
+    provider->token_endpoint = endpoints->token_endpoint;
+
+    if (issuer && !provider->discovered_issuer) {
+        __atomic_store_n(&provider->discovered_issuer, issuer, __ATOMIC_RELEASE);
+        issuer = NULL;
+    }
+
+    pthread_mutex_unlock(&provider->lock);
+    free(issuer);
+    memset(endpoints, 0, sizeof(*endpoints));
+}
+
+/* Build a key set from a JWKS document and install it with the document */
+static int oauth2_provider_apply_jwks(oauth2_config_t *config, oauth2_provider_t *provider,
+                                      oauth2_http_doc_t *doc) {
+    oauth2_keyset_t *keys = oauth2_keyset_new();
+    if (!keys) {
+        return SASL_NOMEM;
+    }
+
+    int result = oauth2_keyset_add_buffer(config->oauth2_log, keys, doc->body, doc->len,
+                                          provider->keys->options);
+    if (result != SASL_OK || keys->key_count == 0) {
+        oauth2_keyset_release(keys, config->oauth2_log);
+        return SASL_FAIL;
+    }
+    if (keys->skipped_count > 0 && config->utils) {
+        OAUTH2_LOG_WARN(config->utils, "Skipped %d unusable key(s) of %s, using the other %d",
+                        keys->skipped_count, provider->discovery_url, keys->key_count);
+    }
+
+    oauth2_key_store_swap(provider->keys, keys);
+
+    pthread_mutex_lock(&provider->lock);
+    oauth2_http_doc_clear(&provider->jwks);
+    provider->jwks = *doc;
+    memset(doc, 0, sizeof(*doc));
+    pthread_mutex_unlock(&provider->lock);
+
+    return SASL_OK;
+}
+
+/* Classify a transfer: 200 and 304 (with a cached copy) are usable, anything else is freed */
+static int oauth2_provider_check_response(const sasl_utils_t *utils, oauth2_config_t *config,
+                                          const char *url, const oauth2_http_doc_t *cached,
+                                          int result, oauth2_http_response_t *response) {
+    if (result != SASL_OK) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        OAUTH2_LOG_WARN(utils, "Fetching %s failed", url);
+        return result;
+    }
+
+    if (response->status == 304 && cached && cached->body) {
+        OAUTH2_METRIC_INC(config, http_not_modified);
+        return SASL_OK;
+    }
+    if (response->status == 200 && response->body) {
+        OAUTH2_METRIC_INC(config, http_ok);
+        return SASL_OK;
+    }
+
+    OAUTH2_METRIC_INC(config, http_errors);
+    OAUTH2_LOG_WARN(utils, "Fetching %s returned HTTP %ld", url, response->status);
+    oauth2_http_response_free(response);
+    return SASL_FAIL;
+}
+
+/*
+ * Start fetching a document, or revalidating the cached copy with a conditional
+ * request. A URL on the provider's own origin goes to its mirrors, best first,
+ * until one answers or the deadline passes; op->transfer is the next request.
+ */
+static int oauth2_provider_fetch_begin(oauth2_config_t *config, oauth2_provider_refresh_op_t *op,
+                                       const char *url, const oauth2_http_doc_t *cached) {
+    op->url = url;
+    op->cached = cached;
+    op->mirror = 0;
+    op->mirrors = oauth2_mirror_order(op->provider, url, config->breaker_cooldown, op->order);
+    op->mirrored = op->mirrors > 0 ? oauth2_mirror_url(op->provider, op->order[0], url) : NULL;
+    if (op->mirrors > 0 && !op->mirrored) {
+        return SASL_NOMEM;
+    }
+
+    memset(&op->transfer, 0, sizeof(op->transfer));
+    op->transfer.url = op->mirrored ? op->mirrored : url;
+    op->transfer.cached = cached;
+    op->started = oauth2_monotonic_ms();
+    return SASL_CONTINUE;
+}
+
+/* Account for the transfer of a fetch; SASL_CONTINUE when the next mirror is to be tried */
+static int oauth2_provider_fetch_done(const sasl_utils_t *utils, oauth2_config_t *config,
+                                      oauth2_provider_refresh_op_t *op, oauth2_deadline_t deadline) {
+    int result = oauth2_provider_check_response(utils, config, op->transfer.url, op->cached,
+                                                op->transfer.result, &op->transfer.response);
+    if (op->mirrors == 0) {
+        return result;
+    }
+
+    oauth2_mirror_record(op->provider, op->order[op->mirror], result == SASL_OK,
+                         oauth2_monotonic_ms() - op->started);
+    if (result != SASL_OK && op->mirror + 1 < op->mirrors) {
+        OAUTH2_METRIC_INC(config, mirror_failovers);
+        OAUTH2_LOG_WARN(utils, "Failing over from %s to the next mirror", op->mirrored);
+    }
+    free(op->mirrored);
+    op->mirrored = NULL;
+    if (result == SASL_OK || ++op->mirror >= op->mirrors) {
+        return result;
+    }
+    if (oauth2_deadline_remaining(deadline) == 0) {
+        OAUTH2_METRIC_INC(config, deadline_exceeded);
+        return result;
+    }
+
+    op->mirrored = oauth2_mirror_url(op->provider, op->order[op->mirror], op->url);
+    if (!op->mirrored) {
+        return SASL_NOMEM;
+    }
+    memset(&op->transfer, 0, sizeof(op->transfer));
+    op->transfer.url = op->mirrored;
+    op->transfer.cached = op->cached;
+    op->started = oauth2_monotonic_ms();
+    return SASL_CONTINUE;
+}
+
+/* Persist the last good state; the caller holds the refresh lock, so the documents are stable */
+static void oauth2_provider_persist(const sasl_utils_t *utils, oauth2_config_t *config,
+                                    oauth2_provider_t *provider) {
+    if (!config->state_dir || provider->discovery.no_store ||
+        (!provider->introspection && provider->jwks.no_store)) {
+        return;
+    }
+
+    if (oauth2_state_save(config, provider->discovery_url, &provider->discovery,
+                          &provider->jwks) != SASL_OK) {
+        OAUTH2_LOG_WARN(utils, "Cannot persist provider state to %s", config->state_dir);
+    }
+}
+
+/* Install a fetched discovery document; a 304 only extends the cached one */
+static int oauth2_provider_store_discovery(oauth2_config_t *config, oauth2_provider_t *provider,
+                                           oauth2_http_response_t *response) {
+    time_t now = time(NULL);
+    time_t lifetime = oauth2_http_lifetime(config, response, now);
+
+    if (response->status == 304) {
+        pthread_mutex_lock(&provider->lock);
+        oauth2_http_doc_update(&provider->discovery, response, now, lifetime);
+        pthread_mutex_unlock(&provider->lock);
+        return SASL_OK;
+    }
+
+    oauth2_http_doc_t doc = { 0 };
+    oauth2_provider_endpoints_t endpoints;
+    oauth2_http_doc_update(&doc, response, now, lifetime);
+
+    int result = oauth2_provider_parse_discovery(provider, &doc, &endpoints);
+    if (result == SASL_OK) {
+        oauth2_provider_apply_discovery(provider, &doc, &endpoints);
+    }
+    oauth2_http_doc_clear(&doc);
+    return result;
+}
+
+/* Install a fetched JWKS; a 304 keeps the current key set and extends its lifetime */
+static int oauth2_provider_store_jwks(oauth2_config_t *config, oauth2_provider_t *provider,
+                                      oauth2_http_response_t *response) {
+    time_t now = time(NULL);
+    time_t lifetime = oauth2_http_lifetime(config, response, now);
+
+    if (response->status == 304) {
+        pthread_mutex_lock(&provider->lock);
+        oauth2_http_doc_update(&provider->jwks, response, now, lifetime);
+        pthread_mutex_unlock(&provider->lock);
+        return SASL_OK;
+    }
+
+    oauth2_http_doc_t doc = { 0 };
+    oauth2_http_doc_update(&doc, response, now, lifetime);
+
+    int result = oauth2_provider_apply_jwks(config, provider, &doc);
+    oauth2_http_doc_clear(&doc);
+    return result;
+}
+
+int oauth2_provider_warm_start(const sasl_utils_t *utils, oauth2_config_t *config,
+                               oauth2_provider_t *provider) {
+    if (!config || !provider || provider->local_keys || !config->state_dir) {
+        return SASL_OK;
+    }
+
+    oauth2_http_doc_t discovery, jwks;
+    int result = oauth2_state_load(config, provider->discovery_url, &discovery, &jwks);
+    if (result == SASL_NOTDONE) {
+        return SASL_OK;
+    }
+    if (result != SASL_OK) {
+        OAUTH2_LOG_WARN(utils, "Ignoring unreadable cached state for %s", provider->discovery_url);
+        return result;
+    }
+
+    oauth2_provider_endpoints_t endpoints;
+    result = oauth2_provider_parse_discovery(provider, &discovery, &endpoints);
+    if (result == SASL_OK) {
+        oauth2_provider_apply_discovery(provider, &discovery, &endpoints);
+        if (!provider->introspection) {
+            result = oauth2_provider_apply_jwks(config, provider, &jwks);
+        }
+    }
+
+    oauth2_http_doc_clear(&discovery);
+    oauth2_http_doc_clear(&jwks);
+
+    if (result == SASL_OK && provider->introspection) {
+        OAUTH2_LOG_INFO(utils, "Warm start: using cached introspection endpoint for %s (age %lds)",
+                        provider->discovery_url, (long)(time(NULL) - provider->discovery.fetched_at));
+    } else if (result == SASL_OK) {
+        OAUTH2_LOG_INFO(utils, "Warm start: using cached keys for %s (age %lds)",
+                        provider->discovery_url, (long)(time(NULL) - provider->jwks.fetched_at));
+    }
+    return result;
+}
+
+static char *oauth2_provider_strdup(const char *value) {
+    return value ? strdup(value) : NULL;
+}
+
+static int oauth2_provider_copy_doc(oauth2_http_doc_t *doc, const oauth2_http_doc_t *from) {
+    *doc = *from;
+    doc->body = NULL;
+    doc->etag = oauth2_provider_strdup(from->etag);
+    doc->last_modified = oauth2_provider_strdup(from->last_modified);
+    if (from->body) {
+        doc->body = malloc(from->len + 1);
+        if (doc->body) {
+            memcpy(doc->body, from->body, from->len + 1);
+        }
+    }
+    if ((from->body && !doc->body) || (from->etag && !doc->etag) ||
+        (from->last_modified && !doc->last_modified)) {
+        oauth2_http_doc_clear(doc);
+        return SASL_NOMEM;
+    }
+    return SASL_OK;
+}
+
+int oauth2_provider_inherit(const sasl_utils_t *utils, oauth2_provider_t *provider,
+                            oauth2_provider_t *previous) {
+    if (!provider || !previous || provider->local_keys) {
+        return SASL_OK;
+    }
+
+    /* The previous snapshot may still be serving logins: copy under its lock */
+    pthread_mutex_lock(&previous->lock);
+    int result = oauth2_provider_copy_doc(&provider->discovery, &previous->discovery);
+    if (result == SASL_OK) {
+        result = oauth2_provider_copy_doc(&provider->jwks, &previous->jwks);
+    }
+    provider->jwks_uri = oauth2_provider_strdup(previous->jwks_uri);
+    provider->discovered_issuer = oauth2_provider_strdup(previous->discovered_issuer);
+    provider->introspection_endpoint = oauth2_provider_strdup(previous->introspection_endpoint);
+    provider->userinfo_endpoint = oauth2_provider_strdup(previous->userinfo_endpoint);
+    provider->token_endpoint = oauth2_provider_strdup(previous->token_endpoint);
+    provider->last_attempt = previous->last_attempt;
+    provider->generation = previous->generation;
+    provider->breaker_state = previous->breaker_state;
+    provider->breaker_failures = previous->breaker_failures;
+    provider->breaker_opened_at = previous->breaker_opened_at;
+    oauth2_mirror_inherit(provider, previous);
+    pthread_mutex_unlock(&previous->lock);
+
+    /* Key sets are immutable: both snapshots can share the current one */
+    oauth2_keyset_t *keys = oauth2_key_store_acquire(previous->keys, utils);
+    if (keys) {
+        oauth2_key_store_swap(provider->keys, keys);
+    }
+    return result;
+}
+
+int oauth2_provider_breaker_allow(oauth2_config_t *config, oauth2_provider_t *provider) {
+    if (config->breaker_threshold <= 0) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&provider->lock);
+    int allowed = 1;
+    if (provider->breaker_state == OAUTH2_BREAKER_OPEN &&
+        time(NULL) - provider->breaker_opened_at >= config->breaker_cooldown) {
+        provider->breaker_state = OAUTH2_BREAKER_HALF_OPEN; /* The caller is the probe */
+    } else if (provider->breaker_state != OAUTH2_BREAKER_CLOSED) {
+        allowed = 0;
+    }
+    pthread_mutex_unlock(&provider->lock);
+
+    if (!allowed) {
+        OAUTH2_METRIC_INC(config, breaker_rejected);
+    }
+    return allowed;
+}
+
+void oauth2_provider_breaker_record(oauth2_config_t *config, oauth2_provider_t *provider, int success) {
+    if (config->breaker_threshold <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&provider->lock);
+    int opened = 0;
+    if (success) {
+        provider->breaker_state = OAUTH2_BREAKER_CLOSED;
+        provider->breaker_failures = 0;
+    } else {
+        provider->breaker_failures++;
+        if (provider->breaker_state == OAUTH2_BREAKER_HALF_OPEN ||
+            (provider->breaker_state == OAUTH2_BREAKER_CLOSED &&
+             provider->breaker_failures >= config->breaker_threshold)) {
+            provider->breaker_state = OAUTH2_BREAKER_OPEN;
+            provider->breaker_opened_at = time(NULL);
+            opened = 1;
+        }
+    }
+    pthread_mutex_unlock(&provider->lock);
+
+    if (opened) {
+        OAUTH2_METRIC_INC(config, breaker_opened);
+        if (config->utils) {
+            OAUTH2_LOG_WARN(config->utils, "Circuit breaker open for %s after %d failures, retrying in %ds",
+                            provider->discovery_url, provider->breaker_failures, config->breaker_cooldown);
+        }
+    }
+}
+
+oauth2_breaker_state_t oauth2_provider_breaker_state(oauth2_provider_t *provider) {
+    pthread_mutex_lock(&provider->lock);
+    oauth2_breaker_state_t state = provider->breaker_state;
+    pthread_mutex_unlock(&provider->lock);
+    return state;
+}
+
+/* Wait for the refresh lock no longer than the deadline allows */
+static int oauth2_provider_lock_refresh(oauth2_provider_t *provider, oauth2_deadline_t deadline) {
+    if (deadline == 0) {
+        return pthread_mutex_lock(&provider->refresh_lock) == 0 ? SASL_OK : SASL_FAIL;
+    }
+
+    long remaining_ms = oauth2_deadline_remaining(deadline);
+    struct timespec abs;
+    clock_gettime(CLOCK_REALTIME, &abs);
+    abs.tv_sec += remaining_ms / 1000;
+    abs.tv_nsec += (remaining_ms % 1000) * 1000000L;
+    if (abs.tv_nsec >= 1000000000L) {
+        abs.tv_sec++;
+        abs.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_mutex_timedlock(&provider->refresh_lock, &abs) == 0 ? SASL_OK : SASL_UNAVAIL;
+}
+
+/* End of a refresh: report to the breaker, persist and publish what was fetched */
+static int oauth2_provider_refresh_end(const sasl_utils_t *utils, oauth2_config_t *config,
+                                       oauth2_provider_refresh_op_t *op, int result) {
+    oauth2_provider_t *provider = op->provider;
+    free(op->jwks_uri);
+    free(op->mirrored);
+    op->jwks_uri = op->mirrored = NULL;
+    oauth2_provider_breaker_record(config, provider, !op->unavailable);
+
+    if (result == SASL_OK) {
+        oauth2_provider_persist(utils, config, provider);
+        pthread_mutex_lock(&provider->lock);
+        provider->generation++;
+        pthread_mutex_unlock(&provider->lock);
+        OAUTH2_LOG_DEBUG(utils, "Refreshed discovery%s for %s", provider->introspection ? "" : " and keys",
+                         provider->discovery_url);
+    }
+    return result;
+}
+
+/* Fetch the JWKS once discovery is settled, or end the refresh */
+static int oauth2_provider_refresh_jwks(const sasl_utils_t *utils, oauth2_config_t *config,
+                                        oauth2_provider_refresh_op_t *op, int result) {
+    /* Introspection providers have no keys to fetch */
+    if (result != SASL_OK || !op->jwks_uri || op->provider->introspection) {
+        return oauth2_provider_refresh_end(utils, config, op, result);
+    }
+
+    op->phase = OAUTH2_REFRESH_JWKS;
+    result = oauth2_provider_fetch_begin(config, op, op->jwks_uri, &op->provider->jwks);
+    if (result != SASL_CONTINUE) {
+        op->unavailable = 1;
+        return oauth2_provider_refresh_end(utils, config, op, result);
+    }
+    return SASL_CONTINUE;
+}
+
+int oauth2_provider_refresh_begin(const sasl_utils_t *utils, oauth2_config_t *config,
+                                  oauth2_provider_t *provider, unsigned long generation, int min_interval,
+                                  oauth2_provider_refresh_op_t *op) {
+    memset(op, 0, sizeof(*op));
+    op->provider = provider;
+
+    pthread_mutex_lock(&provider->lock);
+    int refreshed = provider->generation != generation;
+    time_t now = time(NULL);
+    int throttled = now - provider->last_attempt < min_interval;
+    int need_discovery = !(provider->introspection ? provider->introspection_endpoint : provider->jwks_uri) ||
+                         provider->discovery.expires_at <= now;
+    op->jwks_uri = provider->jwks_uri ? strdup(provider->jwks_uri) : NULL;
+    if (!refreshed && !throttled) {
+        provider->last_attempt = now;
+    }
+    pthread_mutex_unlock(&provider->lock);
+
+    if (refreshed || throttled) {
+        free(op->jwks_uri);
+        op->jwks_uri = NULL;
+        return refreshed ? SASL_OK : SASL_TRYAGAIN;
+    }
+
+    /* Fail fast while the IdP is known to be down */
+    if (!oauth2_provider_breaker_allow(config, provider)) {
+        free(op->jwks_uri);
+        op->jwks_uri = NULL;
+        return SASL_UNAVAIL;
+    }
+
+    if (!need_discovery) {
+        return oauth2_provider_refresh_jwks(utils, config, op, SASL_OK);
+    }
+    op->phase = OAUTH2_REFRESH_DISCOVERY;
+    int result = oauth2_provider_fetch_begin(config, op, provider->discovery_url, &provider->discovery);
+    if (result != SASL_CONTINUE) {
+        op->unavailable = 1;
+        return oauth2_provider_refresh_end(utils, config, op, result);
+    }
+    return SASL_CONTINUE;
+}
+
+int oauth2_provider_refresh_step(const sasl_utils_t *utils, oauth2_config_t *config,
+                                 oauth2_provider_refresh_op_t *op, oauth2_deadline_t deadline) {
+    oauth2_provider_t *provider = op->provider;
+    int result = oauth2_provider_fetch_done(utils, config, op, deadline);
+    if (result == SASL_CONTINUE) {
+        return result;
+    }
+    op->unavailable |= result != SASL_OK;
+
+    if (op->phase == OAUTH2_REFRESH_JWKS) {
+        if (result == SASL_OK) {
+            result = oauth2_provider_store_jwks(config, provider, &op->transfer.response);
+            if (result != SASL_OK) {
+                OAUTH2_LOG_WARN(utils, "No usable keys in JWKS from %s", op->jwks_uri);
+            }
+            oauth2_http_response_free(&op->transfer.response);
+        }
+        return oauth2_provider_refresh_end(utils, config, op, result);
+    }
+
+    if (result == SASL_OK) {
+        result = oauth2_provider_store_discovery(config, provider, &op->transfer.response);
+        if (result != SASL_OK) {
+            OAUTH2_LOG_WARN(utils, "Discovery document of %s has no %s", provider->discovery_url,
+                            provider->introspection ? "introspection_endpoint" : "jwks_uri");
+        }
+        oauth2_http_response_free(&op->transfer.response);
+    }
+
+    /* A failed discovery refresh still lets a known jwks_uri be refreshed */
+    free(op->jwks_uri);
+    pthread_mutex_lock(&provider->lock);
+    op->jwks_uri = provider->jwks_uri ? strdup(provider->jwks_uri) : NULL;
+    pthread_mutex_unlock(&provider->lock);
+    if (op->jwks_uri && !provider->introspection) result = SASL_OK;
+
+    return oauth2_provider_refresh_jwks(utils, config, op, result);
+}
+
+int oauth2_provider_refresh(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, int min_interval, oauth2_deadline_t deadline) {
+    if (!config || !provider || provider->local_keys) {
+        return SASL_OK;
+    }
+
+    pthread_mutex_lock(&provider->lock);
+    unsigned long generation = provider->generation;
+    pthread_mutex_unlock(&provider->lock);
+
+    /* Coalesce: concurrent callers wait for the refresh in flight and share its result */
+    if (oauth2_provider_lock_refresh(provider, deadline) != SASL_OK) {
+        OAUTH2_METRIC_INC(config, deadline_exceeded);
+        return SASL_UNAVAIL;
+    }
+
+    oauth2_provider_refresh_op_t op;
+    int result = oauth2_provider_refresh_begin(utils, config, provider, generation, min_interval, &op);
+    while (result == SASL_CONTINUE) {
+        op.transfer.result = oauth2_http_get(config, op.transfer.url, op.transfer.cached, deadline,
+                                             &op.transfer.response);
+        result = oauth2_provider_refresh_step(utils, config, &op, deadline);
+    }
+
+    pthread_mutex_unlock(&provider->refresh_lock);
+    return result;
+}
+
+/*
+ * Run one concurrent batch of discovery or JWKS fetches; urls[i] NULL skips
+ * provider i. Each fetch goes to its provider's best mirror and every
+ * mirror's result is recorded, as for a single refresh; fetches that fail
+ * over are sent together in the next round.
+ */
+static void oauth2_provider_fetch_batch(const sasl_utils_t *utils, oauth2_config_t *config,
+                                        oauth2_provider_t **providers, char **urls, int count,
+                                        int jwks, int *failed, oauth2_deadline_t deadline) {
+    oauth2_provider_refresh_op_t *ops = calloc((size_t)count, sizeof(oauth2_provider_refresh_op_t));
+    oauth2_http_transfer_t *requests = calloc((size_t)count, sizeof(oauth2_http_transfer_t));
+    int *index = calloc((size_t)count, sizeof(int));
+    int *active = calloc((size_t)count, sizeof(int));
+    if (!ops || !requests || !index || !active) {
+        free(ops);
+        free(requests);
+        free(index);
+        free(active);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!urls[i]) continue;
+        ops[i].provider = providers[i];
+        active[i] = oauth2_provider_fetch_begin(config, &ops[i], urls[i],
+                                                jwks ? &providers[i]->jwks : &providers[i]->discovery)
+                    == SASL_CONTINUE;
+        failed[i] |= !active[i];
+    }
+
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (!active[i]) continue;
+            requests[n] = ops[i].transfer;
+            index[n++] = i;
+        }
+        if (n == 0) break;
+
+        oauth2_http_get_many(config, requests, n, deadline);
+
+        for (int j = 0; j < n; j++) {
+            oauth2_provider_refresh_op_t *op = &ops[index[j]];
+            op->transfer = requests[j];
+
+            int result = oauth2_provider_fetch_done(utils, config, op, deadline);
+            if (result == SASL_CONTINUE) continue;
+            active[index[j]] = 0;
+            if (result == SASL_OK) {
+                result = jwks ? oauth2_provider_store_jwks(config, op->provider, &op->transfer.response)
+                              : oauth2_provider_store_discovery(config, op->provider, &op->transfer.response);
+                oauth2_http_response_free(&op->transfer.response);
+            }
+            if (result != SASL_OK) {
+                failed[index[j]] = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(ops[i].mirrored);
+    }
+    free(ops);
+    free(requests);
+    free(index);
+    free(active);
+}
+
+/* Whether a provider has everything its validation mode needs, still fresh; caller holds the refresh lock */
+static int oauth2_provider_fresh(const oauth2_provider_t *provider, time_t now) {
+    const oauth2_http_doc_t *doc = provider->introspection ? &provider->discovery : &provider->jwks;
+    return doc->body && doc->expires_at > now;
+}
+
+int oauth2_provider_warmup(const sasl_utils_t *utils, oauth2_config_t *config, int budget) {
+    if (!config || budget <= 0 || config->providers_count == 0) {
+        return 0;
+    }
+
+    oauth2_deadline_t deadline = oauth2_deadline_after(budget);
+    long long started = oauth2_monotonic_ms();
+    int count = config->providers_count;
+    oauth2_provider_t **providers = calloc((size_t)count, sizeof(oauth2_provider_t*));
+    char **urls = calloc((size_t)count, sizeof(char*));
+    int *failed = calloc((size_t)count, sizeof(int));
+    if (!providers || !urls || !failed) {
+        free(providers);
+        free(urls);
+        free(failed);
+        return -1;
+    }
+
+    /* Pick providers without fresh keys (warm start may have served some); hold their refresh locks */
+    time_t now = time(NULL);
+    int pending = 0, ready = 0, network = 0;
+    for (int i = 0; i < count; i++) {
+        oauth2_provider_t *provider = &config->providers[i];
+        if (provider->local_keys) continue;
+        network++;
+
+        pthread_mutex_lock(&provider->refresh_lock);
+        if (oauth2_provider_fresh(provider, now)) {
+            pthread_mutex_unlock(&provider->refresh_lock);
+            ready++;
+            continue;
+        }
+        provider->last_attempt = now;
+        providers[pending++] = provider;
+    }
+
+    /* Phase 1: every discovery document at once */
+    for (int i = 0; i < pending; i++) {
+        const char *endpoint = providers[i]->introspection ? providers[i]->introspection_endpoint
+                                                           : providers[i]->jwks_uri;
+        if (!endpoint || providers[i]->discovery.expires_at <= now) {
+            urls[i] = (char*)providers[i]->discovery_url;
+        }
+    }
+    oauth2_provider_fetch_batch(utils, config, providers, urls, pending, 0, failed, deadline);
+
+    /* Phase 2: every JWKS at once, including providers whose discovery was still fresh;
+     * a discovery that failed in phase 1 keeps the provider failed */
+    for (int i = 0; i < pending; i++) {
+        if (providers[i]->introspection) {
+            urls[i] = NULL;
+            failed[i] |= !providers[i]->introspection_endpoint;
+        } else {
+            urls[i] = providers[i]->jwks_uri;
+            failed[i] |= !urls[i];
+        }
+    }
+    oauth2_provider_fetch_batch(utils, config, providers, urls, pending, 1, failed, deadline);
+
+    for (int i = 0; i < pending; i++) {
+        oauth2_provider_t *provider = providers[i];
+        oauth2_provider_breaker_record(config, provider, !failed[i]);
+        if (!failed[i]) {
+            oauth2_provider_persist(utils, config, provider);
+            pthread_mutex_lock(&provider->lock);
+            provider->generation++;
+            pthread_mutex_unlock(&provider->lock);
+            OAUTH2_LOG_INFO(utils, "Warmup: provider %s ready", provider->discovery_url);
+            ready++;
+        } else {
+            OAUTH2_LOG_WARN(utils, "Warmup: provider %s not ready, keys will be fetched on demand",
+                            provider->discovery_url);
+        }
+        pthread_mutex_unlock(&provider->refresh_lock);
+    }
+
+    long elapsed_ms = (long)(oauth2_monotonic_ms() - started);
+    OAUTH2_LOG_INFO(utils, "Warmup: %d of %d network providers ready in %ld ms",
+                    ready, network, elapsed_ms);
+
+    free(providers);
+    free(urls);
+    free(failed);
+    return ready;
+}
+
+/*
+ * Refresh on the authentication path. On an asynchronous validator the
+ * network thread does it instead (SASL_CONTINUE): the validation runs
+ * again once it is done, and then goes on with what it brought.
+ */
+static int oauth2_provider_refresh_login(const sasl_utils_t *utils, oauth2_config_t *config,
+                                         oauth2_provider_t *provider, oauth2_deadline_t deadline) {
+    if (oauth2_async_result(OAUTH2_NET_REFRESH, provider, NULL) != SASL_NOTDONE) {
+        return SASL_OK;
+    }
+
+    oauth2_net_request_t *request = oauth2_async_request(OAUTH2_NET_REFRESH, provider);
+    if (request) {
+        pthread_mutex_lock(&provider->lock);
+        request->generation = provider->generation;
+        pthread_mutex_unlock(&provider->lock);
+        request->min_interval = OAUTH2_PROVIDER_RETRY_INTERVAL;
+        return SASL_CONTINUE;
+    }
+    return oauth2_provider_refresh(utils, config, provider, OAUTH2_PROVIDER_RETRY_INTERVAL, deadline);
+}
+
+oauth2_keyset_t *oauth2_provider_acquire_keys(const sasl_utils_t *utils, oauth2_config_t *config,
+                                              oauth2_provider_t *provider, int force_refresh,
+                                              oauth2_deadline_t deadline) {
+    if (!provider) return NULL;
+
+    if (!provider->local_keys) {
+        oauth2_keyset_t *keys = oauth2_key_store_acquire(provider->keys, utils);
+        if (keys && !force_refresh) {
+            return keys;
+        }
+        oauth2_keyset_release(keys, config->oauth2_log);
+
+        /* No keys yet, or a signing key we do not know: fetch on the authentication path */
+        if (oauth2_provider_refresh_login(utils, config, provider, deadline) == SASL_CONTINUE) {
+            return NULL;
+        }
+    }
+
+    return oauth2_key_store_acquire(provider->keys, utils);
+}
+
+/* Copy of an endpoint announced by discovery, fetching the discovery document once if unknown */
+static char *oauth2_provider_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                      oauth2_provider_t *provider, char **field, oauth2_deadline_t deadline) {
+    pthread_mutex_lock(&provider->lock);
+    char *endpoint = *field ? strdup(*field) : NULL;
+    pthread_mutex_unlock(&provider->lock);
+    if (endpoint) {
+        return endpoint;
+    }
+
+    /* Discovery not fetched yet: do it on the authentication path */
+    if (oauth2_provider_refresh_login(utils, config, provider, deadline) == SASL_CONTINUE) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&provider->lock);
+    endpoint = *field ? strdup(*field) : NULL;
+    pthread_mutex_unlock(&provider->lock);
+    return endpoint;
+}
+
+char *oauth2_provider_introspection_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                             oauth2_provider_t *provider, oauth2_deadline_t deadline) {
+    if (!provider || !provider->introspection) return NULL;
+
+    return oauth2_provider_endpoint(utils, config, provider, &provider->introspection_endpoint, deadline);
+}
+
+char *oauth2_provider_userinfo_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                        oauth2_provider_t *provider, oauth2_deadline_t deadline) {
+    if (!provider || provider->local_keys) return NULL;
+
+    return oauth2_provider_endpoint(utils, config, provider, &provider->userinfo_endpoint, deadline);
+}
+
+char *oauth2_provider_token_endpoint(const sasl_utils_t *utils, oauth2_config_t *config,
+                                     oauth2_provider_t *provider, oauth2_deadline_t deadline) {
+    if (!provider || provider->local_keys) return NULL;
+
+    return oauth2_provider_endpoint(utils, config, provider, &provider->token_endpoint, deadline);
+}
+
+static void *oauth2_provider_refresher(void *arg) {
+    oauth2_config_t *config = (oauth2_config_t*)arg;
+    const sasl_utils_t *utils = config->utils;
+
+    pthread_mutex_lock(&config->refresher_lock);
+    while (!config->refresher_stop) {
+        pthread_mutex_unlock(&config->refresher_lock);
+
+        time_t now = time(NULL);
+        time_t next = now + OAUTH2_PROVIDER_MAX_SLEEP;
+        int attempts = 0;
+
+        for (int i = 0; i < config->providers_count; i++) {
+            oauth2_provider_t *provider = &config->providers[i];
+            if (provider->local_keys) continue;
+
+            pthread_mutex_lock(&provider->lock);
+            const oauth2_http_doc_t *doc = provider->introspection ? &provider->discovery : &provider->jwks;
+            time_t due = doc->body ? doc->expires_at : 0;
+            pthread_mutex_unlock(&provider->lock);
+
+            if (due <= now) {
+                attempts++;
+                oauth2_deadline_t deadline = oauth2_deadline_after(config->timeout);
+                if (oauth2_provider_refresh(utils, config, provider, OAUTH2_PROVIDER_RETRY_INTERVAL,
+                                            deadline) == SASL_OK) {
+                    pthread_mutex_lock(&provider->lock);
+                    due = doc->expires_at;
+                    pthread_mutex_unlock(&provider->lock);
+                } else {
+                    due = now + OAUTH2_PROVIDER_RETRY_INTERVAL;
+                }
+            }
+            if (due < next) next = due;
+        }
+
+        if (attempts > 0) {
+            char metrics[8192];
+            if (oauth2_metrics_format(config, metrics, sizeof(metrics)) == SASL_OK) {
+                OAUTH2_LOG_DEBUG(utils, "Provider refresh done: %s", metrics);
+            }
+        }
+
+        pthread_mutex_lock(&config->refresher_lock);
+        if (config->refresher_stop) break;
+
+        struct timespec wake = { .tv_sec = next > now ? next : now + 1, .tv_nsec = 0 };
+        pthread_cond_timedwait(&config->refresher_cond, &config->refresher_lock, &wake);
+    }
+    pthread_mutex_unlock(&config->refresher_lock);
+
+    return NULL;
+}
+
+int oauth2_provider_start_refresher(oauth2_config_t *config) {
+    if (!config) {
+        return SASL_BADPARAM;
+    }
+
+    /* Started lazily and once per process, so that forked children get their own thread */
+    pid_t pid = getpid();
+    if (__atomic_load_n(&config->refresher_pid, __ATOMIC_ACQUIRE) == pid) {
+        return SASL_OK;
+    }
+
+    int network_providers = 0;
+    for (int i = 0; i < config->providers_count; i++) {
+        if (!config->providers[i].local_keys) network_providers++;
+    }
+
+    pthread_mutex_lock(&config->refresher_lock);
+    int result = SASL_OK;
+    if (config->refresher_pid != pid) {
+        config->refresher_stop = 0;
+        if (network_providers > 0 &&
+            pthread_create(&config->refresher, NULL, oauth2_provider_refresher, config) != 0) {
+            result = SASL_FAIL;
+        } else {
+            config->refresher_running = network_providers > 0;
+            __atomic_store_n(&config->refresher_pid, pid, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&config->refresher_lock);
+
+    return result;
+}
+
+void oauth2_provider_stop_refresher(oauth2_config_t *config) {
+    if (!config || !config->refresher_running || config->refresher_pid != getpid()) {
+        return;
+    }
+
+    pthread_mutex_lock(&config->refresher_lock);
+    config->refresher_stop = 1;
+    pthread_cond_signal(&config->refresher_cond);
+    pthread_mutex_unlock(&config->refresher_lock);
+
+    pthread_join(config->refresher, NULL);
+    config->refresher_running = 0;
+    config->refresher_pid = 0;
+}
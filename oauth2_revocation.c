@@ -0,0 +1,391 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Local Revocation List
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Tokens revoked before they expire, read from a local file:
+ *
+ *   # comment
+ *   jti <token id>               one token
+ *   sub <subject> <unix time>    every token of subject issued before time
+ *
+ * The file is compiled into an immutable set: a blocked Bloom filter
+ * (one cache line per lookup) answers most checks for valid tokens, and
+ * an exact open addressing table confirms its hits. Sets are swapped
+ * atomically when the file changes, so logins never wait for a reload.
+ * A list is never without a set: a file unusable from the start fails
+ * the configuration, and a broken update keeps the previous set.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OAUTH2_REVOCATION_BLOOM_BITS_PER_ENTRY 10
+#define OAUTH2_REVOCATION_BLOOM_PROBES 7        /* 9 bits each, from one 64-bit hash */
+#define OAUTH2_REVOCATION_BLOCK_WORDS 8         /* 512 bits, one cache line */
+
+static uint64_t oauth2_revocation_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* FNV-1a over type byte and id, finalized for well spread high and low halves */
+static uint64_t oauth2_revocation_hash(char type, const char *id, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = (h ^ (unsigned char)type) * 0x100000001b3ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)id[i]) * 0x100000001b3ULL;
+    }
+    return oauth2_revocation_mix(h);
+}
+
+/* Map 32 hash bits onto [0, n) without a division */
+static size_t oauth2_revocation_range(uint32_t bits, size_t n) {
+    return (size_t)(((uint64_t)bits * (uint64_t)n) >> 32);
+}
+
+static void oauth2_revocation_bloom_add(oauth2_revocation_set_t *set, uint64_t h) {
+    uint64_t *block = set->bloom + oauth2_revocation_range((uint32_t)(h >> 32), set->bloom_blocks) *
+                                   OAUTH2_REVOCATION_BLOCK_WORDS;
+    uint64_t g = oauth2_revocation_mix(h ^ 0x9e3779b97f4a7c15ULL);
+    for (int i = 0; i < OAUTH2_REVOCATION_BLOOM_PROBES; i++, g >>= 9) {
+        block[(g & 511) >> 6] |= 1ULL << (g & 63);
+    }
+}
+
+static int oauth2_revocation_bloom_test(const oauth2_revocation_set_t *set, uint64_t h) {
+    const uint64_t *block = set->bloom + oauth2_revocation_range((uint32_t)(h >> 32), set->bloom_blocks) *
+                                         OAUTH2_REVOCATION_BLOCK_WORDS;
+    uint64_t g = oauth2_revocation_mix(h ^ 0x9e3779b97f4a7c15ULL);
+    for (int i = 0; i < OAUTH2_REVOCATION_BLOOM_PROBES; i++, g >>= 9) {
+        if (!(block[(g & 511) >> 6] & (1ULL << (g & 63)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Slot holding (type, id), or the empty slot where it belongs */
+static oauth2_revocation_slot_t *oauth2_revocation_probe(const oauth2_revocation_set_t *set, uint64_t h,
+                                                         char type, const char *id, size_t len) {
+    uint32_t tag = (uint32_t)(h >> 32) | 1u;
+    size_t i = oauth2_revocation_range((uint32_t)h, set->slots_count);
+
+    for (;;) {
+        oauth2_revocation_slot_t *slot = &set->slots[i];
+        if (slot->tag == 0) {
+            return slot;
+        }
+        if (slot->tag == tag) {
+            const char *key = set->pool + slot->offset;
+            if (key[0] == type && strncmp(key + 1, id, len) == 0 && key[len + 1] == '\0') {
+                return slot;
+            }
+        }
+        if (++i == set->slots_count) i = 0;
+    }
+}
+
+static int oauth2_revocation_insert(oauth2_revocation_set_t *set, char type, const char *id, size_t len,
+                                    long long cutoff) {
+    uint64_t h = oauth2_revocation_hash(type, id, len);
+    oauth2_revocation_slot_t *slot = oauth2_revocation_probe(set, h, type, id, len);
+
+    if (slot->tag != 0) {
+        /* Repeated subject: the latest cutoff wins */
+        if (cutoff > slot->cutoff) slot->cutoff = cutoff;
+        return SASL_OK;
+    }
+
+    slot->tag = (uint32_t)(h >> 32) | 1u;
+    slot->offset = (uint32_t)set->pool_len;
+    slot->cutoff = cutoff;
+    set->pool[set->pool_len++] = type;
+    memcpy(set->pool + set->pool_len, id, len);
+    set->pool_len += len;
+    set->pool[set->pool_len++] = '\0';
+
+    oauth2_revocation_bloom_add(set, h);
+    set->count++;
+    return SASL_OK;
+}
+
+/* Next whitespace separated field of [*p, end), advancing *p */
+static const char *oauth2_revocation_field(const char **p, const char *end, size_t *len) {
+    const char *s = *p;
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    const char *e = s;
+    while (e < end && *e != ' ' && *e != '\t') e++;
+    *p = e;
+    *len = (size_t)(e - s);
+    return s;
+}
+
+/* Unix time of a field; the mapped file is not NUL terminated, so no strtoll() */
+static int oauth2_revocation_time(const char *s, size_t len, long long *value) {
+    if (len == 0 || len > 18) {
+        return SASL_FAIL;
+    }
+
+    *value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return SASL_FAIL;
+        *value = *value * 10 + (s[i] - '0');
+    }
+    return SASL_OK;
+}
+
+oauth2_revocation_set_t *oauth2_revocation_set_build(const char *data, size_t len, int *bad_line) {
+    if (bad_line) *bad_line = 0;
+    if (!data || len >= UINT32_MAX) {
+        return NULL;
+    }
+
+    /* Every line may be an entry: size both indexes for that bound */
+    size_t lines = 1;
+    for (const char *p = data; (p = memchr(p, '\n', (size_t)(data + len - p))) != NULL; p++) {
+        lines++;
+    }
+
+    oauth2_revocation_set_t *set = calloc(1, sizeof(oauth2_revocation_set_t));
+    if (!set) {
+        return NULL;
+    }
+    set->refcount = 1;
+    set->slots_count = lines + lines / 3 + 1;       /* Load factor at most 3/4 */
+    set->bloom_blocks = (lines * OAUTH2_REVOCATION_BLOOM_BITS_PER_ENTRY + 511) / 512;
+    set->slots = calloc(set->slots_count, sizeof(oauth2_revocation_slot_t));
+    set->pool = malloc(len + 2);                    /* Entries are never longer than their line */
+    if (!set->slots || !set->pool ||
+        posix_memalign((void**)&set->bloom, 64, set->bloom_blocks * OAUTH2_REVOCATION_BLOCK_WORDS * 8) != 0) {
+        set->bloom = NULL;
+        oauth2_revocation_set_release(set);
+        return NULL;
+    }
+    memset(set->bloom, 0, set->bloom_blocks * OAUTH2_REVOCATION_BLOCK_WORDS * 8);
+
+    const char *end = data + len;
+    int line_no = 0;
+    for (const char *line = data; line < end; ) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) eol = end;
+        line_no++;
+
+        const char *p = line;
+        const char *line_end = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+        size_t kind_len, id_len, cutoff_len, extra_len;
+        const char *kind = oauth2_revocation_field(&p, line_end, &kind_len);
+        int ok = 1;
+
+        if (kind_len > 0 && kind[0] != '#') {
+            const char *id = oauth2_revocation_field(&p, line_end, &id_len);
+            const char *cutoff = NULL;
+            if (kind_len == 3 && memcmp(kind, "jti", 3) == 0) {
+                ok = id_len > 0 && memchr(id, '\0', id_len) == NULL;
+                if (ok) oauth2_revocation_insert(set, 'j', id, id_len, 0);
+            } else if (kind_len == 3 && memcmp(kind, "sub", 3) == 0) {
+                cutoff = oauth2_revocation_field(&p, line_end, &cutoff_len);
+                long long value;
+                ok = id_len > 0 && memchr(id, '\0', id_len) == NULL &&
+                     oauth2_revocation_time(cutoff, cutoff_len, &value) == SASL_OK;
+                if (ok) oauth2_revocation_insert(set, 's', id, id_len, value);
+            } else {
+                ok = 0;
+            }
+            oauth2_revocation_field(&p, line_end, &extra_len);
+            ok = ok && extra_len == 0;
+        }
+
+        if (!ok) {
+            if (bad_line) *bad_line = line_no;
+            oauth2_revocation_set_release(set);
+            return NULL;
+        }
+        line = eol + 1;
+    }
+
+    return set;
+}
+
+oauth2_revocation_set_t *oauth2_revocation_set_ref(oauth2_revocation_set_t *set) {
+    if (set) {
+        __atomic_add_fetch(&set->refcount, 1, __ATOMIC_RELAXED);
+    }
+    return set;
+}
+
+void oauth2_revocation_set_release(oauth2_revocation_set_t *set) {
+    if (!set) return;
+
+    if (__atomic_sub_fetch(&set->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(set->bloom);
+        free(set->slots);
+        free(set->pool);
+        free(set);
+    }
+}
+
+size_t oauth2_revocation_set_bytes(const oauth2_revocation_set_t *set) {
+    if (!set) return 0;
+
+    return sizeof(*set) + set->bloom_blocks * OAUTH2_REVOCATION_BLOCK_WORDS * 8 +
+           set->slots_count * sizeof(oauth2_revocation_slot_t) + set->pool_len;
+}
+
+static const oauth2_revocation_slot_t *oauth2_revocation_find(const oauth2_revocation_set_t *set,
+                                                              char type, const char *id) {
+    size_t len = strlen(id);
+    uint64_t h = oauth2_revocation_hash(type, id, len);
+    if (!oauth2_revocation_bloom_test(set, h)) {
+        return NULL;
+    }
+
+    const oauth2_revocation_slot_t *slot = oauth2_revocation_probe(set, h, type, id, len);
+    return slot->tag != 0 ? slot : NULL;
+}
+
+int oauth2_revocation_set_check(const oauth2_revocation_set_t *set, const char *jti,
+                                const char *sub, long long iat) {
+    if (!set || set->count == 0) {
+        return 0;
+    }
+
+    if (jti && oauth2_revocation_find(set, 'j', jti)) {
+        return 1;
+    }
+
+    /* A token without iat cannot prove it was issued after the cutoff */
+    const oauth2_revocation_slot_t *slot = sub ? oauth2_revocation_find(set, 's', sub) : NULL;
+    return slot && iat < slot->cutoff;
+}
+
+/* Compile the file; NULL if it cannot be read or has a malformed line */
+static oauth2_revocation_set_t *oauth2_revocation_list_load(const sasl_utils_t *utils,
+                                                            oauth2_revocation_list_t *list) {
+    oauth2_file_map_t map;
+    const char *path = list->watch.path;
+
+    if (oauth2_file_map(path, &map) != SASL_OK) {
+        /* An empty file is an empty list, but cannot be mapped */
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 0) {
+            return oauth2_revocation_set_build("", 0, NULL);
+        }
+        OAUTH2_LOG_ERR(utils, "Cannot map revocation file %s", path);
+        return NULL;
+    }
+
+    int bad_line = 0;
+    oauth2_revocation_set_t *set = oauth2_revocation_set_build(map.data, map.len, &bad_line);
+    oauth2_file_unmap(&map);
+
+    if (!set && bad_line > 0) {
+        OAUTH2_LOG_ERR(utils, "Malformed entry in revocation file %s line %d", path, bad_line);
+    } else if (!set) {
+        OAUTH2_LOG_ERR(utils, "Cannot load revocation file %s", path);
+    }
+    return set;
+}
+
+/* Install a new set; the previous one lives on until its last user releases it */
+static void oauth2_revocation_list_swap(oauth2_revocation_list_t *list, oauth2_revocation_set_t *set) {
+    pthread_mutex_lock(&list->lock);
+    oauth2_revocation_set_t *old = list->current;
+    list->current = set;
+    pthread_mutex_unlock(&list->lock);
+
+    oauth2_revocation_set_release(old);
+}
+
+oauth2_revocation_list_t *oauth2_revocation_list_create(const sasl_utils_t *utils, const char *path,
+                                                        int reload_interval, oauth2_revocation_list_t *previous) {
+    if (!path) {
+        return NULL;
+    }
+
+    oauth2_revocation_list_t *list = calloc(1, sizeof(oauth2_revocation_list_t));
+    if (!list) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&list->lock, NULL);
+    pthread_mutex_init(&list->reload_lock, NULL);
+    if (oauth2_file_watch_init(&list->watch, path, reload_interval) != SASL_OK) {
+        oauth2_revocation_list_free(list);
+        return NULL;
+    }
+    list->watch_pid = getpid();
+
+    list->current = oauth2_revocation_list_load(utils, list);
+    if (list->current) {
+        OAUTH2_LOG_INFO(utils, "Loaded %zu revocation(s) from %s (%zu KiB)", list->current->count, path,
+                        oauth2_revocation_set_bytes(list->current) / 1024);
+        return list;
+    }
+
+    /* A reload keeps the list the previous configuration enforced, as a file change would */
+    if (previous && strcmp(previous->watch.path, path) == 0) {
+        list->current = oauth2_revocation_list_acquire(previous, utils);
+    }
+    if (!list->current) {
+        OAUTH2_LOG_ERR(utils, "Revocation file %s unusable, revoked tokens cannot be refused", path);
+        oauth2_revocation_list_free(list);
+        return NULL;
+    }
+    OAUTH2_LOG_WARN(utils, "Revocation file %s unusable, keeping previous list of %zu revocation(s)", path,
+                    list->current->count);
+    return list;
+}
+
+void oauth2_revocation_list_free(oauth2_revocation_list_t *list) {
+    if (!list) return;
+
+    oauth2_revocation_set_release(list->current);
+    oauth2_file_watch_free(&list->watch);
+    pthread_mutex_destroy(&list->lock);
+    pthread_mutex_destroy(&list->reload_lock);
+    free(list);
+}
+
+oauth2_revocation_set_t *oauth2_revocation_list_acquire(oauth2_revocation_list_t *list,
+                                                        const sasl_utils_t *utils) {
+    if (!list) return NULL;
+
+    /* Pick up file changes; a single caller reloads while the others keep the current set */
+    if (pthread_mutex_trylock(&list->reload_lock) == 0) {
+        /* A watch inherited across fork shares its inotify queue with the parent and siblings */
+        int changed = 0;
+        pid_t pid = getpid();
+        if (list->watch_pid != pid) {
+            list->watch_pid = pid;
+            changed = oauth2_file_watch_rearm(&list->watch);
+        }
+        changed |= oauth2_file_watch_changed(&list->watch);
+        if (changed) {
+            oauth2_revocation_set_t *set = oauth2_revocation_list_load(utils, list);
+            if (set) {
+                OAUTH2_LOG_INFO(utils, "Reloaded %zu revocation(s) from %s", set->count, list->watch.path);
+                oauth2_revocation_list_swap(list, set);
+            } else {
+                OAUTH2_LOG_WARN(utils, "Revocation file reload failed, keeping previous list");
+            }
+        }
+        pthread_mutex_unlock(&list->reload_lock);
+    }
+
+    pthread_mutex_lock(&list->lock);
+    oauth2_revocation_set_t *set = oauth2_revocation_set_ref(list->current);
+    pthread_mutex_unlock(&list->lock);
+
+    return set;
+}
@@ -0,0 +1,198 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Secure Memory for Bearer Tokens
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Process-wide slab allocator for secret material. Slots come in a few
+ * fixed size classes matching typical token lengths and are carved out
+ * of chunks that are locked in memory (never swapped) and left out of
+ * core dumps. A slot is wiped with its known length when it is freed and
+ * goes back to its class's free list, so a login costs no heap allocation
+ * and no page faults for its token.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <openssl/crypto.h>
+
+/* Opaque tokens, typical JWTs, JWTs with many claims, very large JWTs */
+static const size_t oauth2_secure_sizes[OAUTH2_SECURE_CLASSES] = { 256, 1024, 4096, 16384 };
+
+#define OAUTH2_SECURE_CHUNK_SIZE (64 * 1024)
+#define OAUTH2_SECURE_DEDICATED OAUTH2_SECURE_CLASSES
+
+/* In front of every slot; on a free list, next links the slots of a class */
+typedef struct oauth2_secure_slot {
+    union {
+        struct oauth2_secure_slot *next;
+        size_t len;                 /* Bytes handed out, wiped on free */
+    } u;
+    uint32_t size_class;            /* Index in oauth2_secure_sizes, or OAUTH2_SECURE_DEDICATED */
+    uint32_t map_pages;             /* Dedicated mappings only */
+} __attribute__((aligned(16))) oauth2_secure_slot_t;
+
+typedef struct oauth2_secure_chunk {
+    struct oauth2_secure_chunk *next;
+    size_t size;
+} oauth2_secure_chunk_t;
+
+_Static_assert(sizeof(oauth2_secure_chunk_t) <= sizeof(oauth2_secure_slot_t),
+               "chunk header must fit in a slot header");
+
+static struct {
+    pthread_mutex_t lock;
+    oauth2_secure_slot_t *free_slots[OAUTH2_SECURE_CLASSES];
+    oauth2_secure_chunk_t *chunks;
+    pid_t pid;                      /* Memory locks are not inherited across fork() */
+    oauth2_secure_stats_t stats;
+} oauth2_secure = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void oauth2_secure_wipe(void *p, size_t len) {
+    if (!p || len == 0) return;
+#ifdef __GLIBC__
+    explicit_bzero(p, len);
+#else
+    OPENSSL_cleanse(p, len);
+#endif
+}
+
+/* Anonymous mapping, locked and excluded from core dumps where the system allows it */
+static void *oauth2_secure_map(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(p, size, MADV_DONTDUMP);
+#endif
+    /* RLIMIT_MEMLOCK may be small: the memory is still usable, only swappable */
+    if (mlock(p, size) == 0) {
+        oauth2_secure.stats.bytes_locked += size;
+    } else {
+        oauth2_secure.stats.lock_failures++;
+    }
+    return p;
+}
+
+static void oauth2_secure_unmap(void *p, size_t size) {
+    if (munlock(p, size) == 0) {
+        oauth2_secure.stats.bytes_locked -= size;
+    }
+    munmap(p, size);
+}
+
+/* A forked child starts with no locked pages: lock the chunks it inherited again */
+static void oauth2_secure_check_fork(void) {
+    pid_t pid = getpid();
+    if (oauth2_secure.pid == pid) return;
+
+    if (oauth2_secure.pid != 0) {
+        oauth2_secure.stats.bytes_locked = 0;
+        for (oauth2_secure_chunk_t *chunk = oauth2_secure.chunks; chunk; chunk = chunk->next) {
+            if (mlock(chunk, chunk->size) == 0) {
+                oauth2_secure.stats.bytes_locked += chunk->size;
+            } else {
+                oauth2_secure.stats.lock_failures++;
+            }
+        }
+    }
+    oauth2_secure.pid = pid;
+}
+
+/* Carve a new chunk into slots of one class; the caller holds the lock */
+static int oauth2_secure_grow(int size_class) {
+    oauth2_secure_chunk_t *chunk = oauth2_secure_map(OAUTH2_SECURE_CHUNK_SIZE);
+    if (!chunk) {
+        return SASL_NOMEM;
+    }
+    chunk->size = OAUTH2_SECURE_CHUNK_SIZE;
+    chunk->next = oauth2_secure.chunks;
+    oauth2_secure.chunks = chunk;
+
+    /* The chunk header takes the room of one slot header, keeping slots 16-byte aligned */
+    size_t stride = sizeof(oauth2_secure_slot_t) + oauth2_secure_sizes[size_class];
+    unsigned char *p = (unsigned char*)chunk + sizeof(oauth2_secure_slot_t);
+    unsigned char *end = (unsigned char*)chunk + OAUTH2_SECURE_CHUNK_SIZE;
+    for (; p + stride <= end; p += stride) {
+        oauth2_secure_slot_t *slot = (oauth2_secure_slot_t*)p;
+        slot->size_class = (uint32_t)size_class;
+        slot->u.next = oauth2_secure.free_slots[size_class];
+        oauth2_secure.free_slots[size_class] = slot;
+    }
+    return SASL_OK;
+}
+
+void *oauth2_secure_alloc(size_t size) {
+    int size_class = 0;
+    while (size_class < OAUTH2_SECURE_CLASSES && size > oauth2_secure_sizes[size_class]) {
+        size_class++;
+    }
+
+    pthread_mutex_lock(&oauth2_secure.lock);
+    oauth2_secure_check_fork();
+
+    oauth2_secure_slot_t *slot = NULL;
+    if (size_class == OAUTH2_SECURE_DEDICATED) {
+        /* Larger than any class: a locked mapping of its own */
+        long page = sysconf(_SC_PAGESIZE);
+        size_t pages = (sizeof(oauth2_secure_slot_t) + size + (size_t)page - 1) / (size_t)page;
+        if (size < SIZE_MAX / 2 && pages <= UINT32_MAX) {
+            slot = oauth2_secure_map(pages * (size_t)page);
+        }
+        if (slot) {
+            slot->size_class = OAUTH2_SECURE_DEDICATED;
+            slot->map_pages = (uint32_t)pages;
+            oauth2_secure.stats.dedicated++;
+        }
+    } else if (oauth2_secure.free_slots[size_class] ||
+               oauth2_secure_grow(size_class) == SASL_OK) {
+        slot = oauth2_secure.free_slots[size_class];
+        oauth2_secure.free_slots[size_class] = slot->u.next;
+    }
+
+    if (slot) {
+        slot->u.len = size;
+        oauth2_secure.stats.in_use++;
+    }
+    pthread_mutex_unlock(&oauth2_secure.lock);
+
+    return slot ? slot + 1 : NULL;
+}
+
+char *oauth2_secure_strndup(const char *s, size_t len) {
+    if (!s || len == SIZE_MAX) return NULL;
+
+    char *copy = oauth2_secure_alloc(len + 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void oauth2_secure_free(void *p) {
+    if (!p) return;
+
+    oauth2_secure_slot_t *slot = (oauth2_secure_slot_t*)p - 1;
+    oauth2_secure_wipe(p, slot->u.len);
+
+    pthread_mutex_lock(&oauth2_secure.lock);
+    oauth2_secure.stats.in_use--;
+    if (slot->size_class == OAUTH2_SECURE_DEDICATED) {
+        oauth2_secure_unmap(slot, (size_t)slot->map_pages * (size_t)sysconf(_SC_PAGESIZE));
+    } else {
+        slot->u.next = oauth2_secure.free_slots[slot->size_class];
+        oauth2_secure.free_slots[slot->size_class] = slot;
+    }
+    pthread_mutex_unlock(&oauth2_secure.lock);
+}
+
+void oauth2_secure_stats(oauth2_secure_stats_t *stats) {
+    pthread_mutex_lock(&oauth2_secure.lock);
+    *stats = oauth2_secure.stats;
+    pthread_mutex_unlock(&oauth2_secure.lock);
+}
@@ -0,0 +1,241 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Persistent Provider State
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Stores the last good discovery document and JWKS of each provider in
+ * a small versioned file so that a restarted service can validate tokens
+ * before its first network round trip.
+ *
+ * File layout (integers big-endian):
+ *   "O2WS" | u8 version | u8 doc_count | u16 reserved
+ *   u32 url_len | url
+ *   doc_count x { u8 kind | u64 fetched_at | u64 expires_at | u32 len | body
+ *                 | u16 etag_len | etag | u16 last_modified_len | last_modified }
+ *
+ * Files of any other version are ignored and the documents fetched again.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define OAUTH2_STATE_MAGIC "O2WS"
+#define OAUTH2_STATE_VERSION 2
+#define OAUTH2_STATE_DOC_DISCOVERY 1
+#define OAUTH2_STATE_DOC_JWKS 2
+
+/* FNV-1a, used to derive a stable file name from the discovery URL */
+static uint64_t oauth2_state_hash(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int oauth2_state_path(const oauth2_config_t *config, const char *url, char *path, size_t len) {
+    int n = snprintf(path, len, "%s/%016llx.state", config->state_dir,
+                     (unsigned long long)oauth2_state_hash(url));
+    return (n > 0 && (size_t)n < len) ? SASL_OK : SASL_BUFOVER;
+}
+
+static void oauth2_state_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t oauth2_state_get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void oauth2_state_put_u64(unsigned char *p, uint64_t v) {
+    oauth2_state_put_u32(p, (uint32_t)(v >> 32));
+    oauth2_state_put_u32(p + 4, (uint32_t)v);
+}
+
+static uint64_t oauth2_state_get_u64(const unsigned char *p) {
+    return ((uint64_t)oauth2_state_get_u32(p) << 32) | oauth2_state_get_u32(p + 4);
+}
+
+static int oauth2_state_write_string(FILE *f, const char *value) {
+    size_t len = value ? strlen(value) : 0;
+    unsigned char hdr[2];
+
+    if (len > 0xffff) len = 0;
+    hdr[0] = (unsigned char)(len >> 8);
+    hdr[1] = (unsigned char)len;
+    if (fwrite(hdr, sizeof(hdr), 1, f) != 1) return SASL_FAIL;
+    if (len > 0 && fwrite(value, len, 1, f) != 1) return SASL_FAIL;
+    return SASL_OK;
+}
+
+/* Read a length-prefixed validator; *out stays NULL when empty */
+static int oauth2_state_read_string(const unsigned char **p, const unsigned char *end, char **out) {
+    if (end - *p < 2) return SASL_FAIL;
+    size_t len = ((size_t)(*p)[0] << 8) | (*p)[1];
+    *p += 2;
+    if ((size_t)(end - *p) < len) return SASL_FAIL;
+
+    if (len > 0 && out) {
+        *out = strndup((const char*)*p, len);
+        if (!*out) return SASL_NOMEM;
+    }
+    *p += len;
+    return SASL_OK;
+}
+
+static int oauth2_state_write_doc(FILE *f, int kind, const oauth2_http_doc_t *doc) {
+    unsigned char hdr[21];
+
+    hdr[0] = (unsigned char)kind;
+    oauth2_state_put_u64(hdr + 1, (uint64_t)doc->fetched_at);
+    oauth2_state_put_u64(hdr + 9, (uint64_t)doc->expires_at);
+    oauth2_state_put_u32(hdr + 17, (uint32_t)doc->len);
+
+    if (fwrite(hdr, sizeof(hdr), 1, f) != 1) return SASL_FAIL;
+    if (doc->len > 0 && fwrite(doc->body, doc->len, 1, f) != 1) return SASL_FAIL;
+    if (oauth2_state_write_string(f, doc->etag) != SASL_OK) return SASL_FAIL;
+    return oauth2_state_write_string(f, doc->last_modified);
+}
+
+int oauth2_state_save(const oauth2_config_t *config, const char *url,
+                      const oauth2_http_doc_t *discovery, const oauth2_http_doc_t *jwks) {
+    if (!config || !config->state_dir || !url || !discovery || !jwks) {
+        return SASL_BADPARAM;
+    }
+
+    char path[4096], tmp[4200];
+    if (oauth2_state_path(config, url, path, sizeof(path)) != SASL_OK) {
+        return SASL_BUFOVER;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        return SASL_FAIL;
+    }
+
+    unsigned char hdr[12];
+    size_t url_len = strlen(url);
+    memcpy(hdr, OAUTH2_STATE_MAGIC, 4);
+    hdr[4] = OAUTH2_STATE_VERSION;
+    hdr[5] = 2;
+    hdr[6] = hdr[7] = 0;
+    oauth2_state_put_u32(hdr + 8, (uint32_t)url_len);
+
+    int result = SASL_OK;
+    if (fwrite(hdr, sizeof(hdr), 1, f) != 1 || fwrite(url, url_len, 1, f) != 1) {
+        result = SASL_FAIL;
+    }
+    if (result == SASL_OK) {
+        result = oauth2_state_write_doc(f, OAUTH2_STATE_DOC_DISCOVERY, discovery);
+    }
+    if (result == SASL_OK) {
+        result = oauth2_state_write_doc(f, OAUTH2_STATE_DOC_JWKS, jwks);
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        result = SASL_FAIL;
+    }
+    if (fclose(f) != 0) {
+        result = SASL_FAIL;
+    }
+
+    /* Atomic replacement: readers see either the old or the new file */
+    if (result != SASL_OK || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return SASL_FAIL;
+    }
+    return SASL_OK;
+}
+
+int oauth2_state_load(const oauth2_config_t *config, const char *url,
+                      oauth2_http_doc_t *discovery, oauth2_http_doc_t *jwks) {
+    if (!config || !config->state_dir || !url || !discovery || !jwks) {
+        return SASL_BADPARAM;
+    }
+
+    memset(discovery, 0, sizeof(*discovery));
+    memset(jwks, 0, sizeof(*jwks));
+
+    char path[4096];
+    if (oauth2_state_path(config, url, path, sizeof(path)) != SASL_OK) {
+        return SASL_BUFOVER;
+    }
+
+    oauth2_file_map_t map;
+    if (oauth2_file_map(path, &map) != SASL_OK) {
+        return SASL_NOTDONE; /* No state yet */
+    }
+
+    const unsigned char *p = (const unsigned char*)map.data;
+    const unsigned char *end = p + map.len;
+    size_t url_len = strlen(url);
+    int result = SASL_FAIL;
+
+    if (map.len < 12 || memcmp(p, OAUTH2_STATE_MAGIC, 4) != 0 ||
+        p[4] != OAUTH2_STATE_VERSION) {
+        goto done;
+    }
+    int doc_count = p[5];
+    if (oauth2_state_get_u32(p + 8) != url_len || (size_t)(end - p) < 12 + url_len ||
+        memcmp(p + 12, url, url_len) != 0) {
+        goto done; /* Hash collision or foreign file */
+    }
+    p += 12 + url_len;
+
+    for (int i = 0; i < doc_count; i++) {
+        if (end - p < 21) goto done;
+
+        int kind = p[0];
+        time_t fetched_at = (time_t)oauth2_state_get_u64(p + 1);
+        time_t expires_at = (time_t)oauth2_state_get_u64(p + 9);
+        size_t len = oauth2_state_get_u32(p + 17);
+        p += 21;
+        if ((size_t)(end - p) < len) goto done;
+
+        oauth2_http_doc_t *doc = kind == OAUTH2_STATE_DOC_DISCOVERY ? discovery :
+                                 kind == OAUTH2_STATE_DOC_JWKS ? jwks : NULL;
+        if (doc && doc->body) {
+            doc = NULL; /* Duplicate record, first one wins */
+        }
+        if (doc) {
+            doc->body = malloc(len + 1);
+            if (!doc->body) {
+                result = SASL_NOMEM;
+                goto done;
+            }
+            memcpy(doc->body, p, len);
+            doc->body[len] = '\0';
+            doc->len = len;
+            doc->fetched_at = fetched_at;
+            doc->expires_at = expires_at;
+        }
+        p += len;
+
+        int rc = oauth2_state_read_string(&p, end, doc ? &doc->etag : NULL);
+        if (rc == SASL_OK) {
+            rc = oauth2_state_read_string(&p, end, doc ? &doc->last_modified : NULL);
+        }
+        if (rc != SASL_OK) {
+            result = rc;
+            goto done;
+        }
+    }
+
+    result = (discovery->body && jwks->body) ? SASL_OK : SASL_FAIL;
+
+done:
+    oauth2_file_unmap(&map);
+    if (result != SASL_OK) {
+        oauth2_http_doc_clear(discovery);
+        oauth2_http_doc_clear(jwks);
+    }
+    return result;
+}
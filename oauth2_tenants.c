@@ -0,0 +1,377 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Multi-Tenant Issuers
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Multi-tenant IdPs issue tokens under one issuer per tenant, e.g. Entra
+ * ID's https://login.microsoftonline.com/{tenantid}/v2.0. Listing every
+ * tenant in oauth2_issuers is not possible, so oauth2_tenant_issuers takes
+ * patterns with one {name} placeholder:
+ *
+ *   oauth2_tenant_issuers: https://login.microsoftonline.com/{tenantid}/v2.0
+ *
+ * A token whose issuer matches a pattern gets a provider of its own the
+ * first time its tenant is seen: discovery and keys are fetched by the
+ * login that needs them, concurrent logins of the tenant sharing the one
+ * refresh of oauth2_provider_refresh(). Tenants live in a hash table with
+ * an LRU list; the least recently used are evicted once the documents
+ * held exceed oauth2_tenant_cache_memory, and any unused for
+ * oauth2_tenant_idle_timeout. Logins hold a reference, so an evicted
+ * tenant is freed by the last login using it.
+ *
+ * The placeholder follows the host of the pattern and only matches
+ * letters, digits, '.', '-' and '_': a token can pick a tenant, not the
+ * server or path the plugin fetches from.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest tenant name a pattern accepts */
+#define OAUTH2_TENANT_MAX_NAME 128
+
+/* Minimum delay between two refreshes of a tenant whose keys expired */
+#define OAUTH2_TENANT_RETRY_INTERVAL 30
+
+#define OAUTH2_TENANT_MIN_BUCKETS 64
+
+static const char oauth2_tenant_discovery_suffix[] = "/.well-known/openid-configuration";
+
+static int oauth2_tenant_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+void oauth2_tenant_table_init(oauth2_tenant_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    pthread_mutex_init(&table->lock, NULL);
+}
+
+/* Check one pattern and split it around its placeholder */
+static int oauth2_tenant_template_parse(const sasl_utils_t *utils, oauth2_string_pool_t *pool,
+                                        const char *s, size_t len, oauth2_tenant_template_t *template) {
+    const char *open = memchr(s, '{', len);
+    const char *close = open ? memchr(open, '}', len - (size_t)(open - s)) : NULL;
+    const char *scheme = NULL;
+    for (const char *p = s; open && p + 3 <= open; p++) {
+        if (memcmp(p, "://", 3) == 0) {
+            scheme = p;
+            break;
+        }
+    }
+    /* The host must be fixed: the placeholder comes after the first '/' of the path */
+    const char *path = scheme ? memchr(scheme + 3, '/', (size_t)(open - scheme - 3)) : NULL;
+    if (!close || close == open + 1 || !path || path == scheme + 3 ||
+        memchr(close, '{', len - (size_t)(close - s)) || memchr(open + 1, '{', (size_t)(close - open - 1))) {
+        OAUTH2_LOG_ERR(utils, "Invalid %s pattern '%.*s': expected one {tenant} placeholder in the path "
+                       "of an absolute URL", OAUTH2_CONF_TENANT_ISSUERS, (int)len, s);
+        return SASL_BADPARAM;
+    }
+
+    template->pattern = oauth2_string_pool_intern(pool, s, len);
+    if (template->pattern == OAUTH2_STRING_NONE) {
+        return SASL_NOMEM;
+    }
+    template->prefix_len = (uint32_t)(open - s);
+    template->suffix = template->pattern + (uint32_t)(close + 1 - s);
+    template->suffix_len = (uint32_t)(len - (size_t)(close + 1 - s));
+    return SASL_OK;
+}
+
+int oauth2_tenant_table_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *source,
+                                oauth2_tenant_table_t *table) {
+    table->templates = NULL;
+    table->templates_count = 0;
+    if (!source) {
+        return SASL_OK;
+    }
+
+    int count = 0;
+    for (const char *p = source; *p; ) {
+        while (oauth2_tenant_is_space(*p)) p++;
+        if (!*p) break;
+        count++;
+        while (*p && !oauth2_tenant_is_space(*p)) p++;
+    }
+    if (count == 0) {
+        return SASL_OK;
+    }
+    table->templates = calloc((size_t)count, sizeof(oauth2_tenant_template_t));
+    if (!table->templates) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", OAUTH2_CONF_TENANT_ISSUERS);
+        return SASL_NOMEM;
+    }
+
+    for (const char *p = source; *p; ) {
+        while (oauth2_tenant_is_space(*p)) p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && !oauth2_tenant_is_space(*p)) p++;
+
+        int result = oauth2_tenant_template_parse(utils, pool, start, (size_t)(p - start),
+                                                  &table->templates[table->templates_count]);
+        if (result != SASL_OK) {
+            if (result == SASL_NOMEM) {
+                OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", OAUTH2_CONF_TENANT_ISSUERS);
+            }
+            free(table->templates);
+            table->templates = NULL;
+            table->templates_count = 0;
+            return result;
+        }
+        table->templates_count++;
+    }
+    return SASL_OK;
+}
+
+/* Letters, digits, '.', '-' and '_', not only dots */
+static int oauth2_tenant_name_valid(const char *s, size_t len) {
+    if (len == 0 || len > OAUTH2_TENANT_MAX_NAME) {
+        return 0;
+    }
+    int dots = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '-' || c == '_' || c == '.')) {
+            return 0;
+        }
+        dots += c == '.';
+    }
+    return (size_t)dots < len;
+}
+
+int oauth2_tenant_table_match(const oauth2_tenant_table_t *table, const char *strings,
+                              const char *issuer, size_t len) {
+    for (int i = 0; i < table->templates_count; i++) {
+        const oauth2_tenant_template_t *template = &table->templates[i];
+        size_t fixed = (size_t)template->prefix_len + template->suffix_len;
+        if (len > fixed &&
+            memcmp(issuer, strings + template->pattern, template->prefix_len) == 0 &&
+            memcmp(issuer + len - template->suffix_len, strings + template->suffix, template->suffix_len) == 0 &&
+            oauth2_tenant_name_valid(issuer + template->prefix_len, len - fixed)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Memory held by a tenant: its documents, the JWKS once more for the keys parsed from it */
+static size_t oauth2_tenant_size(oauth2_tenant_t *tenant) {
+    oauth2_provider_t *provider = &tenant->provider;
+    pthread_mutex_lock(&provider->lock);
+    size_t bytes = sizeof(*tenant) + 2 * strlen(tenant->issuer) + sizeof(oauth2_tenant_discovery_suffix) +
+                   provider->discovery.len + 2 * provider->jwks.len;
+    pthread_mutex_unlock(&provider->lock);
+    return bytes;
+}
+
+static void oauth2_tenant_destroy(oauth2_tenant_t *tenant) {
+    oauth2_provider_free(&tenant->provider);
+    free(tenant->issuer);
+    free(tenant);
+}
+
+static void oauth2_tenant_put(oauth2_tenant_t *tenant) {
+    if (__atomic_sub_fetch(&tenant->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        oauth2_tenant_destroy(tenant);
+    }
+}
+
+/* Caller holds the lock */
+static void oauth2_tenant_lru_remove(oauth2_tenant_table_t *table, oauth2_tenant_t *tenant) {
+    if (tenant->newer) tenant->newer->older = tenant->older; else table->newest = tenant->older;
+    if (tenant->older) tenant->older->newer = tenant->newer; else table->oldest = tenant->newer;
+    tenant->newer = tenant->older = NULL;
+}
+
+/* Caller holds the lock */
+static void oauth2_tenant_lru_push(oauth2_tenant_table_t *table, oauth2_tenant_t *tenant) {
+    tenant->older = table->newest;
+    tenant->newer = NULL;
+    if (table->newest) table->newest->newer = tenant; else table->oldest = tenant;
+    table->newest = tenant;
+}
+
+/* Caller holds the lock; drops the table's reference */
+static void oauth2_tenant_unlink(oauth2_tenant_table_t *table, oauth2_tenant_t *tenant) {
+    oauth2_tenant_t **link = &table->buckets[tenant->hash & (table->buckets_count - 1)];
+    while (*link != tenant) {
+        link = &(*link)->next;
+    }
+    *link = tenant->next;
+    oauth2_tenant_lru_remove(table, tenant);
+    tenant->linked = 0;
+    table->count--;
+    table->bytes -= tenant->bytes;
+    oauth2_tenant_put(tenant);
+}
+
+/* Caller holds the lock; the chains only get longer when growing fails */
+static void oauth2_tenant_grow(oauth2_tenant_table_t *table) {
+    size_t count = table->buckets_count ? table->buckets_count * 2 : OAUTH2_TENANT_MIN_BUCKETS;
+    oauth2_tenant_t **buckets = calloc(count, sizeof(oauth2_tenant_t*));
+    if (!buckets) {
+        return;
+    }
+    for (size_t i = 0; i < table->buckets_count; i++) {
+        oauth2_tenant_t *tenant = table->buckets[i];
+        while (tenant) {
+            oauth2_tenant_t *next = tenant->next;
+            tenant->next = buckets[tenant->hash & (count - 1)];
+            buckets[tenant->hash & (count - 1)] = tenant;
+            tenant = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->buckets_count = count;
+}
+
+/* Caller holds the lock; keep is the tenant of the current login, never evicted. utils may be NULL */
+static void oauth2_tenant_evict(const sasl_utils_t *utils, oauth2_tenant_table_t *table,
+                                oauth2_tenant_t *keep, time_t now) {
+    while (table->oldest && table->oldest != keep) {
+        oauth2_tenant_t *oldest = table->oldest;
+        int idle = table->idle_timeout > 0 && now - oldest->used_at >= table->idle_timeout;
+        if (!idle && table->bytes <= table->max_bytes) {
+            break;
+        }
+        if (utils) {
+            OAUTH2_LOG_DEBUG(utils, "Evicting tenant %s (%s)", oldest->issuer, idle ? "idle" : "memory cap");
+        }
+        oauth2_tenant_unlink(table, oldest);
+    }
+}
+
+static oauth2_tenant_t *oauth2_tenant_new(const sasl_utils_t *utils, oauth2_config_t *config,
+                                          const char *issuer, size_t len, uint32_t hash) {
+    oauth2_tenant_t *tenant = calloc(1, sizeof(oauth2_tenant_t));
+    size_t base = len > 0 && issuer[len - 1] == '/' ? len - 1 : len;
+    char *names = malloc(len + 1 + base + sizeof(oauth2_tenant_discovery_suffix));
+    const char *options = config->default_policy.audiences.count > 0 ? "verify.aud=required" : NULL;
+    oauth2_key_store_t *keys = tenant && names ?
+        oauth2_key_store_create(utils, config->oauth2_log, NULL, 0, options, config->key_reload_interval) : NULL;
+    if (!keys) {
+        free(tenant);
+        free(names);
+        return NULL;
+    }
+
+    /* Issuer and discovery URL in one block */
+    memcpy(names, issuer, len);
+    names[len] = '\0';
+    char *discovery_url = names + len + 1;
+    memcpy(discovery_url, issuer, base);
+    memcpy(discovery_url + base, oauth2_tenant_discovery_suffix, sizeof(oauth2_tenant_discovery_suffix));
+
+    tenant->issuer = names;
+    tenant->hash = hash;
+    tenant->refcount = 1;
+    tenant->provider.issuer = names;
+    tenant->provider.discovery_url = discovery_url;
+    tenant->provider.keys = keys;
+    oauth2_provider_init(&tenant->provider);
+    return tenant;
+}
+
+oauth2_provider_t *oauth2_tenant_acquire(const sasl_utils_t *utils, oauth2_config_t *config,
+                                         const char *issuer, oauth2_deadline_t deadline) {
+    oauth2_tenant_table_t *table = config ? &config->tenants : NULL;
+    size_t len = issuer ? strlen(issuer) : 0;
+    if (!table || table->templates_count == 0 || !issuer ||
+        oauth2_tenant_table_match(table, config->strings.data, issuer, len) < 0) {
+        return NULL;
+    }
+
+    uint32_t hash = oauth2_string_hash(issuer, len);
+    time_t now = time(NULL);
+    int created = 0;
+
+    pthread_mutex_lock(&table->lock);
+    oauth2_tenant_t *tenant = table->buckets ? table->buckets[hash & (table->buckets_count - 1)] : NULL;
+    while (tenant && !(tenant->hash == hash && strcmp(tenant->issuer, issuer) == 0)) {
+        tenant = tenant->next;
+    }
+
+    if (tenant) {
+        oauth2_tenant_lru_remove(table, tenant);
+    } else {
+        if (table->count >= table->buckets_count) {
+            oauth2_tenant_grow(table);
+        }
+        tenant = table->buckets ? oauth2_tenant_new(utils, config, issuer, len, hash) : NULL;
+        if (!tenant) {
+            pthread_mutex_unlock(&table->lock);
+            OAUTH2_LOG_ERR(utils, "Failed to allocate memory for tenant %s", issuer);
+            return NULL;
+        }
+        size_t slot = hash & (table->buckets_count - 1);
+        tenant->next = table->buckets[slot];
+        table->buckets[slot] = tenant;
+        tenant->table = table;
+        tenant->linked = 1;
+        tenant->bytes = oauth2_tenant_size(tenant);
+        table->bytes += tenant->bytes;
+        table->count++;
+        created = 1;
+
+        /* Warm start below, before any login of the tenant refreshes it */
+        pthread_mutex_lock(&tenant->provider.refresh_lock);
+    }
+    oauth2_tenant_lru_push(table, tenant);
+    __atomic_add_fetch(&tenant->refcount, 1, __ATOMIC_RELAXED);
+    tenant->used_at = now;
+    oauth2_tenant_evict(utils, table, tenant, now);
+    size_t count = table->count;
+    pthread_mutex_unlock(&table->lock);
+
+    oauth2_provider_t *provider = &tenant->provider;
+    if (created) {
+        oauth2_provider_warm_start(utils, config, provider);
+        pthread_mutex_unlock(&provider->refresh_lock);
+        OAUTH2_LOG_INFO(utils, "Tenant %s seen for the first time (%zu tenants cached)", issuer, count);
+        return provider;
+    }
+
+    /* Tenants have no background refresher: expired keys are refreshed by the logins needing them */
+    pthread_mutex_lock(&provider->lock);
+    int expired = provider->jwks.body && provider->jwks.expires_at <= now;
+    pthread_mutex_unlock(&provider->lock);
+    if (expired) {
+        oauth2_provider_refresh(utils, config, provider, OAUTH2_TENANT_RETRY_INTERVAL, deadline);
+    }
+    return provider;
+}
+
+void oauth2_tenant_release(void *provider) {
+    oauth2_tenant_t *tenant = (oauth2_tenant_t*)provider;
+    if (!tenant) return;
+
+    /* Charge what the login fetched, then enforce the cap */
+    oauth2_tenant_table_t *table = tenant->table;
+    pthread_mutex_lock(&table->lock);
+    if (tenant->linked) {
+        size_t bytes = oauth2_tenant_size(tenant);
+        table->bytes = table->bytes - tenant->bytes + bytes;
+        tenant->bytes = bytes;
+        if (table->bytes > table->max_bytes) {
+            oauth2_tenant_evict(NULL, table, table->newest, time(NULL));
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    oauth2_tenant_put(tenant);
+}
+
+void oauth2_tenant_table_free(oauth2_tenant_table_t *table) {
+    pthread_mutex_lock(&table->lock);
+    while (table->oldest) {
+        oauth2_tenant_unlink(table, table->oldest);
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    free(table->buckets);
+    free(table->templates);
+    pthread_mutex_destroy(&table->lock);
+    memset(table, 0, sizeof(*table));
+}
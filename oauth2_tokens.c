@@ -0,0 +1,432 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Client Token Cache
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Per-process cache of access tokens obtained by the client mechanisms
+ * from the token endpoint, with a configured refresh token or with the
+ * client credentials grant, or from an external helper (oauth2_helper.c).
+ * Entries are keyed by (issuer, user) and kept in secure memory until the
+ * token expires, as read from its own "exp" claim. A token entering its
+ * refresh margin is renewed in the background while connections keep
+ * using it; an expired or missing token is fetched once, concurrent
+ * connections waiting for that single request.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <jansson.h>
+
+typedef struct oauth2_client_token {
+    struct oauth2_client_token *next;
+    unsigned char key[32];          /* SHA-256 of (issuer, user) */
+    char *issuer;                   /* Named in helper requests */
+    char *user;
+    char *access_token;             /* Secure slab, NULL until first fetched */
+    char *refresh_token;            /* Secure slab; the latest one issued, rotated by the IdP */
+    time_t expires_at;
+    int refreshing;                 /* A token endpoint request is in flight */
+} oauth2_client_token_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;            /* Signalled when a refresh completes */
+    oauth2_client_token_t *entries;
+    pid_t pid;                      /* Refreshes in flight are not inherited across fork() */
+    oauth2_client_token_stats_t stats;
+} oauth2_client_tokens = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+/* Provider the client authenticates against: the one of oauth2_issuer, or the first one */
+static oauth2_provider_t *oauth2_client_token_provider(oauth2_config_t *config) {
+    oauth2_provider_t *provider = config->issuers.count > 0 ?
+        oauth2_config_find_provider(config, oauth2_config_list_item(config, &config->issuers, 0)) : NULL;
+    return provider ? provider : (config->providers_count > 0 ? &config->providers[0] : NULL);
+}
+
+/* Entry for key, created empty if missing; the caller holds the lock */
+static oauth2_client_token_t *oauth2_client_token_entry(const unsigned char key[32]) {
+    pid_t pid = getpid();
+    if (oauth2_client_tokens.pid != pid) {
+        for (oauth2_client_token_t *e = oauth2_client_tokens.entries; e; e = e->next) {
+            e->refreshing = 0;
+        }
+        oauth2_client_tokens.pid = pid;
+    }
+
+    for (oauth2_client_token_t *e = oauth2_client_tokens.entries; e; e = e->next) {
+        if (memcmp(e->key, key, 32) == 0) {
+            return e;
+        }
+    }
+
+    oauth2_client_token_t *entry = calloc(1, sizeof(oauth2_client_token_t));
+    if (entry) {
+        memcpy(entry->key, key, 32);
+        entry->next = oauth2_client_tokens.entries;
+        oauth2_client_tokens.entries = entry;
+    }
+    return entry;
+}
+
+/* Expiry of a new token: its own "exp" claim when it is a JWT, else expires_in, else now */
+static time_t oauth2_client_token_expiry(const sasl_utils_t *utils, const char *token, json_t *response) {
+    time_t expires_at = 0;
+
+    oauth2_arena_t arena;
+    oauth2_arena_init(&arena);
+    json_t *claims = NULL;
+    if (strchr(token, '.') && oauth2_jwt_decode_claims(utils, &arena, token, &claims) == SASL_OK) {
+        json_t *exp = json_object_get(claims, "exp");
+        if (json_is_integer(exp)) {
+            expires_at = (time_t)json_integer_value(exp);
+        }
+    }
+    oauth2_arena_release(&arena);
+
+    if (expires_at == 0) {
+        json_t *expires_in = json_object_get(response, "expires_in");
+        expires_at = time(NULL) + (json_is_integer(expires_in) ? (time_t)json_integer_value(expires_in) : 0);
+    }
+    return expires_at;
+}
+
+/*
+ * One token endpoint round trip. On success the new access token and, if
+ * the IdP rotated it, the new refresh token are returned in secure memory.
+ */
+static int oauth2_client_token_request(const sasl_utils_t *utils, oauth2_config_t *config,
+                                       const char *refresh_token, oauth2_deadline_t deadline,
+                                       char **access_token, char **new_refresh_token, time_t *expires_at) {
+    *access_token = NULL;
+    *new_refresh_token = NULL;
+
+    oauth2_provider_t *provider = oauth2_client_token_provider(config);
+    char *endpoint = oauth2_provider_token_endpoint(utils, config, provider, deadline);
+    if (!endpoint) {
+        OAUTH2_LOG_WARN(utils, "No token endpoint known for %s",
+                        provider ? provider->discovery_url : "the client (no provider configured)");
+        return SASL_UNAVAIL;
+    }
+    if (!oauth2_provider_breaker_allow(config, provider)) {
+        free(endpoint);
+        return SASL_UNAVAIL;
+    }
+
+    /* Confidential clients authenticate with HTTP Basic, public clients name themselves in the form */
+    int refresh = strcmp(config->client_grant, OAUTH2_GRANT_REFRESH_TOKEN) == 0;
+    if (refresh && !refresh_token) {
+        OAUTH2_LOG_ERR(utils, "%s is required for the %s grant", OAUTH2_CONF_CLIENT_REFRESH_TOKEN,
+                       OAUTH2_GRANT_REFRESH_TOKEN);
+        free(endpoint);
+        return SASL_BADPARAM;
+    }
+    char *value = oauth2_http_form_escape(refresh ? refresh_token : config->scope);
+    char *client_id = config->client_secret ? NULL : oauth2_http_form_escape(config->client_id);
+    size_t fields_len = (value ? strlen(value) : 0) + (client_id ? strlen(client_id) : 0) + 96;
+    char *fields = value && (client_id || config->client_secret) ? oauth2_secure_alloc(fields_len) : NULL;
+    if (!fields) {
+        oauth2_secure_free(value);
+        oauth2_secure_free(client_id);
+        free(endpoint);
+        return SASL_NOMEM;
+    }
+    snprintf(fields, fields_len, "grant_type=%s&%s=%s%s%s", config->client_grant,
+             refresh ? "refresh_token" : "scope", value,
+             client_id ? "&client_id=" : "", client_id ? client_id : "");
+    oauth2_secure_free(value);
+    oauth2_secure_free(client_id);
+
+    oauth2_http_response_t response;
+    int result = oauth2_http_post_form(config, endpoint, fields,
+                                       config->client_secret ? config->client_id : NULL,
+                                       config->client_secret, deadline, &response);
+    oauth2_secure_free(fields);
+
+    if (result != SASL_OK || response.status >= 500) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        oauth2_provider_breaker_record(config, provider, 0);
+        if (result == SASL_OK) {
+            OAUTH2_LOG_WARN(utils, "Token endpoint %s returned HTTP %ld", endpoint, response.status);
+            oauth2_http_response_free(&response);
+        } else {
+            OAUTH2_LOG_WARN(utils, "Token endpoint %s failed", endpoint);
+        }
+        free(endpoint);
+        return SASL_UNAVAIL;
+    }
+    oauth2_provider_breaker_record(config, provider, 1);
+
+    /* The response holds tokens: parse it, then wipe the body */
+    json_error_t json_error;
+    json_t *json = response.status == 200 && response.body ?
+                   json_loadb(response.body, response.len, 0, &json_error) : NULL;
+    long status = response.status;
+    oauth2_secure_wipe(response.body, response.len);
+    oauth2_http_response_free(&response);
+
+    json_t *token_json = json_object_get(json, "access_token");
+    if (!json_is_string(token_json)) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        OAUTH2_LOG_ERR(utils, "Token endpoint %s returned HTTP %ld without an access token (check %s and %s)",
+                       endpoint, status, refresh ? OAUTH2_CONF_CLIENT_REFRESH_TOKEN : OAUTH2_CONF_CLIENT_ID,
+                       OAUTH2_CONF_CLIENT_SECRET);
+        if (json) json_decref(json);
+        free(endpoint);
+        return SASL_BADAUTH;
+    }
+    OAUTH2_METRIC_INC(config, http_ok);
+    free(endpoint);
+
+    const char *token = json_string_value(token_json);
+    json_t *refresh_json = json_object_get(json, "refresh_token");
+    *access_token = oauth2_secure_strndup(token, strlen(token));
+    *new_refresh_token = json_is_string(refresh_json) ?
+                         oauth2_secure_strndup(json_string_value(refresh_json), strlen(json_string_value(refresh_json))) : NULL;
+    *expires_at = *access_token ? oauth2_client_token_expiry(utils, token, json) : 0;
+    json_decref(json);
+
+    if (!*access_token) {
+        oauth2_secure_free(*new_refresh_token);
+        *new_refresh_token = NULL;
+        return SASL_NOMEM;
+    }
+    return SASL_OK;
+}
+
+/* Token from the external helper: its JSON answer, or the bare token with the expiry of its "exp" claim */
+static int oauth2_client_token_from_helper(const sasl_utils_t *utils, oauth2_config_t *config,
+                                           const char *issuer, const char *user, oauth2_deadline_t deadline,
+                                           char **access_token, time_t *expires_at) {
+    *access_token = NULL;
+
+    char *response = NULL;
+    int result = oauth2_token_helper_request(utils, config, issuer, user, deadline, &response);
+    if (result != SASL_OK) {
+        return result;
+    }
+
+    json_t *json = NULL;
+    const char *token = response;
+    if (response[0] == '{') {
+        json_error_t json_error;
+        json = json_loads(response, 0, &json_error);
+        json_t *token_json = json_object_get(json, "access_token");
+        token = json_is_string(token_json) ? json_string_value(token_json) : NULL;
+    }
+    if (!token || !*token) {
+        OAUTH2_LOG_ERR(utils, "Token helper returned no access token for %s", user);
+        if (json) json_decref(json);
+        oauth2_secure_free(response);
+        return SASL_BADAUTH;
+    }
+
+    *access_token = oauth2_secure_strndup(token, strlen(token));
+    *expires_at = *access_token ? oauth2_client_token_expiry(utils, token, json) : 0;
+    if (json) json_decref(json);
+    oauth2_secure_free(response);
+    return *access_token ? SASL_OK : SASL_NOMEM;
+}
+
+/* Request a token for entry, which the caller marked refreshing; takes and returns with the lock held */
+static int oauth2_client_token_refresh(const sasl_utils_t *utils, oauth2_config_t *config,
+                                       const unsigned char key[32], oauth2_deadline_t deadline) {
+    oauth2_client_token_t *entry = oauth2_client_token_entry(key);
+    const char *seed = entry->refresh_token ? entry->refresh_token : config->client_refresh_token;
+    char *refresh_token = seed ? oauth2_secure_strndup(seed, strlen(seed)) : NULL;
+    /* Stable while the entry is refreshing, see below */
+    const char *issuer = entry->issuer, *user = entry->user;
+    pthread_mutex_unlock(&oauth2_client_tokens.lock);
+
+    char *access_token = NULL, *new_refresh_token = NULL;
+    time_t expires_at = 0;
+    int result;
+    if (strcmp(config->client_grant, OAUTH2_GRANT_HELPER) == 0) {
+        result = oauth2_client_token_from_helper(utils, config, issuer, user, deadline,
+                                                 &access_token, &expires_at);
+    } else {
+        result = oauth2_client_token_request(utils, config, refresh_token, deadline,
+                                             &access_token, &new_refresh_token, &expires_at);
+    }
+    oauth2_secure_free(refresh_token);
+
+    /* Entries are only removed by oauth2_client_token_drain(), which waits for refreshes */
+    pthread_mutex_lock(&oauth2_client_tokens.lock);
+    entry = oauth2_client_token_entry(key);
+    entry->refreshing = 0;
+    oauth2_client_tokens.stats.requests++;
+    if (result == SASL_OK) {
+        oauth2_secure_free(entry->access_token);
+        entry->access_token = access_token;
+        entry->expires_at = expires_at;
+        if (new_refresh_token) {
+            oauth2_secure_free(entry->refresh_token);
+            entry->refresh_token = new_refresh_token;
+        }
+    } else {
+        oauth2_client_tokens.stats.failures++;
+    }
+    pthread_cond_broadcast(&oauth2_client_tokens.done);
+    return result;
+}
+
+typedef struct oauth2_client_token_job {
+    oauth2_config_t *config;        /* Pinned for the duration of the refresh */
+    unsigned char key[32];
+} oauth2_client_token_job_t;
+
+static void *oauth2_client_token_background(void *arg) {
+    oauth2_client_token_job_t *job = (oauth2_client_token_job_t*)arg;
+
+    pthread_mutex_lock(&oauth2_client_tokens.lock);
+    oauth2_client_token_refresh(job->config->utils, job->config, job->key,
+                                oauth2_deadline_after(job->config->timeout));
+    pthread_mutex_unlock(&oauth2_client_tokens.lock);
+
+    oauth2_config_release(job->config);
+    free(job);
+    return NULL;
+}
+
+/* Renew a token still in use off the connection path; the caller holds the lock and marked entry refreshing */
+static int oauth2_client_token_refresh_async(oauth2_config_t *config, oauth2_client_token_t *entry) {
+    oauth2_client_token_job_t *job = malloc(sizeof(oauth2_client_token_job_t));
+    if (!job) {
+        return SASL_NOMEM;
+    }
+    job->config = config;
+    memcpy(job->key, entry->key, 32);
+    __atomic_fetch_add(&config->refcount, 1, __ATOMIC_RELAXED);
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, oauth2_client_token_background, job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        oauth2_config_release(config);
+        free(job);
+        return SASL_FAIL;
+    }
+    oauth2_client_tokens.stats.background++;
+    return SASL_OK;
+}
+
+int oauth2_client_token_get(const sasl_utils_t *utils, oauth2_config_t *config, const char *user,
+                            char **token) {
+    if (!config || !user || !token) {
+        return SASL_BADPARAM;
+    }
+    *token = NULL;
+    if (!config->client_grant) {
+        return SASL_NOTDONE;
+    }
+
+    oauth2_provider_t *provider = oauth2_client_token_provider(config);
+    const char *issuer = provider ? (provider->issuer ? provider->issuer : provider->discovery_url) : "";
+    unsigned char key[32];
+    int result = oauth2_claims_cache_key(issuer, user, key);
+    if (result != SASL_OK) {
+        return result;
+    }
+
+    oauth2_deadline_t deadline = oauth2_deadline_after(config->timeout);
+    pthread_mutex_lock(&oauth2_client_tokens.lock);
+    for (;;) {
+        oauth2_client_token_t *entry = oauth2_client_token_entry(key);
+        if (entry && !entry->user) {
+            entry->issuer = strdup(issuer);
+            entry->user = strdup(user);
+        }
+        if (!entry || !entry->issuer || !entry->user) {
+            result = SASL_NOMEM;
+            break;
+        }
+
+        time_t now = time(NULL);
+        int valid = entry->access_token && entry->expires_at > now;
+        if (valid && !entry->refreshing && entry->expires_at - config->client_refresh_margin <= now) {
+            entry->refreshing = 1;
+            if (oauth2_client_token_refresh_async(config, entry) != SASL_OK) {
+                entry->refreshing = 0;
+            }
+        }
+        if (valid) {
+            oauth2_client_tokens.stats.hits++;
+            *token = oauth2_secure_strndup(entry->access_token, strlen(entry->access_token));
+            result = *token ? SASL_OK : SASL_NOMEM;
+            break;
+        }
+
+        if (!entry->refreshing) {
+            /* No usable token: this connection fetches it, the others wait for its result */
+            entry->refreshing = 1;
+            result = oauth2_client_token_refresh(utils, config, key, deadline);
+            entry = oauth2_client_token_entry(key);
+            if (result == SASL_OK && entry && entry->access_token) {
+                *token = oauth2_secure_strndup(entry->access_token, strlen(entry->access_token));
+                result = *token ? SASL_OK : SASL_NOMEM;
+            }
+            break;
+        }
+
+        oauth2_client_tokens.stats.waits++;
+        long remaining_ms = oauth2_deadline_remaining(deadline);
+        if (remaining_ms == 0) {
+            result = SASL_UNAVAIL;
+            break;
+        }
+        struct timespec abs;
+        clock_gettime(CLOCK_REALTIME, &abs);
+        abs.tv_sec += remaining_ms / 1000;
+        abs.tv_nsec += (remaining_ms % 1000) * 1000000L;
+        if (abs.tv_nsec >= 1000000000L) {
+            abs.tv_sec++;
+            abs.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&oauth2_client_tokens.done, &oauth2_client_tokens.lock, &abs) == ETIMEDOUT) {
+            result = SASL_UNAVAIL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&oauth2_client_tokens.lock);
+
+    return result;
+}
+
+void oauth2_client_token_drain(void) {
+    pthread_mutex_lock(&oauth2_client_tokens.lock);
+
+    /* Background refreshes look their entry up again when they complete */
+    for (;;) {
+        int refreshing = 0;
+        for (oauth2_client_token_t *e = oauth2_client_tokens.entries; e; e = e->next) {
+            refreshing |= e->refreshing;
+        }
+        if (!refreshing || oauth2_client_tokens.pid != getpid()) break;
+        pthread_cond_wait(&oauth2_client_tokens.done, &oauth2_client_tokens.lock);
+    }
+
+    oauth2_client_token_t *entries = oauth2_client_tokens.entries;
+    oauth2_client_tokens.entries = NULL;
+    pthread_mutex_unlock(&oauth2_client_tokens.lock);
+    oauth2_token_helper_close();
+
+    while (entries) {
+        oauth2_client_token_t *next = entries->next;
+        oauth2_secure_free(entries->access_token);
+        oauth2_secure_free(entries->refresh_token);
+        free(entries->issuer);
+        free(entries->user);
+        free(entries);
+        entries = next;
+    }
+}
+
+void oauth2_client_token_stats(oauth2_client_token_stats_t *stats) {
+    pthread_mutex_lock(&oauth2_client_tokens.lock);
+    *stats = oauth2_client_tokens.stats;
+    pthread_mutex_unlock(&oauth2_client_tokens.lock);
+}
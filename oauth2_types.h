@@ -7,6 +7,7 @@
 #define OAUTH2_TYPES_H
 
 #include <sasl/sasl.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,22 +19,43 @@ extern "C" {
 /* Forward declaration for plugin configuration (full definition in oauth2_plugin.h) */
 struct oauth2_config;
 
+/* Inline arena space, enough for the strings and decoded claims of a typical login */
+#define OAUTH2_ARENA_INLINE_SIZE 4096
+
+struct oauth2_arena_block;
+struct oauth2_arena_cleanup;
+
+/* Bump allocator for the lifetime of one authentication (oauth2_arena.c) */
+typedef struct oauth2_arena {
+    size_t used;                            /* Bytes taken from buffer */
+    struct oauth2_arena_block *blocks;      /* Overflow blocks for large tokens, newest first */
+    struct oauth2_arena_cleanup *cleanups;  /* Objects released with the arena, newest first */
+    unsigned char buffer[OAUTH2_ARENA_INLINE_SIZE] __attribute__((aligned(16)));
+} oauth2_arena_t;
+
 /* Server-side context structure */
 typedef struct oauth2_server_context {
     struct oauth2_config *config;   /* Plugin configuration */
     int state;                      /* Current state in authentication */
-    char *username;                 /* Authenticated username */
-    char *access_token;             /* Access token from client */
+    char *username;                 /* Authenticated username (arena) */
+    char *access_token;             /* Access token from client (secure slab) */
+    size_t token_len;               /* Bytes of access_token, wiped on dispose */
     void *oauth2_ctx;               /* Internal liboauth2 context */
+    char *token_buffer;             /* Secure buffer for the token, kept when the context is reused */
+    oauth2_arena_t arena;           /* Parser output and validation temporaries, wiped on dispose */
 } oauth2_server_context_t;
 
 /* Client-side context structure */
 typedef struct oauth2_client_context {
     struct oauth2_config *config;   /* Plugin configuration */
     int state;                      /* Current state in authentication */
-    char *access_token;             /* Access token to send to server */
+    int mech;                       /* OAUTH2_CLIENT_*, set by the plugin entry that created the context */
+    char *access_token;             /* Access token to send to server (secure slab) */
     char *username;                 /* Username for authentication */
     void *oauth2_ctx;               /* Internal liboauth2 context */
+    size_t response_len;            /* Bytes of response in use, wiped on dispose */
+    char *response;                 /* Secure buffer for the initial response, kept when the context is reused */
+    size_t response_size;
 } oauth2_client_context_t;
 
 #ifdef __cplusplus
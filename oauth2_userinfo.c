@@ -0,0 +1,187 @@
+/*
+ * OAuth2/OIDC SASL Plugin - UserInfo Fallback
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Some IdPs leave profile claims such as "email" out of access tokens.
+ * When the user claim is missing, the OIDC userinfo endpoint is called
+ * with the token itself. Answers are cached by (iss, sub), so a user
+ * logging in again with a fresh token does not cost another round trip.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+
+/* Track the slowest request without a lock */
+static void oauth2_userinfo_record_latency(oauth2_config_t *config, unsigned long elapsed_ms) {
+    __atomic_fetch_add(&config->metrics.userinfo_latency_ms, elapsed_ms, __ATOMIC_RELAXED);
+
+    unsigned long max = __atomic_load_n(&config->metrics.userinfo_latency_max_ms, __ATOMIC_RELAXED);
+    while (elapsed_ms > max &&
+           !__atomic_compare_exchange_n(&config->metrics.userinfo_latency_max_ms, &max, elapsed_ms,
+                                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * The answer to a userinfo request. Returns SASL_OK with the response,
+ * SASL_BADAUTH when the IdP refuses the token or answers for another
+ * subject, or SASL_UNAVAIL when it cannot be reached.
+ */
+static int oauth2_userinfo_answer(const sasl_utils_t *utils, oauth2_config_t *config,
+                                  oauth2_provider_t *provider, const char *endpoint, const char *sub,
+                                  int result, oauth2_http_response_t *response, json_t **userinfo) {
+    /* Transport errors and server errors count against the provider's breaker */
+    if (result != SASL_OK || response->status >= 500) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        oauth2_provider_breaker_record(config, provider, 0);
+        if (result == SASL_OK) {
+            OAUTH2_LOG_WARN(utils, "Userinfo at %s returned HTTP %ld", endpoint, response->status);
+            oauth2_http_response_free(response);
+        } else {
+            OAUTH2_LOG_WARN(utils, "Userinfo at %s failed", endpoint);
+        }
+        return SASL_UNAVAIL;
+    }
+    oauth2_provider_breaker_record(config, provider, 1);
+
+    if (response->status != 200 || !response->body) {
+        OAUTH2_METRIC_INC(config, http_errors);
+        OAUTH2_LOG_WARN(utils, "Userinfo at %s returned HTTP %ld", endpoint, response->status);
+        oauth2_http_response_free(response);
+        return SASL_BADAUTH;
+    }
+    OAUTH2_METRIC_INC(config, http_ok);
+
+    json_error_t json_error;
+    json_t *json = json_loadb(response->body, response->len, 0, &json_error);
+    oauth2_http_response_free(response);
+    if (!json || !json_is_object(json)) {
+        OAUTH2_LOG_ERR(utils, "Invalid userinfo response from %s", endpoint);
+        if (json) json_decref(json);
+        return SASL_FAIL;
+    }
+
+    /* OIDC Core 5.3.2: the response must be about the token's subject */
+    const char *info_sub = json_string_value(json_object_get(json, "sub"));
+    if (sub && (!info_sub || strcmp(info_sub, sub) != 0)) {
+        OAUTH2_LOG_ERR(utils, "Userinfo at %s answered for another subject", endpoint);
+        json_decref(json);
+        return SASL_BADAUTH;
+    }
+
+    *userinfo = json;
+    return SASL_OK;
+}
+
+/*
+ * One userinfo round trip, answered as by oauth2_userinfo_answer(). On an
+ * asynchronous validator the network thread sends the request and completes
+ * the cache slot (SASL_CONTINUE); otherwise the caller completes it.
+ */
+static int oauth2_userinfo_request(const sasl_utils_t *utils, oauth2_config_t *config,
+                                   oauth2_provider_t *provider, const char *token, const char *sub,
+                                   oauth2_deadline_t deadline, oauth2_claims_entry_t *slot, json_t **userinfo) {
+    char *endpoint = oauth2_provider_userinfo_endpoint(utils, config, provider, deadline);
+    if (!endpoint && oauth2_async_pending()) {
+        oauth2_claims_cache_complete(&config->userinfo_cache, slot, 0, NULL, 0);
+        return SASL_CONTINUE; /* Discovery first */
+    }
+    if (!endpoint) {
+        OAUTH2_LOG_WARN(utils, "No userinfo endpoint known for %s", provider->discovery_url);
+        return SASL_UNAVAIL;
+    }
+
+    /* Fail fast while the IdP is known to be down */
+    if (!oauth2_provider_breaker_allow(config, provider)) {
+        free(endpoint);
+        return SASL_UNAVAIL;
+    }
+
+    OAUTH2_METRIC_INC(config, userinfo_requests);
+    long long started = oauth2_monotonic_ms();
+    oauth2_net_request_t *request = oauth2_async_request(OAUTH2_NET_USERINFO, provider);
+    if (request) {
+        request->endpoint = endpoint;
+        request->sub = sub;
+        request->slot = slot;
+        request->started = started;
+        request->transfer.url = endpoint;
+        request->transfer.bearer = token;
+        return SASL_CONTINUE;
+    }
+
+    oauth2_http_response_t response;
+    int result = oauth2_http_get_bearer(config, endpoint, token, deadline, &response);
+    oauth2_userinfo_record_latency(config, (unsigned long)(oauth2_monotonic_ms() - started));
+
+    result = oauth2_userinfo_answer(utils, config, provider, endpoint, sub, result, &response, userinfo);
+    free(endpoint);
+    return result;
+}
+
+/* Until when an answer is cached */
+static time_t oauth2_userinfo_expiry(const oauth2_config_t *config, const oauth2_provider_t *provider) {
+    return time(NULL) + (provider->policy ? provider->policy->userinfo_cache_ttl : config->userinfo_cache_ttl);
+}
+
+void oauth2_userinfo_complete(const sasl_utils_t *utils, oauth2_config_t *config,
+                              oauth2_net_request_t *request) {
+    oauth2_userinfo_record_latency(config, (unsigned long)(oauth2_monotonic_ms() - request->started));
+    request->result = oauth2_userinfo_answer(utils, config, request->provider, request->endpoint, request->sub,
+                                             request->transfer.result, &request->transfer.response,
+                                             &request->claims);
+
+    /* Only answers are cached: a refused token says nothing about the next token of this subject */
+    oauth2_claims_cache_complete(&config->userinfo_cache, request->slot, request->result == SASL_OK,
+                                 request->claims, oauth2_userinfo_expiry(config, request->provider));
+}
+
+int oauth2_userinfo_resolve(const sasl_utils_t *utils, oauth2_config_t *config,
+                            oauth2_provider_t *provider, const char *token, json_t *claims,
+                            oauth2_deadline_t deadline, json_t **userinfo) {
+    if (!config || !provider || !token || !claims || !userinfo) {
+        return SASL_BADPARAM;
+    }
+    *userinfo = NULL;
+
+    /* A validation resumed by an asynchronous validator: the answer its network thread got */
+    int result = oauth2_async_result(OAUTH2_NET_USERINFO, provider, userinfo);
+    if (result != SASL_NOTDONE) {
+        return result;
+    }
+    OAUTH2_METRIC_INC(config, userinfo_lookups);
+
+    /* Without a subject there is nothing stable to cache by */
+    const char *sub = json_string_value(json_object_get(claims, "sub"));
+    const char *iss = json_string_value(json_object_get(claims, "iss"));
+    if (!sub) {
+        return oauth2_userinfo_request(utils, config, provider, token, NULL, deadline, NULL, userinfo);
+    }
+
+    unsigned char key[32];
+    result = oauth2_claims_cache_key(iss ? iss : provider->discovery_url, sub, key);
+    if (result != SASL_OK) {
+        return result;
+    }
+
+    oauth2_claims_entry_t *slot = NULL;
+    result = oauth2_claims_cache_lookup(&config->userinfo_cache, key, deadline, userinfo, &slot);
+    if (result == SASL_OK) {
+        OAUTH2_METRIC_INC(config, userinfo_cache_hits);
+        return *userinfo ? SASL_OK : SASL_BADAUTH;
+    }
+    if (result == SASL_UNAVAIL) {
+        OAUTH2_METRIC_INC(config, deadline_exceeded);
+        return SASL_UNAVAIL;
+    }
+
+    /* Only answers are cached: a refused token says nothing about the next token of this subject */
+    result = oauth2_userinfo_request(utils, config, provider, token, sub, deadline, slot, userinfo);
+    if (result != SASL_CONTINUE) {
+        oauth2_claims_cache_complete(&config->userinfo_cache, slot, result == SASL_OK, *userinfo,
+                                     oauth2_userinfo_expiry(config, provider));
+    }
+    return result;
+}
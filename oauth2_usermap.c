@@ -0,0 +1,300 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Username Mapping
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * The username of a token is the first claim of oauth2_user_claim present
+ * as a non-empty string. Each entry is a top-level claim name or a JSON
+ * pointer (RFC 6901) into nested claims:
+ *
+ *   oauth2_user_claim: /ext/upn preferred_username email
+ *
+ * oauth2_user_transform then rewrites it, steps applied in order:
+ *   lowercase              ASCII letters to lower case
+ *   strip_realm            drop everything from the last '@'
+ *   append_realm:<realm>   add "@<realm>" to names without '@'
+ *   regex:<ERE>            keep the first capture group, or the whole
+ *                          match; a name that does not match is refused
+ *
+ * Both are compiled once per configuration load: pointer segments are
+ * unescaped and interned in the string pool, array indexes parsed and
+ * regular expressions compiled. Mapping a login costs one arena buffer,
+ * sized up front for every step.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+
+static int oauth2_user_is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/* Number of space-separated words of s */
+static int oauth2_user_words(const char *s) {
+    int count = 0;
+    for (const char *p = s; *p; ) {
+        while (oauth2_user_is_space(*p)) p++;
+        if (!*p) break;
+        count++;
+        while (*p && !oauth2_user_is_space(*p)) p++;
+    }
+    return count;
+}
+
+/* One reference token of a pointer, ~1 and ~0 unescaped (RFC 6901 section 4), or a plain claim name */
+static int oauth2_user_segment(oauth2_string_pool_t *pool, const char *s, size_t len, int pointer,
+                               oauth2_user_segment_t *segment) {
+    char unescaped[256];
+    size_t n = 0;
+    if (len >= sizeof(unescaped)) {
+        return SASL_BADPARAM;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (pointer && s[i] == '~') {
+            if (i + 1 == len || (s[i + 1] != '0' && s[i + 1] != '1')) {
+                return SASL_BADPARAM;
+            }
+            unescaped[n++] = s[++i] == '1' ? '/' : '~';
+        } else {
+            unescaped[n++] = s[i];
+        }
+    }
+    unescaped[n] = '\0';
+
+    /* Array indexes are decimal without leading zeros; anything else only names members */
+    segment->index = OAUTH2_STRING_NONE;
+    if (pointer && n > 0 && n < 10 && (n == 1 || unescaped[0] != '0') && strspn(unescaped, "0123456789") >= n) {
+        segment->index = 0;
+        for (size_t i = 0; i < n; i++) {
+            segment->index = segment->index * 10 + (uint32_t)(unescaped[i] - '0');
+        }
+    }
+    segment->name = oauth2_string_pool_intern(pool, unescaped, n);
+    return segment->name == OAUTH2_STRING_NONE ? SASL_NOMEM : SASL_OK;
+}
+
+static int oauth2_user_map_paths(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *claims,
+                                 oauth2_user_map_t *map) {
+    int count = oauth2_user_words(claims);
+    if (count == 0) {
+        return SASL_OK;
+    }
+    int segments = 0;
+    for (const char *p = claims; *p; p++) {
+        segments += *p == '/' || (!oauth2_user_is_space(*p) && (p == claims || oauth2_user_is_space(p[-1])));
+    }
+    map->paths = calloc((size_t)count, sizeof(oauth2_user_path_t));
+    map->segments = calloc((size_t)segments, sizeof(oauth2_user_segment_t));
+    if (!map->paths || !map->segments) {
+        return SASL_NOMEM;
+    }
+
+    for (const char *p = claims; *p; ) {
+        while (oauth2_user_is_space(*p)) p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && !oauth2_user_is_space(*p)) p++;
+
+        oauth2_user_path_t *path = &map->paths[map->paths_count++];
+        path->segments = (uint32_t)map->segments_count;
+
+        /* A plain name is the top-level claim, slashes and tildes included */
+        const char *s = start;
+        int pointer = *start == '/';
+        do {
+            const char *end = pointer ? s + 1 : p;
+            while (pointer && end < p && *end != '/') end++;
+            const char *name = pointer ? s + 1 : s;
+            int result = oauth2_user_segment(pool, name, (size_t)(end - name), pointer,
+                                             &map->segments[map->segments_count]);
+            if (result != SASL_OK) {
+                if (result == SASL_BADPARAM) {
+                    OAUTH2_LOG_ERR(utils, "Invalid %s entry '%.*s'", OAUTH2_CONF_USER_CLAIM,
+                                   (int)(p - start), start);
+                }
+                return result;
+            }
+            map->segments_count++;
+            path->segments_count++;
+            s = end;
+        } while (pointer && s < p);
+    }
+    return SASL_OK;
+}
+
+static int oauth2_user_map_steps(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *transform,
+                                 oauth2_user_map_t *map) {
+    int count = oauth2_user_words(transform);
+    if (count == 0) {
+        return SASL_OK;
+    }
+    map->steps = calloc((size_t)count, sizeof(oauth2_user_step_t));
+    if (!map->steps) {
+        return SASL_NOMEM;
+    }
+
+    for (const char *p = transform; *p; ) {
+        while (oauth2_user_is_space(*p)) p++;
+        if (!*p) break;
+        const char *start = p;
+        while (*p && !oauth2_user_is_space(*p)) p++;
+        size_t len = (size_t)(p - start);
+        const char *colon = memchr(start, ':', len);
+        size_t name_len = colon ? (size_t)(colon - start) : len;
+        const char *arg = colon ? colon + 1 : p;
+        size_t arg_len = (size_t)(p - arg);
+
+        oauth2_user_step_t *step = &map->steps[map->steps_count];
+        if (name_len == 9 && memcmp(start, "lowercase", 9) == 0 && !colon) {
+            step->op = OAUTH2_USER_LOWERCASE;
+        } else if (name_len == 11 && memcmp(start, "strip_realm", 11) == 0 && !colon) {
+            step->op = OAUTH2_USER_STRIP_REALM;
+        } else if (name_len == 12 && memcmp(start, "append_realm", 12) == 0 && arg_len > 0) {
+            step->op = OAUTH2_USER_APPEND_REALM;
+            step->arg = oauth2_string_pool_intern(pool, arg, arg_len);
+            step->arg_len = (uint32_t)arg_len;
+            map->growth += arg_len + 1;
+            if (step->arg == OAUTH2_STRING_NONE) {
+                return SASL_NOMEM;
+            }
+        } else if (name_len == 5 && memcmp(start, "regex", 5) == 0 && arg_len > 0) {
+            step->op = OAUTH2_USER_REGEX;
+            char *pattern = strndup(arg, arg_len);
+            step->regex = malloc(sizeof(regex_t));
+            if (!pattern || !step->regex) {
+                free(pattern);
+                free(step->regex);
+                step->regex = NULL;
+                return SASL_NOMEM;
+            }
+            int rc = regcomp(step->regex, pattern, REG_EXTENDED);
+            free(pattern);
+            if (rc != 0) {
+                free(step->regex);
+                step->regex = NULL;
+                OAUTH2_LOG_ERR(utils, "Invalid regular expression in %s: %.*s", OAUTH2_CONF_USER_TRANSFORM,
+                               (int)arg_len, arg);
+                return SASL_BADPARAM;
+            }
+        } else {
+            OAUTH2_LOG_ERR(utils, "Invalid %s step '%.*s' (use lowercase, strip_realm, append_realm:<realm> "
+                           "or regex:<expression>)", OAUTH2_CONF_USER_TRANSFORM, (int)len, start);
+            return SASL_BADPARAM;
+        }
+        map->steps_count++;
+    }
+    return SASL_OK;
+}
+
+int oauth2_user_map_compile(const sasl_utils_t *utils, oauth2_string_pool_t *pool, const char *claims,
+                            const char *transform, oauth2_user_map_t *map) {
+    memset(map, 0, sizeof(*map));
+
+    int result = oauth2_user_map_paths(utils, pool, claims ? claims : OAUTH2_DEFAULT_USER_CLAIM, map);
+    if (result == SASL_OK && map->paths_count == 0) {
+        OAUTH2_LOG_ERR(utils, "%s names no claim", OAUTH2_CONF_USER_CLAIM);
+        result = SASL_BADPARAM;
+    }
+    if (result == SASL_OK && transform) {
+        result = oauth2_user_map_steps(utils, pool, transform, map);
+    }
+    if (result == SASL_NOMEM) {
+        OAUTH2_LOG_ERR(utils, "Failed to allocate memory for %s", OAUTH2_CONF_USER_CLAIM);
+    }
+    if (result != SASL_OK) {
+        oauth2_user_map_free(map);
+    }
+    return result;
+}
+
+void oauth2_user_map_free(oauth2_user_map_t *map) {
+    for (int i = 0; map->steps && i < map->steps_count; i++) {
+        if (map->steps[i].regex) {
+            regfree(map->steps[i].regex);
+            free(map->steps[i].regex);
+        }
+    }
+    free(map->steps);
+    free(map->paths);
+    free(map->segments);
+    memset(map, 0, sizeof(*map));
+}
+
+json_t *oauth2_user_map_find(const oauth2_user_map_t *map, const char *strings, json_t *claims) {
+    for (int i = 0; i < map->paths_count; i++) {
+        const oauth2_user_path_t *path = &map->paths[i];
+        json_t *node = claims;
+        for (uint32_t j = 0; node && j < path->segments_count; j++) {
+            const oauth2_user_segment_t *segment = &map->segments[path->segments + j];
+            if (json_is_object(node)) {
+                node = json_object_get(node, strings + segment->name);
+            } else if (json_is_array(node) && segment->index != OAUTH2_STRING_NONE) {
+                node = json_array_get(node, segment->index);
+            } else {
+                node = NULL;
+            }
+        }
+        if (json_is_string(node) && json_string_length(node) > 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+int oauth2_user_map_apply(const sasl_utils_t *utils, const oauth2_user_map_t *map, const char *strings,
+                          oauth2_arena_t *arena, const char *value, size_t len, char **username) {
+    char *user = oauth2_arena_alloc(arena, len + map->growth + 1);
+    if (!user) {
+        return SASL_NOMEM;
+    }
+    memcpy(user, value, len);
+    user[len] = '\0';
+
+    for (int i = 0; i < map->steps_count; i++) {
+        const oauth2_user_step_t *step = &map->steps[i];
+        switch (step->op) {
+        case OAUTH2_USER_LOWERCASE:
+            /* ASCII only: the result must not depend on the server's locale */
+            for (size_t j = 0; j < len; j++) {
+                if (user[j] >= 'A' && user[j] <= 'Z') user[j] = (char)(user[j] + ('a' - 'A'));
+            }
+            break;
+        case OAUTH2_USER_STRIP_REALM: {
+            char *at = strrchr(user, '@');
+            if (at) {
+                len = (size_t)(at - user);
+                *at = '\0';
+            }
+            break;
+        }
+        case OAUTH2_USER_APPEND_REALM:
+            if (!memchr(user, '@', len)) {
+                user[len++] = '@';
+                memcpy(user + len, strings + step->arg, step->arg_len);
+                len += step->arg_len;
+                user[len] = '\0';
+            }
+            break;
+        case OAUTH2_USER_REGEX: {
+            regmatch_t match[2];
+            if (regexec(step->regex, user, 2, match, 0) != 0) {
+                OAUTH2_LOG_ERR(utils, "Username '%s' does not match %s", user, OAUTH2_CONF_USER_TRANSFORM);
+                return SASL_BADAUTH;
+            }
+            regmatch_t *keep = match[1].rm_so >= 0 ? &match[1] : &match[0];
+            len = (size_t)(keep->rm_eo - keep->rm_so);
+            memmove(user, user + keep->rm_so, len);
+            user[len] = '\0';
+            break;
+        }
+        }
+    }
+
+    if (len == 0) {
+        OAUTH2_LOG_ERR(utils, "Username is empty once transformed by %s", OAUTH2_CONF_USER_TRANSFORM);
+        return SASL_BADAUTH;
+    }
+    *username = user;
+    return SASL_OK;
+}
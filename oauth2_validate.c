@@ -0,0 +1,513 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Token Validation
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * The validation engine shared by the SASL server step, which calls it
+ * synchronously, and the asynchronous validator (oauth2_async.c), which
+ * runs it on worker threads. Routes a token to its provider, verifies it
+ * (local keys, cached JWKS, metadata discovery or introspection), applies
+ * revocation, issuer and audience checks and extracts the user claim.
+ */
+
+#include "oauth2_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <jansson.h>
+
+/* Arena release of claims handed to oauth2_arena_defer() (json_decref is inline) */
+static void oauth2_json_release(void *json) {
+    json_decref((json_t*)json);
+}
+
+/* base64url (RFC 4648 section 5, padding optional) into a NUL terminated arena buffer */
+static int oauth2_jwt_segment_decode(oauth2_arena_t *arena, const char *in, size_t len,
+                                     char **out, size_t *out_len) {
+    static const signed char map[256] = {
+        ['A'] = 1, ['B'] = 2, ['C'] = 3, ['D'] = 4, ['E'] = 5, ['F'] = 6, ['G'] = 7, ['H'] = 8,
+        ['I'] = 9, ['J'] = 10, ['K'] = 11, ['L'] = 12, ['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16,
+        ['Q'] = 17, ['R'] = 18, ['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+        ['Y'] = 25, ['Z'] = 26, ['a'] = 27, ['b'] = 28, ['c'] = 29, ['d'] = 30, ['e'] = 31, ['f'] = 32,
+        ['g'] = 33, ['h'] = 34, ['i'] = 35, ['j'] = 36, ['k'] = 37, ['l'] = 38, ['m'] = 39, ['n'] = 40,
+        ['o'] = 41, ['p'] = 42, ['q'] = 43, ['r'] = 44, ['s'] = 45, ['t'] = 46, ['u'] = 47, ['v'] = 48,
+        ['w'] = 49, ['x'] = 50, ['y'] = 51, ['z'] = 52, ['0'] = 53, ['1'] = 54, ['2'] = 55, ['3'] = 56,
+        ['4'] = 57, ['5'] = 58, ['6'] = 59, ['7'] = 60, ['8'] = 61, ['9'] = 62, ['-'] = 63, ['_'] = 64,
+        ['+'] = 63, ['/'] = 64
+    }; /* Sextet + 1, 0 for characters outside the alphabet */
+    
+    while (len > 0 && in[len - 1] == '=') len--;
+    if (len % 4 == 1) {
+        return SASL_BADAUTH;
+    }
+    
+    char *decoded = oauth2_arena_alloc(arena, len / 4 * 3 + 3);
+    if (!decoded) {
+        return SASL_NOMEM;
+    }
+    
+    size_t n = 0;
+    unsigned int bits = 0;
+    int count = 0;
+    for (size_t i = 0; i < len; i++) {
+        int v = map[(unsigned char)in[i]];
+        if (v == 0) {
+            return SASL_BADAUTH;
+        }
+        bits = (bits << 6) | (unsigned int)(v - 1);
+        if (++count == 4) {
+            decoded[n++] = (char)(bits >> 16);
+            decoded[n++] = (char)(bits >> 8);
+            decoded[n++] = (char)bits;
+            bits = 0;
+            count = 0;
+        }
+    }
+    if (count == 3) {
+        decoded[n++] = (char)(bits >> 10);
+        decoded[n++] = (char)(bits >> 2);
+    } else if (count == 2) {
+        decoded[n++] = (char)(bits >> 4);
+    }
+    decoded[n] = '\0';
+    
+    *out = decoded;
+    *out_len = n;
+    return SASL_OK;
+}
+
+/* Whether a token has the three dot-separated parts of a JWT; anything else is opaque */
+static int oauth2_token_is_jwt(const char *token) {
+    int dot_count = 0;
+    for (const char *p = token; *p; p++) {
+        if (*p == '.') dot_count++;
+    }
+    return dot_count == 2;
+}
+
+/* Decode the (unverified) claims of a JWT; the claims are released with the arena */
+int oauth2_jwt_decode_claims(const sasl_utils_t *utils,
+                             oauth2_arena_t *arena,
+                             const char *token,
+                             json_t **claims) {
+    *claims = NULL;
+    
+    /* Basic token validation - check if it looks like a JWT */
+    const char *payload = strchr(token, '.');
+    const char *signature = payload ? strchr(payload + 1, '.') : NULL;
+    if (!signature || strchr(signature + 1, '.') || payload == token || signature == payload + 1 ||
+        signature[1] == '\0') {
+        OAUTH2_LOG_ERR(utils, "Token does not appear to be a valid JWT (expected 3 non-empty parts)");
+        return SASL_BADAUTH;
+    }
+    payload++;
+    
+    /* Decode base64url payload */
+    char *decoded = NULL;
+    size_t decoded_len = 0;
+    int result = oauth2_jwt_segment_decode(arena, payload, (size_t)(signature - payload), &decoded, &decoded_len);
+    if (result != SASL_OK) {
+        OAUTH2_LOG_ERR(utils, "Failed to decode JWT payload");
+        return result;
+    }
+    
+    /* Parse JSON payload */
+    json_error_t json_error;
+    json_t *json = json_loadb(decoded, decoded_len, 0, &json_error);
+    if (!json) {
+        OAUTH2_LOG_ERR(utils, "Failed to parse JWT payload JSON");
+        return SASL_BADAUTH;
+    }
+    
+    result = oauth2_arena_defer(arena, oauth2_json_release, json);
+    if (result != SASL_OK) {
+        return result;
+    }
+    *claims = json;
+    return SASL_OK;
+}
+
+/* Whether the JWS "alg" of a JWT's header is one of the provider's allowed algorithms */
+static int oauth2_jwt_alg_allowed(const sasl_utils_t *utils, oauth2_config_t *config, oauth2_arena_t *arena,
+                                  const oauth2_issuer_policy_t *policy, const char *token) {
+    char *header = NULL;
+    size_t header_len = 0;
+    if (oauth2_jwt_segment_decode(arena, token, (size_t)(strchr(token, '.') - token), &header, &header_len) != SASL_OK) {
+        return 0;
+    }
+    
+    json_t *json = json_loadb(header, header_len, 0, NULL);
+    json_t *alg = json ? json_object_get(json, "alg") : NULL;
+    int allowed = json_is_string(alg) &&
+                  oauth2_config_list_find(config, &policy->allowed_algs, json_string_value(alg),
+                                          json_string_length(alg)) >= 0;
+    if (!allowed) {
+        OAUTH2_LOG_ERR(utils, "JWT algorithm '%s' not allowed", json_is_string(alg) ? json_string_value(alg) : "");
+    }
+    if (json) json_decref(json);
+    return allowed;
+}
+
+/*
+ * Validate a token and return the user it authenticates. Claims and the
+ * username live in the arena; the claims are released by the caller with
+ * oauth2_arena_run_deferred(), so every exit below is a plain return.
+ * On an asynchronous validator's worker, SASL_CONTINUE means a network
+ * round trip was handed to the network thread and the validation is run
+ * again once it completes.
+ */
+int oauth2_validate_token(const sasl_utils_t *utils,
+                          oauth2_config_t *config,
+                          oauth2_arena_t *arena,
+                          const char *token,
+                          char **username) {
+    
+    if (!token || strlen(token) < 10) {
+        OAUTH2_LOG_ERR(utils, "Invalid token format");
+        return SASL_BADAUTH;
+    }
+    
+    if (!config) {
+        OAUTH2_LOG_ERR(utils, "No OAuth2 configuration available");
+        return SASL_BADAUTH;
+    }
+    
+    /* Try to use oauth2_token_verify for modern JWT validation */
+    json_t *json_payload = NULL;
+    const char *rv = NULL;
+    bool validation_success = false;
+    bool claims_verified = false;   /* Checked by signature or by the IdP, not just decoded */
+    
+    /* All network work done for this login shares one deadline, set at submission on an asynchronous validator */
+    oauth2_deadline_t deadline = oauth2_async_deadline();
+    if (!deadline) {
+        deadline = oauth2_deadline_after(config->timeout);
+    }
+    
+    /* Route the token to its provider; routing by issuer is only needed with several providers or tenants */
+    oauth2_provider_t *provider = NULL;
+    int is_jwt = oauth2_token_is_jwt(token);
+    int tenants = config->tenants.templates_count > 0;
+    if (config->providers_count == 1 && !tenants) {
+        provider = &config->providers[0];
+    } else if ((config->providers_count > 1 || tenants) && is_jwt) {
+        json_t *unverified = NULL;
+        if (oauth2_jwt_decode_claims(utils, arena, token, &unverified) != SASL_OK) {
+            return SASL_BADAUTH;
+        }
+        json_t *iss_json = json_object_get(unverified, "iss");
+        const char *iss = json_is_string(iss_json) ? json_string_value(iss_json) : NULL;
+        provider = oauth2_config_find_provider(config, iss);
+        
+        /* Not a configured issuer: the tenant's own provider, loaded on first use and held until the arena resets */
+        if (!provider && tenants && iss) {
+            provider = oauth2_tenant_acquire(utils, config, iss, deadline);
+            if (provider && oauth2_arena_defer(arena, oauth2_tenant_release, provider) != SASL_OK) {
+                oauth2_tenant_release(provider);
+                return SASL_NOMEM;
+            }
+        }
+    }
+    
+    /* The routed provider's settings apply from here on, the global ones to unrouted tokens */
+    const oauth2_issuer_policy_t *policy = provider && provider->policy ? provider->policy : &config->default_policy;
+    if (is_jwt && policy->allowed_algs.count > 0 && !oauth2_jwt_alg_allowed(utils, config, arena, policy, token)) {
+        return SASL_BADAUTH;
+    }
+    
+    /* Introspection: the routed provider, or for opaque tokens each introspection provider in turn */
+    if (provider ? provider->introspection : (!is_jwt && config->providers_count > 1)) {
+        oauth2_provider_t *routed = provider;
+        int result = SASL_BADAUTH, unavailable = 0, tried = 0;
+        for (int i = 0; i < config->providers_count && !json_payload; i++) {
+            oauth2_provider_t *candidate = routed ? routed : &config->providers[i];
+            if (!candidate->introspection) continue;
+            tried++;
+            
+            int rc = oauth2_introspect_token(utils, config, candidate, token, deadline, &json_payload);
+            if (rc == SASL_CONTINUE) {
+                return rc; /* Resumed once the network thread has the answer */
+            }
+            if (rc == SASL_OK) {
+                provider = candidate;
+                policy = candidate->policy ? candidate->policy : &config->default_policy;
+            } else if (rc == SASL_UNAVAIL) {
+                unavailable = 1;
+            } else if (rc != SASL_BADAUTH) {
+                result = rc;
+            }
+            if (routed) break;
+        }
+        
+        if (!json_payload) {
+            OAUTH2_LOG_ERR(utils, "Token introspection failed: %s", !tried ? "opaque token and no introspection provider" :
+                           unavailable ? "identity provider unavailable" : "token not active");
+            return unavailable ? SASL_UNAVAIL : result;
+        }
+        validation_success = true;
+        claims_verified = true;
+        OAUTH2_LOG_INFO(utils, "Token validation successful using introspection at %s", provider->discovery_url);
+    }
+    
+    /* Providers with local key files are verified offline, without any network fallback */
+    if (provider && provider->local_keys && config->verify_signature) {
+        oauth2_keyset_t *keys = oauth2_key_store_acquire(provider->keys, utils);
+        if (!keys) {
+            OAUTH2_LOG_ERR(utils, "No local keys available for provider %s", provider->discovery_url);
+            return SASL_BADAUTH;
+        }
+        
+        validation_success = oauth2_token_verify(config->oauth2_log, NULL, keys->verify, token, &json_payload);
+        oauth2_keyset_release(keys, config->oauth2_log);
+        
+        if (!validation_success) {
+            OAUTH2_LOG_ERR(utils, "JWT signature verification failed against local keys");
+            return SASL_BADAUTH;
+        }
+        claims_verified = true;
+        OAUTH2_LOG_INFO(utils, "JWT validation successful using local keys");
+    }
+    
+    /* Network providers use the cached JWKS, kept fresh by the background refresher */
+    if (provider && !provider->local_keys && !provider->introspection && config->verify_signature) {
+        oauth2_keyset_t *keys = oauth2_provider_acquire_keys(utils, config, provider, 0, deadline);
+        if (!keys && oauth2_async_pending()) {
+            return SASL_CONTINUE;
+        }
+        int answered = keys != NULL;
+        if (keys) {
+            validation_success = oauth2_token_verify(config->oauth2_log, NULL, keys->verify, token, &json_payload);
+            oauth2_keyset_release(keys, config->oauth2_log);
+            
+            /* An unknown signing key may mean key rotation: refetch once (rate limited) and retry */
+            if (!validation_success) {
+                keys = oauth2_provider_acquire_keys(utils, config, provider, 1, deadline);
+                if (!keys && oauth2_async_pending()) {
+                    return SASL_CONTINUE;
+                }
+                if (keys) {
+                    validation_success = oauth2_token_verify(config->oauth2_log, NULL, keys->verify, token, &json_payload);
+                    oauth2_keyset_release(keys, config->oauth2_log);
+                }
+            }
+        }
+        
+        if (validation_success) {
+            claims_verified = true;
+            OAUTH2_LOG_INFO(utils, "JWT validation successful using cached provider keys");
+        } else if (answered) {
+            /* The provider's own keys are authoritative, whatever the state of its IdP: a bad signature */
+            OAUTH2_LOG_ERR(utils, "JWT signature verification failed against keys of %s", provider->discovery_url);
+            return SASL_BADAUTH;
+        } else if (oauth2_provider_breaker_state(provider) != OAUTH2_BREAKER_CLOSED) {
+            /* Do not queue logins behind an IdP that is known to be down */
+            OAUTH2_LOG_WARN(utils, "Identity provider %s unavailable (circuit open), rejecting login",
+                            provider->discovery_url);
+            return SASL_UNAVAIL;
+        } else if (oauth2_deadline_remaining(deadline) == 0) {
+            OAUTH2_METRIC_INC(config, deadline_exceeded);
+            OAUTH2_LOG_WARN(utils, "Login deadline of %ds exceeded while contacting %s",
+                            config->timeout, provider->discovery_url);
+            return SASL_UNAVAIL;
+        } else {
+            OAUTH2_LOG_WARN(utils, "No keys available for provider %s, rejecting login", provider->discovery_url);
+            return SASL_UNAVAIL;
+        }
+    }
+    
+    /* Tokens no provider claims: metadata-based verification against the first discovery URL,
+     * within the login deadline and not while that provider's breaker is open */
+    oauth2_provider_t *fallback = !provider && config->providers_count > 0 ? &config->providers[0] : NULL;
+    if (!validation_success && fallback) {
+        if (oauth2_provider_breaker_state(fallback) != OAUTH2_BREAKER_CLOSED) {
+            OAUTH2_LOG_WARN(utils, "Identity provider %s unavailable (circuit open), rejecting login",
+                            fallback->discovery_url);
+            return SASL_UNAVAIL;
+        }
+        if (oauth2_deadline_remaining(deadline) == 0) {
+            OAUTH2_METRIC_INC(config, deadline_exceeded);
+            OAUTH2_LOG_WARN(utils, "Login deadline of %ds exceeded while contacting %s",
+                            config->timeout, fallback->discovery_url);
+            return SASL_UNAVAIL;
+        }
+        OAUTH2_LOG_DEBUG(utils, "Using metadata-based token verification with discovery URL: %s",
+                         fallback->discovery_url);
+        
+        /* Configure metadata-based verification, with audience validation if configured */
+        const char *options = policy->audiences.count > 0 ? "verify.aud=required" : NULL;
+        oauth2_cfg_token_verify_t *verify = NULL;
+        rv = oauth2_cfg_token_verify_add_options(config->oauth2_log, &verify, "metadata", 
+                                                fallback->discovery_url, options);
+        
+        if (rv == NULL) {
+            /* liboauth2 handles caching internally - we don't need to detect it manually */
+            validation_success = oauth2_token_verify(config->oauth2_log, NULL, verify, token, &json_payload);
+            oauth2_cfg_token_verify_free(config->oauth2_log, verify);
+            if (validation_success) {
+                claims_verified = true;
+                OAUTH2_LOG_INFO(utils, "JWT validation successful using metadata discovery");
+            } else {
+                OAUTH2_LOG_WARN(utils, "JWT validation failed using metadata discovery, falling back to manual parsing");
+            }
+        } else {
+            OAUTH2_LOG_ERR(utils, "Failed to configure metadata verification: %s", rv);
+            oauth2_mem_free((char*)rv);
+            if (verify) oauth2_cfg_token_verify_free(config->oauth2_log, verify);
+        }
+    }
+    
+    /* If metadata verification failed or not configured, try simple JWT parsing for basic validation */
+    if (!validation_success) {
+        int decode_result = oauth2_jwt_decode_claims(utils, arena, token, &json_payload);
+        if (decode_result != SASL_OK) {
+            return decode_result;
+        }
+        
+        OAUTH2_LOG_INFO(utils, "JWT claims parsed successfully using fallback manual parsing");
+        validation_success = true;
+    }
+    
+    if (!validation_success || !json_payload) {
+        OAUTH2_LOG_ERR(utils, "JWT validation failed");
+        return SASL_BADAUTH;
+    }
+    
+    /* Verified claims are new references: the arena releases them with the decoded ones */
+    if (claims_verified) {
+        int rc = oauth2_arena_defer(arena, oauth2_json_release, json_payload);
+        if (rc != SASL_OK) {
+            return rc;
+        }
+    }
+    
+    /* Locally revoked tokens; unlisted tokens cost one Bloom filter probe */
+    if (config->revocation) {
+        oauth2_revocation_set_t *revoked = oauth2_revocation_list_acquire(config->revocation, utils);
+        json_t *iat_json = json_object_get(json_payload, "iat");
+        int is_revoked = oauth2_revocation_set_check(revoked, json_string_value(json_object_get(json_payload, "jti")),
+                                                     json_string_value(json_object_get(json_payload, "sub")),
+                                                     json_is_integer(iat_json) ? (long long)json_integer_value(iat_json) : 0);
+        oauth2_revocation_set_release(revoked);
+        if (is_revoked) {
+            OAUTH2_METRIC_INC(config, tokens_revoked);
+            OAUTH2_LOG_WARN(utils, "Token rejected: listed in %s", OAUTH2_CONF_REVOCATION_FILE);
+            return SASL_BADAUTH;
+        }
+    }
+    
+    /* Extract username: the first configured claim present (default: "email") */
+    const char *user_claim = policy->user_claim ? policy->user_claim : OAUTH2_DEFAULT_USER_CLAIM;
+    json_t *user_json = oauth2_user_map_find(&policy->user_map, config->strings.data, json_payload);
+    
+    /* Claim left out of the token: ask the provider's userinfo endpoint, only for verified tokens */
+    if (!user_json && config->userinfo_fallback && claims_verified && provider && !provider->local_keys) {
+        json_t *userinfo = NULL;
+        int rc = oauth2_userinfo_resolve(utils, config, provider, token, json_payload, deadline, &userinfo);
+        if (rc == SASL_CONTINUE) {
+            return rc;
+        }
+        if (rc == SASL_UNAVAIL) {
+            OAUTH2_LOG_WARN(utils, "User claim '%s' not in token and userinfo unavailable", user_claim);
+            return SASL_UNAVAIL;
+        }
+        
+        /* Cached answers are shared and read only; the arena drops this reference */
+        if (userinfo && oauth2_arena_defer(arena, oauth2_json_release, userinfo) != SASL_OK) {
+            json_decref(userinfo);
+            return SASL_NOMEM;
+        }
+        user_json = userinfo ? oauth2_user_map_find(&policy->user_map, config->strings.data, userinfo) : NULL;
+        if (user_json) {
+            OAUTH2_LOG_DEBUG(utils, "User claim '%s' resolved from userinfo", user_claim);
+        }
+    }
+    
+    if (!user_json) {
+        OAUTH2_LOG_ERR(utils, "User claim '%s' not found or not a non-empty string in JWT", user_claim);
+        return SASL_BADAUTH;
+    }
+    
+    const char *user_value = json_string_value(user_json);
+    OAUTH2_LOG_INFO(utils, "JWT user claim '%s': %s", user_claim, user_value);
+    
+    /* Validate issuer if configured; with issuer patterns, only routed tokens have a known issuer */
+    if (config->issuers.count > 0 || config->tenants.templates_count > 0) {
+        json_t *iss_json = json_object_get(json_payload, "iss");
+        if (!iss_json || !json_is_string(iss_json)) {
+            OAUTH2_LOG_ERR(utils, "JWT issuer claim missing or invalid");
+            return SASL_BADAUTH;
+        }
+        
+        const char *token_issuer = json_string_value(iss_json);
+        bool issuer_valid = oauth2_config_list_find(config, &config->issuers, token_issuer,
+                                                    json_string_length(iss_json)) >= 0;
+        
+        /* With issuer patterns, a routed token carries the issuer of its tenant or provider */
+        if (!issuer_valid && config->tenants.templates_count > 0 && provider) {
+            const char *discovered = __atomic_load_n(&provider->discovered_issuer, __ATOMIC_ACQUIRE);
+            issuer_valid = (provider->issuer && strcmp(provider->issuer, token_issuer) == 0) ||
+                           (discovered && strcmp(discovered, token_issuer) == 0);
+        }
+        
+        if (!issuer_valid) {
+            OAUTH2_LOG_ERR(utils, "JWT issuer '%s' not in allowed issuers list", token_issuer);
+            return SASL_BADAUTH;
+        }
+        
+        OAUTH2_LOG_INFO(utils, "JWT issuer validated: %s", token_issuer);
+    }
+    
+    /* Validate audience if configured */
+    if (policy->audiences.count > 0) {
+        json_t *aud_json = json_object_get(json_payload, "aud");
+        if (!aud_json) {
+            OAUTH2_LOG_ERR(utils, "JWT audience claim missing");
+            return SASL_BADAUTH;
+        }
+        
+        bool audience_valid = false;
+        
+        if (json_is_string(aud_json)) {
+            /* Single audience */
+            audience_valid = oauth2_config_list_find(config, &policy->audiences, json_string_value(aud_json),
+                                                     json_string_length(aud_json)) >= 0;
+        } else if (json_is_array(aud_json)) {
+            /* Multiple audiences */
+            size_t index;
+            json_t *aud_value;
+            json_array_foreach(aud_json, index, aud_value) {
+                if (json_is_string(aud_value) &&
+                    oauth2_config_list_find(config, &policy->audiences, json_string_value(aud_value),
+                                            json_string_length(aud_value)) >= 0) {
+                    audience_valid = true;
+                    break;
+                }
+            }
+        }
+        
+        if (!audience_valid) {
+            OAUTH2_LOG_ERR(utils, "JWT audience validation failed - no matching audience found");
+            return SASL_BADAUTH;
+        }
+        
+        OAUTH2_LOG_DEBUG(utils, "JWT audience validated");
+    }
+    
+    /* Scopes, groups and other claim conditions, compiled at load */
+    if (policy->claims.count > 0 &&
+        oauth2_claim_policy_check(utils, &policy->claims, config->strings.data, json_payload) != SASL_OK) {
+        return SASL_BADAUTH;
+    }
+    
+    /* Copy username through oauth2_user_transform, it outlives the claims */
+    int map_result = oauth2_user_map_apply(utils, &policy->user_map, config->strings.data, arena, user_value,
+                                           json_string_length(user_json), username);
+    if (map_result != SASL_OK) {
+        if (map_result == SASL_NOMEM) {
+            OAUTH2_LOG_ERR(utils, "Failed to allocate memory for username");
+        }
+        return map_result;
+    }
+    
+    OAUTH2_LOG_INFO(utils, "JWT validation successful for: %s", *username);
+    return SASL_OK;
+}
@@ -0,0 +1,112 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Admission Control Benchmark
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Fills the admission table with failing sources, some of them throttled,
+ * then reports the cost of the check made before every login (address
+ * parsing included) and of recording a failure.
+ *
+ * Usage: bench_admission [sources] [checks]
+ */
+
+#include "../unit/mock_sasl.h"
+#include "../../oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void bench_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t bench_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = bench_log,
+    .seterror = mock_seterror
+};
+
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Remote address of source i, as libsasl formats it */
+static void bench_source(long i, char *buf, size_t len) {
+    if (i % 2) {
+        snprintf(buf, len, "2001:db8:%lx:%lx::1;993", (i >> 16) & 0xffff, i & 0xffff);
+    } else {
+        snprintf(buf, len, "10.%ld.%ld.%ld;143", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+    }
+}
+
+int main(int argc, char **argv) {
+    long sources = argc > 1 ? atol(argv[1]) : 8192;
+    long checks = argc > 2 ? atol(argv[2]) : 2000000;
+
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.admission_burst = 30;
+    config.admission_rate = 10;
+    config.admission_ipv4_prefix = 32;
+    config.admission_ipv6_prefix = 64;
+    if (oauth2_admission_setup(&bench_utils, OAUTH2_DEFAULT_ADMISSION_ENTRIES, NULL) != SASL_OK) {
+        fprintf(stderr, "Admission table not allocated\n");
+        return 1;
+    }
+
+    /* Every source fails once, one in eight until it is throttled */
+    char address[64];
+    long long start = bench_now_ns();
+    long failures = 0;
+    for (long i = 0; i < sources; i++) {
+        bench_source(i, address, sizeof(address));
+        uint64_t key = oauth2_admission_key(&config, address);
+        for (int j = 0; j < (i % 8 == 0 ? config.admission_burst : 1); j++) {
+            oauth2_admission_fail(&config, key);
+            failures++;
+        }
+    }
+    double fail_ns = (double)(bench_now_ns() - start) / (double)failures;
+
+    char (*addresses)[64] = malloc((size_t)sources * sizeof(*addresses));
+    uint64_t *keys = malloc((size_t)sources * sizeof(uint64_t));
+    if (!addresses || !keys) {
+        return 1;
+    }
+    for (long i = 0; i < sources; i++) {
+        bench_source(i, addresses[i], sizeof(addresses[i]));
+        keys[i] = oauth2_admission_key(&config, addresses[i]);
+    }
+
+    long refused = 0;
+    start = bench_now_ns();
+    for (long i = 0; i < checks; i++) {
+        refused += !oauth2_admission_allow(&config, keys[i % sources]);
+    }
+    double allow_ns = (double)(bench_now_ns() - start) / (double)checks;
+
+    start = bench_now_ns();
+    for (long i = 0; i < checks; i++) {
+        refused += !oauth2_admission_allow(&config, oauth2_admission_key(&config, addresses[i % sources]));
+    }
+    double check_ns = (double)(bench_now_ns() - start) / (double)checks;
+
+    oauth2_admission_stats_t stats;
+    oauth2_admission_stats(&config, &stats);
+    printf("Admission table: %lu entries, %lu sources, %lu throttled\n", stats.entries, stats.sources,
+           stats.throttled);
+    printf("record failure   %8.1f ns\n", fail_ns);
+    printf("allow (key known)%8.1f ns\n", allow_ns);
+    printf("allow (address)  %8.1f ns\n", check_ns);
+    printf("refused          %8.1f %%\n", 100.0 * (double)refused / (double)(checks * 2));
+
+    free(addresses);
+    free(keys);
+    return stats.throttled > 0 ? 0 : 1;
+}
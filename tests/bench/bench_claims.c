@@ -0,0 +1,113 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Claim Policy Benchmark
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Compiles a typical claim policy and checks it against tokens carrying
+ * more and more scopes and groups, the matching ones last. Reports the
+ * size of the claims, the cost of parsing them (paid by every login
+ * anyway) and the cost of the policy check.
+ *
+ * Usage: bench_claims [checks]
+ */
+
+#include "../unit/mock_sasl.h"
+#include "../../oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jansson.h>
+
+static void bench_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t bench_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = bench_log,
+    .seterror = mock_seterror
+};
+
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Claims of a token with n extra scopes and groups before the ones the policy wants */
+static char *bench_claims(int n) {
+    json_t *claims = json_pack("{s:s, s:s, s:s, s:i}", "iss", "https://auth.example.com",
+                               "email", "admin-alice@example.com", "hd", "example.com", "exp", 4102444800);
+    json_t *groups = json_array();
+    size_t scope_size = (size_t)n * 16 + 32;
+    char *scope = malloc(scope_size);
+    size_t len = 0;
+    char name[32];
+    for (int i = 0; i < n; i++) {
+        len += (size_t)snprintf(scope + len, scope_size - len, "api.read%d ", i);
+        snprintf(name, sizeof(name), "team-%d", i);
+        json_array_append_new(groups, json_string(name));
+    }
+    snprintf(scope + len, scope_size - len, "openid email imap");
+    json_array_append_new(groups, json_string("mail-users"));
+    json_object_set_new(claims, "scope", json_string(scope));
+    json_object_set_new(claims, "groups", groups);
+
+    char *text = json_dumps(claims, JSON_COMPACT);
+    json_decref(claims);
+    free(scope);
+    return text;
+}
+
+int main(int argc, char **argv) {
+    long checks = argc > 1 ? atol(argv[1]) : 200000;
+    static const char source[] =
+        "scope has imap email; groups any mail-users staff; hd = example.com; email prefix admin- ops-";
+
+    oauth2_string_pool_t pool;
+    oauth2_claim_policy_t policy;
+    memset(&pool, 0, sizeof(pool));
+    long long start = bench_now_ns();
+    if (oauth2_claim_policy_compile(&bench_utils, &pool, source, &policy) != SASL_OK) {
+        fprintf(stderr, "Policy did not compile\n");
+        return 1;
+    }
+    oauth2_string_pool_seal(&pool);
+    printf("Claim policy: %s\n", source);
+    printf("compile          %10.1f us (%d rules)\n", (double)(bench_now_ns() - start) / 1e3, policy.count);
+    printf("%8s %10s %12s %12s\n", "items", "claims", "parse", "check");
+
+    static const int sizes[] = { 0, 4, 16, 64, 256, 1024 };
+    int failed = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char *text = bench_claims(sizes[s]);
+        size_t text_len = strlen(text);
+
+        start = bench_now_ns();
+        for (long i = 0; i < checks / 10; i++) {
+            json_decref(json_loadb(text, text_len, 0, NULL));
+        }
+        double parse_ns = (double)(bench_now_ns() - start) / (double)(checks / 10);
+
+        json_t *claims = json_loadb(text, text_len, 0, NULL);
+        long passed = 0;
+        start = bench_now_ns();
+        for (long i = 0; i < checks; i++) {
+            passed += oauth2_claim_policy_check(&bench_utils, &policy, pool.data, claims) == SASL_OK;
+        }
+        double check_ns = (double)(bench_now_ns() - start) / (double)checks;
+        failed += passed != checks;
+
+        printf("%8d %8zu B %9.1f ns %9.1f ns\n", sizes[s], text_len, parse_ns, check_ns);
+        json_decref(claims);
+        free(text);
+    }
+
+    oauth2_claim_policy_free(&policy);
+    oauth2_string_pool_free(&pool);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Revocation List Benchmark
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Builds a revocation file of N entries (90% jti, 10% subject cutoffs),
+ * loads it the way the plugin does and reports load time, memory
+ * footprint and the cost of one check for unlisted and listed tokens.
+ *
+ * Usage: bench_revocation [entries] [lookups]
+ */
+
+#include "../unit/mock_sasl.h"
+#include "../../oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void bench_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t bench_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = bench_log,
+    .seterror = mock_seterror
+};
+
+static long long bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* jti values look like UUIDs, subjects like opaque IdP user ids */
+static void bench_jti(char *buf, size_t len, long i) {
+    snprintf(buf, len, "%08lx-%04lx-4%03lx-a%03lx-%012lx", i * 2654435761UL & 0xffffffffUL,
+             i & 0xffff, i & 0xfff, (i >> 12) & 0xfff, (unsigned long)i * 40503UL);
+}
+
+static void bench_sub(char *buf, size_t len, long i) {
+    snprintf(buf, len, "user-%010ld", i);
+}
+
+/* Time n checks of generated tokens starting at first; returns ns per check */
+static double bench_checks(const oauth2_revocation_set_t *set, long first, long n, int subjects, long *revoked) {
+    /* Ids are generated up front so that only the check is timed */
+    char *ids = malloc((size_t)n * 48);
+    if (!ids) return 0.0;
+    for (long i = 0; i < n; i++) {
+        if (subjects) {
+            bench_sub(ids + i * 48, 48, first + i);
+        } else {
+            bench_jti(ids + i * 48, 48, first + i);
+        }
+    }
+
+    long long start = bench_now_ns();
+    for (long i = 0; i < n; i++) {
+        *revoked += subjects ? oauth2_revocation_set_check(set, NULL, ids + i * 48, 0) :
+                               oauth2_revocation_set_check(set, ids + i * 48, NULL, 0);
+    }
+    double ns = (double)(bench_now_ns() - start) / (double)n;
+    free(ids);
+    return ns;
+}
+
+int main(int argc, char **argv) {
+    long entries = argc > 1 ? atol(argv[1]) : 1000000;
+    long lookups = argc > 2 ? atol(argv[2]) : 1000000;
+    long subjects = entries / 10;
+    long jtis = entries - subjects;
+
+    char path[] = "/tmp/oauth2_bench_revoked_XXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        fprintf(stderr, "Cannot create %s\n", path);
+        return 1;
+    }
+    char id[64];
+    for (long i = 0; i < jtis; i++) {
+        bench_jti(id, sizeof(id), i);
+        fprintf(f, "jti %s\n", id);
+    }
+    for (long i = 0; i < subjects; i++) {
+        bench_sub(id, sizeof(id), i);
+        fprintf(f, "sub %s %ld\n", id, 1700000000L + i);
+    }
+    long file_size = ftell(f);
+    fclose(f);
+
+    long long start = bench_now_ns();
+    oauth2_revocation_list_t *list = oauth2_revocation_list_create(&bench_utils, path, 0, NULL);
+    long long load_ns = bench_now_ns() - start;
+    oauth2_revocation_set_t *set = oauth2_revocation_list_acquire(list, &bench_utils);
+    unlink(path);
+    if (!set) {
+        fprintf(stderr, "Revocation file did not load\n");
+        oauth2_revocation_list_free(list);
+        return 1;
+    }
+
+    size_t bytes = oauth2_revocation_set_bytes(set);
+    printf("Revocation list: %zu entries (%ld jti, %ld sub), file %.1f MiB\n",
+           set->count, jtis, subjects, (double)file_size / 1048576.0);
+    printf("load             %10.1f ms\n", (double)load_ns / 1e6);
+    printf("memory           %10.1f MiB (%.1f bytes/entry)\n", (double)bytes / 1048576.0,
+           (double)bytes / (double)set->count);
+    printf("  bloom filter   %10.1f MiB\n",
+           (double)(set->bloom_blocks * 64) / 1048576.0);
+    printf("  exact set      %10.1f MiB\n",
+           (double)(set->slots_count * sizeof(oauth2_revocation_slot_t)) / 1048576.0);
+    printf("  id pool        %10.1f MiB\n", (double)set->pool_len / 1048576.0);
+
+    /* Valid tokens are the common case: ids past the listed range */
+    long revoked = 0;
+    double miss_jti = bench_checks(set, jtis, lookups, 0, &revoked);
+    double miss_sub = bench_checks(set, subjects, lookups, 1, &revoked);
+    long false_hits = revoked;
+    double hit_jti = bench_checks(set, 0, lookups < jtis ? lookups : jtis, 0, &revoked);
+    double hit_sub = bench_checks(set, 0, lookups < subjects ? lookups : subjects, 1, &revoked);
+
+    printf("check, unlisted jti  %8.1f ns\n", miss_jti);
+    printf("check, unlisted sub  %8.1f ns\n", miss_sub);
+    printf("check, listed jti    %8.1f ns\n", hit_jti);
+    printf("check, listed sub    %8.1f ns\n", hit_sub);
+    printf("false revocations    %8ld of %ld\n", false_hits, 2 * lookups);
+
+    oauth2_revocation_set_release(set);
+    oauth2_revocation_list_free(list);
+    mock_config_clear();
+    return false_hits == 0 ? 0 : 1;
+}
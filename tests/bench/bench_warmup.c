@@ -0,0 +1,110 @@
+/*
+ * OAuth2/OIDC SASL Plugin - Startup Warmup Benchmark
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * Measures the wall time needed to make N providers usable, fetching them
+ * one after the other (on-demand refresh) and concurrently (init warmup).
+ *
+ * Usage: bench_warmup <discovery-url> [providers] [rounds]
+ * Each provider gets a distinct URL ("?provider=N" is appended). Run the
+ * mock IdP with MOCK_LATENCY_MS to emulate a remote IdP.
+ */
+
+#include "../unit/mock_sasl.h"
+#include "../../oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void bench_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t bench_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = bench_log,
+    .seterror = mock_seterror
+};
+
+static oauth2_config_t *bench_config(const char *url, int providers) {
+    size_t len = (strlen(url) + 32) * (size_t)providers;
+    char *urls = malloc(len);
+    if (!urls) return NULL;
+
+    urls[0] = '\0';
+    for (int i = 0; i < providers; i++) {
+        size_t used = strlen(urls);
+        snprintf(urls + used, len - used, "%s%s%sprovider=%d", i ? " " : "", url,
+                 strchr(url, '?') ? "&" : "?", i);
+    }
+
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_DISCOVERY_URLS, urls);
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "bench");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_BREAKER_THRESHOLD, "0");
+    free(urls);
+
+    oauth2_config_t *config = oauth2_config_init(&bench_utils);
+    if (config && oauth2_config_load(config, &bench_utils) != SASL_OK) {
+        oauth2_config_free(config);
+        return NULL;
+    }
+    return config;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <discovery-url> [providers] [rounds]\n", argv[0]);
+        return 77; /* Skipped: no IdP to measure against */
+    }
+
+    int providers = argc > 2 ? atoi(argv[2]) : 5;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+    long long serial_total = 0, parallel_total = 0;
+
+    printf("Startup warmup: %d providers, %d rounds\n", providers, rounds);
+    printf("%-6s %12s %12s %8s\n", "round", "serial ms", "parallel ms", "ready");
+
+    for (int round = 0; round < rounds; round++) {
+        /* Serial: what the first logins pay when every provider is fetched on demand */
+        oauth2_config_t *config = bench_config(argv[1], providers);
+        if (!config) {
+            fprintf(stderr, "Configuration failed\n");
+            return 1;
+        }
+        long long start = oauth2_monotonic_ms();
+        for (int i = 0; i < config->providers_count; i++) {
+            oauth2_provider_refresh(&bench_utils, config, &config->providers[i], 0,
+                                    oauth2_deadline_after(config->timeout));
+        }
+        long long serial = oauth2_monotonic_ms() - start;
+        oauth2_config_free(config);
+
+        /* Concurrent: init-time warmup through one curl multi handle */
+        config = bench_config(argv[1], providers);
+        if (!config) {
+            fprintf(stderr, "Configuration failed\n");
+            return 1;
+        }
+        start = oauth2_monotonic_ms();
+        int ready = oauth2_provider_warmup(&bench_utils, config, config->timeout);
+        long long parallel = oauth2_monotonic_ms() - start;
+        oauth2_config_free(config);
+
+        printf("%-6d %12lld %12lld %5d/%d\n", round + 1, serial, parallel, ready, providers);
+        serial_total += serial;
+        parallel_total += parallel;
+    }
+
+    printf("mean   %12.1f %12.1f  speedup %.1fx\n",
+           (double)serial_total / rounds, (double)parallel_total / rounds,
+           parallel_total > 0 ? (double)serial_total / (double)parallel_total : 0.0);
+
+    mock_config_clear();
+    return 0;
+}
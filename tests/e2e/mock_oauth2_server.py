@@ -5,6 +5,7 @@ Provides JWKS endpoint and token validation for testing
 """
 
 import json
+import os
 import time
 from datetime import datetime, timedelta
 from flask import Flask, jsonify, request
@@ -13,6 +14,7 @@ from cryptography.hazmat.primitives.asymmetric import rsa
 from cryptography.hazmat.primitives.serialization import Encoding, PublicFormat
 import jwt
 import base64
+import secrets
 
 app = Flask(__name__)
 
@@ -37,6 +39,15 @@ def int_to_base64url(val):
     # Base64url encode
     return base64.urlsafe_b64encode(val_bytes).decode('ascii').rstrip('=')
 
+# Optional artificial latency, used by the benchmarks to emulate a remote IdP
+MOCK_LATENCY_MS = int(os.environ.get('MOCK_LATENCY_MS', '0'))
+
+@app.before_request
+def simulate_latency():
+    """Delay every response by MOCK_LATENCY_MS milliseconds"""
+    if MOCK_LATENCY_MS > 0:
+        time.sleep(MOCK_LATENCY_MS / 1000.0)
+
 @app.route('/health')
 def health():
     """Health check endpoint"""
@@ -52,6 +63,7 @@ def openid_configuration():
         "token_endpoint": f"{base_url}/token",
         "userinfo_endpoint": f"{base_url}/userinfo",
         "jwks_uri": f"{base_url}/.well-known/jwks.json",
+        "introspection_endpoint": f"{base_url}/introspect",
         "response_types_supported": ["code", "token", "id_token"],
         "subject_types_supported": ["public"],
         "id_token_signing_alg_values_supported": ["RS256"],
@@ -145,6 +157,59 @@ def userinfo():
     except jwt.InvalidTokenError as e:
         return jsonify({"error": "invalid_token", "description": str(e)}), 401
 
+# Opaque tokens issued by /generate_opaque_token, with their introspection claims
+opaque_tokens = {}
+introspection_calls = 0
+
+@app.route('/generate_opaque_token')
+def generate_opaque_token():
+    """Generate an opaque (non-JWT) access token, validated through /introspect"""
+    subject = request.args.get('sub', 'testuser')
+    audience = request.args.get('aud', 'test_audience')
+    expires_in = int(request.args.get('expires_in', '3600'))
+    scope = request.args.get('scope', 'openid email profile')
+    
+    now = datetime.utcnow()
+    token = secrets.token_urlsafe(32)
+    opaque_tokens[token] = {
+        'active': True,
+        'iss': request.url_root.rstrip('/'),
+        'sub': subject,
+        'aud': [audience],
+        'exp': int((now + timedelta(seconds=expires_in)).timestamp()),
+        'iat': int(now.timestamp()),
+        'scope': scope,
+        'token_type': 'Bearer',
+        'email': f"{subject}@test.local",
+        'username': subject
+    }
+    
+    return jsonify({
+        "access_token": token,
+        "token_type": "Bearer",
+        "expires_in": expires_in,
+        "scope": scope
+    })
+
+@app.route('/introspect', methods=['POST'])
+def introspect():
+    """RFC 7662 token introspection, client authentication with HTTP Basic"""
+    global introspection_calls
+    introspection_calls += 1
+    
+    if not request.authorization or not request.authorization.username:
+        return jsonify({"error": "invalid_client"}), 401
+    
+    claims = opaque_tokens.get(request.form.get('token', ''))
+    if not claims or claims['exp'] <= int(time.time()):
+        return jsonify({"active": False})
+    return jsonify(claims)
+
+@app.route('/introspect/stats')
+def introspect_stats():
+    """Number of introspection calls, to check plugin side caching"""
+    return jsonify({"calls": introspection_calls})
+
 @app.route('/generate_token')
 def generate_token():
     """Generate a test token (for testing purposes)"""
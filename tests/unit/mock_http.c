@@ -0,0 +1,230 @@
+/*
+ * Mock HTTP Identity Provider for Unit Testing
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "mock_http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MOCK_HTTP_MAX_REQUEST 65536
+#define MOCK_HTTP_MAX_BODY 65536
+
+struct mock_http_server {
+    int fd;
+    int port;
+    int delay_ms;
+    mock_http_handler_t handler;
+    void *arg;
+    pthread_t acceptor;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    int active;                     /* Connections being served */
+    int requests;
+    int stopping;
+};
+
+typedef struct mock_http_conn {
+    mock_http_server_t *server;
+    int fd;
+} mock_http_conn_t;
+
+/* Read one request: header block plus Content-Length bytes of body */
+static int mock_http_read(int fd, char *buf, size_t size, char **body) {
+    size_t used = 0;
+    char *end = NULL;
+    while (!end) {
+        if (used + 1 >= size) return -1;
+        ssize_t n = recv(fd, buf + used, size - used - 1, 0);
+        if (n <= 0) return -1;
+        used += (size_t)n;
+        buf[used] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+
+    size_t content_length = 0;
+    for (char *line = strstr(buf, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            content_length = strtoul(line + 17, NULL, 10);
+        }
+    }
+
+    *end = '\0';
+    *body = end + 4;
+    while ((size_t)(buf + used - *body) < content_length) {
+        if (used + 1 >= size) return -1;
+        ssize_t n = recv(fd, buf + used, size - used - 1, 0);
+        if (n <= 0) return -1;
+        used += (size_t)n;
+        buf[used] = '\0';
+    }
+    return 0;
+}
+
+static void *mock_http_serve(void *arg) {
+    mock_http_conn_t *conn = (mock_http_conn_t*)arg;
+    mock_http_server_t *server = conn->server;
+    char *request = malloc(MOCK_HTTP_MAX_REQUEST);
+    char *body = malloc(MOCK_HTTP_MAX_BODY);
+    char *request_body = NULL;
+
+    if (request && body && mock_http_read(conn->fd, request, MOCK_HTTP_MAX_REQUEST, &request_body) == 0) {
+        pthread_mutex_lock(&server->lock);
+        server->requests++;
+        pthread_mutex_unlock(&server->lock);
+
+        if (server->delay_ms > 0) {
+            struct timespec delay = { server->delay_ms / 1000, (server->delay_ms % 1000) * 1000000L };
+            nanosleep(&delay, NULL);
+        }
+
+        /* Request line: METHOD SP PATH SP VERSION */
+        char *headers = strstr(request, "\r\n");
+        if (headers) *headers++ = '\0';
+        char *method = request;
+        char *path = strchr(method, ' ');
+        if (path) {
+            *path++ = '\0';
+            char *version = strchr(path, ' ');
+            if (version) *version = '\0';
+        }
+
+        mock_http_request_t req = { method, path ? path : "/", headers ? headers : "", request_body };
+        body[0] = '\0';
+        int status = server->handler(server->arg, &req, body, MOCK_HTTP_MAX_BODY);
+
+        char head[256];
+        size_t len = strlen(body);
+        int n = snprintf(head, sizeof(head), "HTTP/1.1 %d Mock\r\nContent-Type: application/json\r\n"
+                         "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, len);
+        if (send(conn->fd, head, (size_t)n, MSG_NOSIGNAL) == n) {
+            send(conn->fd, body, len, MSG_NOSIGNAL);
+        }
+    }
+
+    free(request);
+    free(body);
+    close(conn->fd);
+    free(conn);
+
+    pthread_mutex_lock(&server->lock);
+    if (--server->active == 0) {
+        pthread_cond_broadcast(&server->idle);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+static void *mock_http_accept(void *arg) {
+    mock_http_server_t *server = (mock_http_server_t*)arg;
+
+    for (;;) {
+        int fd = accept(server->fd, NULL, NULL);
+        if (fd < 0) break;
+
+        pthread_mutex_lock(&server->lock);
+        int stopping = server->stopping;
+        if (!stopping) server->active++;
+        pthread_mutex_unlock(&server->lock);
+        if (stopping) {
+            close(fd);
+            break;
+        }
+
+        /* One thread per connection, so that slow responses overlap */
+        mock_http_conn_t *conn = malloc(sizeof(*conn));
+        pthread_t thread;
+        if (conn) {
+            conn->server = server;
+            conn->fd = fd;
+        }
+        if (!conn || pthread_create(&thread, NULL, mock_http_serve, conn) != 0) {
+            free(conn);
+            close(fd);
+            pthread_mutex_lock(&server->lock);
+            server->active--;
+            pthread_mutex_unlock(&server->lock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+mock_http_server_t *mock_http_start(mock_http_handler_t handler, void *arg, int delay_ms) {
+    mock_http_server_t *server = calloc(1, sizeof(*server));
+    if (!server) return NULL;
+
+    server->handler = handler;
+    server->arg = arg;
+    server->delay_ms = delay_ms;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->idle, NULL);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    server->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->fd < 0 ||
+        bind(server->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->fd, 64) != 0 ||
+        getsockname(server->fd, (struct sockaddr*)&addr, &addr_len) != 0 ||
+        pthread_create(&server->acceptor, NULL, mock_http_accept, server) != 0) {
+        if (server->fd >= 0) close(server->fd);
+        pthread_mutex_destroy(&server->lock);
+        pthread_cond_destroy(&server->idle);
+        free(server);
+        return NULL;
+    }
+    server->port = ntohs(addr.sin_port);
+    return server;
+}
+
+void mock_http_stop(mock_http_server_t *server) {
+    if (!server) return;
+
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_mutex_unlock(&server->lock);
+
+    /* Unblock accept() and wait for connections in flight */
+    shutdown(server->fd, SHUT_RDWR);
+    pthread_join(server->acceptor, NULL);
+    close(server->fd);
+
+    pthread_mutex_lock(&server->lock);
+    while (server->active > 0) {
+        pthread_cond_wait(&server->idle, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->idle);
+    free(server);
+}
+
+int mock_http_port(const mock_http_server_t *server) {
+    return server->port;
+}
+
+int mock_http_requests(mock_http_server_t *server) {
+    pthread_mutex_lock(&server->lock);
+    int requests = server->requests;
+    pthread_mutex_unlock(&server->lock);
+    return requests;
+}
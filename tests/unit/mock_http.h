@@ -0,0 +1,34 @@
+/*
+ * Mock HTTP Identity Provider for Unit Testing
+ * Copyright (c) 2025 Stephane Benoit <stefb@wizzz.net>
+ *
+ * A minimal threaded HTTP/1.1 server on 127.0.0.1 with an ephemeral port.
+ * Every request is answered by a handler; connections are closed after
+ * one response.
+ */
+
+#ifndef MOCK_HTTP_H
+#define MOCK_HTTP_H
+
+#include <stddef.h>
+
+/* A request as seen by the handler */
+typedef struct mock_http_request {
+    const char *method;
+    const char *path;
+    const char *headers;            /* Raw header block */
+    const char *body;               /* NUL terminated, empty without a body */
+} mock_http_request_t;
+
+/* Fill body (NUL terminated, at most len bytes) and return the HTTP status */
+typedef int (*mock_http_handler_t)(void *arg, const mock_http_request_t *request,
+                                   char *body, size_t len);
+
+typedef struct mock_http_server mock_http_server_t;
+
+mock_http_server_t *mock_http_start(mock_http_handler_t handler, void *arg, int delay_ms);
+void mock_http_stop(mock_http_server_t *server);
+int mock_http_port(const mock_http_server_t *server);
+int mock_http_requests(mock_http_server_t *server);
+
+#endif /* MOCK_HTTP_H */
@@ -2,78 +2,484 @@
 #include "mock_sasl.h"
 #include "../../oauth2_plugin.h"
 #include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <jansson.h>
 
-/* Forward declarations for functions we need to test */
-extern char **oauth2_parse_string_list(const char *input, int *count);
-extern void oauth2_free_string_list(char **list, int count);
+static void test_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t test_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = test_log,
+    .seterror = mock_seterror
+};
+
+/* Item i of a list parsed into pool */
+static const char *test_item(const oauth2_string_pool_t *pool, const oauth2_string_list_t *list, int i) {
+    return pool->data + list->offsets[i];
+}
 
 /* Test string list parsing */
 int test_parse_string_list() {
-    int count = 0;
+    oauth2_string_pool_t pool;
+    oauth2_string_list_t list;
+    memset(&pool, 0, sizeof(pool));
     
     /* Test single item */
-    char **result = oauth2_parse_string_list("single_item", &count);
-    TEST_ASSERT_NOT_NULL(result, "Should parse single item successfully");
-    TEST_ASSERT(count == 1, "Should have one item");
-    TEST_ASSERT_NOT_NULL(result[0], "First item should not be NULL");
-    TEST_ASSERT_STR_EQ("single_item", result[0], "Item should match");
-    
-    /* Cleanup */
-    oauth2_free_string_list(result, count);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, "single_item", &list), "Should parse single item successfully");
+    TEST_ASSERT(list.count == 1, "Should have one item");
+    TEST_ASSERT_STR_EQ("single_item", test_item(&pool, &list, 0), "Item should match");
+    TEST_ASSERT_EQ(11, (int)list.lengths[0], "Item length should be recorded");
+    oauth2_string_list_free(&list);
     
     /* Test multiple items */
-    result = oauth2_parse_string_list("item1 item2 item3", &count);
-    TEST_ASSERT_NOT_NULL(result, "Should parse multiple items successfully");
-    TEST_ASSERT(count == 3, "Should have three items");
-    TEST_ASSERT_NOT_NULL(result[0], "First item should not be NULL");
-    TEST_ASSERT_NOT_NULL(result[1], "Second item should not be NULL");
-    TEST_ASSERT_NOT_NULL(result[2], "Third item should not be NULL");
-    TEST_ASSERT_STR_EQ("item1", result[0], "First item should match");
-    TEST_ASSERT_STR_EQ("item2", result[1], "Second item should match");
-    TEST_ASSERT_STR_EQ("item3", result[2], "Third item should match");
-    
-    /* Cleanup */
-    oauth2_free_string_list(result, count);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, "item1 item2 item3", &list), "Should parse multiple items successfully");
+    TEST_ASSERT(list.count == 3, "Should have three items");
+    TEST_ASSERT_STR_EQ("item1", test_item(&pool, &list, 0), "First item should match");
+    TEST_ASSERT_STR_EQ("item2", test_item(&pool, &list, 1), "Second item should match");
+    TEST_ASSERT_STR_EQ("item3", test_item(&pool, &list, 2), "Third item should match");
+    oauth2_string_list_free(&list);
     
     /* Test empty string */
-    result = oauth2_parse_string_list("", &count);
-    TEST_ASSERT_NULL(result, "Result should be NULL for empty input");
-    TEST_ASSERT(count == 0, "Should have zero items for empty input");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, "", &list), "Empty input should parse");
+    TEST_ASSERT(list.count == 0, "Should have zero items for empty input");
+    TEST_ASSERT(list.offsets == NULL, "Empty list should not allocate");
     
     /* Test NULL input */
-    result = oauth2_parse_string_list(NULL, &count);
-    TEST_ASSERT_NULL(result, "Result should be NULL for NULL input");
-    TEST_ASSERT(count == 0, "Should have zero items for NULL input");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, NULL, &list), "NULL input should parse");
+    TEST_ASSERT(list.count == 0, "Should have zero items for NULL input");
     
+    oauth2_string_pool_free(&pool);
     return 0;
 }
 
 /* Test string list parsing with extra spaces */
 int test_parse_string_list_spaces() {
-    int count = 0;
+    oauth2_string_pool_t pool;
+    oauth2_string_list_t list;
+    memset(&pool, 0, sizeof(pool));
     
     /* Test with leading/trailing spaces */
-    char **result = oauth2_parse_string_list("  item1  item2  item3  ", &count);
-    TEST_ASSERT_NOT_NULL(result, "Should parse items with extra spaces successfully");
-    TEST_ASSERT(count == 3, "Should have three items");
-    TEST_ASSERT_STR_EQ("item1", result[0], "First item should match");
-    TEST_ASSERT_STR_EQ("item2", result[1], "Second item should match");
-    TEST_ASSERT_STR_EQ("item3", result[2], "Third item should match");
-    
-    /* Cleanup */
-    oauth2_free_string_list(result, count);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, "  item1  item2  item3  ", &list),
+                   "Should parse items with extra spaces successfully");
+    TEST_ASSERT(list.count == 3, "Should have three items");
+    TEST_ASSERT_STR_EQ("item1", test_item(&pool, &list, 0), "First item should match");
+    TEST_ASSERT_STR_EQ("item2", test_item(&pool, &list, 1), "Second item should match");
+    TEST_ASSERT_STR_EQ("item3", test_item(&pool, &list, 2), "Third item should match");
+    oauth2_string_list_free(&list);
     
     /* Test with multiple spaces between items */
-    result = oauth2_parse_string_list("item1  item2   item3", &count);
-    TEST_ASSERT_NOT_NULL(result, "Should parse items with multiple spaces successfully");
-    TEST_ASSERT(count == 3, "Should have three items");
-    TEST_ASSERT_STR_EQ("item1", result[0], "First item should match");
-    TEST_ASSERT_STR_EQ("item2", result[1], "Second item should match");
-    TEST_ASSERT_STR_EQ("item3", result[2], "Third item should match");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_string_list_parse(&pool, "item1  item2 \t item3\n", &list),
+                   "Should parse items with multiple spaces successfully");
+    TEST_ASSERT(list.count == 3, "Should have three items");
+    TEST_ASSERT_STR_EQ("item1", test_item(&pool, &list, 0), "First item should match");
+    TEST_ASSERT_STR_EQ("item2", test_item(&pool, &list, 1), "Second item should match");
+    TEST_ASSERT_STR_EQ("item3", test_item(&pool, &list, 2), "Third item should match");
+    oauth2_string_list_free(&list);
+    
+    /* Both lists were interned into the same three strings */
+    TEST_ASSERT_EQ(3 * 6, (int)pool.len, "Repeated items should be stored once");
+    oauth2_string_pool_free(&pool);
+    
+    return 0;
+}
+
+/* Lists of a configuration share one pool, equal strings stored once */
+int test_config_string_pool() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_ISSUERS, "https://a.example.com/ https://b.example.com");
+    mock_config_set("oauth2", OAUTH2_CONF_AUDIENCES, "https://b.example.com mail");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_TOKEN_VALIDATION, "jwt jwt");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Config should load");
+    TEST_ASSERT_EQ(2, config->discovery_urls.count, "Discovery URLs should be derived from the issuers");
+    TEST_ASSERT_STR_EQ("https://a.example.com/.well-known/openid-configuration",
+                       oauth2_config_list_item(config, &config->discovery_urls, 0),
+                       "Trailing slash should be dropped from the derived URL");
+    TEST_ASSERT(config->issuers.offsets[1] == config->audiences.offsets[0],
+                "An issuer that is also an audience should be stored once");
+    TEST_ASSERT(config->token_validation.offsets[0] == config->token_validation.offsets[1],
+                "Repeated items should be stored once");
+    TEST_ASSERT(config->strings.slots == NULL, "The index should be dropped once loaded");
+    TEST_ASSERT_EQ((int)config->strings.len, (int)config->strings.size, "The pool should be trimmed once loaded");
+    TEST_ASSERT(config->providers[1].issuer == oauth2_config_list_item(config, &config->issuers, 1),
+                "Providers should point into the pool");
+    
+    TEST_ASSERT_EQ(1, oauth2_config_list_find(config, &config->audiences, "mail", 4), "Audience should be found");
+    TEST_ASSERT_EQ(-1, oauth2_config_list_find(config, &config->audiences, "mai", 3), "Prefix should not match");
+    oauth2_config_release(config);
+    
+    mock_config_clear();
+    return 0;
+}
+
+/* Per-provider settings are compiled into one policy per provider, routed by issuer */
+int test_config_issuer_policies() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_ISSUERS, "https://a.example.com https://b.example.com https://c.example.com");
+    mock_config_set("oauth2", OAUTH2_CONF_AUDIENCES, "mail");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_USERINFO_CACHE_TTL, "60");
+    mock_config_set("oauth2", "oauth2_provider2_audiences", "imap smtp");
+    mock_config_set("oauth2", "oauth2_provider2_user_claim", "preferred_username");
+    mock_config_set("oauth2", "oauth2_provider2_allowed_algs", "RS256 ES256");
+    mock_config_set("oauth2", "oauth2_provider2_userinfo_cache_ttl", "-5");
+    mock_config_set("oauth2", "oauth2_provider3_token_validation", "introspection");
+    mock_config_set("oauth2", "oauth2_provider2_mirrors", "https://b2.example.com https://b3.example.com:8443/");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_SECRET, "secret");
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Config should load");
+    
+    const oauth2_issuer_policy_t *a = config->providers[0].policy;
+    const oauth2_issuer_policy_t *b = config->providers[1].policy;
+    TEST_ASSERT(a == &config->policies[0] && b == &config->policies[1], "Policies should be indexed like providers");
+    TEST_ASSERT_STR_EQ("email", a->user_claim, "Unset settings should be the global ones");
+    TEST_ASSERT_EQ(0, oauth2_config_list_find(config, &a->audiences, "mail", 4), "Global audiences should be inherited");
+    TEST_ASSERT_EQ(0, a->allowed_algs.count, "No algorithm restriction by default");
+    TEST_ASSERT_EQ(60, a->userinfo_cache_ttl, "Global TTL should be inherited");
+    TEST_ASSERT_STR_EQ("preferred_username", b->user_claim, "Provider user claim should apply");
+    TEST_ASSERT_EQ(2, b->audiences.count, "Provider audiences should replace the global ones");
+    TEST_ASSERT_EQ(-1, oauth2_config_list_find(config, &b->audiences, "mail", 4), "Global audience should not apply");
+    TEST_ASSERT_EQ(1, oauth2_config_list_find(config, &b->allowed_algs, "ES256", 5), "Provider algorithms should apply");
+    TEST_ASSERT_EQ(0, b->userinfo_cache_ttl, "Negative TTL should be clamped");
+    TEST_ASSERT(!config->providers[0].introspection && config->providers[2].introspection,
+                "Provider validation mode should apply");
+    TEST_ASSERT_EQ(0, config->providers[0].mirrors_count, "Providers should have no mirrors by default");
+    TEST_ASSERT_EQ(3, config->providers[1].mirrors_count, "Provider mirrors should follow its own origin");
+    TEST_ASSERT_EQ(27, (int)config->providers[1].mirrors[2].origin_len, "Trailing slash should be dropped");
+    TEST_ASSERT_EQ(1, config->default_policy.audiences.count, "Unrouted tokens should use the global settings");
+    
+    TEST_ASSERT(oauth2_config_find_provider(config, "https://b.example.com") == &config->providers[1],
+                "Issuer should route to its provider");
+    TEST_ASSERT(oauth2_config_find_provider(config, "https://c.example.com") == &config->providers[2],
+                "Issuer should route to its provider");
+    TEST_ASSERT(oauth2_config_find_provider(config, "https://b.example.co") == NULL, "Unknown issuer should not route");
+    
+    /* Rejected on the routed provider's algorithms, before any network work */
+    oauth2_arena_t arena;
+    oauth2_arena_init(&arena);
+    char *username = NULL;
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_validate_token(&test_utils, config, &arena,
+                   "eyJhbGciOiJub25lIn0.eyJpc3MiOiJodHRwczovL2IuZXhhbXBsZS5jb20iLCJlbWFpbCI6ImFAYiJ9.c2ln",
+                   &username), "Algorithm not allowed for the provider should be rejected");
+    oauth2_arena_run_deferred(&arena);
+    oauth2_arena_release(&arena);
+    oauth2_config_release(config);
+    
+    /* A bad provider setting names the provider's key */
+    mock_config_set("oauth2", "oauth2_provider3_token_validation", "bogus");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Invalid provider mode should be rejected");
+    oauth2_config_release(config);
+    
+    /* Global mirrors cannot tell which provider they belong to */
+    mock_config_set("oauth2", "oauth2_provider3_token_validation", "jwt");
+    mock_config_set("oauth2", OAUTH2_CONF_MIRRORS, "https://a2.example.com");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Global mirrors should need a single provider");
+    oauth2_config_release(config);
     
-    /* Cleanup */
-    oauth2_free_string_list(result, count);
+    mock_config_clear();
+    return 0;
+}
+
+/* Provider blocks naming their issuer follow it when the issuers are reordered */
+int test_config_provider_blocks() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_ISSUERS, "https://c.example.com https://a.example.com https://b.example.com");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_SECRET, "secret");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    /* Written for the order a, b, c */
+    mock_config_set("oauth2", "oauth2_provider2_issuer", "https://b.example.com");
+    mock_config_set("oauth2", "oauth2_provider2_user_claim", "preferred_username");
+    mock_config_set("oauth2", "oauth2_provider3_issuer", "https://c.example.com/.well-known/openid-configuration");
+    mock_config_set("oauth2", "oauth2_provider3_token_validation", "introspection");
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Config should load");
+    TEST_ASSERT(config->providers[0].introspection, "Block naming the discovery URL should follow its provider");
+    TEST_ASSERT_STR_EQ("email", config->policies[0].user_claim, "Block at the provider's position should not apply");
+    TEST_ASSERT(!config->providers[1].introspection, "Provider without a block should use the global mode");
+    TEST_ASSERT_STR_EQ("email", config->policies[1].user_claim, "Provider without a block should use the globals");
+    TEST_ASSERT_STR_EQ("preferred_username", config->policies[2].user_claim, "Block naming the issuer should follow it");
+    TEST_ASSERT(!config->providers[2].introspection, "Another provider's block should not apply");
+    oauth2_config_release(config);
+    
+    /* A block for a provider no longer configured, or two blocks for one, fail the load */
+    mock_config_set("oauth2", "oauth2_provider2_issuer", "https://d.example.com");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Block naming no provider should be rejected");
+    oauth2_config_release(config);
+    
+    mock_config_set("oauth2", "oauth2_provider2_issuer", "https://c.example.com");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Provider named twice should be rejected");
+    oauth2_config_release(config);
+    
+    mock_config_clear();
+    return 0;
+}
+
+/* Claim policies are compiled at load and checked against the claims only */
+int test_config_claim_policy() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_ISSUERS, "https://a.example.com https://b.example.com");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_CLAIM_POLICY,
+                    "scope has imap email imap; groups any mail-users staff; hd = example.com;"
+                    " acr in gold silver; email prefix admin- ops-;");
+    mock_config_set("oauth2", "oauth2_provider2_claim_policy", "roles any partner");
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Config should load");
+    const oauth2_claim_policy_t *policy = &config->policies[0].claims;
+    TEST_ASSERT_EQ(5, policy->count, "Every rule should be compiled, empty ones skipped");
+    TEST_ASSERT_EQ(2, (int)policy->rules[0].values_count, "Repeated values should be kept once");
+    TEST_ASSERT_EQ(5, config->default_policy.claims.count, "Unrouted tokens should use the global policy");
+    TEST_ASSERT_EQ(1, config->policies[1].claims.count, "Provider policy should replace the global one");
+    
+    json_t *claims = json_pack("{s:s, s:[s,s], s:s, s:s, s:s}", "scope", "openid email imap",
+                               "groups", "users", "staff", "hd", "example.com", "acr", "silver",
+                               "email", "ops-alice@example.com");
+    const char *strings = config->strings.data;
+    TEST_ASSERT_EQ(SASL_OK, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "Matching claims should pass");
+    
+    json_object_set_new(claims, "scope", json_string("openid imap"));
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "'has' should need every value");
+    json_object_set_new(claims, "scope", json_pack("[s,s]", "email", "imap"));
+    TEST_ASSERT_EQ(SASL_OK, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "Array claims should be sets");
+    
+    json_object_set_new(claims, "groups", json_pack("[s]", "staf"));
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "'any' should need one value");
+    json_object_set_new(claims, "groups", json_string("mail-users"));
+    TEST_ASSERT_EQ(SASL_OK, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "A string claim should be split for 'any'");
+    
+    json_object_set_new(claims, "hd", json_string("example.com.evil"));
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "'=' should match exactly");
+    json_object_set_new(claims, "hd", json_string("example.com"));
+    
+    json_object_set_new(claims, "acr", json_string("gold silver"));
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "'in' should not split the claim");
+    json_object_set_new(claims, "acr", json_string("gold"));
+    
+    json_object_set_new(claims, "email", json_string("alice@example.com"));
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "'prefix' should need a prefix");
+    json_object_del(claims, "email");
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_claim_policy_check(&test_utils, policy, strings, claims),
+                   "A missing claim should fail");
+    json_decref(claims);
+    oauth2_config_release(config);
+    
+    /* Malformed rules are load errors */
+    const char *bad[] = { "scope", "scope contains imap", "scope has", "hd = a b" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        mock_config_set("oauth2", OAUTH2_CONF_CLAIM_POLICY, bad[i]);
+        config = oauth2_config_init(&test_utils);
+        TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Malformed policy should be rejected");
+        oauth2_config_release(config);
+    }
+    
+    mock_config_clear();
+    return 0;
+}
+
+/* Username of the first configured claim present, nested or not, through the transform steps */
+static const char *test_map_user(const oauth2_user_map_t *map, const oauth2_string_pool_t *pool,
+                                 json_t *claims, oauth2_arena_t *arena) {
+    json_t *user = oauth2_user_map_find(map, pool->data, claims);
+    char *username = NULL;
+    if (!user || oauth2_user_map_apply(&test_utils, map, pool->data, arena, json_string_value(user),
+                                       json_string_length(user), &username) != SASL_OK) {
+        return NULL;
+    }
+    return username;
+}
+
+int test_config_user_map() {
+    oauth2_string_pool_t pool;
+    oauth2_user_map_t map;
+    oauth2_arena_t arena;
+    memset(&pool, 0, sizeof(pool));
+    oauth2_arena_init(&arena);
+    
+    json_t *claims = json_pack("{s:s, s:{s:s, s:[s,s]}, s:s, s:s}", "email", "Alice.Smith@Example.COM",
+                               "ext", "a/b", "slash", "roles", "admin", "ops",
+                               "preferred_username", "", "upn", "bob");
+    
+    TEST_ASSERT_EQ(SASL_OK, oauth2_user_map_compile(&test_utils, &pool, "/ext/missing preferred_username email",
+                                                    "lowercase strip_realm append_realm:corp.example", &map),
+                   "User map should compile");
+    TEST_ASSERT_EQ(3, map.paths_count, "Every claim should be compiled");
+    TEST_ASSERT_STR_EQ("alice.smith@corp.example", test_map_user(&map, &pool, claims, &arena),
+                       "Missing and empty claims should fall back, then be transformed");
+    oauth2_user_map_free(&map);
+    
+    TEST_ASSERT_EQ(SASL_OK, oauth2_user_map_compile(&test_utils, &pool, "/ext/a~1b /ext/roles/1", NULL, &map),
+                   "Pointers should compile");
+    TEST_ASSERT_STR_EQ("slash", test_map_user(&map, &pool, claims, &arena), "~1 should stand for '/'");
+    json_object_del(json_object_get(claims, "ext"), "a/b");
+    TEST_ASSERT_STR_EQ("ops", test_map_user(&map, &pool, claims, &arena), "Array indexes should be followed");
+    oauth2_user_map_free(&map);
+    
+    TEST_ASSERT_EQ(SASL_OK, oauth2_user_map_compile(&test_utils, &pool, "email",
+                                                    "regex:^([^.@]+)\\.[^@]*@example\\.com$", &map),
+                   "Regex should compile");
+    TEST_ASSERT_NULL(test_map_user(&map, &pool, claims, &arena), "Regex matching is case sensitive");
+    json_object_set_new(claims, "email", json_string("alice.smith@example.com"));
+    TEST_ASSERT_STR_EQ("alice", test_map_user(&map, &pool, claims, &arena), "The capture group should be kept");
+    json_object_set_new(claims, "email", json_string("alice@other.example"));
+    TEST_ASSERT_NULL(test_map_user(&map, &pool, claims, &arena), "A name that does not match should be refused");
+    oauth2_user_map_free(&map);
+    
+    TEST_ASSERT_EQ(SASL_OK, oauth2_user_map_compile(&test_utils, &pool, "upn", "append_realm:a.example strip_realm "
+                                                    "append_realm:b.example", &map), "Steps should compile");
+    TEST_ASSERT_STR_EQ("bob@b.example", test_map_user(&map, &pool, claims, &arena), "Steps should apply in order");
+    oauth2_user_map_free(&map);
+    
+    const char *bad[] = { "uppercase", "append_realm", "append_realm:", "regex:(" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        TEST_ASSERT(oauth2_user_map_compile(&test_utils, &pool, "email", bad[i], &map) != SASL_OK,
+                    "Invalid step should be rejected");
+    }
+    TEST_ASSERT(oauth2_user_map_compile(&test_utils, &pool, "/a~2", NULL, &map) != SASL_OK,
+                "Invalid pointer escape should be rejected");
+    
+    json_decref(claims);
+    oauth2_arena_release(&arena);
+    oauth2_string_pool_free(&pool);
+    
+    /* Compiled per provider at load */
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_ISSUERS, "https://a.example.com https://b.example.com");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_USER_TRANSFORM, "lowercase");
+    mock_config_set("oauth2", "oauth2_provider2_user_claim", "/realm_access/user email");
+    mock_config_set("oauth2", "oauth2_provider2_user_transform", "strip_realm");
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Config should load");
+    TEST_ASSERT_EQ(1, config->policies[0].user_map.steps_count, "Global transform should be inherited");
+    TEST_ASSERT_EQ(2, config->policies[1].user_map.paths_count, "Provider claims should be compiled");
+    TEST_ASSERT(config->policies[1].user_map.steps[0].op == OAUTH2_USER_STRIP_REALM,
+                "Provider transform should replace the global one");
+    oauth2_config_release(config);
+    
+    mock_config_set("oauth2", "oauth2_provider2_user_transform", "regex:[");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Invalid transform should be rejected");
+    oauth2_config_release(config);
+    
+    mock_config_clear();
+    return 0;
+}
+
+/* Test that issuer patterns match tenants only, and that tenants are kept in a bounded LRU */
+int test_config_tenant_issuers() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_TENANT_ISSUERS,
+                    "https://login.example.com/{tenantid}/v2.0 https://sts.example.net/{tenant}");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Patterns alone should be enough");
+    TEST_ASSERT_EQ(0, config->providers_count, "No provider should be configured");
+    TEST_ASSERT_EQ(2, config->tenants.templates_count, "Both patterns should be compiled");
+    
+    static const struct { const char *issuer; int template; } cases[] = {
+        { "https://login.example.com/72f988bf-86f1-41af-91ab-2d7cd011db47/v2.0", 0 },
+        { "https://sts.example.net/contoso.example", 1 },
+        { "https://login.example.com//v2.0", -1 },
+        { "https://login.example.com/a/b/v2.0", -1 },
+        { "https://login.example.com/../v2.0", -1 },
+        { "https://login.example.com/a?b=c/v2.0", -1 },
+        { "https://login.example.com/tenant/v2", -1 },
+        { "https://login.example.org/tenant/v2.0", -1 }
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        TEST_ASSERT_EQ(cases[i].template, oauth2_tenant_table_match(&config->tenants, config->strings.data,
+                                                                    cases[i].issuer, strlen(cases[i].issuer)),
+                       "Issuer should match its pattern only, with a plain tenant name");
+    }
+    
+    /* Loaded on first use, then shared */
+    oauth2_deadline_t deadline = oauth2_deadline_after(1);
+    oauth2_provider_t *a = oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/a", deadline);
+    TEST_ASSERT_NOT_NULL(a, "Matching issuer should get a provider");
+    TEST_ASSERT_STR_EQ("https://sts.example.net/a/.well-known/openid-configuration", a->discovery_url,
+                       "Discovery URL should derive from the tenant's issuer");
+    TEST_ASSERT(a->jwks.body == NULL, "Nothing should be fetched before keys are needed");
+    oauth2_provider_t *again = oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/a", deadline);
+    TEST_ASSERT(a == again, "A tenant should be loaded once");
+    TEST_ASSERT_NULL(oauth2_tenant_acquire(&test_utils, config, "https://evil.example/a", deadline),
+                     "Unmatched issuer should get no provider");
+    TEST_ASSERT(oauth2_config_find_provider(config, "https://sts.example.net/a") == NULL,
+                "Tenants should not be configured providers");
+    oauth2_tenant_release(again);
+    
+    /* Over the cap, the least recently used tenant goes first; a held one stays valid */
+    config->tenants.max_bytes = config->tenants.bytes * 2 + 1;
+    oauth2_provider_t *b = oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/b", deadline);
+    oauth2_tenant_release(b);
+    TEST_ASSERT_EQ(2, (int)config->tenants.count, "Two tenants should fit");
+    b = oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/b", deadline);
+    oauth2_tenant_release(b);
+    oauth2_provider_t *c = oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/c", deadline);
+    TEST_ASSERT_EQ(2, (int)config->tenants.count, "The least recently used tenant should be evicted");
+    TEST_ASSERT_STR_EQ("https://sts.example.net/a", a->issuer, "An evicted tenant in use should stay valid");
+    TEST_ASSERT_STR_EQ("https://sts.example.net/b", config->tenants.oldest->issuer,
+                       "The recently used tenant should be kept");
+    oauth2_tenant_release(a);
+    
+    /* Idle tenants are dropped on the next lookup */
+    config->tenants.oldest->used_at -= config->tenants.idle_timeout;
+    oauth2_tenant_release(oauth2_tenant_acquire(&test_utils, config, "https://sts.example.net/c", deadline));
+    TEST_ASSERT_EQ(1, (int)config->tenants.count, "An idle tenant should be evicted");
+    oauth2_tenant_release(c);
+    
+    /* A token of no configured issuer and no tenant is refused, whatever its claims */
+    oauth2_arena_t arena;
+    oauth2_arena_init(&arena);
+    char *username = NULL;
+    TEST_ASSERT_EQ(SASL_BADAUTH, oauth2_validate_token(&test_utils, config, &arena,
+                   "eyJhbGciOiJub25lIn0.eyJpc3MiOiJodHRwczovL2V2aWwuZXhhbXBsZS9hIiwiZW1haWwiOiJhQGIifQ.c2ln",
+                   &username), "Issuer outside the patterns should be rejected");
+    oauth2_arena_run_deferred(&arena);
+    oauth2_arena_release(&arena);
+    oauth2_config_release(config);
+    
+    const char *bad[] = { "https://login.example.com/v2.0", "https://{tenant}.example.com/v2.0",
+                          "login.example.com/{tenant}", "https://login.example.com/{}/v2.0",
+                          "https://login.example.com/{a}/{b}" };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        mock_config_set("oauth2", OAUTH2_CONF_TENANT_ISSUERS, bad[i]);
+        config = oauth2_config_init(&test_utils);
+        TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Invalid pattern should be rejected");
+        oauth2_config_release(config);
+    }
     
+    mock_config_clear();
     return 0;
 }
 
@@ -234,6 +640,268 @@ int test_config_edge_cases() {
     return 0;
 }
 
+/* A connection keeps its snapshot when a new configuration is published */
+int test_config_snapshot_pinning() {
+    oauth2_config_holder_t holder = OAUTH2_CONFIG_HOLDER_INIT;
+    TEST_ASSERT_NULL(oauth2_config_acquire(&holder), "Nothing to pin before a config is published");
+    
+    oauth2_config_t *first = oauth2_config_init(&test_utils);
+    oauth2_config_t *second = oauth2_config_init(&test_utils);
+    TEST_ASSERT(first && second, "Should create configurations");
+    first->debug = 1;
+    
+    oauth2_config_publish(&holder, first);
+    oauth2_config_t *pinned = oauth2_config_acquire(&holder);
+    TEST_ASSERT(pinned == first, "Should pin the published config");
+    TEST_ASSERT_EQ(2, first->refcount, "Published and pinned");
+    
+    oauth2_config_publish(&holder, second);
+    TEST_ASSERT(holder.current == second, "New connections should get the new config");
+    TEST_ASSERT_EQ(1, pinned->refcount, "Old config should live on for its connection");
+    TEST_ASSERT_EQ(1, pinned->debug, "Old config should be unchanged");
+    
+    oauth2_config_t *next = oauth2_config_acquire(&holder);
+    TEST_ASSERT(next == second, "Should pin the new config");
+    oauth2_config_release(pinned);
+    oauth2_config_release(next);
+    TEST_ASSERT_EQ(1, second->refcount, "Only the holder should keep the new config");
+    
+    oauth2_config_publish(&holder, NULL);
+    TEST_ASSERT_NULL(holder.current, "Should unpublish");
+    
+    return 0;
+}
+
+static oauth2_config_holder_t snapshot_holder = OAUTH2_CONFIG_HOLDER_INIT;
+static int snapshot_stop;
+
+static void *snapshot_reader(void *arg) {
+    long *pins = arg;
+    while (!__atomic_load_n(&snapshot_stop, __ATOMIC_ACQUIRE)) {
+        oauth2_config_t *config = oauth2_config_acquire(&snapshot_holder);
+        if (!config || config->refcount < 1) {
+            return NULL;
+        }
+        (*pins)++;
+        oauth2_config_release(config);
+    }
+    return pins;
+}
+
+/* Readers never see a freed snapshot while configurations are swapped under them */
+int test_config_snapshot_concurrent() {
+    pthread_t readers[4];
+    long pins[4] = { 0 };
+    
+    oauth2_config_publish(&snapshot_holder, oauth2_config_init(&test_utils));
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&readers[i], NULL, snapshot_reader, &pins[i]);
+    }
+    for (int i = 0; i < 200; i++) {
+        oauth2_config_publish(&snapshot_holder, oauth2_config_init(&test_utils));
+    }
+    __atomic_store_n(&snapshot_stop, 1, __ATOMIC_RELEASE);
+    
+    int ok = 1;
+    for (int i = 0; i < 4; i++) {
+        void *result;
+        pthread_join(readers[i], &result);
+        ok = ok && result == &pins[i];
+    }
+    TEST_ASSERT(ok, "Every reader should always pin a live config");
+    TEST_ASSERT_EQ(1, snapshot_holder.current->refcount, "All pins should be released");
+    
+    oauth2_config_publish(&snapshot_holder, NULL);
+    
+    return 0;
+}
+
+/* A publisher waits only for readers that started before it: a steady stream of newer ones cannot hold it */
+int test_config_publish_bounded() {
+    oauth2_config_holder_t holder = OAUTH2_CONFIG_HOLDER_INIT;
+    oauth2_config_publish(&holder, oauth2_config_init(&test_utils));
+    
+    /* A reader announced in the generation the next publish opens, as one arriving during it */
+    unsigned long next = (holder.generation + 1) & 1;
+    __atomic_fetch_add(&holder.readers[next], 1, __ATOMIC_SEQ_CST);
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    oauth2_config_publish(&holder, config);
+    TEST_ASSERT(holder.current == config, "Publish should not wait for readers that started after it");
+    __atomic_fetch_sub(&holder.readers[next], 1, __ATOMIC_SEQ_CST);
+    
+    oauth2_config_t *pinned = oauth2_config_acquire(&holder);
+    TEST_ASSERT(pinned == config, "Readers should pin the published snapshot");
+    TEST_ASSERT_EQ(0, (int)(holder.readers[0] + holder.readers[1]), "Readers should leave both generations drained");
+    oauth2_config_release(pinned);
+    
+    oauth2_config_publish(&holder, NULL);
+    return 0;
+}
+
+/* Replace a file atomically, the way configuration management tools do */
+static int write_file(const char *path, const char *content) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    fputs(content, f);
+    fclose(f);
+    return rename(tmp, path);
+}
+
+/* Settings of the configuration file take precedence over SASL options */
+int test_config_file() {
+    char dir[] = "/tmp/oauth2_conf_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/oauth2.conf", dir);
+    TEST_ASSERT_EQ(0, write_file(path,
+        "# Managed by configuration management\n"
+        "oauth2_discovery_url: http://127.0.0.1:1/.well-known/openid-configuration\n"
+        "\n"
+        "  oauth2_audience :  mail-file  \r\n"
+        "oauth2_client_secret: s3cr#t:x\n"
+        "oauth2_warmup_timeout: 0\n"), "Should write config file");
+    
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_CONFIG_FILE, path);
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client-sasl");
+    mock_config_set("oauth2", OAUTH2_CONF_AUDIENCE, "mail-sasl");
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_NOT_NULL(config, "Should create config");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Should load with the file");
+    TEST_ASSERT_EQ(1, config->providers_count, "Provider should come from the file");
+    TEST_ASSERT_STR_EQ("client-sasl", config->client_id, "Unset keys should fall back to SASL");
+    TEST_ASSERT_STR_EQ("mail-file", oauth2_config_list_item(config, &config->audiences, 0),
+                       "File should override SASL, trimmed");
+    TEST_ASSERT_STR_EQ("s3cr#t:x", config->client_secret, "Values should keep '#' and ':'");
+    oauth2_config_release(config);
+    
+    /* A line that is not "key: value" rejects the whole file */
+    TEST_ASSERT_EQ(0, write_file(path, "oauth2_audience mail\n"), "Should write config file");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Should reject a malformed line");
+    oauth2_config_release(config);
+    
+    unlink(path);
+    rmdir(dir);
+    mock_config_clear();
+    return 0;
+}
+
+/* A changed configuration file is rebuilt and swapped in, unchanged providers stay warm */
+int test_config_reload() {
+    char dir[] = "/tmp/oauth2_conf_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+    char path[256];
+    snprintf(path, sizeof(path), "%s/oauth2.conf", dir);
+    TEST_ASSERT_EQ(0, write_file(path,
+        "oauth2_discovery_urls: http://127.0.0.1:1/a/.well-known/openid-configuration\n"
+        "oauth2_warmup_timeout: 0\n"), "Should write config file");
+    
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_CONFIG_FILE, path);
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_CONFIG_RELOAD_INTERVAL, "0"); /* Poll on every check without inotify */
+    
+    oauth2_config_holder_t holder = OAUTH2_CONFIG_HOLDER_INIT;
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Should load");
+    oauth2_config_publish(&holder, config);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_watch(&holder, &test_utils), "Should watch the file");
+    
+    /* Pretend provider a was discovered already */
+    config->providers[0].jwks_uri = strdup("http://127.0.0.1:1/a/jwks");
+    config->metrics.http_ok = 7;
+    config->metrics.mirror_failovers = 3;
+    config->metrics.userinfo_latency_max_ms = 250;
+    oauth2_config_t *pinned = oauth2_config_acquire(&holder);
+    
+    oauth2_config_reload_check(&holder);
+    TEST_ASSERT(holder.current == config, "Nothing should happen without a change");
+    
+    TEST_ASSERT_EQ(0, write_file(path,
+        "oauth2_discovery_urls: http://127.0.0.1:1/a/.well-known/openid-configuration "
+        "http://127.0.0.1:1/b/.well-known/openid-configuration\n"
+        "oauth2_warmup_timeout: 0\n"), "Should rewrite config file");
+    
+    /* The reload runs in the background */
+    for (int i = 0; i < 200 && holder.current == config; i++) {
+        oauth2_config_reload_check(&holder);
+        usleep(10000);
+    }
+    oauth2_config_t *reloaded = oauth2_config_acquire(&holder);
+    TEST_ASSERT(reloaded != config, "Changed file should be swapped in");
+    TEST_ASSERT_EQ(2, reloaded->providers_count, "New provider should be added");
+    TEST_ASSERT_STR_EQ("http://127.0.0.1:1/a/jwks", reloaded->providers[0].jwks_uri,
+                       "Unchanged provider should stay warm");
+    TEST_ASSERT_NULL(reloaded->providers[1].jwks_uri, "New provider starts cold");
+    TEST_ASSERT_EQ(7, reloaded->metrics.http_ok, "Metrics should carry over");
+    TEST_ASSERT_EQ(3, reloaded->metrics.mirror_failovers, "Every counter should carry over");
+    TEST_ASSERT_EQ(250, reloaded->metrics.userinfo_latency_max_ms, "Slowest request should carry over");
+    TEST_ASSERT_EQ(1, pinned->providers_count, "In-flight connections keep the old snapshot");
+    oauth2_config_release(pinned);
+    oauth2_config_release(reloaded);
+    
+    /* A broken file keeps the current configuration */
+    TEST_ASSERT_EQ(0, write_file(path, "oauth2_discovery_urls\n"), "Should break config file");
+    TEST_ASSERT(oauth2_config_reload(&holder, &test_utils) != SASL_OK, "Broken file should not load");
+    TEST_ASSERT(holder.current == reloaded, "Current configuration should be kept");
+    
+    oauth2_config_unwatch(&holder);
+    oauth2_config_publish(&holder, NULL);
+    unlink(path);
+    rmdir(dir);
+    mock_config_clear();
+    return 0;
+}
+
+/* Client grants are checked at load time */
+int test_config_client_grant() {
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_DISCOVERY_URL, "http://127.0.0.1:1/.well-known/openid-configuration");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_GRANT, OAUTH2_GRANT_REFRESH_TOKEN);
+    
+    oauth2_config_t *config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Refresh grant needs a refresh token");
+    oauth2_config_release(config);
+    
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_REFRESH_TOKEN, "rt");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_USER, "svc@example.com");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Refresh grant should load");
+    TEST_ASSERT_STR_EQ("svc@example.com", config->client_user, "Client user should be loaded");
+    TEST_ASSERT_EQ(OAUTH2_DEFAULT_CLIENT_REFRESH_MARGIN, config->client_refresh_margin, "Default refresh margin");
+    oauth2_config_release(config);
+    
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_GRANT, "password");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Unknown grant should be rejected");
+    oauth2_config_release(config);
+    
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_GRANT, OAUTH2_GRANT_HELPER);
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT(oauth2_config_load(config, &test_utils) != SASL_OK, "Helper grant needs a helper");
+    oauth2_config_release(config);
+    
+    /* A helper alone selects the helper grant */
+    mock_config_clear();
+    mock_config_set("oauth2", OAUTH2_CONF_DISCOVERY_URL, "http://127.0.0.1:1/.well-known/openid-configuration");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_ID, "client");
+    mock_config_set("oauth2", OAUTH2_CONF_WARMUP_TIMEOUT, "0");
+    mock_config_set("oauth2", OAUTH2_CONF_CLIENT_TOKEN_HELPER, "unix:/run/token-agent.sock");
+    config = oauth2_config_init(&test_utils);
+    TEST_ASSERT_EQ(SASL_OK, oauth2_config_load(config, &test_utils), "Helper should load");
+    TEST_ASSERT_STR_EQ(OAUTH2_GRANT_HELPER, config->client_grant, "Helper should imply the helper grant");
+    oauth2_config_release(config);
+    
+    mock_config_clear();
+    return 0;
+}
+
 /* Main test runner for config tests */
 int main() {
     tests_total = 0;
@@ -245,11 +913,23 @@ int main() {
     
     RUN_TEST(test_parse_string_list);
     RUN_TEST(test_parse_string_list_spaces);
+    RUN_TEST(test_config_string_pool);
+    RUN_TEST(test_config_issuer_policies);
+    RUN_TEST(test_config_provider_blocks);
+    RUN_TEST(test_config_claim_policy);
+    RUN_TEST(test_config_user_map);
+    RUN_TEST(test_config_tenant_issuers);
     RUN_TEST(test_config_parsing);
     RUN_TEST(test_config_string_lists);
     RUN_TEST(test_memory_tracking);
     RUN_TEST(test_config_validation);
     RUN_TEST(test_config_edge_cases);
+    RUN_TEST(test_config_snapshot_pinning);
+    RUN_TEST(test_config_snapshot_concurrent);
+    RUN_TEST(test_config_publish_bounded);
+    RUN_TEST(test_config_file);
+    RUN_TEST(test_config_reload);
+    RUN_TEST(test_config_client_grant);
     
     printf("\nResults: %d/%d tests passed (%d failed)\n", 
            tests_passed, tests_total, tests_failed);
@@ -0,0 +1,700 @@
+#include "test_framework.h"
+#include "mock_sasl.h"
+#include "../../oauth2_plugin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* 1024-bit RSA test key, as JWK modulus and as PEM */
+#define TEST_RSA_N "rWCInKViOqRd5zKJ8hMVQXQpcWV8AY6_IG3mD30mUwl1CWFkhzs9zTS29kj3n6RY7qGghwZwsNu-puLy9nxaz8nGOlg2Rqk8uHpi0l6IR4yU-9jGbKCFwDfZ0OZumMvqSCXoeROw5ayutAq0OJs0Dzhy8DOiK_6S7OZEWecUId8"
+
+static const char *test_jwks_one =
+    "{\"keys\":[{\"kty\":\"RSA\",\"kid\":\"k1\",\"use\":\"sig\",\"alg\":\"RS256\","
+    "\"n\":\"" TEST_RSA_N "\",\"e\":\"AQAB\"}]}";
+
+static const char *test_jwks_two =
+    "{\"keys\":[{\"kty\":\"RSA\",\"kid\":\"k1\",\"use\":\"sig\",\"alg\":\"RS256\","
+    "\"n\":\"" TEST_RSA_N "\",\"e\":\"AQAB\"},"
+    "{\"kty\":\"RSA\",\"kid\":\"k2\",\"alg\":\"RS256\","
+    "\"n\":\"" TEST_RSA_N "\",\"e\":\"AQAB\"},"
+    "{\"kty\":\"RSA\",\"kid\":\"enc1\",\"use\":\"enc\","
+    "\"n\":\"" TEST_RSA_N "\",\"e\":\"AQAB\"}]}";
+
+static const char *test_pem =
+    "-----BEGIN PUBLIC KEY-----\n"
+    "MIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKBgQCtYIicpWI6pF3nMonyExVBdClx\n"
+    "ZXwBjr8gbeYPfSZTCXUJYWSHOz3NNLb2SPefpFjuoaCHBnCw276m4vL2fFrPycY6\n"
+    "WDZGqTy4emLSXohHjJT72MZsoIXAN9nQ5m6Yy+pIJeh5E7DlrK60CrQ4mzQPOHLw\n"
+    "M6Ir/pLs5kRZ5xQh3wIDAQAB\n"
+    "-----END PUBLIC KEY-----\n";
+
+static void test_log(sasl_conn_t *conn, int level, const char *fmt, ...) {
+    (void)conn;
+    (void)level;
+    (void)fmt;
+}
+
+static sasl_utils_t test_utils = {
+    .getopt = mock_getopt,
+    .malloc = mock_malloc,
+    .free = mock_free,
+    .log = test_log,
+    .seterror = mock_seterror
+};
+
+/* Replace a file atomically, the way configuration management tools do */
+static int write_file(const char *path, const char *content) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    fputs(content, f);
+    fclose(f);
+    return rename(tmp, path);
+}
+
+/* Remove a flat temporary directory and its files */
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[512];
+
+    while (d && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d) closedir(d);
+    rmdir(dir);
+}
+
+/* Test memory mapping of a local file */
+int test_file_map() {
+    char dir[] = "/tmp/oauth2_keys_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_one), "Should write JWKS file");
+
+    oauth2_file_map_t map;
+    TEST_ASSERT_EQ(SASL_OK, oauth2_file_map(path, &map), "Should map file");
+    TEST_ASSERT(map.len == strlen(test_jwks_one), "Mapped length should match file size");
+    TEST_ASSERT(memcmp(map.data, test_jwks_one, map.len) == 0, "Mapped content should match");
+    oauth2_file_unmap(&map);
+    TEST_ASSERT_NULL((void*)map.data, "Unmap should reset the mapping");
+
+    snprintf(path, sizeof(path), "%s/missing.json", dir);
+    TEST_ASSERT(oauth2_file_map(path, &map) != SASL_OK, "Missing file should not map");
+
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    unlink(path);
+    rmdir(dir);
+    return 0;
+}
+
+/* Test change detection for replaced files */
+int test_file_watch_changes() {
+    char dir[] = "/tmp/oauth2_keys_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_one), "Should write JWKS file");
+
+    oauth2_file_watch_t watch;
+    TEST_ASSERT_EQ(SASL_OK, oauth2_file_watch_init(&watch, path, 0), "Should init watch");
+    TEST_ASSERT_EQ(0, oauth2_file_watch_changed(&watch), "Unchanged file should not be reported");
+
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_two), "Should replace JWKS file");
+    TEST_ASSERT_EQ(1, oauth2_file_watch_changed(&watch), "Replaced file should be reported");
+    TEST_ASSERT_EQ(0, oauth2_file_watch_changed(&watch), "Change should be reported once");
+
+    oauth2_file_watch_free(&watch);
+    unlink(path);
+    rmdir(dir);
+    return 0;
+}
+
+/* Test that an in-place rewrite of the same size within the same second is seen */
+int test_file_watch_same_second() {
+    char dir[] = "/tmp/oauth2_keys_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_one), "Should write JWKS file");
+
+    struct stat before;
+    TEST_ASSERT_EQ(0, stat(path, &before), "Should stat JWKS file");
+
+    oauth2_file_watch_t watch;
+    TEST_ASSERT_EQ(SASL_OK, oauth2_file_watch_init(&watch, path, 0), "Should init watch");
+
+    /* Same inode, same size, mtime pinned to the same second */
+    char *rewritten = strdup(test_jwks_one);
+    TEST_ASSERT_NOT_NULL(rewritten, "Should copy JWKS");
+    strstr(rewritten, "\"k1\"")[2] = '9';
+    FILE *f = fopen(path, "r+");
+    TEST_ASSERT_NOT_NULL(f, "Should open JWKS file in place");
+    fputs(rewritten, f);
+    fclose(f);
+    free(rewritten);
+
+    struct timespec times[2] = { before.st_atim, before.st_mtim };
+    times[1].tv_nsec = (before.st_mtim.tv_nsec + 1) % 1000000000L;
+    TEST_ASSERT_EQ(0, utimensat(AT_FDCWD, path, times, 0), "Should pin mtime to the same second");
+
+    struct stat after;
+    TEST_ASSERT_EQ(0, stat(path, &after), "Should stat rewritten file");
+    TEST_ASSERT(after.st_ino == before.st_ino && after.st_size == before.st_size &&
+                after.st_mtim.tv_sec == before.st_mtim.tv_sec, "Rewrite should keep inode, size and second");
+
+    TEST_ASSERT_EQ(1, oauth2_file_watch_changed(&watch), "Same-second rewrite should be reported");
+    TEST_ASSERT_EQ(0, oauth2_file_watch_changed(&watch), "Change should be reported once");
+
+    oauth2_file_watch_free(&watch);
+    unlink(path);
+    rmdir(dir);
+    return 0;
+}
+
+/* Test key set construction from JWKS and PEM material */
+int test_keyset_from_buffer() {
+    oauth2_log_t *log = oauth2_init(OAUTH2_LOG_WARN, NULL);
+    TEST_ASSERT_NOT_NULL(log, "Should init liboauth2 log");
+
+    oauth2_keyset_t *keys = oauth2_keyset_new();
+    TEST_ASSERT_NOT_NULL(keys, "Should allocate key set");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_keyset_add_buffer(log, keys, test_jwks_two, strlen(test_jwks_two), NULL),
+                   "Should parse JWKS");
+    TEST_ASSERT_EQ(2, keys->key_count, "Encryption keys should be skipped");
+    oauth2_keyset_release(keys, log);
+
+    keys = oauth2_keyset_new();
+    TEST_ASSERT_EQ(SASL_OK, oauth2_keyset_add_buffer(log, keys, test_pem, strlen(test_pem), NULL),
+                   "Should parse PEM public key");
+    TEST_ASSERT_EQ(1, keys->key_count, "Should have one PEM key");
+    oauth2_keyset_release(keys, log);
+
+    /* An EdDSA key liboauth2 cannot load leaves the RSA key usable; alone, it leaves nothing */
+    static const char *jwks_mixed =
+        "{\"keys\":[{\"kty\":\"OKP\",\"crv\":\"Ed25519\",\"kid\":\"ed1\",\"x\":\"11qYAYKxCrfVS_7TyWQHOg7hcvPapiMlrwIaaPcHURo\"},"
+        "{\"kty\":\"RSA\",\"kid\":\"k1\",\"alg\":\"RS256\",\"n\":\"" TEST_RSA_N "\",\"e\":\"AQAB\"}]}";
+    keys = oauth2_keyset_new();
+    TEST_ASSERT_EQ(SASL_OK, oauth2_keyset_add_buffer(log, keys, jwks_mixed, strlen(jwks_mixed), NULL),
+                   "Unloadable key should not fail the set");
+    TEST_ASSERT_EQ(1, keys->key_count, "RSA key should be loaded");
+    TEST_ASSERT_EQ(1, keys->skipped_count, "EdDSA key should be skipped");
+    oauth2_keyset_release(keys, log);
+
+    static const char *jwks_unusable =
+        "{\"keys\":[{\"kty\":\"OKP\",\"crv\":\"Ed25519\",\"x\":\"11qYAYKxCrfVS_7TyWQHOg7hcvPapiMlrwIaaPcHURo\"}]}";
+    keys = oauth2_keyset_new();
+    TEST_ASSERT(oauth2_keyset_add_buffer(log, keys, jwks_unusable, strlen(jwks_unusable), NULL) != SASL_OK,
+                "A set without a usable key should be rejected");
+    oauth2_keyset_release(keys, log);
+
+    keys = oauth2_keyset_new();
+    TEST_ASSERT(oauth2_keyset_add_buffer(log, keys, "garbage", 7, NULL) != SASL_OK,
+                "Garbage should be rejected");
+    oauth2_keyset_release(keys, log);
+
+    oauth2_shutdown(log);
+    return 0;
+}
+
+/* Test atomic key set swap on file change */
+int test_key_store_reload() {
+    oauth2_log_t *log = oauth2_init(OAUTH2_LOG_WARN, NULL);
+    char dir[] = "/tmp/oauth2_keys_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_one), "Should write JWKS file");
+
+    char *files[] = { path };
+    oauth2_key_store_t *store = oauth2_key_store_create(&test_utils, log, files, 1, NULL, 0);
+    TEST_ASSERT_NOT_NULL(store, "Should create key store");
+
+    oauth2_keyset_t *before = oauth2_key_store_acquire(store, &test_utils);
+    TEST_ASSERT_NOT_NULL(before, "Should have keys after startup");
+    TEST_ASSERT_EQ(1, before->key_count, "Should load one key");
+
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_two), "Should replace JWKS file");
+    oauth2_keyset_t *after = oauth2_key_store_acquire(store, &test_utils);
+    TEST_ASSERT_NOT_NULL(after, "Should have keys after reload");
+    TEST_ASSERT_EQ(2, after->key_count, "Should pick up new keys");
+    TEST_ASSERT_EQ(1, before->key_count, "Pinned key set should stay intact");
+
+    /* A broken update keeps the last good keys */
+    TEST_ASSERT_EQ(0, write_file(path, "{not json"), "Should write broken file");
+    oauth2_keyset_t *kept = oauth2_key_store_acquire(store, &test_utils);
+    TEST_ASSERT(kept == after, "Broken file should keep previous key set");
+
+    oauth2_keyset_release(kept, log);
+    oauth2_keyset_release(after, log);
+    oauth2_keyset_release(before, log);
+    oauth2_key_store_free(store);
+    oauth2_shutdown(log);
+    unlink(path);
+    rmdir(dir);
+    return 0;
+}
+
+/* Test that a forked child sees a key rotation whose event another process consumed */
+int test_key_store_fork() {
+    oauth2_log_t *log = oauth2_init(OAUTH2_LOG_WARN, NULL);
+    char dir[] = "/tmp/oauth2_keys_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/jwks.json", dir);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_one), "Should write JWKS file");
+
+    char *files[] = { path };
+    oauth2_key_store_t *store = oauth2_key_store_create(&test_utils, log, files, 1, NULL, 0);
+    TEST_ASSERT_NOT_NULL(store, "Should create key store");
+
+    int ready[2];
+    TEST_ASSERT_EQ(0, pipe(ready), "Should create pipe");
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0, "Should fork");
+    if (child == 0) {
+        /* Prefork child: first login after the parent drained the shared queue */
+        char c;
+        close(ready[1]);
+        if (read(ready[0], &c, 1) != 1) _exit(2);
+        oauth2_keyset_t *keys = oauth2_key_store_acquire(store, &test_utils);
+        int rotated = keys && keys->key_count == 2;
+        oauth2_keyset_release(keys, log);
+        _exit(rotated ? 0 : 1);
+    }
+
+    close(ready[0]);
+    TEST_ASSERT_EQ(0, write_file(path, test_jwks_two), "Should replace JWKS file");
+    oauth2_keyset_t *keys = oauth2_key_store_acquire(store, &test_utils);
+    TEST_ASSERT(keys && keys->key_count == 2, "Parent should reload the keys");
+    oauth2_keyset_release(keys, log);
+    TEST_ASSERT_EQ(1, (int)write(ready[1], "x", 1), "Should wake the child");
+    close(ready[1]);
+
+    int status = 0;
+    TEST_ASSERT_EQ(child, waitpid(child, &status, 0), "Should reap the child");
+    TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child should reload the keys too");
+
+    oauth2_key_store_free(store);
+    oauth2_shutdown(log);
+    remove_dir(dir);
+    return 0;
+}
+
+/* Test revocation by jti and by subject cutoff */
+int test_revocation_lookup() {
+    const char *list =
+        "# revoked after the incident\n"
+        "jti 3f2a-revoked\n"
+        "sub alice 1700000000\r\n"
+        "sub alice 1600000000\n"
+        "\n"
+        "jti other";
+    int bad_line = -1;
+    oauth2_revocation_set_t *set = oauth2_revocation_set_build(list, strlen(list), &bad_line);
+    TEST_ASSERT_NOT_NULL(set, "Should build revocation set");
+    TEST_ASSERT_EQ(0, bad_line, "Should report no malformed line");
+    TEST_ASSERT_EQ(3, (int)set->count, "Repeated subject should be stored once");
+
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(set, "3f2a-revoked", "bob", 1800000000), "Listed jti is revoked");
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(set, "other", NULL, 0), "Last line without newline is read");
+    TEST_ASSERT_EQ(0, oauth2_revocation_set_check(set, "3f2a", "bob", 0), "Prefix of a jti is not revoked");
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(set, NULL, "alice", 1650000000), "Token before cutoff is revoked");
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(set, NULL, "alice", 0), "Token without iat is revoked");
+    TEST_ASSERT_EQ(0, oauth2_revocation_set_check(set, NULL, "alice", 1700000001), "Later cutoff should win");
+    TEST_ASSERT_EQ(0, oauth2_revocation_set_check(set, "alice", NULL, 0), "Subject entry does not match a jti");
+
+    /* Every listed entry is found, and unlisted ones are not */
+    char many[64 * 1000];
+    size_t used = 0;
+    for (int i = 0; i < 1000; i++) {
+        used += (size_t)snprintf(many + used, sizeof(many) - used, "jti token-%d\n", i);
+    }
+    oauth2_revocation_set_t *big = oauth2_revocation_set_build(many, used, NULL);
+    TEST_ASSERT_NOT_NULL(big, "Should build larger set");
+    int found = 0, false_hits = 0;
+    for (int i = 0; i < 2000; i++) {
+        char jti[32];
+        snprintf(jti, sizeof(jti), "token-%d", i);
+        if (oauth2_revocation_set_check(big, jti, NULL, 0)) {
+            if (i < 1000) found++; else false_hits++;
+        }
+    }
+    TEST_ASSERT_EQ(1000, found, "Every listed jti should be revoked");
+    TEST_ASSERT_EQ(0, false_hits, "Bloom false positives should be filtered by the exact set");
+
+    TEST_ASSERT_NULL(oauth2_revocation_set_build("jti a b\n", 8, &bad_line), "Extra field should be rejected");
+    TEST_ASSERT_EQ(1, bad_line, "Malformed line should be reported");
+    TEST_ASSERT_NULL(oauth2_revocation_set_build("jti a\nsub b 12x\n", 16, &bad_line), "Bad cutoff should be rejected");
+    TEST_ASSERT_EQ(2, bad_line, "Malformed line should be reported");
+
+    oauth2_revocation_set_release(big);
+    oauth2_revocation_set_release(set);
+    return 0;
+}
+
+/* Test atomic revocation list swap on file change */
+int test_revocation_reload() {
+    char dir[] = "/tmp/oauth2_revoked_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/revoked.txt", dir);
+    TEST_ASSERT_EQ(0, write_file(path, ""), "Should write empty list");
+
+    oauth2_revocation_list_t *list = oauth2_revocation_list_create(&test_utils, path, 0, NULL);
+    TEST_ASSERT_NOT_NULL(list, "Should create revocation list");
+    oauth2_revocation_set_t *before = oauth2_revocation_list_acquire(list, &test_utils);
+    TEST_ASSERT_NOT_NULL(before, "Empty file should give an empty list");
+    TEST_ASSERT_EQ(0, oauth2_revocation_set_check(before, "t1", NULL, 0), "Nothing is revoked yet");
+
+    TEST_ASSERT_EQ(0, write_file(path, "jti t1\n"), "Should replace list");
+    oauth2_revocation_set_t *after = oauth2_revocation_list_acquire(list, &test_utils);
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(after, "t1", NULL, 0), "Reloaded list should revoke t1");
+    TEST_ASSERT_EQ(0, oauth2_revocation_set_check(before, "t1", NULL, 0), "Pinned set should stay intact");
+
+    /* A broken update keeps the last good list */
+    TEST_ASSERT_EQ(0, write_file(path, "jti t1\nrevoke everything\n"), "Should write broken list");
+    oauth2_revocation_set_t *kept = oauth2_revocation_list_acquire(list, &test_utils);
+    TEST_ASSERT(kept == after, "Broken file should keep previous list");
+
+    /* A configuration rebuilt over the broken file keeps enforcing the last good list */
+    oauth2_revocation_list_t *rebuilt = oauth2_revocation_list_create(&test_utils, path, 0, list);
+    TEST_ASSERT_NOT_NULL(rebuilt, "Rebuilt list should inherit the previous set");
+    oauth2_revocation_set_t *inherited = oauth2_revocation_list_acquire(rebuilt, &test_utils);
+    TEST_ASSERT(inherited == after, "Previous set should carry over");
+    oauth2_revocation_set_release(inherited);
+    oauth2_revocation_list_free(rebuilt);
+
+    /* Without a previous set, an unusable file is refused rather than revoking nothing */
+    TEST_ASSERT_NULL(oauth2_revocation_list_create(&test_utils, path, 0, NULL), "Broken file should be refused");
+    char missing[300];
+    snprintf(missing, sizeof(missing), "%s/missing.txt", dir);
+    TEST_ASSERT_NULL(oauth2_revocation_list_create(&test_utils, missing, 0, list), "Missing file should be refused");
+
+    oauth2_revocation_set_release(kept);
+    oauth2_revocation_set_release(after);
+    oauth2_revocation_set_release(before);
+    oauth2_revocation_list_free(list);
+    remove_dir(dir);
+    return 0;
+}
+
+/* Test that a forked child sees a change whose event another process consumed */
+int test_revocation_fork() {
+    char dir[] = "/tmp/oauth2_revoked_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/revoked.txt", dir);
+    TEST_ASSERT_EQ(0, write_file(path, ""), "Should write empty list");
+
+    oauth2_revocation_list_t *list = oauth2_revocation_list_create(&test_utils, path, 0, NULL);
+    TEST_ASSERT_NOT_NULL(list, "Should create revocation list");
+
+    int ready[2];
+    TEST_ASSERT_EQ(0, pipe(ready), "Should create pipe");
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0, "Should fork");
+    if (child == 0) {
+        /* Prefork child: first login after the parent drained the shared queue */
+        char c;
+        close(ready[1]);
+        if (read(ready[0], &c, 1) != 1) _exit(2);
+        oauth2_revocation_set_t *set = oauth2_revocation_list_acquire(list, &test_utils);
+        int revoked = oauth2_revocation_set_check(set, "t1", NULL, 0);
+        oauth2_revocation_set_release(set);
+        _exit(revoked ? 0 : 1);
+    }
+
+    close(ready[0]);
+    TEST_ASSERT_EQ(0, write_file(path, "jti t1\n"), "Should replace list");
+    oauth2_revocation_set_t *set = oauth2_revocation_list_acquire(list, &test_utils);
+    TEST_ASSERT_EQ(1, oauth2_revocation_set_check(set, "t1", NULL, 0), "Parent should reload the list");
+    oauth2_revocation_set_release(set);
+    TEST_ASSERT_EQ(1, (int)write(ready[1], "x", 1), "Should wake the child");
+    close(ready[1]);
+
+    int status = 0;
+    TEST_ASSERT_EQ(child, waitpid(child, &status, 0), "Should reap the child");
+    TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child should reload the list too");
+
+    oauth2_revocation_list_free(list);
+    remove_dir(dir);
+    return 0;
+}
+
+/* Test persisted provider state round trip */
+int test_state_roundtrip() {
+    char dir[] = "/tmp/oauth2_state_XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir), "Should create temp dir");
+
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.state_dir = dir;
+
+    const char *url = "https://idp.example.com/.well-known/openid-configuration";
+    char discovery_body[] = "{\"issuer\":\"https://idp.example.com\",\"jwks_uri\":\"https://idp.example.com/jwks\"}";
+    oauth2_http_doc_t discovery = { discovery_body, strlen(discovery_body), 1000, 4600 };
+    oauth2_http_doc_t jwks = { (char*)test_jwks_one, strlen(test_jwks_one), 1000, 4600, "\"abc\"", NULL, 0 };
+
+    oauth2_http_doc_t loaded_discovery, loaded_jwks;
+    TEST_ASSERT_EQ(SASL_NOTDONE, oauth2_state_load(&config, url, &loaded_discovery, &loaded_jwks),
+                   "Missing state should be reported as not done");
+
+    TEST_ASSERT_EQ(SASL_OK, oauth2_state_save(&config, url, &discovery, &jwks), "Should save state");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_state_load(&config, url, &loaded_discovery, &loaded_jwks), "Should load state");
+    TEST_ASSERT(loaded_jwks.len == jwks.len && memcmp(loaded_jwks.body, jwks.body, jwks.len) == 0,
+                "JWKS should round trip");
+    TEST_ASSERT_EQ(4600, (int)loaded_discovery.expires_at, "Expiry should round trip");
+    TEST_ASSERT_STR_EQ("\"abc\"", loaded_jwks.etag, "ETag should round trip");
+    oauth2_http_doc_clear(&loaded_discovery);
+    oauth2_http_doc_clear(&loaded_jwks);
+
+    TEST_ASSERT(oauth2_state_load(&config, "https://other.example.com/", &loaded_discovery, &loaded_jwks) != SASL_OK,
+                "Other URLs should not load this state");
+
+    /* Only the current format is read: any other version is fetched again */
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[512] = "";
+    while (d && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    }
+    if (d) closedir(d);
+    FILE *f = fopen(path, "r+b");
+    TEST_ASSERT_NOT_NULL(f, "State file should exist");
+    fseek(f, 4, SEEK_SET);
+    fputc(1, f);
+    fclose(f);
+    TEST_ASSERT(oauth2_state_load(&config, url, &loaded_discovery, &loaded_jwks) != SASL_OK,
+                "Other format versions should not load");
+    TEST_ASSERT_NULL(loaded_jwks.body, "Nothing should be loaded from another version");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_state_save(&config, url, &discovery, &jwks), "Should save state again");
+
+    /* Warm start installs the persisted keys and the discovered issuer */
+    config.oauth2_log = oauth2_init(OAUTH2_LOG_WARN, NULL);
+    oauth2_provider_t provider;
+    memset(&provider, 0, sizeof(provider));
+    provider.discovery_url = url;
+    oauth2_provider_init(&provider);
+    provider.keys = oauth2_key_store_create(&test_utils, config.oauth2_log, NULL, 0, NULL, 0);
+
+    TEST_ASSERT_EQ(SASL_OK, oauth2_provider_warm_start(&test_utils, &config, &provider), "Should warm start");
+    oauth2_keyset_t *keys = oauth2_key_store_acquire(provider.keys, &test_utils);
+    TEST_ASSERT_NOT_NULL(keys, "Warm start should install keys");
+    TEST_ASSERT_STR_EQ("https://idp.example.com", provider.discovered_issuer, "Should remember discovered issuer");
+    oauth2_keyset_release(keys, config.oauth2_log);
+
+    oauth2_provider_free(&provider);
+    oauth2_shutdown(config.oauth2_log);
+
+    remove_dir(dir);
+    return 0;
+}
+
+/* Test freshness lifetime from caching headers, with floor and ceiling */
+int test_http_cache_lifetime() {
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.refresh_min_interval = 60;
+    config.refresh_max_interval = 86400;
+
+    oauth2_http_response_t response;
+    memset(&response, 0, sizeof(response));
+    response.max_age = -1;
+    TEST_ASSERT_EQ(3600, (int)oauth2_http_lifetime(&config, &response, 1000), "No headers should use the default");
+
+    response.max_age = 600;
+    response.age = 100;
+    TEST_ASSERT_EQ(500, (int)oauth2_http_lifetime(&config, &response, 1000), "Age should reduce max-age");
+
+    response.max_age = 5;
+    response.age = 0;
+    TEST_ASSERT_EQ(60, (int)oauth2_http_lifetime(&config, &response, 1000), "Floor should apply");
+
+    response.max_age = 10000000;
+    TEST_ASSERT_EQ(86400, (int)oauth2_http_lifetime(&config, &response, 1000), "Ceiling should apply");
+
+    response.max_age = -1;
+    response.expires = 1000 + 7200;
+    TEST_ASSERT_EQ(7200, (int)oauth2_http_lifetime(&config, &response, 1000), "Expires should be honoured");
+
+    response.no_store = 1;
+    TEST_ASSERT_EQ(60, (int)oauth2_http_lifetime(&config, &response, 1000), "no-store should refetch at the floor");
+    return 0;
+}
+
+/* Test that a 304 keeps the cached body and refreshes its lifetime */
+int test_http_not_modified() {
+    oauth2_http_doc_t doc;
+    memset(&doc, 0, sizeof(doc));
+
+    oauth2_http_response_t response;
+    memset(&response, 0, sizeof(response));
+    response.status = 200;
+    response.body = strdup(test_jwks_one);
+    response.len = strlen(test_jwks_one);
+    response.etag = strdup("\"v1\"");
+    oauth2_http_doc_update(&doc, &response, 1000, 300);
+    oauth2_http_response_free(&response);
+    TEST_ASSERT_STR_EQ(test_jwks_one, doc.body, "200 should store the body");
+    TEST_ASSERT_STR_EQ("\"v1\"", doc.etag, "200 should store the ETag");
+    TEST_ASSERT_EQ(1300, (int)doc.expires_at, "200 should set the expiry");
+
+    memset(&response, 0, sizeof(response));
+    response.status = 304;
+    oauth2_http_doc_update(&doc, &response, 2000, 300);
+    TEST_ASSERT_STR_EQ(test_jwks_one, doc.body, "304 should keep the body");
+    TEST_ASSERT_STR_EQ("\"v1\"", doc.etag, "304 should keep the ETag");
+    TEST_ASSERT_EQ(2300, (int)doc.expires_at, "304 should extend the expiry");
+
+    oauth2_http_doc_clear(&doc);
+    TEST_ASSERT_NULL(doc.body, "Clear should reset the document");
+    return 0;
+}
+
+/* Test circuit breaker transitions and their metrics */
+int test_provider_breaker() {
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.breaker_threshold = 2;
+    config.breaker_cooldown = 30;
+
+    oauth2_provider_t provider;
+    memset(&provider, 0, sizeof(provider));
+    provider.discovery_url = "https://idp.example.com/.well-known/openid-configuration";
+    oauth2_provider_init(&provider);
+    config.providers = &provider;
+    config.providers_count = 1;
+
+    TEST_ASSERT_EQ(1, oauth2_provider_breaker_allow(&config, &provider), "Closed breaker should allow calls");
+    oauth2_provider_breaker_record(&config, &provider, 0);
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_CLOSED, oauth2_provider_breaker_state(&provider), "One failure should not open");
+    oauth2_provider_breaker_record(&config, &provider, 0);
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_OPEN, oauth2_provider_breaker_state(&provider), "Threshold should open");
+    TEST_ASSERT_EQ(0, oauth2_provider_breaker_allow(&config, &provider), "Open breaker should refuse calls");
+
+    /* After the cooldown a single probe goes through */
+    provider.breaker_opened_at -= config.breaker_cooldown;
+    TEST_ASSERT_EQ(1, oauth2_provider_breaker_allow(&config, &provider), "Cooldown should allow a probe");
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_HALF_OPEN, oauth2_provider_breaker_state(&provider), "Probe should half-open");
+    TEST_ASSERT_EQ(0, oauth2_provider_breaker_allow(&config, &provider), "Only one probe should run");
+    oauth2_provider_breaker_record(&config, &provider, 0);
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_OPEN, oauth2_provider_breaker_state(&provider), "Failed probe should reopen");
+
+    provider.breaker_opened_at -= config.breaker_cooldown;
+    TEST_ASSERT_EQ(1, oauth2_provider_breaker_allow(&config, &provider), "Cooldown should allow a new probe");
+    oauth2_provider_breaker_record(&config, &provider, 1);
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_CLOSED, oauth2_provider_breaker_state(&provider), "Successful probe should close");
+
+    char metrics[1024];
+    TEST_ASSERT_EQ(SASL_OK, oauth2_metrics_format(&config, metrics, sizeof(metrics)), "Should format metrics");
+    TEST_ASSERT_NOT_NULL(strstr(metrics, "breaker_opened=2"), "Openings should be counted");
+    TEST_ASSERT_NOT_NULL(strstr(metrics, "breaker_rejected=2"), "Rejections should be counted");
+    TEST_ASSERT_NOT_NULL(strstr(metrics, "breaker[0]=closed"), "Breaker state should be reported");
+
+    config.providers = NULL;
+    oauth2_provider_free(&provider);
+    return 0;
+}
+
+/* Test that an exhausted login deadline fails fast without network access */
+int test_deadline_fail_fast() {
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.timeout = 10;
+
+    TEST_ASSERT(oauth2_deadline_remaining(0) > 1000000, "No deadline should leave unlimited time");
+    long remaining = oauth2_deadline_remaining(oauth2_deadline_after(2));
+    TEST_ASSERT(remaining > 1000 && remaining <= 2000, "Deadline should be relative to now");
+
+    oauth2_http_response_t response;
+    TEST_ASSERT_EQ(SASL_UNAVAIL, oauth2_http_get(&config, "https://idp.invalid/", NULL, 1, &response),
+                   "Expired deadline should fail before any request");
+    return 0;
+}
+
+/* Test that warmup reports unreachable providers within its budget */
+int test_warmup_unreachable() {
+    oauth2_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.timeout = 10;
+    config.breaker_threshold = 1;
+    config.breaker_cooldown = 30;
+    config.oauth2_log = oauth2_init(OAUTH2_LOG_WARN, NULL);
+
+    oauth2_provider_t providers[3];
+    memset(providers, 0, sizeof(providers));
+    providers[0].discovery_url = "http://127.0.0.1:1/.well-known/openid-configuration";
+    providers[1].discovery_url = "http://127.0.0.1:1/tenant/.well-known/openid-configuration";
+    providers[2].discovery_url = "http://127.0.0.1:1/introspect/.well-known/openid-configuration";
+    for (int i = 0; i < 3; i++) {
+        oauth2_provider_init(&providers[i]);
+        providers[i].keys = oauth2_key_store_create(&test_utils, config.oauth2_log, NULL, 0, NULL, 0);
+    }
+    /* Endpoint left from a warm start, discovery expired and unreachable */
+    providers[2].introspection = 1;
+    providers[2].introspection_endpoint = strdup("http://127.0.0.1:1/introspect");
+    config.providers = providers;
+    config.providers_count = 3;
+
+    long long start = oauth2_monotonic_ms();
+    TEST_ASSERT_EQ(0, oauth2_provider_warmup(&test_utils, &config, 2), "No provider should be ready");
+    TEST_ASSERT(oauth2_monotonic_ms() - start <= 2500, "Warmup should respect its budget");
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_OPEN, oauth2_provider_breaker_state(&providers[1]),
+                   "Failures should be reported per provider");
+    TEST_ASSERT_EQ(OAUTH2_BREAKER_OPEN, oauth2_provider_breaker_state(&providers[2]),
+                   "A failed discovery should not be reported as success");
+
+    for (int i = 0; i < 3; i++) {
+        oauth2_provider_free(&providers[i]);
+    }
+    oauth2_shutdown(config.oauth2_log);
+    return 0;
+}
+
+/* Main test runner for key store tests */
+int main() {
+    tests_total = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    printf("Running OAuth2 Key Store Unit Tests\n");
+    printf("==================================\n");
+
+    RUN_TEST(test_file_map);
+    RUN_TEST(test_file_watch_changes);
+    RUN_TEST(test_file_watch_same_second);
+    RUN_TEST(test_keyset_from_buffer);
+    RUN_TEST(test_key_store_reload);
+    RUN_TEST(test_key_store_fork);
+    RUN_TEST(test_revocation_lookup);
+    RUN_TEST(test_revocation_reload);
+    RUN_TEST(test_revocation_fork);
+    RUN_TEST(test_state_roundtrip);
+    RUN_TEST(test_http_cache_lifetime);
+    RUN_TEST(test_http_not_modified);
+    RUN_TEST(test_provider_breaker);
+    RUN_TEST(test_deadline_fail_fast);
+    RUN_TEST(test_warmup_unreachable);
+
+    printf("\nResults: %d/%d tests passed (%d failed)\n",
+           tests_passed, tests_total, tests_failed);
+
+    return tests_failed > 0 ? 1 : 0;
+}
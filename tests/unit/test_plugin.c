@@ -3,6 +3,9 @@
 #include "../../oauth2_plugin.h"
 #include <sasl/sasl.h>
 #include <sasl/saslplug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 /* External declarations for plugin functions */
 extern int sasl_server_plug_init(const sasl_utils_t *utils,
@@ -369,6 +372,389 @@ int test_multiple_issuers_audiences()
     return 0;
 }
 
+/* Arena: aligned bump allocations, overflow blocks, deferred releases */
+static int arena_released;
+
+static void arena_count_release(void *object) {
+    (void)object;
+    arena_released++;
+}
+
+int test_arena_allocations()
+{
+    oauth2_arena_t arena;
+    oauth2_arena_init(&arena);
+    
+    char *a = oauth2_arena_strndup(&arena, "alice@example.com", 5);
+    TEST_ASSERT_STR_EQ("alice", a, "strndup should copy len bytes and terminate");
+    void *b = oauth2_arena_alloc(&arena, 3);
+    TEST_ASSERT_EQ(0, (int)((uintptr_t)b % 16), "Allocations should be 16-byte aligned");
+    TEST_ASSERT(arena.blocks == NULL, "Small allocations should stay in the inline buffer");
+    
+    /* A token larger than the inline buffer gets its own block */
+    char *big = oauth2_arena_alloc(&arena, OAUTH2_ARENA_INLINE_SIZE * 2);
+    TEST_ASSERT_NOT_NULL(big, "Large allocation should succeed");
+    TEST_ASSERT(arena.blocks != NULL, "Large allocation should use an overflow block");
+    memset(big, 'x', OAUTH2_ARENA_INLINE_SIZE * 2);
+    
+    arena_released = 0;
+    TEST_ASSERT_EQ(SASL_OK, oauth2_arena_defer(&arena, arena_count_release, a), "Defer should succeed");
+    TEST_ASSERT_EQ(SASL_OK, oauth2_arena_defer(&arena, arena_count_release, b), "Defer should succeed");
+    oauth2_arena_run_deferred(&arena);
+    TEST_ASSERT_EQ(2, arena_released, "Deferred releases should run once each");
+    TEST_ASSERT_STR_EQ("alice", a, "Running deferred releases should keep arena strings");
+    
+    oauth2_arena_release(&arena);
+    TEST_ASSERT_EQ(2, arena_released, "Release should not run deferred releases twice");
+    TEST_ASSERT(arena.blocks == NULL && arena.used == 0, "Release should empty the arena");
+    TEST_ASSERT_EQ(0, a[0], "Release should wipe handed out memory");
+    
+    return 0;
+}
+
+/* Secure slab: size classes, slot reuse, wipe on free, dedicated mappings */
+int test_secure_slab()
+{
+    oauth2_secure_stats_t before, stats;
+    oauth2_secure_stats(&before);
+    
+    char *token = oauth2_secure_strndup("eyJhbGciOiJSUzI1NiJ9.payload.signature", 38);
+    TEST_ASSERT_NOT_NULL(token, "Secure strndup should succeed");
+    TEST_ASSERT_EQ(0, (int)((uintptr_t)token % 16), "Secure slots should be 16-byte aligned");
+    TEST_ASSERT_EQ(38, (int)strlen(token), "Secure strndup should copy len bytes and terminate");
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ((int)before.in_use + 1, (int)stats.in_use, "One slot should be in use");
+    
+    oauth2_secure_free(token);
+    TEST_ASSERT_EQ(0, token[0], "Free should wipe the token");
+    TEST_ASSERT_EQ(0, token[37], "Free should wipe the token up to its known length");
+    char *again = oauth2_secure_alloc(100);
+    TEST_ASSERT(again == token, "A freed slot should be reused by its size class");
+    oauth2_secure_free(again);
+    
+    /* Larger than every class: a mapping of its own, unmapped on free */
+    char *large = oauth2_secure_alloc(64 * 1024);
+    TEST_ASSERT_NOT_NULL(large, "Large secure allocation should succeed");
+    memset(large, 'x', 64 * 1024);
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ((int)before.dedicated + 1, (int)stats.dedicated, "Large token should get a dedicated mapping");
+    oauth2_secure_free(large);
+    
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ((int)before.in_use, (int)stats.in_use, "All slots should be back");
+    
+    return 0;
+}
+
+static char canon_user_seen[128];
+
+static int test_canon_user(sasl_conn_t *conn, const char *in, unsigned inlen, unsigned flags,
+                           sasl_out_params_t *oparams) {
+    (void)conn;
+    (void)flags;
+    (void)oparams;
+    snprintf(canon_user_seen, sizeof(canon_user_seen), "%.*s", inlen ? (int)inlen : (int)strlen(in), in);
+    return SASL_OK;
+}
+
+/* Full server exchange: parser output and claims come from the context arena, contexts are reused */
+int test_server_step_arena()
+{
+    sasl_utils_t utils = {
+        .getopt = mock_getopt,
+        .malloc = mock_malloc,
+        .free = mock_free,
+        .getopt_context = NULL,
+        .conn = NULL,
+        .log = mock_log,
+        .seterror = mock_seterror
+    };
+    
+    int out_version;
+    sasl_server_plug_t *pluglist;
+    int plugcount;
+    
+    /* Unsigned token: claims are only decoded, the unreachable issuer fails fast */
+    mock_config_clear();
+    mock_config_set("oauth2", "oauth2_issuers", "http://127.0.0.1:1");
+    mock_config_set("oauth2", "oauth2_audiences", "test_audience");
+    mock_config_set("oauth2", "oauth2_client_id", "test_client");
+    mock_config_set("oauth2", "oauth2_verify_signature", "false");
+    mock_config_set("oauth2", "oauth2_timeout", "1");
+    oauth2_reset_global_config();
+    
+    int result = sasl_server_plug_init(&utils, 4, &out_version, &pluglist, &plugcount);
+    TEST_ASSERT_EQ(SASL_OK, result, "Server plugin init should succeed");
+    
+    sasl_server_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.utils = &utils;
+    params.canon_user = test_canon_user;
+    
+    static const char input[] = "user=alice\x01" "auth=Bearer eyJhbGciOiJub25lIn0."
+        "eyJpc3MiOiJodHRwOi8vMTI3LjAuMC4xOjEiLCJhdWQiOiJ0ZXN0X2F1ZGllbmNlIiwiZW1haWwiOiJhbGljZUBleGFtcGxlLmNvbSIsImV4cCI6NDEwMjQ0NDgwMH0"
+        ".c2ln\x01\x01";
+    
+    void *conn_context = NULL;
+    result = pluglist[0].mech_new(pluglist[0].glob_context, &params, NULL, 0, &conn_context);
+    TEST_ASSERT_EQ(SASL_OK, result, "mech_new should succeed");
+    
+    const char *out = NULL;
+    unsigned outlen = 0;
+    sasl_out_params_t oparams;
+    memset(&oparams, 0, sizeof(oparams));
+    canon_user_seen[0] = '\0';
+    result = pluglist[0].mech_step(conn_context, &params, input, sizeof(input) - 1, &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_OK, result, "Step should accept the token");
+    TEST_ASSERT_STR_EQ("alice@example.com", canon_user_seen, "User should come from the email claim");
+    
+    oauth2_server_context_t *context = (oauth2_server_context_t*)conn_context;
+    TEST_ASSERT(context->arena.blocks == NULL, "A typical login should fit the inline arena");
+    TEST_ASSERT(context->arena.cleanups == NULL, "Claims should be released after the step");
+    TEST_ASSERT(context->access_token == context->token_buffer,
+                "Token should be kept in the context's secure buffer");
+    oauth2_secure_stats_t stats;
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ(1, (int)stats.in_use, "The context should hold the only secure copy of the token");
+    
+    /* Disposed contexts are wiped and handed to the next connection */
+    char *token_buffer = context->token_buffer;
+    oauth2_pool_stats_t before, after;
+    oauth2_context_pool_stats(OAUTH2_POOL_SERVER, &before);
+    pluglist[0].mech_dispose(conn_context, &utils);
+    TEST_ASSERT_EQ(0, token_buffer[0], "Dispose should wipe the token");
+    TEST_ASSERT_NULL(context->config, "Dispose should reset the context");
+    
+    void *reused = NULL;
+    result = pluglist[0].mech_new(pluglist[0].glob_context, &params, NULL, 0, &reused);
+    TEST_ASSERT_EQ(SASL_OK, result, "mech_new should succeed");
+    TEST_ASSERT(reused == conn_context, "The disposed context should be reused");
+    oauth2_context_pool_stats(OAUTH2_POOL_SERVER, &after);
+    TEST_ASSERT_EQ((int)before.reused + 1, (int)after.reused, "Reuse should be counted");
+    TEST_ASSERT(((oauth2_server_context_t*)reused)->token_buffer == token_buffer,
+                "The token buffer should stay attached to the context");
+    
+    /* A retried step replaces the token of the failed one; input without a token keeps nothing */
+    oauth2_secure_stats(&stats);
+    int in_use = (int)stats.in_use;
+    size_t large_len = OAUTH2_TOKEN_BUFFER_SIZE + 64;
+    char *large = malloc(large_len + 32);
+    TEST_ASSERT_NOT_NULL(large, "Input should be allocated");
+    int n = snprintf(large, 32, "user=alice\x01" "auth=Bearer ");
+    memset(large + n, 'x', large_len);
+    memcpy(large + n + large_len, "\x01\x01", 2);
+    result = pluglist[0].mech_step(reused, &params, large, (unsigned)(n + large_len + 2), &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_BADAUTH, result, "Bogus large token should be rejected");
+    free(large);
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ(in_use + 1, (int)stats.in_use, "A large token should take a slab slot");
+    
+    static const char no_token[] = "user=alice\x01\x01";
+    result = pluglist[0].mech_step(reused, &params, no_token, sizeof(no_token) - 1, &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_BADAUTH, result, "Input without a token should be rejected");
+    TEST_ASSERT(((oauth2_server_context_t*)reused)->access_token != ((oauth2_server_context_t*)reused)->token_buffer,
+                "A missing token should not be kept");
+    
+    static const char small[] = "user=alice\x01" "auth=Bearer not-a-valid-token\x01\x01";
+    result = pluglist[0].mech_step(reused, &params, small, sizeof(small) - 1, &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_BADAUTH, result, "Bogus token should be rejected");
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ(in_use, (int)stats.in_use, "The previous token should be freed when replaced");
+    
+    /* The whole token is wiped, past a NUL the client embedded in it */
+    static const char embedded[] = "user=alice\x01" "auth=Bearer abc\0secret-tail\x01\x01";
+    result = pluglist[0].mech_step(reused, &params, embedded, sizeof(embedded) - 1, &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_BADAUTH, result, "Token with a NUL should be rejected");
+    TEST_ASSERT_EQ(15, (int)((oauth2_server_context_t*)reused)->token_len, "Token length should be recorded");
+    pluglist[0].mech_dispose(reused, &utils);
+    TEST_ASSERT(memchr(token_buffer, 't', 16) == NULL, "Dispose should wipe the token past an embedded NUL");
+    TEST_ASSERT_EQ(0, (int)((oauth2_server_context_t*)reused)->token_len, "Token length should be reset");
+    
+    /* Nothing is kept beyond oauth2_context_pool_size */
+    mock_config_set("oauth2", "oauth2_context_pool_size", "0");
+    oauth2_reset_global_config();
+    result = sasl_server_plug_init(&utils, 4, &out_version, &pluglist, &plugcount);
+    TEST_ASSERT_EQ(SASL_OK, result, "Server plugin init should succeed");
+    result = pluglist[0].mech_new(pluglist[0].glob_context, &params, NULL, 0, &conn_context);
+    TEST_ASSERT_EQ(SASL_OK, result, "mech_new should succeed");
+    oauth2_context_pool_stats(OAUTH2_POOL_SERVER, &before);
+    pluglist[0].mech_dispose(conn_context, &utils);
+    oauth2_context_pool_stats(OAUTH2_POOL_SERVER, &after);
+    TEST_ASSERT_EQ((int)before.dropped + 1, (int)after.dropped, "A full pool should free disposed contexts");
+    TEST_ASSERT_EQ(0, after.idle, "A pool of size 0 should keep nothing");
+    
+    oauth2_reset_global_config();
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ(0, (int)stats.in_use, "Draining the pool should free the token buffers");
+    mock_config_clear();
+    
+    return 0;
+}
+
+/* A source is refused before parsing once its failures exhaust the burst; other prefixes are not */
+int test_server_admission()
+{
+    sasl_utils_t utils = {
+        .getopt = mock_getopt,
+        .malloc = mock_malloc,
+        .free = mock_free,
+        .getopt_context = NULL,
+        .conn = NULL,
+        .log = mock_log,
+        .seterror = mock_seterror
+    };
+    
+    int out_version;
+    sasl_server_plug_t *pluglist;
+    int plugcount;
+    
+    mock_config_clear();
+    mock_config_set("oauth2", "oauth2_issuers", "http://127.0.0.1:1");
+    mock_config_set("oauth2", "oauth2_audiences", "test_audience");
+    mock_config_set("oauth2", "oauth2_client_id", "test_client");
+    mock_config_set("oauth2", "oauth2_admission_burst", "3");
+    mock_config_set("oauth2", "oauth2_admission_rate", "1");
+    oauth2_reset_global_config();
+    
+    int result = sasl_server_plug_init(&utils, 4, &out_version, &pluglist, &plugcount);
+    TEST_ASSERT_EQ(SASL_OK, result, "Server plugin init should succeed");
+    
+    sasl_server_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.utils = &utils;
+    params.canon_user = test_canon_user;
+    params.ipremoteport = "198.51.100.7;40000";
+    
+    static const char input[] = "user=alice\x01\x01";
+    const char *out = NULL;
+    unsigned outlen = 0;
+    sasl_out_params_t oparams;
+    for (int i = 0; i < 5; i++) {
+        void *conn_context = NULL;
+        result = pluglist[0].mech_new(pluglist[0].glob_context, &params, NULL, 0, &conn_context);
+        TEST_ASSERT_EQ(SASL_OK, result, "mech_new should succeed");
+        memset(&oparams, 0, sizeof(oparams));
+        result = pluglist[0].mech_step(conn_context, &params, input, sizeof(input) - 1, &out, &outlen, &oparams);
+        if (i < 3) {
+            TEST_ASSERT_EQ(SASL_BADAUTH, result, "Failures within the burst should be processed");
+        } else {
+            TEST_ASSERT_EQ(SASL_TRYAGAIN, result, "Source should be refused once its burst is spent");
+        }
+        pluglist[0].mech_dispose(conn_context, &utils);
+    }
+    
+    /* The neighbour is another /32 */
+    void *conn_context = NULL;
+    params.ipremoteport = "198.51.100.8;40000";
+    pluglist[0].mech_new(pluglist[0].glob_context, &params, NULL, 0, &conn_context);
+    result = pluglist[0].mech_step(conn_context, &params, input, sizeof(input) - 1, &out, &outlen, &oparams);
+    TEST_ASSERT_EQ(SASL_BADAUTH, result, "Another source should not be throttled");
+    
+    oauth2_server_context_t *context = (oauth2_server_context_t*)conn_context;
+    char metrics[4096];
+    TEST_ASSERT_EQ(SASL_OK, oauth2_metrics_format(context->config, metrics, sizeof(metrics)), "Metrics should format");
+    TEST_ASSERT_NOT_NULL(strstr(metrics, "admission_rejected="), "Admission counters should be reported");
+    oauth2_admission_stats_t stats;
+    oauth2_admission_stats(context->config, &stats);
+    TEST_ASSERT(stats.rejected >= 2 && stats.throttled >= 1, "Refusals and the throttled source should be counted");
+    
+    /* Prefixes: IPv4 /24, IPv6 /64, IPv4-mapped addresses are IPv4 */
+    oauth2_config_t prefixes = *context->config;
+    prefixes.admission_ipv4_prefix = 24;
+    uint64_t key = oauth2_admission_key(&prefixes, "192.0.2.7;143");
+    TEST_ASSERT(key != 0, "IPv4 source should have a key");
+    TEST_ASSERT(key == oauth2_admission_key(&prefixes, "192.0.2.200;993"), "Same /24 should share a bucket");
+    TEST_ASSERT(key == oauth2_admission_key(&prefixes, "::ffff:192.0.2.9;143"), "Mapped address should be IPv4");
+    TEST_ASSERT(key != oauth2_admission_key(&prefixes, "192.0.3.7;143"), "Other /24 should not share a bucket");
+    key = oauth2_admission_key(&prefixes, "2001:db8:1:2::1;993");
+    TEST_ASSERT(key == oauth2_admission_key(&prefixes, "[2001:db8:1:2::ff];993"), "Same /64 should share a bucket");
+    TEST_ASSERT(key != oauth2_admission_key(&prefixes, "2001:db8:1:3::1;993"), "Other /64 should not share a bucket");
+    TEST_ASSERT_EQ(0, (int)oauth2_admission_key(&prefixes, "unknown"), "Unparsable source should have no key");
+    pluglist[0].mech_dispose(conn_context, &utils);
+    
+    oauth2_reset_global_config();
+    mock_config_clear();
+    return 0;
+}
+
+/* Client initial responses for both mechanisms, written into the context's reusable buffer */
+int test_client_step_encoding()
+{
+    sasl_utils_t utils = {
+        .getopt = mock_getopt,
+        .malloc = mock_malloc,
+        .free = mock_free,
+        .getopt_context = NULL,
+        .conn = NULL,
+        .log = mock_log,
+        .seterror = mock_seterror
+    };
+    
+    int out_version;
+    sasl_client_plug_t *pluglist;
+    int plugcount;
+    
+    mock_config_clear();
+    mock_config_set("oauth2", "oauth2_issuers", "https://issuer.example.com");
+    mock_config_set("oauth2", "oauth2_audiences", "test_audience");
+    mock_config_set("oauth2", "oauth2_client_id", "test_client");
+    oauth2_reset_global_config();
+    
+    int result = sasl_client_plug_init(&utils, 4, &out_version, &pluglist, &plugcount);
+    TEST_ASSERT_EQ(SASL_OK, result, "Client plugin init should succeed");
+    TEST_ASSERT_EQ(2, plugcount, "Both mechanisms should be offered");
+    
+    sasl_client_params_t params;
+    memset(&params, 0, sizeof(params));
+    params.utils = &utils;
+    params.canon_user = test_canon_user;
+    
+    static const char *const expected[2] = {
+        "user=a,b=c\x01" "auth=Bearer tok\x01\x01",
+        "n,a=a=2Cb=3Dc,\x01" "auth=Bearer tok\x01\x01"
+    };
+    char *response = NULL;
+    for (int i = 0; i < 2; i++) {
+        void *conn_context = NULL;
+        result = pluglist[i].mech_new(pluglist[i].glob_context, &params, &conn_context);
+        TEST_ASSERT_EQ(SASL_OK, result, "mech_new should succeed");
+        
+        oauth2_client_context_t *context = (oauth2_client_context_t*)conn_context;
+        if (i == 1) {
+            TEST_ASSERT(context->response == response, "The response buffer should stay attached to the context");
+        }
+        context->username = utils.malloc(6);
+        memcpy(context->username, "a,b=c", 6);
+        context->access_token = oauth2_secure_strndup("tok", 3);
+        
+        const char *out = NULL;
+        unsigned outlen = 0;
+        sasl_interact_t *prompts = NULL;
+        sasl_out_params_t oparams;
+        memset(&oparams, 0, sizeof(oparams));
+        canon_user_seen[0] = '\0';
+        result = pluglist[i].mech_step(conn_context, &params, NULL, 0, &prompts, &out, &outlen, &oparams);
+        TEST_ASSERT_EQ(SASL_OK, result, "Step should produce the initial response");
+        TEST_ASSERT_EQ((int)strlen(expected[i]), (int)outlen, "Response length should match the format");
+        TEST_ASSERT(memcmp(expected[i], out, outlen) == 0, "Response should match the mechanism's format");
+        TEST_ASSERT(out == context->response, "Response should be written into the context buffer");
+        TEST_ASSERT_STR_EQ("a,b=c", canon_user_seen, "Identities should be set through canon_user");
+        TEST_ASSERT_EQ(1, oparams.doneflag, "Client should be done after the initial response");
+        
+        response = context->response;
+        pluglist[i].mech_dispose(conn_context, &utils);
+        TEST_ASSERT_EQ(0, response[0], "Dispose should wipe the response");
+    }
+    
+    oauth2_reset_global_config();
+    oauth2_secure_stats_t stats;
+    oauth2_secure_stats(&stats);
+    TEST_ASSERT_EQ(0, (int)stats.in_use, "Draining the pool should free the response buffers");
+    mock_config_clear();
+    
+    return 0;
+}
+
 /* Main test runner for plugin tests */
 int main() {
     tests_total = 0;
@@ -385,6 +771,11 @@ int main() {
     RUN_TEST(test_plugin_version_compatibility);
     RUN_TEST(test_mechanism_properties);
     RUN_TEST(test_multiple_issuers_audiences);
+    RUN_TEST(test_arena_allocations);
+    RUN_TEST(test_secure_slab);
+    RUN_TEST(test_server_step_arena);
+    RUN_TEST(test_server_admission);
+    RUN_TEST(test_client_step_encoding);
     
     printf("\nResults: %d/%d tests passed (%d failed)\n", 
            tests_passed, tests_total, tests_failed);